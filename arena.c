@@ -0,0 +1,131 @@
+// Bump allocator for memory that lives as long as one command.
+//
+// A command line, its tokens and everything parsed from them are used for
+// one command and then dropped together. Allocating them by bumping a
+// pointer through a few large blocks, and dropping them all by resetting
+// it, avoids a malloc()/free() per word and any fixed size limit.
+
+#include "arena.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FIRST_BLOCK_SIZE (16 * 1024)
+// Types with the strictest alignment an allocation may need
+union max_align
+{
+  long double ld;
+  long long ll;
+  void *ptr;
+};
+
+// Allocations are rounded to this (a power of two at least as strict as
+// union max_align)
+#define ALIGNMENT 16
+
+struct arena_block
+{
+  struct arena_block *next;
+  size_t size;            // bytes of data[]
+  union max_align data[]; // the memory handed out, seen as bytes
+};
+
+#define BLOCK_DATA(block) ((char *)(block)->data)
+
+static size_t align_up(size_t n)
+{
+  return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+/*
+ * Move on to a block with room for 'size' bytes: the next one in the chain
+ * if it is big enough (blocks are reused after a reset), else a new one,
+ * twice as big as the current one, linked in after it.
+ * returns: false if out of memory.
+ */
+static bool next_block(struct arena *arena, size_t size)
+{
+  struct arena_block *current = arena->current;
+  struct arena_block *next = current != NULL ? current->next : arena->first;
+  if (next == NULL || next->size < size)
+  {
+    size_t block_size = current != NULL ? current->size * 2 : FIRST_BLOCK_SIZE;
+    while (block_size < size)
+    {
+      block_size *= 2;
+    }
+    struct arena_block *block = malloc(sizeof(struct arena_block) + block_size);
+    if (block == NULL)
+    {
+      return false;
+    }
+    block->size = block_size;
+    block->next = next;
+    if (current != NULL)
+    {
+      current->next = block;
+    }
+    else
+    {
+      arena->first = block;
+    }
+    next = block;
+  }
+  arena->current = next;
+  arena->used = 0;
+  return true;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+  size = align_up(size > 0 ? size : 1);
+  if (arena->current == NULL || arena->current->size - arena->used < size)
+  {
+    if (!next_block(arena, size))
+    {
+      return NULL;
+    }
+  }
+  void *ptr = BLOCK_DATA(arena->current) + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+  struct arena_block *block = arena->current;
+  if (ptr != NULL && block != NULL &&
+      (char *)ptr + align_up(old_size > 0 ? old_size : 1) == BLOCK_DATA(block) + arena->used)
+  {
+    size_t start = (char *)ptr - BLOCK_DATA(block);
+    if (block->size - start >= align_up(new_size))
+    {
+      arena->used = start + align_up(new_size);
+      return ptr;
+    }
+  }
+  void *grown = arena_alloc(arena, new_size);
+  if (grown != NULL && ptr != NULL)
+  {
+    memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+  }
+  return grown;
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t len)
+{
+  char *copy = arena_alloc(arena, len + 1);
+  if (copy != NULL)
+  {
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+void arena_reset(struct arena *arena)
+{
+  arena->current = NULL;
+  arena->used = 0;
+}
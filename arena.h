@@ -0,0 +1,45 @@
+// Bump allocator for memory that lives as long as one command.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_block;
+
+struct arena
+{
+  struct arena_block *first;   // chain of blocks, kept across resets
+  struct arena_block *current; // block allocations are carved from
+  size_t used;                 // bytes taken from 'current'
+};
+
+// An empty arena; blocks are allocated on first use
+#define ARENA_INIT {NULL, NULL, 0}
+
+/*
+ * Allocate 'size' bytes, aligned for any type. The memory stays valid
+ * until the next arena_reset().
+ * returns: the memory, or NULL if out of memory.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/*
+ * Grow the most recent allocation 'ptr' of 'old_size' bytes to 'new_size'
+ * bytes, in place when it is still at the end of its block, else by
+ * copying it (the old copy is only reclaimed by arena_reset()).
+ * returns: the allocation, or NULL if out of memory.
+ */
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+// Copy 'len' bytes of 's' and null terminate them. returns: the copy, or NULL.
+char *arena_strndup(struct arena *arena, const char *s, size_t len);
+
+/*
+ * Free everything allocated so far, in O(1): the blocks are kept and
+ * reused, so once the arena has grown to fit the largest command no more
+ * memory is requested from malloc().
+ */
+void arena_reset(struct arena *arena);
+
+#endif
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Batch mode throughput: run an N-line script through the shell and report
+# commands per second.
+#
+# usage: bench/batch_bench.sh [lines] [command...]
+#        (default: 100000 lines of "pwd", run with ./shell)
+
+SHELL_BIN=${SHELL_BIN:-./shell}
+LINES=${1:-100000}
+[ $# -gt 0 ] && shift
+CMD=${*:-pwd}
+
+SCRIPT=$(mktemp)
+trap 'rm -f "$SCRIPT"' EXIT
+yes "$CMD" | head -n "$LINES" > "$SCRIPT"
+
+start=$(date +%s.%N)
+"$SHELL_BIN" "$SCRIPT" > /dev/null 2>&1
+end=$(date +%s.%N)
+
+echo "$LINES $start $end" | awk -v cmd="$CMD" \
+  '{ t = $3 - $2; printf "command\tlines\tseconds\tcommands_per_sec\n%s\t%d\t%.3f\t%.0f\n", cmd, $1, t, $1 / t }'
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Hold a run of bench/run.sh against a baseline: print every benchmark's
+# old and new value and the change, and flag the ones that got worse by
+# more than the threshold (rates in /s are better higher, everything else
+# lower). Benchmarks missing from either side are listed too.
+#
+# usage: bench/compare.sh baseline.tsv results.tsv [threshold_percent]
+#        (default threshold: 25)
+# exit status: 1 if anything regressed
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 baseline.tsv results.tsv [threshold_percent]" >&2
+  exit 2
+fi
+BASELINE=$1
+RESULTS=$2
+THRESHOLD=${3:-25}
+
+awk -F '\t' -v threshold="$THRESHOLD" '
+  FNR == 1 { next }                      # header
+  NR == FNR { old[$1] = $2; order[++n] = $1; next }
+  { new[$1] = $2; unit[$1] = $3; if (!($1 in old)) order[++n] = $1 }
+  END {
+    printf "%-22s %12s %12s %9s  %s\n", "benchmark", "baseline", "current", "change", "unit"
+    for (i = 1; i <= n; i++) {
+      name = order[i]
+      if (!(name in new)) { printf "%-22s %12s %12s %9s\n", name, old[name], "-", "missing"; continue }
+      if (!(name in old)) { printf "%-22s %12s %12s %9s  %s\n", name, "-", new[name], "new", unit[name]; continue }
+      change = old[name] == 0 ? 0 : (new[name] - old[name]) * 100 / old[name]
+      worse = unit[name] ~ /\/s$/ ? -change : change
+      flag = worse > threshold ? "  REGRESSION" : ""
+      regressed += flag != ""
+      printf "%-22s %12.1f %12.1f %+8.1f%%  %s%s\n", name, old[name], new[name], change, unit[name], flag
+    }
+    exit regressed > 0
+  }' "$BASELINE" "$RESULTS"
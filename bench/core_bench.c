@@ -0,0 +1,140 @@
+// Microbenchmarks of the shell's per-command work, run inside the shell's
+// own code: tokenize_command() on typical lines, add_to_hist() and
+// get_cmd() against a full history, and builtin dispatch (lookup, argument
+// checks, handler) of a builtin that does nothing.
+//
+// shell.c is compiled into this program (its main() renamed), so what is
+// timed is exactly what the shell runs, statics and all.
+//
+// Prints one line per result, "name<TAB>value<TAB>unit", for bench/compare.sh.
+//
+// usage: core_bench [-n iterations]
+
+#define main shell_main
+#include "../shell.c"
+#undef main
+
+static double now_nsec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, double value, const char *unit)
+{
+  printf("%s\t%.1f\t%s\n", name, value, unit);
+}
+
+// Lines like the ones people type and scripts run
+static const char *lines[] = {
+    "ls -la",
+    "git commit -m \"fix the build\" --quiet",
+    "cat access.log | grep -v healthz | sort | uniq -c | sort -rn | head -20",
+    "make -j8 > build.log 2>&1 && echo done || echo failed",
+    "cd /var/log; ls *.gz; echo \"$HOME\" '$literal'",
+    "tar -czf backup.tar.gz --exclude=.git src/ include/ docs/ Makefile README.md",
+};
+
+#define NUM_LINES (sizeof(lines) / sizeof(lines[0]))
+
+// ns per tokenize_command() of each line in turn, arena reset in between
+static double bench_tokenize(int iterations)
+{
+  char buff[256];
+  struct command cmd;
+  double start = now_nsec();
+  for (int i = 0; i < iterations; i++)
+  {
+    const char *line = lines[i % NUM_LINES];
+    size_t len = strlen(line);
+    memcpy(buff, line, len + 1); // the lexer works in place
+    arena_reset(&command_arena);
+    if (tokenize_command(buff, len, &cmd) < 0)
+    {
+      fprintf(stderr, "core_bench: cannot tokenize '%s'\n", line);
+      exit(1);
+    }
+  }
+  return (now_nsec() - start) / iterations;
+}
+
+// ns per add_to_hist() of a new command, with the history already full
+static double bench_add_to_hist(int iterations)
+{
+  char buff[64];
+  for (size_t i = 0; i < hist_depth(); i++)
+  {
+    snprintf(buff, sizeof(buff), "make -C build target_%zu", i);
+    add_to_hist(buff);
+  }
+  static char cmds[1024][32];
+  for (int i = 0; i < 1024; i++)
+  {
+    snprintf(cmds[i], sizeof(cmds[i]), "git log --oneline -n %d", i);
+  }
+  double start = now_nsec();
+  for (int i = 0; i < iterations; i++)
+  {
+    add_to_hist(cmds[i % 1024]);
+  }
+  return (now_nsec() - start) / iterations;
+}
+
+// ns per get_cmd() of one of the 10 newest commands (what '!N' and '!!' do)
+static double bench_get_cmd(int iterations)
+{
+  int newest = hist_count() - 1;
+  size_t total = 0;
+  double start = now_nsec();
+  for (int i = 0; i < iterations; i++)
+  {
+    total += strlen(get_cmd(newest - i % 10));
+  }
+  double ns = (now_nsec() - start) / iterations;
+  if (total == 0)
+  {
+    exit(1);
+  }
+  return ns;
+}
+
+// ns per run_builtin() of 'true'
+static double bench_dispatch(int iterations)
+{
+  char *tokens[] = {"true", NULL};
+  double start = now_nsec();
+  for (int i = 0; i < iterations; i++)
+  {
+    run_builtin(tokens);
+  }
+  return (now_nsec() - start) / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+  int iterations = 1000000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (iterations <= 0)
+  {
+    iterations = 1;
+  }
+
+  report("tokenize", bench_tokenize(iterations), "ns/op");
+  report("add_to_hist", bench_add_to_hist(iterations), "ns/op");
+  report("get_cmd", bench_get_cmd(iterations), "ns/op");
+  report("dispatch", bench_dispatch(iterations), "ns/op");
+  return 0;
+}
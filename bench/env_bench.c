@@ -0,0 +1,145 @@
+// Environment benchmark: what it costs to hand the exported variables to a
+// command as the environment grows. Compares building envp from scratch for
+// every command (formatting each "NAME=value") with the envp kept by vars.c,
+// both on its own and for a real spawn of a trivial command, also right
+// after an exported variable changed.
+//
+// usage: env_bench [-n spawns] [num_vars...]   (default 0 1000 5000 20000)
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../spawn.h"
+#include "../vars.h"
+
+#define BUILDS 200
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The per-command work vars.c avoids: one "NAME=value" string per variable
+static char **build_envp(char **names, char **values, size_t count)
+{
+  char **envp = malloc((count + 1) * sizeof(char *));
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t name_len = strlen(names[i]);
+    size_t value_len = strlen(values[i]);
+    envp[i] = malloc(name_len + value_len + 2);
+    memcpy(envp[i], names[i], name_len);
+    envp[i][name_len] = '=';
+    memcpy(envp[i] + name_len + 1, values[i], value_len + 1);
+  }
+  envp[count] = NULL;
+  return envp;
+}
+
+static void free_envp(char **envp)
+{
+  for (size_t i = 0; envp[i] != NULL; i++)
+  {
+    free(envp[i]);
+  }
+  free(envp);
+}
+
+static double spawn_usec(int spawns, char *cmd[], _Bool set_each_time)
+{
+  char value[32];
+  double start = now_sec();
+  for (int i = 0; i < spawns; i++)
+  {
+    if (set_each_time)
+    {
+      snprintf(value, sizeof(value), "%d", i);
+      vars_set("BENCH_COUNTER", value, true);
+    }
+    pid_t pid = spawn_command(NULL, cmd, NULL);
+    if (pid < 0)
+    {
+      spawn_report_error(cmd[0], errno);
+      exit(1);
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return (now_sec() - start) * 1e6 / spawns;
+}
+
+int main(int argc, char *argv[])
+{
+  int spawns = 500;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      spawns = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n spawns] [num_vars...]\n", argv[0]);
+      return 2;
+    }
+  }
+  char *default_sizes[] = {"0", "1000", "5000", "20000"};
+  char **sizes = optind < argc ? &argv[optind] : default_sizes;
+  int num_sizes = optind < argc ? argc - optind : 4;
+
+  char *empty[] = {NULL};
+  vars_init(empty);
+  vars_set("PATH", "/usr/local/bin:/usr/bin:/bin", true);
+  char *cmd[] = {"true", NULL};
+
+  size_t max_vars = 0;
+  for (int s = 0; s < num_sizes; s++)
+  {
+    size_t n = strtoul(sizes[s], NULL, 10);
+    max_vars = n > max_vars ? n : max_vars;
+  }
+  char **names = malloc((max_vars + 1) * sizeof(char *));
+  char **values = malloc((max_vars + 1) * sizeof(char *));
+  size_t num_vars = 0;
+
+  printf("vars\tbuild_envp_usec\tcached_envp_usec\tspawn_usec\tspawn_after_set_usec\n");
+  for (int s = 0; s < num_sizes; s++)
+  {
+    size_t target = strtoul(sizes[s], NULL, 10);
+    for (; num_vars < target; num_vars++)
+    {
+      char name[32], value[64];
+      snprintf(name, sizeof(name), "BENCH_VAR_%zu", num_vars);
+      snprintf(value, sizeof(value), "value of variable number %zu", num_vars);
+      names[num_vars] = strdup(name);
+      values[num_vars] = strdup(value);
+      vars_set(name, value, true);
+    }
+
+    double start = now_sec();
+    for (int i = 0; i < BUILDS; i++)
+    {
+      free_envp(build_envp(names, values, num_vars));
+    }
+    double build = (now_sec() - start) * 1e6 / BUILDS;
+
+    start = now_sec();
+    volatile size_t sink = 0;
+    for (int i = 0; i < BUILDS; i++)
+    {
+      sink += (size_t)vars_environ();
+    }
+    double cached = (now_sec() - start) * 1e6 / BUILDS;
+
+    printf("%zu\t%.1f\t%.3f\t%.1f\t%.1f\n", num_vars, build, cached,
+           spawn_usec(spawns, cmd, false), spawn_usec(spawns, cmd, true));
+  }
+  return 0;
+}
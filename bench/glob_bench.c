@@ -0,0 +1,114 @@
+// Glob benchmark: expand a pattern over a large directory with the shell's
+// globbing, reading the directory every time (cache cleared) and from the
+// listing cache, next to the C library's glob(3).
+//
+// usage: glob_bench [-n files] [-r runs] [dir]
+//        (creates 'files' files in dir, default a new directory in /tmp;
+//        a tenth of them match the pattern *.log)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../arena.h"
+#include "../pathglob.h"
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+  int num_files = 100000;
+  int runs = 20;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:r:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      num_files = atoi(optarg);
+      break;
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n files] [-r runs] [dir]\n", argv[0]);
+      return 2;
+    }
+  }
+  char dir[] = "/tmp/glob_bench.XXXXXX";
+  const char *path = optind < argc ? argv[optind] : mkdtemp(dir);
+  if (path == NULL || (optind < argc && mkdir(path, 0755) < 0 && errno != EEXIST))
+  {
+    perror("directory");
+    return 1;
+  }
+  char name[4096];
+  for (int i = 0; i < num_files; i++)
+  {
+    snprintf(name, sizeof(name), "%s/file%07d.%s", path, i, i % 10 == 0 ? "log" : "txt");
+    int fd = open(name, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+      perror(name);
+      return 1;
+    }
+    close(fd);
+  }
+  // a listing taken right after a change is not trusted by the cache
+  sleep(2);
+
+  char pattern[4096];
+  snprintf(pattern, sizeof(pattern), "%s/*.log", path);
+  struct arena arena = ARENA_INIT;
+  size_t count = 0;
+
+  printf("method\tfiles\tmatches\tmsec_per_glob\n");
+  double start = now_sec();
+  for (int r = 0; r < runs; r++)
+  {
+    glob_cache_clear();
+    arena_reset(&arena);
+    glob_expand(pattern, &arena, &count);
+  }
+  printf("shell_uncached\t%d\t%zu\t%.2f\n", num_files, count, (now_sec() - start) * 1e3 / runs);
+
+  start = now_sec();
+  for (int r = 0; r < runs; r++)
+  {
+    arena_reset(&arena);
+    glob_expand(pattern, &arena, &count);
+  }
+  printf("shell_cached\t%d\t%zu\t%.2f\n", num_files, count, (now_sec() - start) * 1e3 / runs);
+
+  start = now_sec();
+  for (int r = 0; r < runs; r++)
+  {
+    glob_t g;
+    glob(pattern, 0, NULL, &g);
+    count = g.gl_pathc;
+    globfree(&g);
+  }
+  printf("libc_glob\t%d\t%zu\t%.2f\n", num_files, count, (now_sec() - start) * 1e3 / runs);
+
+  if (optind >= argc)
+  {
+    for (int i = 0; i < num_files; i++)
+    {
+      snprintf(name, sizeof(name), "%s/file%07d.%s", path, i, i % 10 == 0 ? "log" : "txt");
+      unlink(name);
+    }
+    rmdir(path);
+  }
+  return 0;
+}
@@ -0,0 +1,112 @@
+// History search latency against history size: fill the history with
+// synthetic commands, then time trigram-index lookups ('!?pattern',
+// '!prefix') against a plain newest-first scan.
+//
+// usage: histsearch_bench [max_entries]   (default 1000000)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../histindex.h"
+#include "../histlog.h"
+#include "../history.h"
+
+#define QUERIES 200
+
+static const char *programs[] = {"make", "git", "ls", "grep", "cd", "ssh", "python3", "cat",
+                                 "vim", "docker", "tar", "find", "rsync", "gcc", "kubectl"};
+static const char *words[] = {"-la", "src", "build", "status", "--all", "-rf", "main.c",
+                              "logs", "deploy", "test", "origin", "/var/log", "release",
+                              "-j8", "config.yaml", "README.md", "--verbose", "data"};
+
+#define NUM_PROGRAMS (sizeof(programs) / sizeof(programs[0]))
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+static double now_usec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int linear_search(const char *pattern, enum hist_match mode)
+{
+  size_t len = strlen(pattern);
+  for (int num = hist_count() - 1; num >= hist_oldest(); num--)
+  {
+    const char *cmd = hist_get(num);
+    if (mode == MATCH_PREFIX ? strncmp(cmd, pattern, len) == 0 : strstr(cmd, pattern) != NULL)
+    {
+      return num;
+    }
+  }
+  return -1;
+}
+
+static void fill(int upto)
+{
+  char cmd[256];
+  while (hist_count() < upto)
+  {
+    int n = hist_count();
+    int len = snprintf(cmd, sizeof(cmd), "%s %s %s host%d", programs[rand() % NUM_PROGRAMS],
+                       words[rand() % NUM_WORDS], words[rand() % NUM_WORDS], n % 5000);
+    // one unique needle near the start so rare lookups have to go deep
+    if (n == 7)
+    {
+      len = snprintf(cmd, sizeof(cmd), "echo needle-xyzzy-42");
+    }
+    hist_add(cmd, len);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int max = argc > 1 ? atoi(argv[1]) : 1000000;
+  struct
+  {
+    const char *name;
+    const char *pattern;
+    enum hist_match mode;
+  } queries[] = {
+      {"rare_substring", "needle-xyzzy", MATCH_SUBSTRING},
+      {"common_substring", "status", MATCH_SUBSTRING},
+      {"prefix", "kubectl deploy", MATCH_PREFIX},
+      {"missing", "no-such-command", MATCH_SUBSTRING},
+  };
+
+  srand(1);
+  hist_set_depth(max);
+  printf("entries\tquery\tfirst_search_usec\tindexed_usec\tlinear_usec\n");
+  for (int size = 10000; size <= max; size *= 10)
+  {
+    fill(size);
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++)
+    {
+      int num;
+      // the first search also indexes everything added since the last one
+      double start = now_usec();
+      histindex_search(queries[q].pattern, queries[q].mode, &num, 1);
+      double first = now_usec() - start;
+
+      start = now_usec();
+      for (int i = 0; i < QUERIES; i++)
+      {
+        histindex_search(queries[q].pattern, queries[q].mode, &num, 1);
+      }
+      double indexed = (now_usec() - start) / QUERIES;
+
+      start = now_usec();
+      for (int i = 0; i < QUERIES / 20; i++)
+      {
+        linear_search(queries[q].pattern, queries[q].mode);
+      }
+      double linear = (now_usec() - start) / (QUERIES / 20);
+
+      printf("%d\t%s\t%.1f\t%.2f\t%.1f\n", size, queries[q].name, first, indexed, linear);
+    }
+  }
+  return 0;
+}
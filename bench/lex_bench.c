@@ -0,0 +1,140 @@
+// Tokenizer throughput benchmark: split one long generated command line
+// (file names, options and a few quoted words, like the lines our scripts
+// generate) with the old byte-at-a-time tokenize_command() and with the
+// lexer using each scan method.
+//
+// usage: lex_bench [-s line_bytes] [-n iterations]
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lexer.h"
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The shell's tokenizer before the lexer, without its 1 KB line limit
+static int tokenize_command(char *buff, size_t num_chars, char *tokens[])
+{
+  int token_count = 0;
+  _Bool in_token = false;
+  for (size_t i = 0; i < num_chars; i++)
+  {
+    switch (buff[i])
+    {
+    case ' ':
+    case '\t':
+    case '\n':
+      buff[i] = '\0';
+      in_token = false;
+      break;
+
+    default:
+      if (!in_token)
+      {
+        tokens[token_count] = &buff[i];
+        token_count++;
+        in_token = true;
+      }
+    }
+  }
+  tokens[token_count] = NULL;
+  return token_count;
+}
+
+// A command line of about 'size' bytes
+static char *make_line(size_t size, size_t *len)
+{
+  static const char *words[] = {"src/module/component_implementation.c", "-Wall", "--output=build/out",
+                                "\"quoted words with spaces\"", "'single quoted'",
+                                "path/to/some/deeply/nested/directory/file_name.txt", "a", "|"};
+  char *line = malloc(size + 64);
+  size_t n = 0;
+  for (unsigned i = 0; n < size; i++)
+  {
+    const char *w = words[(i * 7) % 8];
+    if (strcmp(w, "|") == 0 && i % 64 != 0)
+    {
+      w = "x";
+    }
+    n += sprintf(line + n, "%s ", w);
+  }
+  *len = n;
+  return line;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t size = 1 << 20;
+  int iterations = 50;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:n:")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      size = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-s line_bytes] [-n iterations]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  size_t len;
+  char *line = make_line(size, &len);
+  char *work = malloc(len + 1);
+  size_t max_tokens = len / 2 + 1;
+  char **words = malloc(max_tokens * sizeof(char *));
+  struct arena arena = ARENA_INIT;
+  struct token *tokens;
+
+  printf("tokenizer\tline_bytes\ttokens\tusec_per_line\tMB_per_sec\n");
+
+  double start = now_sec();
+  int count = 0;
+  for (int i = 0; i < iterations; i++)
+  {
+    memcpy(work, line, len + 1);
+    count = tokenize_command(work, len, words);
+  }
+  double elapsed = now_sec() - start;
+  printf("tokenize_command\t%zu\t%d\t%.1f\t%.0f\n", len, count, elapsed * 1e6 / iterations,
+         len * (double)iterations / elapsed / 1e6);
+
+  for (int m = LEX_SCAN_SCALAR; m <= LEX_SCAN_AVX2; m++)
+  {
+    if (!lex_set_scan(lex_scan_name(m)))
+    {
+      continue; // not supported by this CPU
+    }
+    const char *error = NULL;
+    start = now_sec();
+    for (int i = 0; i < iterations; i++)
+    {
+      memcpy(work, line, len + 1);
+      arena_reset(&arena);
+      count = lex_line(work, len, &arena, &tokens, &error);
+    }
+    elapsed = now_sec() - start;
+    if (count < 0)
+    {
+      fprintf(stderr, "lex_line: %s\n", error);
+      return 1;
+    }
+    printf("lex_%s\t%zu\t%d\t%.1f\t%.0f\n", lex_scan_name(m), len, count,
+           elapsed * 1e6 / iterations, len * (double)iterations / elapsed / 1e6);
+  }
+  return 0;
+}
@@ -0,0 +1,110 @@
+// Prompt drawing benchmark: prompts per second the old way (getcwd() for
+// the path, then one write() for it and one for "$ ") against the cached
+// working directory and a pre-parsed format drawn with a single write().
+// -d nests the working directory that many levels deep, since getcwd()
+// walks back up every level.
+//
+// usage: prompt_bench [-n prompts] [-d depth] [-f format]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../cwd.h"
+#include "../prompt.h"
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+  int prompts = 200000;
+  int depth = 0;
+  const char *format = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:d:f:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      prompts = atoi(optarg);
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    case 'f':
+      format = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n prompts] [-d depth] [-f format]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  // Work from a directory 'depth' levels below a fresh temporary one
+  char top[] = "/tmp/prompt_bench.XXXXXX";
+  if (mkdtemp(top) == NULL || chdir(top) != 0)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  for (int i = 0; i < depth; i++)
+  {
+    if ((mkdir("d", 0700) != 0 && errno != EEXIST) || chdir("d") != 0)
+    {
+      perror("mkdir");
+      return 1;
+    }
+  }
+  cwd_init();
+  prompt_set_format(format);
+
+  int out = open("/dev/null", O_WRONLY);
+  char cwd[PATH_MAX];
+
+  printf("method\tdepth\tprompts\tusec_per_prompt\tprompts_per_sec\n");
+
+  double start = now_sec();
+  for (int i = 0; i < prompts; i++)
+  {
+    getcwd(cwd, sizeof(cwd));
+    write(out, getcwd(cwd, sizeof(cwd)), strlen(cwd));
+    write(out, "$ ", strlen("$ "));
+  }
+  double elapsed = now_sec() - start;
+  printf("getcwd\t%d\t%d\t%.3f\t%.0f\n", depth, prompts, elapsed * 1e6 / prompts,
+         prompts / elapsed);
+
+  start = now_sec();
+  for (int i = 0; i < prompts; i++)
+  {
+    size_t len;
+    const char *prompt = prompt_render(i & 1, &len);
+    write(out, prompt, len);
+  }
+  elapsed = now_sec() - start;
+  printf("cached\t%d\t%d\t%.3f\t%.0f\n", depth, prompts, elapsed * 1e6 / prompts,
+         prompts / elapsed);
+
+  // Clean up the directory chain
+  for (int i = 0; i < depth; i++)
+  {
+    if (chdir("..") != 0 || rmdir("d") != 0)
+    {
+      break;
+    }
+  }
+  rmdir(top);
+  return 0;
+}
@@ -0,0 +1,254 @@
+// End-to-end benchmark of the interactive shell: run it on a pseudo
+// terminal, as a person would, type scripted input and time the prompts
+// coming back. Measures
+//   - startup: exec to the first prompt
+//   - prompt latency: an empty line to the next prompt
+//   - spawn latency: '/bin/true' to the next prompt, one at a time
+//   - throughput: commands/sec for a batch of builtins ('true') and of
+//     programs ('/bin/true') typed ahead
+//   - memory: the shell's VmRSS and VmHWM once it has done all that
+//
+// The shell gets PS1="bench> " and no history file, and echo is off on the
+// terminal, so every "bench> " read back is one prompt.
+//
+// Prints one line per result, "name<TAB>value<TAB>unit", for bench/compare.sh.
+//
+// usage: pty_bench [-s shell] [-n commands]   (default: ./shell, 2000)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROMPT "bench> "
+
+static int master = -1;
+static size_t matched; // bytes of PROMPT matched so far
+
+static double now_usec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void report(const char *name, double value, const char *unit)
+{
+  printf("%s\t%.1f\t%s\n", name, value, unit);
+}
+
+// returns: how many prompts buf[0, len) completes
+static int count_prompts(const char *buf, size_t len)
+{
+  int prompts = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    if (buf[i] == PROMPT[matched])
+    {
+      matched++;
+    }
+    else
+    {
+      matched = buf[i] == PROMPT[0];
+    }
+    if (matched == strlen(PROMPT))
+    {
+      prompts++;
+      matched = 0;
+    }
+  }
+  return prompts;
+}
+
+/*
+ * Type input[0, len) while reading the shell's output, until 'prompts'
+ * prompts have come back. Typing and reading are interleaved, since the
+ * shell stops reading input once its output is not read.
+ */
+static void type_and_wait(const char *input, size_t len, int prompts)
+{
+  char buf[4096];
+  while (prompts > 0)
+  {
+    struct pollfd pfd = {master, POLLIN | (len > 0 ? POLLOUT : 0), 0};
+    if (poll(&pfd, 1, 10000) <= 0)
+    {
+      fprintf(stderr, "pty_bench: the shell stopped answering\n");
+      exit(1);
+    }
+    if (pfd.revents & POLLIN)
+    {
+      ssize_t n = read(master, buf, sizeof(buf));
+      if (n <= 0)
+      {
+        fprintf(stderr, "pty_bench: the shell went away\n");
+        exit(1);
+      }
+      prompts -= count_prompts(buf, n);
+    }
+    else if (pfd.revents & (POLLERR | POLLHUP))
+    {
+      fprintf(stderr, "pty_bench: the shell went away\n");
+      exit(1);
+    }
+    if (len > 0 && (pfd.revents & POLLOUT))
+    {
+      // one line at a time: the terminal holds only so much typed-ahead input
+      const char *nl = memchr(input, '\n', len);
+      size_t line = nl != NULL ? (size_t)(nl - input) + 1 : len;
+      ssize_t n = write(master, input, line);
+      if (n < 0 && errno != EAGAIN && errno != EINTR)
+      {
+        perror("pty_bench: write");
+        exit(1);
+      }
+      if (n > 0)
+      {
+        input += n;
+        len -= n;
+      }
+    }
+  }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Time 'line' typed n times, one after the other: report its p50 and p99
+static void round_trips(const char *name, const char *line, int n)
+{
+  double *times = malloc(n * sizeof(double));
+  char label[64];
+  if (times == NULL)
+  {
+    perror("pty_bench");
+    exit(1);
+  }
+  for (int i = 0; i < n; i++)
+  {
+    double start = now_usec();
+    type_and_wait(line, strlen(line), 1);
+    times[i] = now_usec() - start;
+  }
+  qsort(times, n, sizeof(double), compare_doubles);
+  snprintf(label, sizeof(label), "%s_p50", name);
+  report(label, times[(n - 1) / 2], "us");
+  snprintf(label, sizeof(label), "%s_p99", name);
+  report(label, times[(99 * n + 99) / 100 - 1], "us");
+  free(times);
+}
+
+// Type 'line' n times at once: report commands per second
+static void throughput(const char *name, const char *line, int n)
+{
+  size_t len = strlen(line);
+  char *input = malloc(n * len);
+  if (input == NULL)
+  {
+    perror("pty_bench");
+    exit(1);
+  }
+  for (int i = 0; i < n; i++)
+  {
+    memcpy(input + i * len, line, len);
+  }
+  double start = now_usec();
+  type_and_wait(input, n * len, n);
+  report(name, n / ((now_usec() - start) / 1e6), "cmds/s");
+  free(input);
+}
+
+// Report a "Vm...:" line of /proc/<pid>/status
+static void report_memory(pid_t pid, const char *field, const char *name)
+{
+  char path[64], line[256];
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+  FILE *status = fopen(path, "r");
+  if (status == NULL)
+  {
+    perror(path);
+    return;
+  }
+  while (fgets(line, sizeof(line), status) != NULL)
+  {
+    if (strncmp(line, field, strlen(field)) == 0)
+    {
+      report(name, atof(line + strlen(field)), "KB");
+    }
+  }
+  fclose(status);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *shell = "./shell";
+  int commands = 2000;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:n:")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      shell = optarg;
+      break;
+    case 'n':
+      commands = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-s shell] [-n commands]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (commands < 1)
+  {
+    commands = 1;
+  }
+
+  double start = now_usec();
+  pid_t pid = forkpty(&master, NULL, NULL, NULL);
+  if (pid < 0)
+  {
+    perror("forkpty");
+    return 1;
+  }
+  if (pid == 0)
+  {
+    struct termios modes;
+    if (tcgetattr(STDIN_FILENO, &modes) == 0)
+    {
+      modes.c_lflag &= ~ECHO;
+      tcsetattr(STDIN_FILENO, TCSANOW, &modes);
+    }
+    setenv("PS1", PROMPT, 1);
+    setenv("HISTFILE", "", 1);
+    execl(shell, shell, (char *)NULL);
+    perror(shell);
+    _exit(127);
+  }
+  fcntl(master, F_SETFL, O_NONBLOCK);
+
+  type_and_wait("", 0, 1);
+  report("startup", (now_usec() - start) / 1e3, "ms");
+  round_trips("prompt_latency", "\n", commands);
+  round_trips("spawn_latency", "/bin/true\n", commands);
+  throughput("builtin_throughput", "true\n", commands);
+  throughput("spawn_throughput", "/bin/true\n", commands);
+  report_memory(pid, "VmRSS:", "rss");
+  report_memory(pid, "VmHWM:", "peak_rss");
+
+  write(master, "exit\n", strlen("exit\n"));
+  int status;
+  waitpid(pid, &status, 0);
+  close(master);
+  return 0;
+}
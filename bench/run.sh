@@ -0,0 +1,16 @@
+#!/bin/sh
+# The benchmark suite behind 'make bench': the in-process microbenchmarks
+# (bench/core_bench) and the end-to-end ones on a pseudo terminal
+# (bench/pty_bench), as one table of "benchmark<TAB>value<TAB>unit" lines
+# that bench/compare.sh can hold against bench/baseline.tsv.
+#
+# usage: bench/run.sh   (SHELL_BIN, CORE_ITERATIONS and PTY_COMMANDS
+#                        override ./shell, 1000000 and 2000)
+
+SHELL_BIN=${SHELL_BIN:-./shell}
+CORE_ITERATIONS=${CORE_ITERATIONS:-1000000}
+PTY_COMMANDS=${PTY_COMMANDS:-2000}
+
+printf "benchmark\tvalue\tunit\n"
+bench/core_bench -n "$CORE_ITERATIONS" || exit 1
+bench/pty_bench -s "$SHELL_BIN" -n "$PTY_COMMANDS" || exit 1
@@ -0,0 +1,88 @@
+// Spawn latency benchmark: start and wait for a trivial command N times with
+// every spawn method, optionally after growing the heap so the cost of
+// copying page tables in fork() shows up. The spawn helper is started
+// first, as the shell starts it, so it keeps the small heap.
+//
+// usage: spawn_bench [-n iterations] [-m heap_megabytes] [command args...]
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../spawn.h"
+
+static double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+  int iterations = 2000;
+  size_t heap_mb = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:m:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    case 'm':
+      heap_mb = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n iterations] [-m heap_mb] [cmd args...]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  char *default_cmd[] = {"true", NULL};
+  char **cmd = optind < argc ? &argv[optind] : default_cmd;
+
+  if (!spawn_set_method("helper"))
+  {
+    perror("spawn helper");
+    return 1;
+  }
+
+  // Touch every page so it is really mapped in the page tables
+  if (heap_mb > 0)
+  {
+    char *heap = malloc(heap_mb << 20);
+    if (heap == NULL)
+    {
+      perror("malloc");
+      return 1;
+    }
+    memset(heap, 1, heap_mb << 20);
+  }
+
+  printf("method\theap_mb\tspawns\tusec_per_spawn\n");
+  for (int m = SPAWN_POSIX_SPAWN; m <= SPAWN_HELPER; m++)
+  {
+    spawn_method = (enum spawn_method)m;
+    double start = now_sec();
+    for (int i = 0; i < iterations; i++)
+    {
+      pid_t pid = spawn_command(NULL, cmd, NULL);
+      if (pid < 0)
+      {
+        spawn_report_error(cmd[0], errno);
+        return 1;
+      }
+      waitpid(pid, NULL, 0);
+    }
+    double elapsed = now_sec() - start;
+    printf("%s\t%zu\t%d\t%.1f\n", spawn_method_name(spawn_method), heap_mb,
+           iterations, elapsed * 1e6 / iterations);
+  }
+  return 0;
+}
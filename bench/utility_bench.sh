@@ -0,0 +1,32 @@
+#!/bin/sh
+# Builtin utilities against the programs they replace: run an N-line script
+# of each command through the shell once as is and once after
+# 'enable -n <name>' (fork + exec of the program on $PATH), and report
+# commands per second for both.
+#
+# usage: bench/utility_bench.sh [lines]   (default: 20000)
+
+SHELL_BIN=${SHELL_BIN:-./shell}
+LINES=${1:-20000}
+
+SCRIPT=$(mktemp)
+trap 'rm -f "$SCRIPT"' EXIT
+
+# seconds to run $SCRIPT
+run() {
+  start=$(date +%s.%N)
+  "$SHELL_BIN" "$SCRIPT" > /dev/null 2>&1
+  end=$(date +%s.%N)
+  echo "$start $end" | awk '{ print $2 - $1 }'
+}
+
+printf "command\tlines\tbuiltin_per_sec\texternal_per_sec\tspeedup\n"
+for cmd in "echo hello world" "printf %s\\\\n x" "test -d /tmp" "[ 1 -lt 2 ]" "true" "false"; do
+  name=${cmd%% *}
+  yes "$cmd" | head -n "$LINES" > "$SCRIPT"
+  builtin=$(run)
+  { echo "enable -n $name"; yes "$cmd" | head -n "$LINES"; } > "$SCRIPT"
+  external=$(run)
+  echo "$LINES $builtin $external" | awk -v cmd="$cmd" \
+    '{ printf "%s\t%d\t%.0f\t%.0f\t%.1fx\n", cmd, $1, $1 / $2, $1 / $3, $3 / $2 }'
+done
@@ -0,0 +1,258 @@
+// Repeated runs of one command for the 'bench' builtin.
+//
+// Runs are strictly one after the other: the clock starts right before
+// the spawn and stops when wait4() (events_wait_pid()) has reaped the
+// child, so a run's wall time includes starting the process, which a
+// baseline of 'true' runs can take out again. The command's stdout goes to
+// /dev/null so printing it does not end up in the numbers.
+
+#include "benchmark.h"
+
+#include "events.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool bench_run(char *argv[], bench_spawner spawn, int runs, int warmup,
+               struct bench_result *result)
+{
+  result->samples = malloc((runs > 0 ? runs : 1) * sizeof(struct bench_sample));
+  result->num_samples = 0;
+  result->failed = 0;
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (result->samples == NULL || null_fd < 0)
+  {
+    perror("bench");
+    if (null_fd >= 0)
+    {
+      close(null_fd);
+    }
+    return false;
+  }
+  struct spawn_io io = {{-1, null_fd, -1}, -1, NULL};
+
+  bool completed = true;
+  for (int i = 0; i < warmup + runs; i++)
+  {
+    double start = now_seconds();
+    pid_t pid = spawn(argv, &io);
+    if (pid < 0)
+    {
+      spawn_report_error(STDERR_FILENO, argv[0], errno);
+      completed = false;
+      break;
+    }
+    struct child_exit child;
+    if (!events_wait_pid(pid, 0, &child))
+    {
+      perror("bench");
+      completed = false;
+      break;
+    }
+    double wall = now_seconds() - start;
+    if (WIFSIGNALED(child.status) && WTERMSIG(child.status) == SIGINT)
+    {
+      completed = false;
+      break;
+    }
+    if (i < warmup)
+    {
+      continue;
+    }
+    struct bench_sample *sample = &result->samples[result->num_samples++];
+    sample->wall = wall;
+    sample->usage = child.usage;
+    sample->status = child.status;
+    result->failed += child.status != 0;
+  }
+  close(null_fd);
+  return completed;
+}
+
+void bench_free(struct bench_result *result)
+{
+  free(result->samples);
+  result->samples = NULL;
+  result->num_samples = 0;
+}
+
+void bench_total_usage(const struct bench_result *result, struct rusage *total)
+{
+  memset(total, 0, sizeof(*total));
+  for (size_t i = 0; i < result->num_samples; i++)
+  {
+    rusage_add(total, &result->samples[i].usage);
+  }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Wall time percentiles of a run, in milliseconds
+struct wall_stats
+{
+  double min, median, p95, p99, max;
+};
+
+// returns: the value at 'percent' of sorted[0, n) (nearest rank)
+static double percentile(const double *sorted, size_t n, size_t percent)
+{
+  size_t rank = (percent * n + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// returns: false if out of memory
+static bool wall_stats(const struct bench_result *result, struct wall_stats *stats)
+{
+  size_t n = result->num_samples;
+  double *sorted = malloc(n * sizeof(double));
+  if (sorted == NULL)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    sorted[i] = result->samples[i].wall * 1e3;
+  }
+  qsort(sorted, n, sizeof(double), compare_doubles);
+  stats->min = sorted[0];
+  stats->median = percentile(sorted, n, 50);
+  stats->p95 = percentile(sorted, n, 95);
+  stats->p99 = percentile(sorted, n, 99);
+  stats->max = sorted[n - 1];
+  free(sorted);
+  return true;
+}
+
+static double ms(struct timeval tv)
+{
+  return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+/*
+ * Copy 'name' to 'out' quoted for CSV ("" for ") or JSON (\" \\ and \u
+ * escapes). 'out' needs room for 6 bytes per byte of name plus 3.
+ * returns: the end of the copy (null terminated).
+ */
+static char *quote_name(char *out, const char *name, enum bench_format format)
+{
+  *out++ = '"';
+  for (const char *c = name; *c != '\0'; c++)
+  {
+    if (*c == '"')
+    {
+      *out++ = format == BENCH_CSV ? '"' : '\\';
+    }
+    else if (format == BENCH_JSON && *c == '\\')
+    {
+      *out++ = '\\';
+    }
+    else if (format == BENCH_JSON && (unsigned char)*c < 0x20)
+    {
+      out += sprintf(out, "\\u%04x", *c);
+      continue;
+    }
+    *out++ = *c;
+  }
+  *out++ = '"';
+  *out = '\0';
+  return out;
+}
+
+void bench_report(int fd, enum bench_format format, const char *name,
+                  const struct bench_result *result, const struct bench_result *baseline)
+{
+  size_t runs = result->num_samples;
+  struct wall_stats wall;
+  struct wall_stats base = {0, 0, 0, 0, 0};
+  if (runs == 0 || !wall_stats(result, &wall) ||
+      (baseline != NULL && baseline->num_samples > 0 && !wall_stats(baseline, &base)))
+  {
+    const char *msg = runs == 0 ? "bench: no runs to report.\n" : "bench: out of memory.\n";
+    write(STDERR_FILENO, msg, strlen(msg));
+    return;
+  }
+  // what starting a process costs on its own
+  double *stats[] = {&wall.min, &wall.median, &wall.p95, &wall.p99, &wall.max};
+  for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++)
+  {
+    *stats[i] = *stats[i] > base.median ? *stats[i] - base.median : 0;
+  }
+  struct rusage total;
+  bench_total_usage(result, &total);
+  double user = ms(total.ru_utime) / runs;
+  double sys = ms(total.ru_stime) / runs;
+  double voluntary = (double)total.ru_nvcsw / runs;
+  double involuntary = (double)total.ru_nivcsw / runs;
+
+  size_t size = 6 * strlen(name) + 1024;
+  char *quoted = malloc(6 * strlen(name) + 3);
+  char *buf = malloc(size);
+  if (quoted == NULL || buf == NULL)
+  {
+    free(quoted);
+    free(buf);
+    return;
+  }
+  int len = 0;
+  switch (format)
+  {
+  case BENCH_TEXT:
+    len = snprintf(buf, size,
+                   "%s: %zu runs, %zu failed\n"
+                   "wall ms     %10s %10s %10s %10s %10s\n"
+                   "            %10.3f %10.3f %10.3f %10.3f %10.3f\n"
+                   "cpu ms      %10.3f user %10.3f sys (per run)\n"
+                   "max rss     %10ld KB\n"
+                   "switches    %10.1f voluntary %10.1f involuntary (per run)\n",
+                   name, runs, result->failed, "min", "median", "p95", "p99", "max", wall.min,
+                   wall.median, wall.p95, wall.p99, wall.max, user, sys, total.ru_maxrss,
+                   voluntary, involuntary);
+    if (baseline != NULL)
+    {
+      len += snprintf(buf + len, size - len,
+                      "baseline    %10.3f ms median of 'true', subtracted\n", base.median);
+    }
+    break;
+  case BENCH_CSV:
+    quote_name(quoted, name, format);
+    len = snprintf(buf, size,
+                   "command,runs,failed,min_ms,median_ms,p95_ms,p99_ms,max_ms,user_ms,sys_ms,"
+                   "max_rss_kb,voluntary_switches,involuntary_switches,baseline_ms\n"
+                   "%s,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%ld,%.1f,%.1f,%.3f\n",
+                   quoted, runs, result->failed, wall.min, wall.median, wall.p95, wall.p99,
+                   wall.max, user, sys, total.ru_maxrss, voluntary, involuntary, base.median);
+    break;
+  case BENCH_JSON:
+    quote_name(quoted, name, format);
+    len = snprintf(buf, size,
+                   "{\"command\":%s,\"runs\":%zu,\"failed\":%zu,\"min_ms\":%.3f,"
+                   "\"median_ms\":%.3f,\"p95_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,"
+                   "\"user_ms\":%.3f,\"sys_ms\":%.3f,\"max_rss_kb\":%ld,"
+                   "\"voluntary_switches\":%.1f,\"involuntary_switches\":%.1f,"
+                   "\"baseline_ms\":%.3f}\n",
+                   quoted, runs, result->failed, wall.min, wall.median, wall.p95, wall.p99,
+                   wall.max, user, sys, total.ru_maxrss, voluntary, involuntary, base.median);
+    break;
+  }
+  write(fd, buf, len);
+  free(quoted);
+  free(buf);
+}
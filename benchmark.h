@@ -0,0 +1,70 @@
+// Repeated runs of one command for the 'bench' builtin: wall time of every
+// run plus what wait4() says it used, summarized as percentiles.
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "spawn.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/resource.h>
+
+enum bench_format
+{
+  BENCH_TEXT, // a table for people
+  BENCH_CSV,  // a header line and one line of numbers
+  BENCH_JSON, // one object on one line
+};
+
+// One timed run
+struct bench_sample
+{
+  double wall; // seconds from just before the spawn to the child reaped
+  struct rusage usage;
+  int status; // wait status
+};
+
+struct bench_result
+{
+  struct bench_sample *samples; // in the order they ran (malloc'd)
+  size_t num_samples;
+  size_t failed; // runs that did not exit with status 0
+};
+
+/*
+ * Starts one run of 'argv' with 'io' (stdout goes to /dev/null), as the
+ * shell would start it. returns: the child, or -1 with errno set.
+ */
+typedef pid_t (*bench_spawner)(char *argv[], const struct spawn_io *io);
+
+/*
+ * Run 'argv' warmup + runs times, one after the other, and time the last
+ * 'runs' of them with CLOCK_MONOTONIC; their resource usage is collected
+ * when each is reaped with wait4(). ctrl-c (a run killed by SIGINT) ends
+ * the benchmark early with the runs so far.
+ * result: filled in; free it with bench_free().
+ * returns: false if the benchmark was cut short or a run could not start
+ *          (with an error printed).
+ */
+bool bench_run(char *argv[], bench_spawner spawn, int runs, int warmup,
+               struct bench_result *result);
+
+void bench_free(struct bench_result *result);
+
+// Sum of the resource usage of all runs (see rusage_add()).
+void bench_total_usage(const struct bench_result *result, struct rusage *total);
+
+/*
+ * Print the summary of 'result' to fd: min, median, p95, p99 and max wall
+ * time, mean user and system CPU time per run, the largest maximum RSS and
+ * the mean voluntary and involuntary context switches per run.
+ * name: the command, as typed.
+ * baseline: runs of 'true' started the same way, or NULL. Its median is
+ *           subtracted from the wall times, so what is left is the
+ *           command's own time, not the cost of starting a process.
+ */
+void bench_report(int fd, enum bench_format format, const char *name,
+                  const struct bench_result *result, const struct bench_result *baseline);
+
+#endif
@@ -0,0 +1,40 @@
+// Table of builtin commands, looked up through a perfect hash.
+
+#include "builtins.h"
+
+#include "builtin_hash.h"
+
+#include <string.h>
+
+const struct builtin builtins[] = {
+#define BUILTIN(name, handler, min_args, max_args, help) {#name, handler, min_args, max_args, help},
+#include "builtins.def"
+#undef BUILTIN
+};
+
+const int num_builtins = sizeof(builtins) / sizeof(builtins[0]);
+
+// Builtins turned off with 'enable -n'
+static bool disabled[sizeof(builtins) / sizeof(builtins[0])];
+
+const struct builtin *builtin_find(const char *name)
+{
+  int i = builtin_slots[builtin_hash(name, BUILTIN_HASH_SEED) & (BUILTIN_HASH_SIZE - 1)];
+  return i >= 0 && strcmp(builtins[i].name, name) == 0 ? &builtins[i] : NULL;
+}
+
+const struct builtin *builtin_lookup(const char *name)
+{
+  const struct builtin *builtin = builtin_find(name);
+  return builtin != NULL && !disabled[builtin - builtins] ? builtin : NULL;
+}
+
+void builtin_set_enabled(const struct builtin *builtin, bool enabled)
+{
+  disabled[builtin - builtins] = !enabled;
+}
+
+bool builtin_enabled(const struct builtin *builtin)
+{
+  return !disabled[builtin - builtins];
+}
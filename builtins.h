@@ -0,0 +1,54 @@
+// Table of builtin commands (see builtins.def), looked up through a perfect
+// hash generated at build time.
+
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct builtin
+{
+  const char *name;
+  void (*run)(char *tokens[]);
+  int min_args; // arguments, not counting the name
+  int max_args; // -1: no limit
+  const char *help;
+};
+
+// The handlers, defined in shell.c
+#define BUILTIN(name, handler, min_args, max_args, help) void handler(char *tokens[]);
+#include "builtins.def"
+#undef BUILTIN
+
+// Every builtin, in builtins.def order
+extern const struct builtin builtins[];
+extern const int num_builtins;
+
+/*
+ * Find a builtin by name with one hash and one strcmp().
+ * returns: its descriptor, or NULL if 'name' is not a builtin or has been
+ *          disabled (then the command of that name on $PATH runs instead).
+ */
+const struct builtin *builtin_lookup(const char *name);
+
+// Like builtin_lookup(), but also finds disabled builtins.
+const struct builtin *builtin_find(const char *name);
+
+// Turn a builtin off (so 'echo' runs /bin/echo) or back on, for 'enable'.
+void builtin_set_enabled(const struct builtin *builtin, bool enabled);
+bool builtin_enabled(const struct builtin *builtin);
+
+// Hash of a builtin name; tools/gen_builtin_hash picks a seed for which
+// the names of builtins.def never collide.
+static inline uint32_t builtin_hash(const char *name, uint32_t seed)
+{
+  uint32_t h = 2166136261u ^ seed;
+  for (; *name != '\0'; name++)
+  {
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  }
+  return h ^ (h >> 16);
+}
+
+#endif
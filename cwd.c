@@ -0,0 +1,160 @@
+// The shell's working directory, kept in memory.
+//
+// The working directory only changes when the shell itself calls chdir(),
+// so there is no need to call getcwd() (a walk up the directory tree in the
+// kernel, slow on deep or network mounted paths) for every prompt: track
+// it here and update it only on a successful cwd_change().
+
+#include "cwd.h"
+
+#include "vars.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char *current;
+static size_t current_len;
+static char *previous;
+
+// true if paths 'a' and 'b' name the same directory
+static bool same_dir(const char *a, const char *b)
+{
+  struct stat sa, sb;
+  return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev &&
+         sa.st_ino == sb.st_ino;
+}
+
+// Replace the remembered directory with 'dir' (taken over, heap allocated)
+static void set_current(char *dir)
+{
+  free(previous);
+  previous = current;
+  current = dir;
+  current_len = strlen(dir);
+  vars_set("PWD", current, true);
+  if (previous != NULL)
+  {
+    vars_set("OLDPWD", previous, true);
+  }
+}
+
+bool cwd_init(void)
+{
+  const char *pwd = vars_get("PWD");
+  char *dir;
+  if (pwd != NULL && pwd[0] == '/' && same_dir(pwd, "."))
+  {
+    dir = strdup(pwd);
+  }
+  else
+  {
+    dir = getcwd(NULL, 0);
+  }
+  if (dir == NULL)
+  {
+    return false;
+  }
+  set_current(dir);
+  return true;
+}
+
+const char *cwd_get(void)
+{
+  return current != NULL ? current : ".";
+}
+
+size_t cwd_length(void)
+{
+  return current != NULL ? current_len : 1;
+}
+
+const char *cwd_previous(void)
+{
+  return previous;
+}
+
+/*
+ * Join 'dir' onto 'base' (unless it is absolute) and drop every ".", ".."
+ * and empty component.
+ * returns: the absolute path (heap allocated), or NULL if out of memory.
+ */
+static char *logical_path(const char *base, const char *dir)
+{
+  size_t base_len = dir[0] == '/' ? 0 : strlen(base);
+  char *path = malloc(base_len + strlen(dir) + 3);
+  if (path == NULL)
+  {
+    return NULL;
+  }
+
+  // 'len' is the length of the normalized prefix, always "/..." or ""
+  size_t len = 0;
+  const char *parts[2] = {base_len > 0 ? base : "", dir};
+  for (int p = 0; p < 2; p++)
+  {
+    const char *s = parts[p];
+    while (*s != '\0')
+    {
+      while (*s == '/')
+      {
+        s++;
+      }
+      size_t n = strcspn(s, "/");
+      if (n == 0 || (n == 1 && s[0] == '.'))
+      {
+        // nothing to add
+      }
+      else if (n == 2 && s[0] == '.' && s[1] == '.')
+      {
+        while (len > 0 && path[--len] != '/')
+        {
+        }
+      }
+      else
+      {
+        path[len++] = '/';
+        memcpy(path + len, s, n);
+        len += n;
+      }
+      s += n;
+    }
+  }
+  if (len == 0)
+  {
+    path[len++] = '/';
+  }
+  path[len] = '\0';
+  return path;
+}
+
+bool cwd_change(const char *dir)
+{
+  // without a known current directory a relative 'dir' can only be
+  // resolved by the kernel
+  char *path = current != NULL || dir[0] == '/' ? logical_path(current, dir) : NULL;
+  if (path == NULL || chdir(path) != 0)
+  {
+    // "link/.." can also name a directory the textual path does not:
+    // fall back to the kernel's view of 'dir' (as 'cd -P' would)
+    int saved_errno = path != NULL ? errno : 0;
+    free(path);
+    if (chdir(dir) != 0)
+    {
+      if (saved_errno != 0)
+      {
+        errno = saved_errno;
+      }
+      return false;
+    }
+    path = getcwd(NULL, 0);
+    if (path == NULL)
+    {
+      return false;
+    }
+  }
+  set_current(path);
+  return true;
+}
@@ -0,0 +1,35 @@
+// The shell's working directory, kept in memory so the prompt and 'pwd'
+// never have to ask the kernel for it.
+
+#ifndef CWD_H
+#define CWD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Learn the working directory once at startup: $PWD if it names the
+ * directory we are in (keeping the symlinks the user came through, as
+ * other shells do), else getcwd().
+ * returns: false if the working directory cannot be determined.
+ */
+bool cwd_init(void);
+
+// Current working directory (logical: symlinks are not resolved)
+const char *cwd_get(void);
+size_t cwd_length(void);
+
+// Previous working directory, or NULL if the shell never changed directory
+const char *cwd_previous(void);
+
+/*
+ * chdir() to 'dir' (absolute, or relative to the current directory) and
+ * remember the new directory, with "." and ".." resolved textually first,
+ * like 'cd -L' in other shells. The previous directory becomes
+ * cwd_previous(); $PWD and $OLDPWD are kept up to date for children.
+ * returns: false with errno set if the directory cannot be entered; the
+ *          working directory is then unchanged.
+ */
+bool cwd_change(const char *dir);
+
+#endif
@@ -0,0 +1,656 @@
+// Event loop: reaps children as they exit and services SIGINT and terminal
+// input from one epoll instance.
+//
+// Every watched child gets a pidfd in the epoll set, so an exit wakes the
+// loop for exactly that child and waitid(P_PIDFD) reaps it without scanning
+// the other children. Signals arrive through a signalfd in the same set.
+// If pidfd_open() is unavailable (old kernel, out of descriptors) the child
+// is reaped from the SIGCHLD path instead.
+
+#include "events.h"
+
+#include "spawn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#define MAX_EVENTS 64
+#define INITIAL_SLOTS 64
+
+struct watched_child
+{
+  pid_t pid;
+  int pidfd; // -1 when reaped through SIGCHLD instead
+  child_callback cb;
+  void *ctx;
+};
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static int input_fd = -1;
+static int timer_fd = -1;
+static void (*sigint_callback)(void);
+static void (*timer_callback)(void);
+
+// Tags for the epoll entries that are not children
+static int signal_tag, input_tag, timer_tag;
+
+// pid -> watched child, open addressing
+static struct watched_child **table;
+static size_t num_slots;
+static size_t num_watched;
+
+// Children with no pidfd (pidfd_open() failed, or we could not watch them
+// at all), reaped one by one with wait4() on SIGCHLD. Never wait4(-1): it
+// would also reap children whose pidfd event is still to be dispatched.
+static pid_t *without_pidfd;
+static size_t num_without_pidfd;
+static size_t without_pidfd_cap;
+
+// returns: false if out of memory
+static bool add_without_pidfd(pid_t pid)
+{
+  if (num_without_pidfd == without_pidfd_cap)
+  {
+    size_t cap = without_pidfd_cap ? without_pidfd_cap * 2 : 16;
+    pid_t *grown = realloc(without_pidfd, cap * sizeof(pid_t));
+    if (grown == NULL)
+    {
+      return false;
+    }
+    without_pidfd = grown;
+    without_pidfd_cap = cap;
+  }
+  without_pidfd[num_without_pidfd++] = pid;
+  return true;
+}
+
+static void remove_without_pidfd(pid_t pid)
+{
+  for (size_t i = 0; i < num_without_pidfd; i++)
+  {
+    if (without_pidfd[i] == pid)
+    {
+      without_pidfd[i] = without_pidfd[--num_without_pidfd];
+      return;
+    }
+  }
+}
+
+static size_t slot_of(pid_t pid, size_t size)
+{
+  return ((uint32_t)pid * 2654435761u) & (size - 1);
+}
+
+static struct watched_child **find_slot(pid_t pid)
+{
+  size_t i = slot_of(pid, num_slots);
+  while (table[i] != NULL && table[i]->pid != pid)
+  {
+    i = (i + 1) & (num_slots - 1);
+  }
+  return &table[i];
+}
+
+static bool grow_table(void)
+{
+  size_t size = num_slots ? num_slots * 2 : INITIAL_SLOTS;
+  struct watched_child **slots = calloc(size, sizeof(*slots));
+  if (slots == NULL)
+  {
+    return false;
+  }
+  struct watched_child **old = table;
+  size_t old_size = num_slots;
+  table = slots;
+  num_slots = size;
+  for (size_t i = 0; i < old_size; i++)
+  {
+    if (old[i] != NULL)
+    {
+      *find_slot(old[i]->pid) = old[i];
+    }
+  }
+  free(old);
+  return true;
+}
+
+// Remove a slot, shifting later entries of the same probe run back so
+// lookups never need tombstones.
+static void remove_slot(struct watched_child **slot)
+{
+  size_t hole = slot - table;
+  size_t i = hole;
+  while (true)
+  {
+    i = (i + 1) & (num_slots - 1);
+    if (table[i] == NULL)
+    {
+      break;
+    }
+    size_t home = slot_of(table[i]->pid, num_slots);
+    // move table[i] into the hole unless its home lies after the hole
+    if ((i > hole && (home <= hole || home > i)) || (i < hole && home <= hole && home > i))
+    {
+      table[hole] = table[i];
+      hole = i;
+    }
+  }
+  table[hole] = NULL;
+}
+
+static struct watched_child *lookup(pid_t pid)
+{
+  return num_slots ? *find_slot(pid) : NULL;
+}
+
+// A watched child stopped or continued: tell its owner and keep watching.
+static void notify(struct watched_child *child, int status)
+{
+  struct child_exit change;
+  memset(&change, 0, sizeof(change));
+  change.pid = child->pid;
+  change.status = status;
+  if (child->cb != NULL)
+  {
+    child->cb(&change, child->ctx);
+  }
+}
+
+// A watched child has terminated: forget it and run its callback.
+static void finish(struct watched_child *child, int status, const struct rusage *usage)
+{
+  remove_slot(find_slot(child->pid));
+  num_watched--;
+  if (child->pidfd >= 0)
+  {
+    close(child->pidfd);
+  }
+  else
+  {
+    remove_without_pidfd(child->pid);
+  }
+
+  struct child_exit exit_info;
+  exit_info.pid = child->pid;
+  exit_info.status = status;
+  exit_info.usage = *usage;
+  if (child->cb != NULL)
+  {
+    child->cb(&exit_info, child->ctx);
+  }
+  free(child);
+}
+
+void rusage_add(struct rusage *sum, const struct rusage *usage)
+{
+  timeradd(&sum->ru_utime, &usage->ru_utime, &sum->ru_utime);
+  timeradd(&sum->ru_stime, &usage->ru_stime, &sum->ru_stime);
+  if (usage->ru_maxrss > sum->ru_maxrss)
+  {
+    sum->ru_maxrss = usage->ru_maxrss;
+  }
+  sum->ru_minflt += usage->ru_minflt;
+  sum->ru_majflt += usage->ru_majflt;
+  sum->ru_inblock += usage->ru_inblock;
+  sum->ru_oublock += usage->ru_oublock;
+  sum->ru_nvcsw += usage->ru_nvcsw;
+  sum->ru_nivcsw += usage->ru_nivcsw;
+}
+
+bool events_init(void (*on_sigint)(void))
+{
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (on_sigint != NULL)
+  {
+    sigaddset(&mask, SIGINT);
+  }
+  sigint_callback = on_sigint;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (epoll_fd < 0 || signal_fd < 0)
+  {
+    return false;
+  }
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &signal_tag};
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+
+  // one pidfd per background child: allow as many as the hard limit does
+  // (children get the original limit back, see spawn.h)
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+  {
+    spawn_set_fd_limit(&limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  return true;
+}
+
+void events_reset(void)
+{
+  for (size_t i = 0; i < num_slots; i++)
+  {
+    if (table[i] != NULL)
+    {
+      if (table[i]->pidfd >= 0)
+      {
+        close(table[i]->pidfd);
+      }
+      free(table[i]);
+      table[i] = NULL;
+    }
+  }
+  num_watched = num_without_pidfd = 0;
+  if (epoll_fd >= 0)
+  {
+    close(epoll_fd);
+  }
+  if (signal_fd >= 0)
+  {
+    close(signal_fd);
+  }
+  if (timer_fd >= 0)
+  {
+    close(timer_fd);
+  }
+  epoll_fd = signal_fd = input_fd = timer_fd = -1;
+  timer_callback = NULL;
+  events_init(NULL);
+}
+
+void events_watch(pid_t pid, child_callback cb, void *ctx)
+{
+  struct watched_child *child = malloc(sizeof(*child));
+  if (child == NULL || ((num_watched + 1) * 2 > num_slots && !grow_table()))
+  {
+    // cannot track it: it will at least be reaped through SIGCHLD
+    free(child);
+    add_without_pidfd(pid);
+    return;
+  }
+  child->pid = pid;
+  child->cb = cb;
+  child->ctx = ctx;
+  child->pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if (child->pidfd >= 0)
+  {
+    fcntl(child->pidfd, F_SETFD, FD_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = child};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, child->pidfd, &ev) < 0)
+    {
+      close(child->pidfd);
+      child->pidfd = -1;
+    }
+  }
+  if (child->pidfd < 0 && !add_without_pidfd(pid))
+  {
+    free(child);
+    return;
+  }
+  *find_slot(pid) = child;
+  num_watched++;
+}
+
+size_t events_num_watched(void)
+{
+  return num_watched;
+}
+
+// Turn the siginfo of a terminated child back into a wait status.
+static int wait_status(const siginfo_t *info)
+{
+  switch (info->si_code)
+  {
+  case CLD_EXITED:
+    return (info->si_status & 0xff) << 8;
+  case CLD_DUMPED:
+    return (info->si_status & 0x7f) | 0x80;
+  case CLD_STOPPED:
+  case CLD_TRAPPED:
+    return ((info->si_status & 0xff) << 8) | 0x7f;
+  case CLD_CONTINUED:
+    return 0xffff;
+  default:
+    return info->si_status & 0x7f;
+  }
+}
+
+// The pidfd of a watched child became readable: it has exited.
+static void reap_pidfd(struct watched_child *child)
+{
+  siginfo_t info;
+  struct rusage usage;
+  memset(&info, 0, sizeof(info));
+  memset(&usage, 0, sizeof(usage));
+  if (syscall(SYS_waitid, P_PIDFD, child->pidfd, &info, WEXITED | WNOHANG, &usage) < 0)
+  {
+    // someone else reaped it already; nothing left to report
+    if (errno == ECHILD)
+    {
+      memset(&usage, 0, sizeof(usage));
+      finish(child, 0, &usage);
+    }
+    return;
+  }
+  if (info.si_pid == 0)
+  {
+    return;
+  }
+  finish(child, wait_status(&info), &usage);
+}
+
+// Reap the children without a pidfd that have terminated. From the end, as
+// a reaped one is replaced by the last, which has been looked at already.
+static void reap_without_pidfd(void)
+{
+  for (size_t i = num_without_pidfd; i-- > 0;)
+  {
+    int status = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    pid_t pid = without_pidfd[i];
+    pid_t got = wait4(pid, &status, WNOHANG, &usage);
+    if (got == 0 || (got < 0 && errno != ECHILD))
+    {
+      continue;
+    }
+    // exited, or reaped by someone else (ECHILD): nothing more to wait for
+    struct watched_child *child = lookup(pid);
+    if (child != NULL)
+    {
+      finish(child, status, &usage);
+    }
+    else
+    {
+      remove_without_pidfd(pid);
+    }
+    if (i > num_without_pidfd)
+    {
+      i = num_without_pidfd;
+    }
+  }
+}
+
+// Collect stop and continue notifications. Exits are left to the pidfds:
+// without WEXITED, waitid() only reports children that changed state.
+static void collect_stops(void)
+{
+  siginfo_t info;
+  while (true)
+  {
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_ALL, 0, &info, WSTOPPED | WCONTINUED | WNOHANG) < 0 || info.si_pid == 0)
+    {
+      break;
+    }
+    struct watched_child *child = lookup(info.si_pid);
+    if (child != NULL)
+    {
+      notify(child, wait_status(&info));
+    }
+  }
+}
+
+// Drain the signalfd, calling the ctrl-c callback if 'deliver_sigint'.
+// returns: true if ctrl-c was pressed.
+static bool service_signals(bool deliver_sigint)
+{
+  struct signalfd_siginfo info[16];
+  bool interrupted = false;
+  bool child_exited = false;
+  ssize_t n;
+  while ((n = read(signal_fd, info, sizeof(info))) > 0)
+  {
+    for (size_t i = 0; i < n / sizeof(info[0]); i++)
+    {
+      if (info[i].ssi_signo == SIGCHLD)
+      {
+        child_exited = true;
+      }
+      else if (info[i].ssi_signo == SIGINT)
+      {
+        interrupted = true;
+      }
+    }
+  }
+  if (child_exited)
+  {
+    collect_stops();
+    if (num_without_pidfd > 0)
+    {
+      reap_without_pidfd();
+    }
+  }
+  if (interrupted && deliver_sigint && sigint_callback != NULL)
+  {
+    sigint_callback();
+  }
+  return interrupted;
+}
+
+// Wait up to 'timeout' ms and dispatch what arrives.
+// returns: bit 0 set if input_fd is readable, bit 1 set if ctrl-c was pressed.
+static int dispatch(int timeout, bool deliver_sigint)
+{
+  struct epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+  int result = 0;
+  for (int i = 0; i < n; i++)
+  {
+    void *tag = events[i].data.ptr;
+    if (tag == &signal_tag)
+    {
+      if (service_signals(deliver_sigint))
+      {
+        result |= 2;
+      }
+    }
+    else if (tag == &input_tag)
+    {
+      result |= 1;
+    }
+    else if (tag == &timer_tag)
+    {
+      uint64_t expirations;
+      if (read(timer_fd, &expirations, sizeof(expirations)) > 0 && timer_callback != NULL)
+      {
+        timer_callback();
+      }
+    }
+    else
+    {
+      reap_pidfd(tag);
+    }
+  }
+  return result;
+}
+
+bool events_wait_input(int fd)
+{
+  if (epoll_fd < 0)
+  {
+    return true;
+  }
+  if (fd != input_fd)
+  {
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &input_tag};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+      // regular files cannot be polled; they are always readable
+      return true;
+    }
+    input_fd = fd;
+  }
+  while (true)
+  {
+    int result = dispatch(-1, true);
+    if (result & 2)
+    {
+      return false;
+    }
+    if (result & 1)
+    {
+      return true;
+    }
+  }
+}
+
+bool events_wait(void)
+{
+  if (epoll_fd < 0)
+  {
+    reap_without_pidfd();
+    return true;
+  }
+  // the terminal may be readable all along; only children and signals count
+  if (input_fd >= 0)
+  {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, input_fd, NULL);
+    input_fd = -1;
+  }
+  return (dispatch(-1, false) & 2) == 0;
+}
+
+bool events_sleep(const struct timespec *duration)
+{
+  if (epoll_fd < 0)
+  {
+    return nanosleep(duration, NULL) == 0;
+  }
+  // as in events_wait(), typed input must not end the sleep
+  if (input_fd >= 0)
+  {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, input_fd, NULL);
+    input_fd = -1;
+  }
+  struct timespec now, end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  end.tv_sec += duration->tv_sec;
+  end.tv_nsec += duration->tv_nsec;
+  if (end.tv_nsec >= 1000000000)
+  {
+    end.tv_sec++;
+    end.tv_nsec -= 1000000000;
+  }
+  while (true)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long left_ns = (end.tv_sec - now.tv_sec) * 1000000000LL + (end.tv_nsec - now.tv_nsec);
+    if (left_ns <= 0)
+    {
+      return true;
+    }
+    // round up: waking early would only mean another round
+    long long left_ms = (left_ns + 999999) / 1000000;
+    if (dispatch(left_ms > INT32_MAX ? INT32_MAX : (int)left_ms, false) & 2)
+    {
+      return false;
+    }
+  }
+}
+
+bool events_set_timer(double seconds, void (*fn)(void))
+{
+  if (epoll_fd < 0)
+  {
+    errno = EBADF;
+    return false;
+  }
+  if (timer_fd < 0 && seconds > 0)
+  {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &timer_tag};
+    if (timer_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0)
+    {
+      int err = errno;
+      if (timer_fd >= 0)
+      {
+        close(timer_fd);
+      }
+      timer_fd = -1;
+      errno = err;
+      return false;
+    }
+  }
+  timer_callback = seconds > 0 ? fn : NULL;
+  if (timer_fd < 0)
+  {
+    return true;
+  }
+  struct itimerspec spec = {{0, 0}, {0, 0}};
+  if (seconds > 0)
+  {
+    spec.it_interval.tv_sec = (time_t)seconds;
+    spec.it_interval.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9);
+    if (spec.it_interval.tv_sec == 0 && spec.it_interval.tv_nsec == 0)
+    {
+      spec.it_interval.tv_nsec = 1;
+    }
+    spec.it_value = spec.it_interval;
+  }
+  return timerfd_settime(timer_fd, 0, &spec, NULL) == 0;
+}
+
+void events_poll(void)
+{
+  if (epoll_fd >= 0)
+  {
+    dispatch(0, true);
+  }
+  else
+  {
+    reap_without_pidfd();
+  }
+}
+
+bool events_wait_pid(pid_t pid, int options, struct child_exit *child)
+{
+  int status;
+  pid_t got;
+  memset(&child->usage, 0, sizeof(child->usage));
+  do
+  {
+    got = wait4(pid, &status, options, &child->usage);
+  } while (got < 0 && errno == EINTR);
+  if (got <= 0)
+  {
+    return false;
+  }
+  child->pid = pid;
+  child->status = status;
+
+  struct watched_child *watched = lookup(pid);
+  if (watched != NULL && (WIFSTOPPED(status) || WIFCONTINUED(status)))
+  {
+    notify(watched, status);
+  }
+  else if (watched != NULL)
+  {
+    finish(watched, status, &child->usage);
+  }
+  if (signal_fd >= 0)
+  {
+    service_signals(false);
+  }
+  return true;
+}
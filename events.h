@@ -0,0 +1,96 @@
+// Event loop: reaps children as they exit and services SIGINT and terminal
+// input from one epoll instance.
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+
+// How a child ended (or stopped or continued), as collected by wait4()/waitid().
+struct child_exit
+{
+  pid_t pid;
+  int status; // wait status: use WIFEXITED(), WEXITSTATUS(), ...
+  struct rusage usage;
+};
+
+// Add 'usage' to 'sum' (times and counters added, maxrss the larger one)
+void rusage_add(struct rusage *sum, const struct rusage *usage);
+
+typedef void (*child_callback)(const struct child_exit *child, void *ctx);
+
+/*
+ * Route SIGCHLD (and SIGINT when 'on_sigint' is given) through a signalfd
+ * instead of signal handlers. Both stay blocked from now on; children get
+ * an empty signal mask from spawn.c.
+ * on_sigint: called from the loop for every ctrl-c at the prompt, or NULL
+ *            to leave SIGINT alone (non-interactive shells).
+ * returns: false if the event loop could not be set up.
+ */
+bool events_init(void (*on_sigint)(void));
+
+/*
+ * For a forked child that goes on running shell code (a builtin in a
+ * pipeline): forget the parent's children and set up an event loop of its
+ * own, without SIGINT handling, instead of sharing the parent's epoll set.
+ */
+void events_reset(void);
+
+/*
+ * Watch a child: the moment it exits it is reaped and cb(child, ctx) is
+ * called from the event loop. cb also hears about the child stopping and
+ * continuing (WIFSTOPPED()/WIFCONTINUED() status, no usage); only an exit
+ * ends the watch. cb may be NULL.
+ */
+void events_watch(pid_t pid, child_callback cb, void *ctx);
+
+// Number of watched children that are still running.
+size_t events_num_watched(void);
+
+/*
+ * Block until 'fd' has input, reaping children and handling ctrl-c while
+ * waiting.
+ * returns: true once fd is readable, false if the wait was interrupted by
+ *          ctrl-c (so the caller can show a fresh prompt).
+ */
+bool events_wait_input(int fd);
+
+/*
+ * Block until at least one event (child state change or signal) has been
+ * handled. ctrl-c does not reach the on_sigint callback here.
+ * returns: false if the wait was interrupted by ctrl-c.
+ */
+bool events_wait(void);
+
+/*
+ * Sleep for 'duration' (to the millisecond), reaping children meanwhile.
+ * returns: false if cut short by ctrl-c.
+ */
+bool events_sleep(const struct timespec *duration);
+
+/*
+ * Call fn() from the event loop every 'seconds' from now on (while the
+ * shell waits for input, children or a sleep; a timer that comes due
+ * during a foreground wait4() fires once it returns). Replaces the
+ * previous timer; seconds <= 0 stops it.
+ * returns: false (errno set) if the timer could not be set up.
+ */
+bool events_set_timer(double seconds, void (*fn)(void));
+
+// Handle whatever is pending without blocking.
+void events_poll(void);
+
+/*
+ * Wait for one specific child in the foreground (e.g. with WUNTRACED).
+ * Its status and resource usage are stored in *child; if it is being
+ * watched, its callback runs as well. A ctrl-c that
+ * arrived meanwhile was meant for the child and is dropped.
+ * returns: false if the child could not be waited for.
+ */
+bool events_wait_pid(pid_t pid, int options, struct child_exit *child);
+
+#endif
@@ -0,0 +1,104 @@
+// Copying between file descriptors inside the kernel.
+
+#include "fdcopy.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+// Bytes asked for per call: large, yet small enough that a ctrl-c is seen
+// within milliseconds
+#define COPY_CHUNK (64L << 20)
+
+#define READ_BUFFER_SIZE (64 * 1024)
+
+// true if a copy_file_range()/sendfile() error means "not for these fds"
+static bool unsupported(int err)
+{
+  return err == EINVAL || err == EXDEV || err == ENOSYS || err == EBADF ||
+         err == EOPNOTSUPP;
+}
+
+// A builtin copying inside the shell runs with SIGINT blocked (see
+// events.c): a ctrl-c then only shows up as pending.
+static bool interrupted(void)
+{
+  sigset_t pending;
+  if (sigpending(&pending) == 0 && sigismember(&pending, SIGINT))
+  {
+    errno = EINTR;
+    return true;
+  }
+  return false;
+}
+
+bool fd_copy(int in, int out)
+{
+  ssize_t n;
+
+  // Both offsets advance with every call, so each fallback picks up
+  // where the previous method stopped
+  while ((n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0)) > 0)
+  {
+    if (interrupted())
+    {
+      return false;
+    }
+  }
+  if (n == 0)
+  {
+    return true;
+  }
+  if (!unsupported(errno))
+  {
+    return false;
+  }
+
+  while ((n = sendfile(out, in, NULL, COPY_CHUNK)) > 0)
+  {
+    if (interrupted())
+    {
+      return false;
+    }
+  }
+  if (n == 0)
+  {
+    return true;
+  }
+  if (!unsupported(errno))
+  {
+    return false;
+  }
+
+  char buf[READ_BUFFER_SIZE];
+  while ((n = read(in, buf, sizeof(buf))) != 0)
+  {
+    if (interrupted())
+    {
+      return false;
+    }
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    for (ssize_t done = 0; done < n;)
+    {
+      ssize_t w = write(out, buf + done, n - done);
+      if (w < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        return false;
+      }
+      done += w;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,19 @@
+// Copying between file descriptors inside the kernel.
+
+#ifndef FDCOPY_H
+#define FDCOPY_H
+
+#include <stdbool.h>
+
+/*
+ * Copy everything from 'in' (from its current offset to the end) to 'out'
+ * without passing the data through user space where the kernel allows:
+ * copy_file_range() between files (which can share blocks on filesystems
+ * with reflinks), else sendfile(), else a plain read()/write() loop.
+ * A pending (blocked) SIGINT stops the copy.
+ * returns: false with errno set on a read or write error, or EINTR after
+ *          ctrl-c.
+ */
+bool fd_copy(int in, int out);
+
+#endif
@@ -0,0 +1,232 @@
+// Trigram index over the command history for fast searches.
+//
+// Every three byte sequence in a command maps to the (ascending) list of
+// command numbers containing it. A search looks up the pattern's trigrams,
+// walks the shortest list from its newest end, keeps the numbers that are
+// in every other list and confirms each against the real command text, so
+// only true candidates are ever read. Patterns shorter than a trigram fall
+// back to a newest-first scan.
+
+#include "histindex.h"
+
+#include "histlog.h"
+#include "history.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SLOTS 4096
+
+struct posting_list
+{
+  uint32_t key; // trigram + 1, 0 marks an empty slot
+  int *nums;    // command numbers, ascending
+  size_t start; // nums[0..start) belong to commands that are gone
+  size_t len;
+  size_t cap;
+};
+
+static struct posting_list *table;
+static size_t num_slots;
+static size_t num_lists;
+static int next_num; // first command number not indexed yet
+
+static uint32_t trigram(const char *s)
+{
+  return ((uint32_t)(unsigned char)s[0] << 16 | (uint32_t)(unsigned char)s[1] << 8 |
+          (unsigned char)s[2]) + 1;
+}
+
+static struct posting_list *find_list(struct posting_list *slots, size_t size, uint32_t key)
+{
+  size_t i = (key * 2654435761u) & (size - 1);
+  while (slots[i].key != 0 && slots[i].key != key)
+  {
+    i = (i + 1) & (size - 1);
+  }
+  return &slots[i];
+}
+
+static bool grow_table(void)
+{
+  size_t size = num_slots ? num_slots * 2 : INITIAL_SLOTS;
+  struct posting_list *slots = calloc(size, sizeof(*slots));
+  if (slots == NULL)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < num_slots; i++)
+  {
+    if (table[i].key != 0)
+    {
+      *find_list(slots, size, table[i].key) = table[i];
+    }
+  }
+  free(table);
+  table = slots;
+  num_slots = size;
+  return true;
+}
+
+static void add_posting(uint32_t key, int num)
+{
+  if ((num_lists + 1) * 2 > num_slots && !grow_table())
+  {
+    return;
+  }
+  struct posting_list *list = find_list(table, num_slots, key);
+  if (list->key == 0)
+  {
+    list->key = key;
+    num_lists++;
+  }
+  // a trigram repeated within one command is listed once
+  if (list->len > list->start && list->nums[list->len - 1] == num)
+  {
+    return;
+  }
+  if (list->len == list->cap)
+  {
+    size_t cap = list->cap ? list->cap * 2 : 4;
+    int *nums = realloc(list->nums, cap * sizeof(*nums));
+    if (nums == NULL)
+    {
+      return;
+    }
+    list->nums = nums;
+    list->cap = cap;
+  }
+  list->nums[list->len++] = num;
+}
+
+// Oldest command number that can still be looked up.
+static int lowest_available(void)
+{
+  return histlog_enabled() ? 0 : hist_oldest();
+}
+
+// Index every command added since the last search.
+static void catch_up(void)
+{
+  int count = hist_count();
+  if (next_num < lowest_available())
+  {
+    next_num = lowest_available();
+  }
+  for (; next_num < count; next_num++)
+  {
+    const char *cmd = histlog_find(next_num);
+    if (cmd == NULL)
+    {
+      continue;
+    }
+    for (size_t i = 0; cmd[i] != '\0' && cmd[i + 1] != '\0' && cmd[i + 2] != '\0'; i++)
+    {
+      add_posting(trigram(cmd + i), next_num);
+    }
+  }
+}
+
+// Drop entries for commands that have left the history from a list.
+static void trim_list(struct posting_list *list, int lowest)
+{
+  while (list->start < list->len && list->nums[list->start] < lowest)
+  {
+    list->start++;
+  }
+  if (list->start > list->len / 2)
+  {
+    memmove(list->nums, list->nums + list->start, (list->len - list->start) * sizeof(int));
+    list->len -= list->start;
+    list->start = 0;
+  }
+}
+
+static bool list_contains(const struct posting_list *list, int num)
+{
+  size_t lo = list->start, hi = list->len;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (list->nums[mid] < num)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo < list->len && list->nums[lo] == num;
+}
+
+static bool matches(const char *cmd, const char *pattern, size_t len, enum hist_match mode)
+{
+  if (mode == MATCH_PREFIX)
+  {
+    return strncmp(cmd, pattern, len) == 0;
+  }
+  return strstr(cmd, pattern) != NULL;
+}
+
+int histindex_search(const char *pattern, enum hist_match mode, int results[], int max)
+{
+  size_t len = strlen(pattern);
+  int lowest = lowest_available();
+  int found = 0;
+
+  if (len < 3)
+  {
+    for (int num = hist_count() - 1; num >= lowest && found < max; num--)
+    {
+      const char *cmd = histlog_find(num);
+      if (cmd != NULL && matches(cmd, pattern, len, mode))
+      {
+        results[found++] = num;
+      }
+    }
+    return found;
+  }
+
+  catch_up();
+
+  // every trigram of the pattern must occur; drive the walk from the rarest
+  size_t num_grams = len - 2;
+  struct posting_list *lists[num_grams];
+  struct posting_list *driver = NULL;
+  for (size_t i = 0; i < num_grams; i++)
+  {
+    lists[i] = num_slots ? find_list(table, num_slots, trigram(pattern + i)) : NULL;
+    if (lists[i] == NULL || lists[i]->key == 0)
+    {
+      return 0;
+    }
+    trim_list(lists[i], lowest);
+    if (driver == NULL || lists[i]->len - lists[i]->start < driver->len - driver->start)
+    {
+      driver = lists[i];
+    }
+  }
+
+  for (size_t i = driver->len; i > driver->start && found < max; i--)
+  {
+    int num = driver->nums[i - 1];
+    bool candidate = true;
+    for (size_t j = 0; j < num_grams && candidate; j++)
+    {
+      candidate = lists[j] == driver || list_contains(lists[j], num);
+    }
+    if (!candidate)
+    {
+      continue;
+    }
+    const char *cmd = histlog_find(num);
+    if (cmd != NULL && matches(cmd, pattern, len, mode))
+    {
+      results[found++] = num;
+    }
+  }
+  return found;
+}
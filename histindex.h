@@ -0,0 +1,21 @@
+// Trigram index over the command history for fast searches.
+
+#ifndef HISTINDEX_H
+#define HISTINDEX_H
+
+enum hist_match
+{
+  MATCH_SUBSTRING, // command contains the pattern ('!?pattern', history -s)
+  MATCH_PREFIX,    // command starts with the pattern ('!pattern')
+};
+
+/*
+ * Find commands matching 'pattern', newest first. Commands added since the
+ * last search are indexed first, so the index is maintained incrementally
+ * and costs nothing until history is searched.
+ * results: receives up to 'max' command numbers.
+ * returns: number of results stored.
+ */
+int histindex_search(const char *pattern, enum hist_match mode, int results[], int max);
+
+#endif
@@ -0,0 +1,221 @@
+// Persistent history shared by every session: an append-only log file.
+//
+// Each command is one "cmd\n" record appended with a single write() on an
+// O_APPEND descriptor, so records from concurrent sessions never interleave.
+// The file is mmap'd and indexed once at startup (one offset per record),
+// after which only the bytes appended since the last look are scanned.
+
+#include "histlog.h"
+
+#include "history.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// The mapping is sized in steps of this much, past the end of the file,
+// so appends rarely require a remap.
+#define MAP_STEP (1024 * 1024)
+
+static int log_fd = -1;
+static char *map;
+static size_t map_size;
+static size_t indexed; // bytes of the file indexed so far, ends after a '\n'
+
+static off_t *offsets; // start of every record, by record (command) number
+static size_t num_records;
+static size_t offsets_cap;
+
+static char *copy; // buffer returned by histlog_get()
+static size_t copy_cap;
+
+bool histlog_enabled(void)
+{
+  return log_fd >= 0;
+}
+
+static void close_log(void)
+{
+  if (map != NULL)
+  {
+    munmap(map, map_size);
+  }
+  if (log_fd >= 0)
+  {
+    close(log_fd);
+  }
+  map = NULL;
+  map_size = 0;
+  log_fd = -1;
+}
+
+// Make sure the first 'size' bytes of the file are mapped.
+static bool map_file(size_t size)
+{
+  if (map != NULL && size <= map_size)
+  {
+    return true;
+  }
+  size_t want = (size / MAP_STEP + 1) * MAP_STEP;
+  void *m = map != NULL ? mremap(map, map_size, want, MREMAP_MAYMOVE)
+                        : mmap(NULL, want, PROT_READ, MAP_SHARED, log_fd, 0);
+  if (m == MAP_FAILED)
+  {
+    return false;
+  }
+  map = m;
+  map_size = want;
+  return true;
+}
+
+static bool push_offset(off_t offset)
+{
+  if (num_records == offsets_cap)
+  {
+    size_t cap = offsets_cap ? offsets_cap * 2 : 1024;
+    off_t *grown = realloc(offsets, cap * sizeof(*grown));
+    if (grown == NULL)
+    {
+      return false;
+    }
+    offsets = grown;
+    offsets_cap = cap;
+  }
+  offsets[num_records++] = offset;
+  return true;
+}
+
+// Index the complete records between 'indexed' and 'size', adding them to
+// the in-memory history when 'load' is set. Empty records are skipped.
+static void index_records(size_t size, bool load)
+{
+  char *p = map + indexed;
+  char *end = map + size;
+  char *nl;
+  while ((nl = memchr(p, '\n', end - p)) != NULL)
+  {
+    if (nl > p)
+    {
+      if (!push_offset(p - map))
+      {
+        break;
+      }
+      if (load)
+      {
+        hist_add(p, nl - p);
+      }
+    }
+    p = nl + 1;
+  }
+  indexed = p - map;
+}
+
+bool histlog_open(const char *path)
+{
+  struct stat st;
+
+  log_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (log_fd < 0)
+  {
+    return false;
+  }
+  if (fstat(log_fd, &st) < 0 || !map_file(st.st_size))
+  {
+    close_log();
+    return false;
+  }
+
+  // A session that died mid-write can leave a record without its '\n';
+  // terminate it so our first record does not get glued onto it.
+  if (st.st_size > 0 && map[st.st_size - 1] != '\n')
+  {
+    write(log_fd, "\n", 1);
+  }
+
+  // Index everything, then load only the newest records that fit into
+  // the in-memory history.
+  index_records(st.st_size, false);
+  size_t load = hist_depth() < num_records ? hist_depth() : num_records;
+  hist_start_at(num_records - load);
+  for (size_t i = num_records - load; i < num_records; i++)
+  {
+    char *rec = map + offsets[i];
+    hist_add(rec, (char *)memchr(rec, '\n', map + indexed - rec) - rec);
+  }
+  histlog_sync();
+  return true;
+}
+
+void histlog_sync(void)
+{
+  struct stat st;
+  if (log_fd < 0 || fstat(log_fd, &st) < 0 || (size_t)st.st_size <= indexed)
+  {
+    return;
+  }
+  if (!map_file(st.st_size))
+  {
+    close_log();
+    return;
+  }
+  index_records(st.st_size, true);
+}
+
+bool histlog_append(const char *cmd, size_t len)
+{
+  char stack_buf[1024];
+  char *record = len + 1 <= sizeof(stack_buf) ? stack_buf : malloc(len + 1);
+  if (record == NULL)
+  {
+    return false;
+  }
+  memcpy(record, cmd, len);
+  record[len] = '\n';
+
+  ssize_t written = write(log_fd, record, len + 1);
+  if (record != stack_buf)
+  {
+    free(record);
+  }
+  if (written != (ssize_t)(len + 1))
+  {
+    close_log();
+    return false;
+  }
+  histlog_sync();
+  return true;
+}
+
+const char *histlog_get(int num)
+{
+  if (log_fd < 0 || num < 0 || (size_t)num >= num_records)
+  {
+    return NULL;
+  }
+  char *rec = map + offsets[num];
+  size_t len = (char *)memchr(rec, '\n', map + indexed - rec) - rec;
+  if (len + 1 > copy_cap)
+  {
+    char *grown = realloc(copy, len + 1);
+    if (grown == NULL)
+    {
+      return NULL;
+    }
+    copy = grown;
+    copy_cap = len + 1;
+  }
+  memcpy(copy, rec, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+const char *histlog_find(int num)
+{
+  const char *cmd = hist_get(num);
+  return cmd != NULL ? cmd : histlog_get(num);
+}
@@ -0,0 +1,41 @@
+// Persistent history shared by every session: an append-only log file.
+
+#ifndef HISTLOG_H
+#define HISTLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Open (creating it if needed) the history log at 'path', index every
+ * record in it and load the newest ones into the in-memory history, whose
+ * command numbers from then on match record numbers in the log.
+ * returns: false if the log cannot be used; history stays in memory only.
+ */
+bool histlog_open(const char *path);
+
+// true once histlog_open() succeeded
+bool histlog_enabled(void);
+
+/*
+ * Append a command to the log with a single O_APPEND write, then pull in
+ * every record written since the last sync, ours included, so numbering
+ * follows the order of the file.
+ * returns: false if the write failed and the log has been closed.
+ */
+bool histlog_append(const char *cmd, size_t len);
+
+// Pull in records other sessions have appended since the last sync.
+void histlog_sync(void);
+
+/*
+ * Look up a record by number, for commands that are older than what the
+ * in-memory history holds.
+ * returns: NUL terminated copy (valid until the next call) or NULL.
+ */
+const char *histlog_get(int num);
+
+// Look up a command by number: in memory first, then in the log.
+const char *histlog_find(int num);
+
+#endif
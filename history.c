@@ -0,0 +1,371 @@
+// In-memory command history.
+//
+// Commands are kept in a ring of slots indexed by command number, so adding
+// one never moves the others and '!n' is a single array lookup. The text of
+// each command lives in large shared chunks sized to fit it rather than in
+// a fixed 1 KB slot; a chunk is released once every command in it has been
+// evicted, so memory tracks what is actually stored even for a very large
+// HISTSIZE.
+
+#include "history.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE (16 * 1024)
+#define MIN_SLOTS 16
+
+struct hist_chunk
+{
+  size_t size; // bytes of data[]
+  size_t used; // bytes of data[] handed out
+  size_t live; // commands stored here that are still in the history
+  char data[];
+};
+
+struct hist_slot
+{
+  char *text;
+  size_t len;
+  struct hist_chunk *chunk;
+  bool has_stats;
+  struct hist_stats stats;
+};
+
+static struct hist_slot *slots; // command num lives in slots[num % num_slots]
+static size_t num_slots;
+static size_t depth = DEFAULT_HISTORY_DEPTH;
+static int count; // commands ever added
+static int first; // oldest command still held
+
+static struct hist_chunk *current; // chunk new commands are appended to
+static struct hist_chunk *spare;   // one emptied chunk kept for reuse
+
+static size_t retained(void)
+{
+  return count - first;
+}
+
+static void release_chunk(struct hist_chunk *chunk)
+{
+  if (--chunk->live > 0 || chunk == current)
+  {
+    return;
+  }
+  if (spare == NULL && chunk->size == CHUNK_SIZE)
+  {
+    spare = chunk;
+  }
+  else
+  {
+    free(chunk);
+  }
+}
+
+static void evict_oldest(void)
+{
+  struct hist_slot *slot = &slots[first % num_slots];
+  release_chunk(slot->chunk);
+  slot->chunk = NULL;
+  first++;
+}
+
+// Move the held commands into a ring of 'size' slots (size >= retained()).
+static bool resize_slots(size_t size)
+{
+  struct hist_slot *table = calloc(size ? size : 1, sizeof(*table));
+  if (table == NULL)
+  {
+    return false;
+  }
+  for (int num = first; num < count; num++)
+  {
+    table[num % size] = slots[num % num_slots];
+  }
+  free(slots);
+  slots = table;
+  num_slots = size;
+  return true;
+}
+
+// Copy 'len' bytes plus a NUL into the current chunk, starting a new one
+// when it is full.
+static char *store_text(const char *cmd, size_t len)
+{
+  if (current == NULL || current->size - current->used < len + 1)
+  {
+    struct hist_chunk *chunk;
+    if (len + 1 <= CHUNK_SIZE && spare != NULL)
+    {
+      chunk = spare;
+      spare = NULL;
+    }
+    else
+    {
+      size_t size = len + 1 > CHUNK_SIZE ? len + 1 : CHUNK_SIZE;
+      chunk = malloc(sizeof(*chunk) + size);
+      if (chunk == NULL)
+      {
+        return NULL;
+      }
+      chunk->size = size;
+    }
+    chunk->used = 0;
+    chunk->live = 0;
+
+    // the old chunk is now only kept alive by the commands stored in it
+    struct hist_chunk *old = current;
+    current = chunk;
+    if (old != NULL && old->live == 0)
+    {
+      old->live = 1;
+      release_chunk(old);
+    }
+  }
+
+  char *text = current->data + current->used;
+  memcpy(text, cmd, len);
+  text[len] = '\0';
+  current->used += len + 1;
+  current->live++;
+  return text;
+}
+
+int hist_add(const char *cmd, size_t len)
+{
+  int num = count;
+  if (depth == 0)
+  {
+    first = ++count;
+    return num;
+  }
+
+  if (retained() == num_slots)
+  {
+    if (num_slots < depth)
+    {
+      size_t size = num_slots * 2 > MIN_SLOTS ? num_slots * 2 : MIN_SLOTS;
+      if (size > depth)
+      {
+        size = depth;
+      }
+      if (!resize_slots(size))
+      {
+        evict_oldest();
+      }
+    }
+    else
+    {
+      evict_oldest();
+    }
+  }
+
+  char *text = store_text(cmd, len);
+  if (text == NULL)
+  {
+    // out of memory: still hand out the number so numbering stays stable
+    first = ++count;
+    return num;
+  }
+  struct hist_slot *slot = &slots[num % num_slots];
+  slot->text = text;
+  slot->len = len;
+  slot->chunk = current;
+  slot->has_stats = false;
+  count++;
+  return num;
+}
+
+const char *hist_get(int num)
+{
+  if (num < first || num >= count)
+  {
+    return NULL;
+  }
+  return slots[num % num_slots].text;
+}
+
+int hist_count(void)
+{
+  return count;
+}
+
+int hist_oldest(void)
+{
+  return first;
+}
+
+void hist_set_depth(size_t new_depth)
+{
+  while (retained() > new_depth)
+  {
+    evict_oldest();
+  }
+  depth = new_depth;
+  if (num_slots > depth)
+  {
+    resize_slots(depth);
+  }
+}
+
+size_t hist_depth(void)
+{
+  return depth;
+}
+
+void hist_start_at(int num)
+{
+  while (retained() > 0)
+  {
+    evict_oldest();
+  }
+  count = first = num;
+}
+
+void hist_print(int fd, int max)
+{
+  int oldest = count - max > first ? count - max : first;
+  size_t size = 0;
+  for (int num = count - 1; num >= oldest; num--)
+  {
+    size += slots[num % num_slots].len + 16;
+  }
+  if (size == 0)
+  {
+    return;
+  }
+
+  char *out = malloc(size);
+  if (out == NULL)
+  {
+    return;
+  }
+  size_t len = 0;
+  for (int num = count - 1; num >= oldest; num--)
+  {
+    struct hist_slot *slot = &slots[num % num_slots];
+    len += sprintf(out + len, "%d\t", num);
+    memcpy(out + len, slot->text, slot->len);
+    len += slot->len;
+    out[len++] = '\n';
+  }
+  write(fd, out, len);
+  free(out);
+}
+
+void hist_annotate(int num, const struct hist_stats *stats)
+{
+  if (hist_get(num) != NULL)
+  {
+    slots[num % num_slots].stats = *stats;
+    slots[num % num_slots].has_stats = true;
+  }
+}
+
+const struct hist_stats *hist_get_stats(int num)
+{
+  if (hist_get(num) == NULL || !slots[num % num_slots].has_stats)
+  {
+    return NULL;
+  }
+  return &slots[num % num_slots].stats;
+}
+
+// Longest line of hist_print_verbose() besides the command
+#define VERBOSE_LINE_MAX 96
+
+// Append the verbose line of command 'num' at out. returns: its length.
+static size_t format_verbose(char *out, int num)
+{
+  struct hist_slot *slot = &slots[num % num_slots];
+  size_t len;
+  if (slot->has_stats)
+  {
+    struct tm tm;
+    char when[32];
+    localtime_r(&slot->stats.start, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    len = sprintf(out, "%d\t%s %10.3fs %3d ", num, when, slot->stats.seconds,
+                  slot->stats.status);
+    // builtins run in the shell: there is no RSS of their own to show
+    len += slot->stats.max_rss_kb >= 0 ? sprintf(out + len, "%8ld KB\t", slot->stats.max_rss_kb)
+                                       : sprintf(out + len, "%11s\t", "-");
+  }
+  else
+  {
+    len = sprintf(out, "%d\t%-19s %11s %3s %11s\t", num, "-", "-", "-", "-");
+  }
+  memcpy(out + len, slot->text, slot->len);
+  len += slot->len;
+  out[len++] = '\n';
+  return len;
+}
+
+// Write the verbose lines of the commands in nums[0, n) in one write().
+static void print_verbose(int fd, const int *nums, size_t n)
+{
+  size_t size = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    size += slots[nums[i] % num_slots].len + VERBOSE_LINE_MAX;
+  }
+  char *out = size > 0 ? malloc(size) : NULL;
+  if (out == NULL)
+  {
+    return;
+  }
+  size_t len = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    len += format_verbose(out + len, nums[i]);
+  }
+  write(fd, out, len);
+  free(out);
+}
+
+void hist_print_verbose(int fd, int max)
+{
+  int oldest = count - max > first ? count - max : first;
+  int *nums = malloc((count - oldest + 1) * sizeof(int));
+  if (nums == NULL)
+  {
+    return;
+  }
+  size_t n = 0;
+  for (int num = count - 1; num >= oldest; num--)
+  {
+    nums[n++] = num;
+  }
+  print_verbose(fd, nums, n);
+  free(nums);
+}
+
+static int by_seconds_desc(const void *a, const void *b)
+{
+  double x = slots[*(const int *)a % num_slots].stats.seconds;
+  double y = slots[*(const int *)b % num_slots].stats.seconds;
+  return (x < y) - (x > y);
+}
+
+void hist_print_slowest(int fd, int max)
+{
+  int *nums = malloc((retained() + 1) * sizeof(int));
+  if (nums == NULL)
+  {
+    return;
+  }
+  size_t n = 0;
+  for (int num = first; num < count; num++)
+  {
+    if (slots[num % num_slots].has_stats)
+    {
+      nums[n++] = num;
+    }
+  }
+  qsort(nums, n, sizeof(int), by_seconds_desc);
+  print_verbose(fd, nums, n < (size_t)max ? n : (size_t)max);
+  free(nums);
+}
@@ -0,0 +1,69 @@
+// In-memory command history.
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#define DEFAULT_HISTORY_DEPTH 10
+
+/*
+ * Append a command to the history, evicting the oldest one once 'depth'
+ * commands are held.
+ * returns: the command number given to it (numbers start at 0).
+ */
+int hist_add(const char *cmd, size_t len);
+
+/*
+ * Look up a command by number in O(1).
+ * returns: the NUL terminated command, or NULL if 'num' was never entered
+ *          or has already been evicted.
+ */
+const char *hist_get(int num);
+
+// Number of commands ever added, i.e. the number the next one will get.
+int hist_count(void);
+
+// Number of the oldest command still held.
+int hist_oldest(void);
+
+// Change how many commands are kept (HISTSIZE); keeps the newest ones.
+void hist_set_depth(size_t depth);
+size_t hist_depth(void);
+
+// Forget every command and give the next one number 'num' (used when the
+// numbering continues from a history file).
+void hist_start_at(int num);
+
+// Write the 'count' most recent commands, newest first, as "num<TAB>cmd"
+// lines to fd using a single write().
+void hist_print(int fd, int count);
+
+// What running a command cost, kept with its entry
+struct hist_stats
+{
+  time_t start;    // when it started
+  double seconds;  // wall time
+  int status;      // exit code, as $? showed it afterwards
+  long max_rss_kb; // largest maximum RSS of its processes, -1 if it started none
+};
+
+// Attach 'stats' to command 'num' if it is still held.
+void hist_annotate(int num, const struct hist_stats *stats);
+
+// returns: the stats of command 'num', or NULL if it has none.
+const struct hist_stats *hist_get_stats(int num);
+
+/*
+ * Like hist_print(), with each command's start time, wall time, exit code
+ * and max RSS before it ("-" for commands run without them).
+ */
+void hist_print_verbose(int fd, int count);
+
+// Write the 'count' held commands that took longest, slowest first, in
+// the format of hist_print_verbose().
+void hist_print_slowest(int fd, int count);
+
+#endif
@@ -0,0 +1,192 @@
+// Buffered line reader for commands coming from a terminal, pipe, file or
+// string.
+//
+// A single read() may return many lines when stdin is a pipe or file, so
+// input is buffered and split on '\n' here instead of assuming one read()
+// per command.
+
+#include "input.h"
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define READ_CHUNK (64 * 1024)
+
+void reader_init_fd(struct line_reader *reader, int fd)
+{
+  struct stat st;
+  memset(reader, 0, sizeof(*reader));
+  reader->fd = fd;
+
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+  {
+    return;
+  }
+  // Not for stdin: commands we run share its file offset and expect it to
+  // point just past the lines we have consumed (see reader_sync())
+  if (fd == STDIN_FILENO)
+  {
+    reader->offset = lseek(fd, 0, SEEK_CUR);
+    reader->shared = reader->offset >= 0;
+    return;
+  }
+  if (st.st_size > 0)
+  {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      reader->buf = map;
+      reader->len = st.st_size;
+      reader->mapped = true;
+      reader->fd = -1;
+    }
+  }
+}
+
+void reader_init_string(struct line_reader *reader, const char *str)
+{
+  memset(reader, 0, sizeof(*reader));
+  reader->fd = -1;
+  reader->buf = (char *)str;
+  reader->len = strlen(str);
+}
+
+void reader_free(struct line_reader *reader)
+{
+  if (reader->mapped)
+  {
+    munmap(reader->buf, reader->len);
+  }
+  else if (reader->cap > 0)
+  {
+    free(reader->buf);
+  }
+  reader->buf = NULL;
+  reader->len = reader->pos = reader->cap = 0;
+  reader->mapped = false;
+}
+
+// Read more input into the heap buffer, moving the unread tail to the front
+// first. returns: bytes read, 0 at end of input, -1 on error.
+static ssize_t fill(struct line_reader *reader)
+{
+  if (reader->pos > 0)
+  {
+    memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos);
+    reader->len -= reader->pos;
+    reader->pos = 0;
+  }
+  if (reader->cap - reader->len < READ_CHUNK)
+  {
+    size_t cap = reader->cap ? reader->cap * 2 : READ_CHUNK * 2;
+    char *buf = realloc(reader->buf, cap);
+    if (buf == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+    reader->buf = buf;
+    reader->cap = cap;
+  }
+
+  METRIC_START(start);
+  ssize_t n;
+  if (reader->shared)
+  {
+    n = pread(reader->fd, reader->buf + reader->len, reader->cap - reader->len, reader->offset);
+  }
+  else
+  {
+    n = read(reader->fd, reader->buf + reader->len, reader->cap - reader->len);
+  }
+  METRIC_STOP(READ, start);
+  if (n > 0)
+  {
+    reader->len += n;
+    reader->offset += n;
+  }
+  return n;
+}
+
+void reader_sync(struct line_reader *reader)
+{
+  if (reader->shared && reader->fd >= 0)
+  {
+    lseek(reader->fd, reader->offset - (off_t)(reader->len - reader->pos), SEEK_SET);
+    reader->synced = true;
+  }
+}
+
+// After reader_sync(): if a command has read from the shared offset, drop
+// the lines read ahead and go on from where it left off
+static void resume(struct line_reader *reader)
+{
+  off_t now = lseek(reader->fd, 0, SEEK_CUR);
+  reader->synced = false;
+  if (now >= 0 && now != reader->offset - (off_t)(reader->len - reader->pos))
+  {
+    reader->len = reader->pos = 0;
+    reader->offset = now;
+  }
+}
+
+const char *reader_next_line(struct line_reader *reader, size_t *len)
+{
+  if (reader->synced)
+  {
+    resume(reader);
+  }
+  size_t scanned = reader->pos;
+  while (true)
+  {
+    char *start = reader->buf + reader->pos;
+    char *nl = memchr(reader->buf + scanned, '\n', reader->len - scanned);
+    if (nl != NULL)
+    {
+      *len = nl - start;
+      reader->pos = nl + 1 - reader->buf;
+      return start;
+    }
+    scanned = reader->len;
+
+    ssize_t n = reader->fd >= 0 ? fill(reader) : 0;
+    if (n < 0)
+    {
+      return NULL;
+    }
+    if (n == 0)
+    {
+      // end of input: hand out a last line that has no '\n'
+      if (reader->shared && reader->fd >= 0)
+      {
+        lseek(reader->fd, reader->offset, SEEK_SET);
+      }
+      reader->fd = -1;
+      if (reader->pos == reader->len)
+      {
+        errno = 0;
+        return NULL;
+      }
+      start = reader->buf + reader->pos;
+      *len = reader->len - reader->pos;
+      reader->pos = reader->len;
+      return start;
+    }
+    // fill() may have moved the unread bytes to the front of the buffer;
+    // everything before the new data has been searched already
+    scanned = reader->len - n;
+  }
+}
+
+bool reader_has_line(const struct line_reader *reader)
+{
+  return reader->fd < 0 || (reader->pos < reader->len &&
+         memchr(reader->buf + reader->pos, '\n', reader->len - reader->pos) != NULL);
+}
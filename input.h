@@ -0,0 +1,60 @@
+// Buffered line reader for commands coming from a terminal, pipe, file or
+// string.
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct line_reader
+{
+  int fd;      // descriptor to read more from, -1 once everything is in buf
+  char *buf;   // pending input: heap buffer, mmap'd file or caller's string
+  size_t len;  // bytes of valid input in buf
+  size_t pos;  // start of the next line in buf
+  size_t cap;  // size of the heap buffer (0 when buf is not ours to grow)
+  bool mapped; // buf is an mmap of the whole input file
+  bool shared; // fd is a regular file on stdin, its offset shared with commands
+  bool synced; // reader_sync() left the shared offset past the consumed lines
+  off_t offset; // shared: file offset of buf[len] (read with pread())
+};
+
+/*
+ * Read lines from fd. Regular files other than stdin are mmap'd whole so
+ * lines are handed out without copying; anything else (terminal, pipe) is
+ * read in large chunks that may hold many lines. A regular file on stdin
+ * is read at its own offset, so reader_sync() can hand the rest of it to
+ * the commands that share it.
+ */
+void reader_init_fd(struct line_reader *reader, int fd);
+
+// Read lines out of a NUL terminated string (e.g. the argument of -c).
+void reader_init_string(struct line_reader *reader, const char *str);
+
+/*
+ * Return the next line without its '\n'. The line is not NUL terminated
+ * and stays valid until the next call.
+ * returns: pointer into the reader's buffer with *len set, or NULL at the
+ *          end of the input, or NULL with errno == EINTR if a signal
+ *          interrupted the wait for input.
+ */
+const char *reader_next_line(struct line_reader *reader, size_t *len);
+
+// Release the reader's buffer (or mapping); the fd is left open.
+void reader_free(struct line_reader *reader);
+
+/*
+ * Before running a command: move the file offset of a regular file on
+ * stdin to just past the lines consumed, as sh does, so a command reading
+ * stdin starts there. If the command moves it, what was read ahead is
+ * dropped and reading goes on from where the command left it. Pipes and
+ * terminals cannot be given back what was read ahead of the command.
+ */
+void reader_sync(struct line_reader *reader);
+
+// true if reader_next_line() can return without reading from the fd
+bool reader_has_line(const struct line_reader *reader);
+
+#endif
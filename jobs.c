@@ -0,0 +1,593 @@
+// Job table: every command line the shell starts is a job of one or more
+// processes (the stages of a pipeline).
+//
+// Jobs live in an array indexed by job number. Process state changes come
+// from the event loop's callbacks, so the table is always up to date
+// without polling; jobs that changed state in the background are queued
+// and reported (and forgotten once done) at the next prompt.
+
+#include "jobs.h"
+
+#include "events.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+enum proc_state
+{
+  PROC_RUNNING,
+  PROC_STOPPED,
+  PROC_EXITED,
+};
+
+struct job_proc
+{
+  pid_t pid;
+  enum proc_state state;
+};
+
+struct job
+{
+  int id;
+  pid_t pgid;            // 0 when the processes are in the shell's group
+  char *cmd;
+  enum job_state state;
+  int status;            // see job_status()
+  struct rusage usage;   // summed over exited processes
+  unsigned long seq;     // when it last went to the background or stopped
+  bool foreground;       // being waited for by job_foreground()
+  bool queued;           // on the report queue
+  bool removed;          // no longer in the table, only on the queue
+  struct job *next_queued;
+  struct termios tmodes; // terminal modes it stopped with
+  bool has_tmodes;
+  int num_procs;
+  int num_running;
+  int num_stopped;
+  struct job_proc procs[];
+};
+
+static int tty = -1;
+static struct termios shell_tmodes;
+
+static struct job **table; // table[id - 1]
+static int table_cap;
+static int highest_id;
+static int num_running_jobs;
+static int num_stopped_jobs;
+static unsigned long next_seq = 1;
+
+static struct job *queue_head, *queue_tail;
+
+void jobs_init(int tty_fd)
+{
+  tty = tty_fd;
+  if (tty >= 0 && tcgetattr(tty, &shell_tmodes) < 0)
+  {
+    tty = -1;
+  }
+}
+
+bool jobs_control_enabled(void)
+{
+  return tty >= 0;
+}
+
+int job_id(const struct job *job)
+{
+  return job->id;
+}
+
+const char *job_command(const struct job *job)
+{
+  return job->cmd;
+}
+
+enum job_state job_state(const struct job *job)
+{
+  return job->state;
+}
+
+int job_status(const struct job *job)
+{
+  return job->status;
+}
+
+const struct rusage *job_usage(const struct job *job)
+{
+  return &job->usage;
+}
+
+int jobs_num_stopped(void)
+{
+  return num_stopped_jobs;
+}
+
+static void queue(struct job *job)
+{
+  if (job->queued)
+  {
+    return;
+  }
+  job->queued = true;
+  job->next_queued = NULL;
+  if (queue_tail != NULL)
+  {
+    queue_tail->next_queued = job;
+  }
+  else
+  {
+    queue_head = job;
+  }
+  queue_tail = job;
+}
+
+// Take a job out of the table; it is freed now or once it leaves the queue.
+static void remove_job(struct job *job)
+{
+  table[job->id - 1] = NULL;
+  while (highest_id > 0 && table[highest_id - 1] == NULL)
+  {
+    highest_id--;
+  }
+  if (job->queued)
+  {
+    job->removed = true;
+    return;
+  }
+  free(job->cmd);
+  free(job);
+}
+
+// Send 'sig' to the job's process group, or to each of its live processes
+// when it has none of its own.
+static int signal_job(struct job *job, int sig)
+{
+  if (job->pgid > 0)
+  {
+    return kill(-job->pgid, sig);
+  }
+  int result = -1;
+  for (int i = 0; i < job->num_procs; i++)
+  {
+    if (job->procs[i].state != PROC_EXITED && kill(job->procs[i].pid, sig) == 0)
+    {
+      result = 0;
+    }
+  }
+  return result;
+}
+
+// Move the job to 'state', keeping the counters and the report queue in step.
+static void set_state(struct job *job, enum job_state state)
+{
+  if (state == job->state)
+  {
+    return;
+  }
+  num_running_jobs -= job->state == JOB_RUNNING;
+  num_stopped_jobs -= job->state == JOB_STOPPED;
+  num_running_jobs += state == JOB_RUNNING;
+  num_stopped_jobs += state == JOB_STOPPED;
+  if (state == JOB_STOPPED)
+  {
+    job->seq = next_seq++;
+  }
+  job->state = state;
+  if (!job->foreground && state != JOB_RUNNING)
+  {
+    queue(job);
+  }
+}
+
+// Event loop callback: one of the job's processes exited, stopped or continued.
+static void proc_changed(const struct child_exit *child, void *ctx)
+{
+  struct job *job = ctx;
+  struct job_proc *proc = NULL;
+  for (int i = 0; i < job->num_procs; i++)
+  {
+    if (job->procs[i].pid == child->pid)
+    {
+      proc = &job->procs[i];
+    }
+  }
+  if (proc == NULL || proc->state == PROC_EXITED)
+  {
+    return;
+  }
+
+  if (proc->state == PROC_RUNNING)
+  {
+    job->num_running--;
+  }
+  else
+  {
+    job->num_stopped--;
+  }
+  if (WIFSTOPPED(child->status))
+  {
+    proc->state = PROC_STOPPED;
+    job->num_stopped++;
+    job->status = child->status;
+  }
+  else if (WIFCONTINUED(child->status))
+  {
+    proc->state = PROC_RUNNING;
+    job->num_running++;
+  }
+  else
+  {
+    proc->state = PROC_EXITED;
+    rusage_add(&job->usage, &child->usage);
+    // like other shells, a pipeline's status is that of its last stage
+    if (proc == &job->procs[job->num_procs - 1])
+    {
+      job->status = child->status;
+    }
+  }
+
+  set_state(job, job->num_running > 0   ? JOB_RUNNING
+                 : job->num_stopped > 0 ? JOB_STOPPED
+                                        : JOB_DONE);
+}
+
+// Send SIGCONT to a stopped job and count it as running straight away;
+// the CLD_CONTINUED notifications that follow change nothing.
+static void continue_job(struct job *job)
+{
+  signal_job(job, SIGCONT);
+  for (int i = 0; i < job->num_procs; i++)
+  {
+    if (job->procs[i].state == PROC_STOPPED)
+    {
+      job->procs[i].state = PROC_RUNNING;
+      job->num_stopped--;
+      job->num_running++;
+    }
+  }
+  set_state(job, JOB_RUNNING);
+}
+
+struct job *jobs_add(pid_t pgid, const pid_t pids[], int num_pids, const char *cmd,
+                     bool in_background)
+{
+  if (highest_id == table_cap)
+  {
+    int cap = table_cap ? table_cap * 2 : 16;
+    struct job **grown = realloc(table, cap * sizeof(*grown));
+    if (grown == NULL)
+    {
+      return NULL;
+    }
+    table = grown;
+    table_cap = cap;
+  }
+  struct job *job = calloc(1, sizeof(*job) + num_pids * sizeof(job->procs[0]));
+  if (job == NULL || (job->cmd = strdup(cmd)) == NULL)
+  {
+    free(job);
+    return NULL;
+  }
+
+  // like bash, a new job is numbered one past the highest in use
+  job->id = ++highest_id;
+  table[job->id - 1] = job;
+  job->pgid = pgid;
+  job->state = JOB_RUNNING;
+  num_running_jobs++;
+  job->seq = in_background ? next_seq++ : 0;
+  job->num_procs = num_pids;
+  job->num_running = num_pids;
+  for (int i = 0; i < num_pids; i++)
+  {
+    job->procs[i].pid = pids[i];
+    job->procs[i].state = PROC_RUNNING;
+    events_watch(pids[i], proc_changed, job);
+  }
+  return job;
+}
+
+// The current (%+) and previous (%-) job: the two that most recently went
+// to the background or stopped, preferring stopped jobs like bash does.
+static void find_current(struct job **current, struct job **previous)
+{
+  *current = *previous = NULL;
+  for (int i = 0; i < highest_id; i++)
+  {
+    struct job *job = table[i];
+    if (job == NULL || job->foreground)
+    {
+      continue;
+    }
+    struct job *best = *current;
+    if (best == NULL || (job->state == JOB_STOPPED) > (best->state == JOB_STOPPED) ||
+        ((job->state == JOB_STOPPED) == (best->state == JOB_STOPPED) && job->seq > best->seq))
+    {
+      *previous = *current;
+      *current = job;
+    }
+    else if (*previous == NULL || (job->state == JOB_STOPPED) > ((*previous)->state == JOB_STOPPED) ||
+             ((job->state == JOB_STOPPED) == ((*previous)->state == JOB_STOPPED) &&
+              job->seq > (*previous)->seq))
+    {
+      *previous = job;
+    }
+  }
+}
+
+struct job *jobs_find(const char *spec)
+{
+  struct job *current, *previous;
+  if (spec == NULL || spec[0] == '\0' || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0)
+  {
+    find_current(&current, &previous);
+    return current;
+  }
+  if (strcmp(spec, "%-") == 0)
+  {
+    find_current(&current, &previous);
+    return previous;
+  }
+  if (spec[0] != '%')
+  {
+    return NULL;
+  }
+  spec++;
+  if (spec[0] != '\0' && strspn(spec, "0123456789") == strlen(spec))
+  {
+    long id = strtol(spec, NULL, 10);
+    return id >= 1 && id <= highest_id ? table[id - 1] : NULL;
+  }
+  // %string: the newest job whose command starts with string
+  for (int i = highest_id - 1; i >= 0; i--)
+  {
+    if (table[i] != NULL && strncmp(table[i]->cmd, spec, strlen(spec)) == 0)
+    {
+      return table[i];
+    }
+  }
+  return NULL;
+}
+
+struct job *jobs_find_pid(pid_t pid)
+{
+  for (int i = 0; i < highest_id; i++)
+  {
+    for (int p = 0; table[i] != NULL && p < table[i]->num_procs; p++)
+    {
+      if (table[i]->procs[p].pid == pid)
+      {
+        return table[i];
+      }
+    }
+  }
+  return NULL;
+}
+
+static void format_state(const struct job *job, char *buf, size_t size)
+{
+  if (job->state == JOB_RUNNING)
+  {
+    snprintf(buf, size, "Running");
+  }
+  else if (job->state == JOB_STOPPED)
+  {
+    snprintf(buf, size, "Stopped");
+  }
+  else if (WIFSIGNALED(job->status))
+  {
+    snprintf(buf, size, "%s%s", strsignal(WTERMSIG(job->status)),
+             WCOREDUMP(job->status) ? " (core dumped)" : "");
+  }
+  else if (WEXITSTATUS(job->status) != 0)
+  {
+    snprintf(buf, size, "Exit %d", WEXITSTATUS(job->status));
+  }
+  else
+  {
+    snprintf(buf, size, "Done");
+  }
+}
+
+static void print_line(int fd, const struct job *job, char mark, bool long_format)
+{
+  char state[64];
+  char line[1024];
+  format_state(job, state, sizeof(state));
+  int len = snprintf(line, sizeof(line), "[%d]%c  ", job->id, mark);
+  if (long_format)
+  {
+    len += snprintf(line + len, sizeof(line) - len, "%d ", (int)job->procs[0].pid);
+  }
+  len += snprintf(line + len, sizeof(line) - len, "%-24s%s%s\n", state, job->cmd,
+                  job->state == JOB_RUNNING ? " &" : "");
+  if (len > (int)sizeof(line) - 1)
+  {
+    len = sizeof(line) - 1;
+    line[len - 1] = '\n';
+  }
+  write(fd, line, len);
+}
+
+static char mark_of(const struct job *job, const struct job *current, const struct job *previous)
+{
+  return job == current ? '+' : job == previous ? '-' : ' ';
+}
+
+void job_print(int fd, const struct job *job, bool launched)
+{
+  if (launched)
+  {
+    char line[64];
+    int len = snprintf(line, sizeof(line), "[%d] %d\n", job->id,
+                       (int)job->procs[job->num_procs - 1].pid);
+    write(fd, line, len);
+    return;
+  }
+  struct job *current, *previous;
+  find_current(&current, &previous);
+  print_line(fd, job, mark_of(job, current, previous), false);
+}
+
+void jobs_print(int fd, bool long_format)
+{
+  struct job *current, *previous;
+  find_current(&current, &previous);
+  for (int i = 0; i < highest_id; i++)
+  {
+    if (table[i] != NULL && !table[i]->foreground)
+    {
+      print_line(fd, table[i], mark_of(table[i], current, previous), long_format);
+    }
+  }
+}
+
+void jobs_report(int fd)
+{
+  if (queue_head == NULL)
+  {
+    return;
+  }
+  struct job *current, *previous;
+  find_current(&current, &previous);
+  while (queue_head != NULL)
+  {
+    struct job *job = queue_head;
+    queue_head = job->next_queued;
+    job->queued = false;
+    // a job that was continued since it stopped has nothing to report
+    if (fd >= 0 && !job->removed && job->state != JOB_RUNNING)
+    {
+      print_line(fd, job, mark_of(job, current, previous), false);
+    }
+    if (job->removed)
+    {
+      free(job->cmd);
+      free(job);
+    }
+    else if (job->state == JOB_DONE)
+    {
+      remove_job(job);
+    }
+  }
+  queue_tail = NULL;
+}
+
+int job_foreground(struct job *job, struct rusage *usage)
+{
+  job->foreground = true;
+  if (tty >= 0 && job->pgid > 0)
+  {
+    tcsetpgrp(tty, job->pgid);
+    if (job->has_tmodes)
+    {
+      tcsetattr(tty, TCSADRAIN, &job->tmodes);
+    }
+  }
+  if (job->state == JOB_STOPPED)
+  {
+    continue_job(job);
+  }
+
+  // Wait for the processes one by one until all are gone or one stops;
+  // the event loop callback keeps the job's counters up to date.
+  struct child_exit child;
+  for (int i = 0; i < job->num_procs && job->state != JOB_DONE; i++)
+  {
+    while (job->procs[i].state != PROC_EXITED)
+    {
+      if (!events_wait_pid(job->procs[i].pid, WUNTRACED, &child))
+      {
+        // already reaped elsewhere
+        struct child_exit gone = {job->procs[i].pid, 0, {{0}}};
+        proc_changed(&gone, job);
+        break;
+      }
+      if (WIFSTOPPED(child.status))
+      {
+        break;
+      }
+    }
+    if (job->state == JOB_STOPPED)
+    {
+      break;
+    }
+  }
+
+  if (tty >= 0 && job->pgid > 0)
+  {
+    tcsetpgrp(tty, getpgrp());
+    if (job->state == JOB_STOPPED)
+    {
+      job->has_tmodes = tcgetattr(tty, &job->tmodes) == 0;
+    }
+    tcsetattr(tty, TCSADRAIN, &shell_tmodes);
+  }
+  job->foreground = false;
+
+  int status = job->status;
+  if (usage != NULL)
+  {
+    *usage = job->usage;
+  }
+  if (job->state == JOB_STOPPED)
+  {
+    write(STDOUT_FILENO, "\n", strlen("\n"));
+    job_print(STDOUT_FILENO, job, false);
+  }
+  else if (job->state == JOB_DONE)
+  {
+    remove_job(job);
+  }
+  return status;
+}
+
+void job_background(struct job *job)
+{
+  if (job->state == JOB_STOPPED)
+  {
+    continue_job(job);
+    job->seq = next_seq++;
+  }
+}
+
+bool jobs_wait(struct job *job)
+{
+  while (job != NULL ? job->state == JOB_RUNNING : num_running_jobs > 0)
+  {
+    if (!events_wait())
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void job_forget(struct job *job)
+{
+  if (job->state == JOB_DONE)
+  {
+    remove_job(job);
+  }
+}
+
+bool job_kill(struct job *job, int sig)
+{
+  if (signal_job(job, sig) < 0)
+  {
+    return false;
+  }
+  if (job->state == JOB_STOPPED && sig != SIGCONT && sig != SIGKILL && sig != SIGSTOP &&
+      sig != SIGTSTP && sig != SIGTTIN && sig != SIGTTOU)
+  {
+    continue_job(job);
+  }
+  return true;
+}
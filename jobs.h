@@ -0,0 +1,111 @@
+// Job table: every command line the shell starts is a job of one or more
+// processes (the stages of a pipeline) that can be listed, stopped,
+// resumed in the foreground or background, waited for and signalled.
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+enum job_state
+{
+  JOB_RUNNING,
+  JOB_STOPPED,
+  JOB_DONE,
+};
+
+struct job;
+
+/*
+ * Turn on job control for the terminal 'tty_fd': jobs get the terminal
+ * while in the foreground, and a job stopped with ctrl-z keeps its
+ * terminal modes until it is resumed. Pass -1 when there is no terminal;
+ * jobs then stay in the shell's process group.
+ */
+void jobs_init(int tty_fd);
+
+// true if jobs_init() was given a terminal
+bool jobs_control_enabled(void);
+
+/*
+ * Add a job whose processes have all been started. They are watched by the
+ * event loop from now on (see events.h).
+ * pgid: the job's process group, or 0 if the processes are in ours.
+ * cmd: command line shown by 'jobs' (copied).
+ * returns: the new job, or NULL if out of memory.
+ */
+struct job *jobs_add(pid_t pgid, const pid_t pids[], int num_pids, const char *cmd,
+                     bool in_background);
+
+/*
+ * Find a job by specification: %n (job number), %% or %+ (current job),
+ * %- (previous job) or %string (job whose command starts with string).
+ * NULL or "" means the current job.
+ * returns: the job, or NULL if there is no such job.
+ */
+struct job *jobs_find(const char *spec);
+
+// Find the job that process 'pid' belongs to, or NULL.
+struct job *jobs_find_pid(pid_t pid);
+
+int job_id(const struct job *job);
+const char *job_command(const struct job *job);
+enum job_state job_state(const struct job *job);
+
+/*
+ * Wait status of the job: that of its last process once it is done, or
+ * the stop status while it is stopped.
+ */
+int job_status(const struct job *job);
+
+// Resource usage of every process of the job that has exited
+const struct rusage *job_usage(const struct job *job);
+
+/*
+ * Give the job the terminal (sending SIGCONT if it is stopped) and wait
+ * until it is done or stops again. A job that stops is reported right
+ * away; a finished job leaves the table.
+ * usage: if not NULL, set to the resource usage of the job's processes.
+ * returns: wait status of the job (see job_status()).
+ */
+int job_foreground(struct job *job, struct rusage *usage);
+
+// Continue a stopped job in the background.
+void job_background(struct job *job);
+
+/*
+ * Wait for a background job to finish (or stop), or for every job when
+ * 'job' is NULL.
+ * returns: false if interrupted by ctrl-c.
+ */
+bool jobs_wait(struct job *job);
+
+// Take a finished job out of the table once 'wait' has collected its status.
+void job_forget(struct job *job);
+
+/*
+ * Send 'sig' to every process of the job; a stopped job also gets SIGCONT
+ * so it can act on signals like SIGTERM.
+ * returns: false (with errno set) if the signal could not be sent.
+ */
+bool job_kill(struct job *job, int sig);
+
+// Number of jobs currently stopped
+int jobs_num_stopped(void);
+
+/*
+ * Report jobs that finished or stopped in the background since the last
+ * report, then forget the finished ones. Call before showing a prompt.
+ * fd: where to print the report, or -1 to only forget finished jobs.
+ */
+void jobs_report(int fd);
+
+// Print every job in the table ('jobs'), with its pids if 'long_format'.
+void jobs_print(int fd, bool long_format);
+
+// Print a job as "[n]+  State   command" (or "[n] pid" if 'launched').
+void job_print(int fd, const struct job *job, bool launched);
+
+#endif
@@ -0,0 +1,713 @@
+// Lexer for command lines.
+//
+// Most of a command line is plain word characters; what matters are the
+// few bytes that end a word or change quoting. Instead of switching on
+// every byte, the lexer asks a scan function for the next such byte and
+// copies the plain run in between in one go (not at all when nothing has
+// been unquoted yet, as words are rewritten in place). On x86 the scan
+// compares 16 (SSE2) or 32 (AVX2) bytes at a time against the special
+// characters, so long generated command lines are split at close to
+// memory speed; elsewhere a 256 entry class table is used.
+
+#include "lexer.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SCAN 1
+#endif
+
+enum lex_scan lex_scan_method = LEX_SCAN_AUTO;
+
+// Characters that end a run of plain word characters: outside quotes
+// (blanks, operators, quotes, backslash, $, wildcards), and inside double
+// quotes
+static const char unquoted_special[] = " \t\n|&;<>'\"\\$*?[";
+static const char dquoted_special[] = "\"\\$";
+
+// char_class[c] has bit 'set' if c is in that set of special characters
+enum char_set
+{
+  SET_UNQUOTED = 1,
+  SET_DQUOTED = 2,
+  SET_OPERATOR = 4, // first characters of operators
+};
+
+static uint8_t char_class[256];
+
+// returns: index of the first character of 'set' in s[0, len), or len
+static inline size_t scan_scalar(const char *s, size_t len, enum char_set set)
+{
+  size_t i = 0;
+  while (i < len && !(char_class[(unsigned char)s[i]] & set))
+  {
+    i++;
+  }
+  return i;
+}
+
+/*
+ * The vector scans classify the whole line up front, one bit per byte for
+ * each set, so finding the next special character is a count of trailing
+ * zeros. The bitmaps are reused between lines and only ever grow.
+ */
+static uint64_t *special_bits[3]; // indexed by enum char_set
+static size_t bits_words;
+static const char *bits_line; // the line the bitmaps describe
+
+// Make room for the bitmaps of a 'len' byte line. returns: false if out of memory.
+static bool reserve_bits(size_t len)
+{
+  size_t words = len / 64 + 1;
+  if (words <= bits_words)
+  {
+    return true;
+  }
+  for (int set = SET_UNQUOTED; set <= SET_DQUOTED; set++)
+  {
+    uint64_t *grown = realloc(special_bits[set], words * sizeof(uint64_t));
+    if (grown == NULL)
+    {
+      return false;
+    }
+    special_bits[set] = grown;
+  }
+  bits_words = words;
+  return true;
+}
+
+// Classify s[start, len) one byte at a time (the tail of a line)
+static void classify_scalar(const char *s, size_t start, size_t len)
+{
+  for (size_t i = start; i < len; i += 64)
+  {
+    uint64_t unquoted = 0, dquoted = 0;
+    for (size_t k = 0; k < 64 && i + k < len; k++)
+    {
+      uint8_t c = char_class[(unsigned char)s[i + k]];
+      unquoted |= (uint64_t)((c & SET_UNQUOTED) != 0) << k;
+      dquoted |= (uint64_t)((c & SET_DQUOTED) != 0) << k;
+    }
+    special_bits[SET_UNQUOTED][i / 64] = unquoted;
+    special_bits[SET_DQUOTED][i / 64] = dquoted;
+  }
+}
+
+// returns: index of the first character of 'set' in s[0, len), or len
+static inline size_t scan_bits(const char *s, size_t len, enum char_set set)
+{
+  size_t pos = s - bits_line;
+  size_t end = pos + len;
+  const uint64_t *bits = special_bits[set];
+  size_t w = pos / 64;
+  uint64_t word = bits[w] & (~0ull << (pos % 64));
+  while (word == 0)
+  {
+    if (++w * 64 >= end)
+    {
+      return len;
+    }
+    word = bits[w];
+  }
+  size_t found = w * 64 + __builtin_ctzll(word);
+  return found < end ? found - pos : len;
+}
+
+#ifdef HAVE_X86_SCAN
+// Masks of the double quote specials (" \ $) and of every unquoted
+// special among 16 bytes
+__attribute__((target("sse2"))) static inline void special_sse2(__m128i v, __m128i *dquoted,
+                                                               __m128i *unquoted)
+{
+#define EQ(c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+  *dquoted = _mm_or_si128(_mm_or_si128(EQ('"'), EQ('\\')), EQ('$'));
+  __m128i blank = _mm_or_si128(_mm_or_si128(EQ(' '), EQ('\t')), EQ('\n'));
+  __m128i op = _mm_or_si128(_mm_or_si128(EQ('|'), EQ('&')),
+                            _mm_or_si128(EQ(';'), _mm_or_si128(EQ('<'), EQ('>'))));
+  __m128i wild = _mm_or_si128(_mm_or_si128(EQ('*'), EQ('?')), EQ('['));
+  *unquoted = _mm_or_si128(_mm_or_si128(*dquoted, blank),
+                           _mm_or_si128(_mm_or_si128(op, EQ('\'')), wild));
+#undef EQ
+}
+
+// The same for 32 bytes
+__attribute__((target("avx2"))) static inline void special_avx2(__m256i v, __m256i *dquoted,
+                                                               __m256i *unquoted)
+{
+#define EQ(c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+  *dquoted = _mm256_or_si256(_mm256_or_si256(EQ('"'), EQ('\\')), EQ('$'));
+  __m256i blank = _mm256_or_si256(_mm256_or_si256(EQ(' '), EQ('\t')), EQ('\n'));
+  __m256i op = _mm256_or_si256(_mm256_or_si256(EQ('|'), EQ('&')),
+                               _mm256_or_si256(EQ(';'), _mm256_or_si256(EQ('<'), EQ('>'))));
+  __m256i wild = _mm256_or_si256(_mm256_or_si256(EQ('*'), EQ('?')), EQ('['));
+  *unquoted = _mm256_or_si256(_mm256_or_si256(*dquoted, blank),
+                              _mm256_or_si256(_mm256_or_si256(op, EQ('\'')), wild));
+#undef EQ
+}
+
+__attribute__((target("sse2"))) static void classify_sse2(const char *s, size_t len)
+{
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64)
+  {
+    uint64_t unquoted = 0, dquoted = 0;
+    for (int k = 0; k < 4; k++)
+    {
+      __m128i dq, uq;
+      special_sse2(_mm_loadu_si128((const __m128i *)(s + i + 16 * k)), &dq, &uq);
+      dquoted |= (uint64_t)(unsigned)_mm_movemask_epi8(dq) << (16 * k);
+      unquoted |= (uint64_t)(unsigned)_mm_movemask_epi8(uq) << (16 * k);
+    }
+    special_bits[SET_UNQUOTED][i / 64] = unquoted;
+    special_bits[SET_DQUOTED][i / 64] = dquoted;
+  }
+  classify_scalar(s, i, len);
+}
+
+__attribute__((target("avx2"))) static void classify_avx2(const char *s, size_t len)
+{
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64)
+  {
+    uint64_t unquoted = 0, dquoted = 0;
+    for (int k = 0; k < 2; k++)
+    {
+      __m256i dq, uq;
+      special_avx2(_mm256_loadu_si256((const __m256i *)(s + i + 32 * k)), &dq, &uq);
+      dquoted |= (uint64_t)(unsigned)_mm256_movemask_epi8(dq) << (32 * k);
+      unquoted |= (uint64_t)(unsigned)_mm256_movemask_epi8(uq) << (32 * k);
+    }
+    special_bits[SET_UNQUOTED][i / 64] = unquoted;
+    special_bits[SET_DQUOTED][i / 64] = dquoted;
+  }
+  classify_scalar(s, i, len);
+}
+#endif
+
+static bool cpu_has(enum lex_scan method)
+{
+#ifdef HAVE_X86_SCAN
+  __builtin_cpu_init();
+  switch (method)
+  {
+  case LEX_SCAN_SSE2:
+    return __builtin_cpu_supports("sse2");
+  case LEX_SCAN_AVX2:
+    return __builtin_cpu_supports("avx2");
+  default:
+    return true;
+  }
+#else
+  return method == LEX_SCAN_AUTO || method == LEX_SCAN_SCALAR;
+#endif
+}
+
+static const char *scan_names[] = {"auto", "scalar", "sse2", "avx2"};
+
+bool lex_set_scan(const char *name)
+{
+  for (int m = LEX_SCAN_AUTO; m <= LEX_SCAN_AVX2; m++)
+  {
+    if (strcmp(name, scan_names[m]) == 0 && cpu_has(m))
+    {
+      lex_scan_method = m;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *lex_scan_name(enum lex_scan method)
+{
+  return scan_names[method];
+}
+
+// Operators, longest first so "&&" wins over "&"
+static const struct
+{
+  const char *text;
+  enum token_type type;
+} operators[] = {
+  // longest first: the first one the line starts with is taken
+  {"<<<", TOKEN_TLESS}, {"<<-", TOKEN_DLESSDASH}, {"<<", TOKEN_DLESS},
+  {"&&", TOKEN_AND_IF}, {"||", TOKEN_OR_IF}, {">>", TOKEN_DGREAT}, {">&", TOKEN_GREATAND},
+  {"<&", TOKEN_LESSAND}, {"|", TOKEN_PIPE},   {"&", TOKEN_AMP},      {";", TOKEN_SEMI},
+  {"<", TOKEN_LESS},     {">", TOKEN_GREAT},
+};
+
+#define NUM_OPERATORS (int)(sizeof(operators) / sizeof(operators[0]))
+
+// Prepare 'line' for scanning with lex_scan_method (AUTO: the best the
+// CPU has). returns: true if it was classified into the bitmaps.
+static bool prepare_scan(const char *line, size_t len)
+{
+  static bool initialized = false;
+  if (!initialized)
+  {
+    for (const char *c = unquoted_special; *c != '\0'; c++)
+    {
+      char_class[(unsigned char)*c] |= SET_UNQUOTED;
+    }
+    for (const char *c = dquoted_special; *c != '\0'; c++)
+    {
+      char_class[(unsigned char)*c] |= SET_DQUOTED;
+    }
+    for (int op = 0; op < NUM_OPERATORS; op++)
+    {
+      char_class[(unsigned char)operators[op].text[0]] |= SET_OPERATOR;
+    }
+    initialized = true;
+  }
+
+  enum lex_scan method = lex_scan_method;
+  if (method == LEX_SCAN_AUTO)
+  {
+    method = cpu_has(LEX_SCAN_AVX2) ? LEX_SCAN_AVX2 : cpu_has(LEX_SCAN_SSE2) ? LEX_SCAN_SSE2
+                                                                          : LEX_SCAN_SCALAR;
+  }
+#ifdef HAVE_X86_SCAN
+  if (method != LEX_SCAN_SCALAR && reserve_bits(len))
+  {
+    bits_line = line;
+    if (method == LEX_SCAN_AVX2)
+    {
+      classify_avx2(line, len);
+    }
+    else
+    {
+      classify_sse2(line, len);
+    }
+    return true;
+  }
+#endif
+  return false;
+}
+
+// returns: index of the first character of 'set' in s[0, len), or len
+static inline size_t scan(bool use_bits, const char *s, size_t len, enum char_set set)
+{
+  return use_bits ? scan_bits(s, len, set) : scan_scalar(s, len, set);
+}
+
+// Move the run s[0, n) down to 'out' (a no-op until something was unquoted)
+static char *copy_run(char *out, const char *s, size_t n)
+{
+  if (out != s)
+  {
+    memmove(out, s, n);
+  }
+  return out + n;
+}
+
+#define FIRST_TOKENS 16
+#define FIRST_EXPANSIONS 4
+
+static bool name_char(char c, bool first)
+{
+  return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (!first && c >= '0' && c <= '9');
+}
+
+// returns: length of the '...' or "..." starting at s[0], or n if unterminated
+static size_t quoted_length(const char *s, size_t n)
+{
+  size_t i = 1;
+  while (i < n && s[i] != s[0])
+  {
+    i += s[0] == '"' && s[i] == '\\' ? 2 : 1;
+  }
+  return i < n ? i + 1 : n;
+}
+
+/*
+ * Length of the command substitution $(...) at s[0] == '$', up to the ')'
+ * matching its '(': quotes, escapes and nested parentheses inside are
+ * skipped, as the command is only split when it runs.
+ * returns: its length including "$(" and ")", or -1 if there is no ')'.
+ */
+static ssize_t substitution_length(const char *s, size_t n)
+{
+  size_t depth = 0;
+  for (size_t i = 1; i < n; i++)
+  {
+    switch (s[i])
+    {
+    case '(':
+      depth++;
+      break;
+    case ')':
+      if (--depth == 0)
+      {
+        return i + 1;
+      }
+      break;
+    case '\\':
+      i++;
+      break;
+    case '\'':
+    case '"':
+      i += quoted_length(s + i, n - i) - 1;
+      break;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Length of the parameter reference or command substitution at
+ * s[0] == '$', n bytes available.
+ * returns: its length including the '$', 0 if the '$' is literal, or -1
+ *          for a malformed ${...} or an unterminated $(...).
+ */
+static ssize_t reference_length(const char *s, size_t n)
+{
+  if (n > 1 && s[1] == '(')
+  {
+    return substitution_length(s, n);
+  }
+  bool braced = n > 1 && s[1] == '{';
+  size_t i = braced ? 2 : 1;
+  size_t name_start = i;
+  if (i < n && (s[i] == '?' || s[i] == '$'))
+  {
+    i++;
+  }
+  else
+  {
+    while (i < n && name_char(s[i], i == name_start))
+    {
+      i++;
+    }
+  }
+  if (!braced)
+  {
+    return i > 1 ? (ssize_t)i : 0;
+  }
+  return i > name_start && i < n && s[i] == '}' ? (ssize_t)i + 1 : -1;
+}
+
+/*
+ * Note that the wildcard just about to be copied to 'out' is not quoted.
+ * returns: false if out of memory.
+ */
+static bool add_glob(struct arena *arena, struct token *token, const char *out)
+{
+  uint32_t n = token->num_globs;
+  if (n == 0)
+  {
+    token->globs = arena_alloc(arena, FIRST_EXPANSIONS * sizeof(uint32_t));
+  }
+  else if (n >= FIRST_EXPANSIONS && (n & (n - 1)) == 0)
+  {
+    token->globs = arena_grow(arena, token->globs, n * sizeof(uint32_t), 2 * n * sizeof(uint32_t));
+  }
+  if (token->globs == NULL)
+  {
+    return false;
+  }
+  token->globs[token->num_globs++] = out - token->text;
+  return true;
+}
+
+/*
+ * Copy the '$' at line[*i] to 'out', with what follows when it starts a
+ * parameter reference or command substitution, which is then noted in the
+ * token. quoted: the '$' is inside double quotes.
+ * returns: the new end of 'out', or NULL with 'error' set.
+ */
+static char *copy_reference(struct arena *arena, struct token *token, char *out,
+                            const char *line, size_t *i, size_t len, bool quoted,
+                            const char **error)
+{
+  ssize_t n = reference_length(line + *i, len - *i);
+  if (n < 0)
+  {
+    *error = line[*i + 1] == '(' ? "Missing ')'" : "Bad substitution";
+    return NULL;
+  }
+  if (n == 0)
+  {
+    *out++ = '$';
+    (*i)++;
+    return out;
+  }
+
+  uint32_t count = token->num_expansions;
+  if (count == 0)
+  {
+    token->expansions = arena_alloc(arena, FIRST_EXPANSIONS * sizeof(struct expansion));
+  }
+  else if (count >= FIRST_EXPANSIONS && (count & (count - 1)) == 0)
+  {
+    token->expansions = arena_grow(arena, token->expansions, count * sizeof(struct expansion),
+                                   2 * count * sizeof(struct expansion));
+  }
+  if (token->expansions == NULL)
+  {
+    *error = "Out of memory";
+    return NULL;
+  }
+  token->expansions[count].start = out - token->text;
+  token->expansions[count].length = n;
+  token->expansions[count].quoted = quoted;
+  token->num_expansions++;
+  out = copy_run(out, line + *i, n);
+  *i += n;
+  return out;
+}
+
+int lex_line(char *line, size_t len, struct arena *arena, struct token **tokens,
+             const char **error)
+{
+  size_t max_tokens = FIRST_TOKENS;
+  *tokens = arena_alloc(arena, max_tokens * sizeof(struct token));
+  bool use_bits = prepare_scan(line, len);
+  size_t num_tokens = 0;
+  size_t i = 0;
+  // end of the previous word: only null terminated once the character
+  // there (maybe the operator right after it) has been looked at
+  char *word_end = NULL;
+
+  while (true)
+  {
+    while (i < len && (line[i] == ' ' || line[i] == '\t' || line[i] == '\n'))
+    {
+      i++;
+    }
+    char c = i < len ? line[i] : '\0';
+    char next = i + 1 < len ? line[i + 1] : '\0';
+    if (word_end != NULL)
+    {
+      *word_end = '\0';
+      word_end = NULL;
+    }
+    if (i >= len)
+    {
+      break;
+    }
+    if (num_tokens == max_tokens)
+    {
+      *tokens = arena_grow(arena, *tokens, max_tokens * sizeof(struct token),
+                           2 * max_tokens * sizeof(struct token));
+      max_tokens *= 2;
+    }
+    if (*tokens == NULL)
+    {
+      *error = "Out of memory";
+      return -1;
+    }
+    struct token *token = &(*tokens)[num_tokens++];
+
+    if (char_class[(unsigned char)c] & SET_OPERATOR)
+    {
+      // line[i] may already be the null byte ending the word before, so
+      // compare with the saved c; line[i + 2] is past any word end
+      int op = 0;
+      while (!(operators[op].text[0] == c &&
+               (operators[op].text[1] == '\0' ||
+                (operators[op].text[1] == next &&
+                 (operators[op].text[2] == '\0' || operators[op].text[2] == line[i + 2])))))
+      {
+        op++;
+      }
+      token->type = operators[op].type;
+      token->text = (char *)operators[op].text;
+      token->quoted = false;
+      token->assignment = false;
+      token->num_expansions = 0;
+      token->num_globs = 0;
+      i += strlen(operators[op].text);
+      continue;
+    }
+
+    // A word: plain runs, quoted parts and escapes up to a blank or operator
+    char *out = &line[i];
+    token->type = TOKEN_WORD;
+    token->text = out;
+    token->quoted = false;
+    token->num_expansions = 0;
+    token->num_globs = 0;
+    size_t name_len = 0;
+    while (i + name_len < len && name_char(line[i + name_len], name_len == 0))
+    {
+      name_len++;
+    }
+    token->assignment = name_len > 0 && i + name_len < len && line[i + name_len] == '=';
+    while (i < len)
+    {
+      size_t n = scan(use_bits, line + i, len - i, SET_UNQUOTED);
+      out = copy_run(out, line + i, n);
+      i += n;
+      if (i >= len)
+      {
+        break;
+      }
+
+      c = line[i];
+      if (c == '*' || c == '?' || c == '[')
+      {
+        if (!add_glob(arena, token, out))
+        {
+          *error = "Out of memory";
+          return -1;
+        }
+        *out++ = c;
+        i++;
+        continue;
+      }
+      if (c == '$')
+      {
+        if ((out = copy_reference(arena, token, out, line, &i, len, false, error)) == NULL)
+        {
+          return -1;
+        }
+        continue;
+      }
+      if (c == '\'')
+      {
+        const char *close = memchr(line + i + 1, '\'', len - i - 1);
+        if (close == NULL)
+        {
+          *error = "Unterminated single quote";
+          return -1;
+        }
+        n = close - (line + i + 1);
+        out = copy_run(out, line + i + 1, n);
+        i += n + 2;
+      }
+      else if (c == '"')
+      {
+        i++;
+        while (true)
+        {
+          n = scan(use_bits, line + i, len - i, SET_DQUOTED);
+          out = copy_run(out, line + i, n);
+          i += n;
+          if (i >= len)
+          {
+            *error = "Unterminated double quote";
+            return -1;
+          }
+          if (line[i] == '"')
+          {
+            i++;
+            break;
+          }
+          if (line[i] == '$')
+          {
+            if ((out = copy_reference(arena, token, out, line, &i, len, true, error)) == NULL)
+            {
+              return -1;
+            }
+            continue;
+          }
+          // backslash: only special before $ ` " \ and newline
+          next = i + 1 < len ? line[i + 1] : '\0';
+          if (next != '\0' && strchr("$`\"\\\n", next) != NULL)
+          {
+            if (next != '\n')
+            {
+              *out++ = next;
+            }
+            i += 2;
+          }
+          else
+          {
+            *out++ = '\\';
+            i++;
+          }
+        }
+      }
+      else if (c == '\\')
+      {
+        if (i + 1 >= len)
+        {
+          *error = "Backslash at end of line";
+          return -1;
+        }
+        // backslash-newline continues the word on the next line
+        if (line[i + 1] != '\n')
+        {
+          *out++ = line[i + 1];
+        }
+        i += 2;
+      }
+      else
+      {
+        break; // blank or operator
+      }
+      token->quoted = true;
+    }
+    word_end = out;
+
+    // "2>": the number says which descriptor to redirect
+    if (!token->quoted && i < len && (line[i] == '<' || line[i] == '>'))
+    {
+      const char *digit = token->text;
+      while (digit < out && *digit >= '0' && *digit <= '9')
+      {
+        digit++;
+      }
+      if (digit == out)
+      {
+        token->type = TOKEN_IO_NUMBER;
+      }
+    }
+  }
+
+  return num_tokens;
+}
+
+bool lex_document(char *text, size_t len, bool expand, struct arena *arena,
+                  struct token *token, const char **error)
+{
+  token->type = TOKEN_WORD;
+  token->text = text;
+  token->quoted = true;
+  token->assignment = false;
+  token->num_expansions = 0;
+  token->num_globs = 0;
+  if (!expand)
+  {
+    return true;
+  }
+  char *out = text;
+  size_t i = 0;
+  while (i < len)
+  {
+    size_t n = strcspn(text + i, "$\\");
+    n = n < len - i ? n : len - i;
+    out = copy_run(out, text + i, n);
+    i += n;
+    if (i >= len)
+    {
+      break;
+    }
+    if (text[i] == '$')
+    {
+      if ((out = copy_reference(arena, token, out, text, &i, len, true, error)) == NULL)
+      {
+        return false;
+      }
+    }
+    else if (i + 1 < len && strchr("$`\\\n", text[i + 1]) != NULL)
+    {
+      if (text[i + 1] != '\n')
+      {
+        *out++ = text[i + 1];
+      }
+      i += 2;
+    }
+    else
+    {
+      *out++ = '\\';
+      i++;
+    }
+  }
+  *out = '\0';
+  return true;
+}
@@ -0,0 +1,106 @@
+// Lexer for command lines: words with quoting and escapes, and operators.
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "arena.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum token_type
+{
+  TOKEN_WORD,
+  TOKEN_PIPE,      // |
+  TOKEN_AND_IF,    // &&
+  TOKEN_OR_IF,     // ||
+  TOKEN_SEMI,      // ;
+  TOKEN_AMP,       // &
+  TOKEN_LESS,      // <
+  TOKEN_GREAT,     // >
+  TOKEN_DGREAT,    // >>
+  TOKEN_LESSAND,   // <&
+  TOKEN_GREATAND,  // >&
+  TOKEN_DLESS,     // <<  here-document
+  TOKEN_DLESSDASH, // <<- here-document with leading tabs removed
+  TOKEN_TLESS,     // <<< here-string
+  TOKEN_IO_NUMBER, // the digits of 2> or 2>&1: the descriptor redirected
+};
+
+// A parameter reference in a word: "$NAME", "${NAME}", "$?" or "$$", or a
+// command substitution "$(command)"
+struct expansion
+{
+  uint32_t start;  // offset of its '$' in the token text
+  uint32_t length; // bytes from the '$' to the end of the reference
+  bool quoted;     // inside double quotes: its value is not split into fields
+};
+
+struct token
+{
+  enum token_type type;
+  char *text;  // the word with quotes and escapes removed, or the operator
+  bool quoted; // some part of the word was quoted or escaped
+  bool assignment; // the word starts with an unquoted NAME=
+  // the references outside single quotes and not escaped, in order; any
+  // other '$' is literal
+  struct expansion *expansions;
+  uint32_t num_expansions;
+  // offsets in 'text' of the unquoted '*', '?' and '[' (pathname expansion)
+  uint32_t *globs;
+  uint32_t num_globs;
+};
+
+// How the lexer finds the next character it has to look at.
+enum lex_scan
+{
+  LEX_SCAN_AUTO,   // the widest vector scan the CPU supports (default)
+  LEX_SCAN_SCALAR, // one byte at a time through a class table
+  LEX_SCAN_SSE2,   // 16 bytes at a time
+  LEX_SCAN_AVX2,   // 32 bytes at a time
+};
+
+extern enum lex_scan lex_scan_method;
+
+/*
+ * Select the scan method by name ("auto", "scalar", "sse2" or "avx2").
+ * returns: false if the name is not recognized or the CPU lacks it.
+ */
+bool lex_set_scan(const char *name);
+const char *lex_scan_name(enum lex_scan method);
+
+/*
+ * Split 'line' into words and operators, as a POSIX shell does:
+ * - blanks separate words, and operators need no blanks around them;
+ * - '...' keeps everything literally;
+ * - "..." keeps everything but \ before $ ` " \ and newline;
+ * - \ outside quotes keeps the next character literally;
+ * - $NAME, ${NAME}, $?, $$ and $(command) outside single quotes are kept
+ *   and noted in the token (NAME: letters, digits and '_', not starting
+ *   with a digit; the command is kept as written up to its matching ')');
+ * - so are the unquoted wildcards '*', '?' and '[';
+ * - an unquoted number right before < or > is a TOKEN_IO_NUMBER.
+ * line: the command, 'len' bytes and a null byte. Modified: words are unquoted in place and
+ *       null terminated, so token texts point into it.
+ * arena: where the token array is allocated; it grows as needed.
+ * tokens: set to the token array.
+ * error: set to a message when the line cannot be split.
+ * returns: number of tokens, or -1 on error (unterminated quote, trailing
+ *          backslash, bad ${...}, missing ')', out of memory).
+ */
+int lex_line(char *line, size_t len, struct arena *arena, struct token **tokens,
+             const char **error);
+
+/*
+ * Make the body of a here-document into a word 'token' that expands to
+ * one field. With 'expand' (its delimiter was not quoted) the references
+ * in it are noted as if inside double quotes and \ is removed before
+ * $ ` \ and newline; otherwise the text is taken as it is.
+ * text: the body, 'len' bytes and a null byte; modified in place.
+ * returns: false with 'error' set on a bad reference or out of memory.
+ */
+bool lex_document(char *text, size_t len, bool expand, struct arena *arena,
+                  struct token *token, const char **error);
+
+#endif
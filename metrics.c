@@ -0,0 +1,423 @@
+// Instrumentation of the shell itself.
+//
+// A timer is a histogram in the style of HdrHistogram: below 16 ticks every
+// value has a bucket of its own, above that every power of two is split
+// into 16 linear sub-buckets, so any value is known to within 1/16 (6.25%)
+// with a fixed 656 buckets for everything up to 2^44 ticks (over an hour
+// at 4 GHz). Recording a value is a count-leading-zeros, a shift and an
+// increment; there is no allocation and no lock (the shell is single
+// threaded). Ticks become seconds only when the metrics are printed.
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define MAX_BITS 44
+#define NUM_BUCKETS ((MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS)
+
+struct histogram
+{
+  uint64_t count;
+  uint64_t sum; // ticks
+  uint64_t max; // ticks
+  uint64_t buckets[NUM_BUCKETS];
+};
+
+static struct histogram timers[NUM_TIMERS];
+uint64_t metric_counters[NUM_COUNTERS];
+bool metrics_timing;
+
+static const char *timer_names[] = {
+#define METRIC_TIMER(NAME, name, help) #name,
+#define METRIC_COUNTER(NAME, name, help)
+#include "metrics.def"
+#undef METRIC_TIMER
+#undef METRIC_COUNTER
+};
+
+static const char *counter_names[] = {
+#define METRIC_TIMER(NAME, name, help)
+#define METRIC_COUNTER(NAME, name, help) #name,
+#include "metrics.def"
+#undef METRIC_TIMER
+#undef METRIC_COUNTER
+};
+
+static const char *counter_help[] = {
+#define METRIC_TIMER(NAME, name, help)
+#define METRIC_COUNTER(NAME, name, help) help,
+#include "metrics.def"
+#undef METRIC_TIMER
+#undef METRIC_COUNTER
+};
+
+static int bucket_of(uint64_t ticks)
+{
+  if (ticks >= (1ull << MAX_BITS))
+  {
+    ticks = (1ull << MAX_BITS) - 1;
+  }
+  if (ticks < SUB_BUCKETS)
+  {
+    return ticks;
+  }
+  int shift = 63 - __builtin_clzll(ticks) - SUB_BITS;
+  return (shift + 1) * SUB_BUCKETS + ((ticks >> shift) & (SUB_BUCKETS - 1));
+}
+
+// returns: the largest value that lands in bucket b
+static uint64_t bucket_top(int b)
+{
+  if (b < SUB_BUCKETS)
+  {
+    return b;
+  }
+  int shift = b / SUB_BUCKETS - 1;
+  return (((uint64_t)(SUB_BUCKETS + b % SUB_BUCKETS) + 1) << shift) - 1;
+}
+
+void metrics_record(enum metric_timer timer, uint64_t ticks)
+{
+  struct histogram *h = &timers[timer];
+  h->count++;
+  h->sum += ticks;
+  h->max = ticks > h->max ? ticks : h->max;
+  h->buckets[bucket_of(ticks)]++;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Where the TSC and CLOCK_MONOTONIC stood when the shell started
+static uint64_t start_ticks;
+static struct timespec start_time;
+
+__attribute__((constructor)) static void start_clock(void)
+{
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  start_ticks = metrics_now();
+}
+
+/*
+ * returns: the length of a tick in ns, from how far the TSC (constant rate
+ * on anything recent) and the clock have moved since the shell started.
+ * The first call in the first millisecond waits that out.
+ */
+static double ns_per_tick(void)
+{
+  while (true)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ticks = metrics_now() - start_ticks;
+    double ns = (now.tv_sec - start_time.tv_sec) * 1e9 + (now.tv_nsec - start_time.tv_nsec);
+    if (ns >= 1e6 && ticks > 0)
+    {
+      return ns / ticks;
+    }
+  }
+}
+#else
+static double ns_per_tick(void)
+{
+  return 1;
+}
+#endif
+
+bool metrics_compiled_in(void)
+{
+#ifdef NO_METRICS
+  return false;
+#else
+  return true;
+#endif
+}
+
+void metrics_reset(void)
+{
+  memset(timers, 0, sizeof(timers));
+  memset(metric_counters, 0, sizeof(metric_counters));
+}
+
+// returns: the value (ticks) at 'percent' of the recorded ones, to within a bucket
+static uint64_t histogram_percentile(const struct histogram *h, unsigned percent)
+{
+  if (h->count == 0)
+  {
+    return 0;
+  }
+  uint64_t rank = (h->count * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (int b = 0; b < NUM_BUCKETS; b++)
+  {
+    seen += h->buckets[b];
+    if (seen >= rank && seen > 0)
+    {
+      uint64_t top = bucket_top(b);
+      return top < h->max ? top : h->max;
+    }
+  }
+  return h->max;
+}
+
+// A growing output buffer; 'failed' once out of memory
+struct out
+{
+  char *buf;
+  size_t len;
+  size_t size;
+  bool failed;
+};
+
+static void out_printf(struct out *out, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void out_printf(struct out *out, const char *format, ...)
+{
+  while (!out->failed)
+  {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->buf + out->len, out->size - out->len, format, args);
+    va_end(args);
+    if (n >= 0 && (size_t)n < out->size - out->len)
+    {
+      out->len += n;
+      return;
+    }
+    size_t size = out->size ? out->size * 2 : 4096;
+    char *grown = realloc(out->buf, size);
+    if (grown == NULL)
+    {
+      out->failed = true;
+      return;
+    }
+    out->buf = grown;
+    out->size = size;
+  }
+}
+
+// The formats; 'tick' is the length of a tick in ns
+static void format_text(struct out *out, double tick)
+{
+  if (!metrics_timing)
+  {
+    out_printf(out, "phases are not timed: 'stats -t on' starts timing them\n\n");
+  }
+  out_printf(out, "%-14s %10s %12s %10s %10s %10s %10s\n", "phase", "count", "total_ms",
+             "p50_us", "p90_us", "p99_us", "max_us");
+  for (int t = 0; t < NUM_TIMERS; t++)
+  {
+    const struct histogram *h = &timers[t];
+    out_printf(out, "%-14s %10llu %12.3f %10.1f %10.1f %10.1f %10.1f\n", timer_names[t],
+               (unsigned long long)h->count, h->sum * tick / 1e6,
+               histogram_percentile(h, 50) * tick / 1e3, histogram_percentile(h, 90) * tick / 1e3,
+               histogram_percentile(h, 99) * tick / 1e3, h->max * tick / 1e3);
+  }
+  out_printf(out, "\n%-14s %10s\n", "counter", "value");
+  for (int c = 0; c < NUM_COUNTERS; c++)
+  {
+    out_printf(out, "%-14s %10llu\n", counter_names[c], (unsigned long long)metric_counters[c]);
+  }
+}
+
+static void format_prometheus(struct out *out, double tick)
+{
+  static const unsigned quantiles[] = {50, 90, 99};
+  out_printf(out, "# HELP shell_phase_seconds Time the shell spends in each phase.\n"
+                  "# TYPE shell_phase_seconds summary\n");
+  for (int t = 0; t < NUM_TIMERS; t++)
+  {
+    const struct histogram *h = &timers[t];
+    for (int q = 0; q < 3; q++)
+    {
+      out_printf(out, "shell_phase_seconds{phase=\"%s\",quantile=\"0.%u\"} %.9f\n",
+                 timer_names[t], quantiles[q],
+                 histogram_percentile(h, quantiles[q]) * tick / 1e9);
+    }
+    out_printf(out, "shell_phase_seconds_sum{phase=\"%s\"} %.9f\n", timer_names[t],
+               h->sum * tick / 1e9);
+    out_printf(out, "shell_phase_seconds_count{phase=\"%s\"} %llu\n", timer_names[t],
+               (unsigned long long)h->count);
+  }
+  out_printf(out, "# HELP shell_phase_max_seconds Longest time spent in each phase.\n"
+                  "# TYPE shell_phase_max_seconds gauge\n");
+  for (int t = 0; t < NUM_TIMERS; t++)
+  {
+    out_printf(out, "shell_phase_max_seconds{phase=\"%s\"} %.9f\n", timer_names[t],
+               timers[t].max * tick / 1e9);
+  }
+  for (int c = 0; c < NUM_COUNTERS; c++)
+  {
+    out_printf(out, "# HELP shell_%s_total Number of %s.\n# TYPE shell_%s_total counter\n",
+               counter_names[c], counter_help[c], counter_names[c]);
+    out_printf(out, "shell_%s_total %llu\n", counter_names[c],
+               (unsigned long long)metric_counters[c]);
+  }
+}
+
+static void format_json(struct out *out, double tick)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  out_printf(out, "{\"time\":%lld.%03ld,\"pid\":%d,\"timers\":{", (long long)now.tv_sec,
+             now.tv_nsec / 1000000, (int)getpid());
+  for (int t = 0; t < NUM_TIMERS; t++)
+  {
+    const struct histogram *h = &timers[t];
+    out_printf(out,
+               "%s\"%s\":{\"count\":%llu,\"sum_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,"
+               "\"p99_us\":%.1f,\"max_us\":%.1f}",
+               t > 0 ? "," : "", timer_names[t], (unsigned long long)h->count,
+               h->sum * tick / 1e3, histogram_percentile(h, 50) * tick / 1e3,
+               histogram_percentile(h, 90) * tick / 1e3, histogram_percentile(h, 99) * tick / 1e3,
+               h->max * tick / 1e3);
+  }
+  out_printf(out, "},\"counters\":{");
+  for (int c = 0; c < NUM_COUNTERS; c++)
+  {
+    out_printf(out, "%s\"%s\":%llu", c > 0 ? "," : "", counter_names[c],
+               (unsigned long long)metric_counters[c]);
+  }
+  out_printf(out, "}}\n");
+}
+
+// returns: the metrics formatted into out->buf (free it), or false if out of memory.
+static bool format(struct out *out, enum metrics_format format)
+{
+  *out = (struct out){NULL, 0, 0, false};
+  double tick = ns_per_tick();
+  switch (format)
+  {
+  case METRICS_TEXT:
+    format_text(out, tick);
+    break;
+  case METRICS_PROMETHEUS:
+    format_prometheus(out, tick);
+    break;
+  case METRICS_JSON:
+    format_json(out, tick);
+    break;
+  }
+  if (out->failed)
+  {
+    free(out->buf);
+    errno = ENOMEM;
+  }
+  return !out->failed;
+}
+
+// returns: false with errno set unless all of buf[0, len) was written
+static bool write_all(int fd, const char *buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0 && errno != EINTR)
+    {
+      return false;
+    }
+    if (n > 0)
+    {
+      buf += n;
+      len -= n;
+    }
+  }
+  return true;
+}
+
+bool metrics_print(int fd, enum metrics_format format_)
+{
+  struct out out;
+  if (!format(&out, format_))
+  {
+    return false;
+  }
+  bool written = write_all(fd, out.buf, out.len);
+  free(out.buf);
+  return written;
+}
+
+// returns: a stream socket connected to the Unix socket at 'path', or -1
+static int connect_unix(const char *path)
+{
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+bool metrics_export(const char *target, enum metrics_format format_)
+{
+  struct out out;
+  if (!format(&out, format_))
+  {
+    metric_counters[COUNTER_EXPORT_ERRORS]++;
+    return false;
+  }
+  bool written = false;
+  int err = 0;
+  if (strncmp(target, "unix:", 5) == 0)
+  {
+    int fd = connect_unix(target + 5);
+    written = fd >= 0 && write_all(fd, out.buf, out.len);
+    err = errno;
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+  else if (format_ == METRICS_JSON)
+  {
+    int fd = open(target, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    written = fd >= 0 && write_all(fd, out.buf, out.len);
+    err = errno;
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+  }
+  else
+  {
+    // replace the file whole, as Prometheus' textfile collector expects
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", target, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    written = fd >= 0 && write_all(fd, out.buf, out.len);
+    err = errno;
+    if (fd >= 0)
+    {
+      close(fd);
+      written = written && rename(tmp, target) == 0;
+      err = written ? 0 : errno;
+      if (!written)
+      {
+        unlink(tmp);
+      }
+    }
+  }
+  free(out.buf);
+  metric_counters[written ? COUNTER_EXPORTS : COUNTER_EXPORT_ERRORS]++;
+  errno = err;
+  return written;
+}
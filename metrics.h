@@ -0,0 +1,105 @@
+// Instrumentation of the shell itself: event counters and HDR-style latency
+// histograms of its hot paths (see metrics.def), shown by the 'stats'
+// builtin and optionally exported on a timer.
+//
+// Counters are always kept. Timers cost two clock reads per phase, which
+// is a large share of a builtin, so they only run once 'stats -t on' has
+// turned them on (metrics_timing). Building with -DNO_METRICS (make
+// METRICS=0) turns the METRIC_* macros into nothing, so the instrumented
+// code compiles to what it was without them.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+enum metric_timer
+{
+#define METRIC_TIMER(NAME, name, help) TIMER_##NAME,
+#define METRIC_COUNTER(NAME, name, help)
+#include "metrics.def"
+#undef METRIC_TIMER
+#undef METRIC_COUNTER
+  NUM_TIMERS
+};
+
+enum metric_counter
+{
+#define METRIC_TIMER(NAME, name, help)
+#define METRIC_COUNTER(NAME, name, help) COUNTER_##NAME,
+#include "metrics.def"
+#undef METRIC_TIMER
+#undef METRIC_COUNTER
+  NUM_COUNTERS
+};
+
+enum metrics_format
+{
+  METRICS_TEXT,       // tables for people
+  METRICS_PROMETHEUS, // Prometheus text exposition format
+  METRICS_JSON,       // one JSON object on one line
+};
+
+extern uint64_t metric_counters[NUM_COUNTERS];
+
+// true while phases are timed ('stats -t on'); false at startup
+extern bool metrics_timing;
+
+// Add a duration (the difference of two metrics_now()) to a timer's histogram.
+void metrics_record(enum metric_timer timer, uint64_t ticks);
+
+/*
+ * returns: a timestamp for METRIC_START()/METRIC_STOP(). On x86 that is the
+ * time stamp counter, since rdtsc costs about half of what even the vDSO
+ * clock_gettime() does and some phases take well under a microsecond;
+ * metrics.c converts ticks to time when printing. Elsewhere it is
+ * CLOCK_MONOTONIC in ns.
+ */
+static inline uint64_t metrics_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+#ifndef NO_METRICS
+#define METRIC_COUNT(NAME) (metric_counters[COUNTER_##NAME]++)
+// var is 0 when timing was off at the start: the phase is not recorded
+#define METRIC_START(var) uint64_t var = metrics_timing ? metrics_now() : 0
+#define METRIC_STOP(NAME, var) \
+  ((var) != 0 ? metrics_record(TIMER_##NAME, metrics_now() - (var)) : (void)0)
+#else
+#define METRIC_COUNT(NAME) ((void)0)
+#define METRIC_START(var) __attribute__((unused)) const uint64_t var = 0
+#define METRIC_STOP(NAME, var) ((void)0)
+#endif
+
+// true unless built with NO_METRICS
+bool metrics_compiled_in(void);
+
+// Forget everything counted and timed so far.
+void metrics_reset(void);
+
+/*
+ * Print every counter and the count, sum, p50, p90, p99 and max of every
+ * timer to fd in one write().
+ * returns: false if out of memory or the write failed.
+ */
+bool metrics_print(int fd, enum metrics_format format);
+
+/*
+ * Write the metrics to 'target' now: "unix:/path" sends them to the
+ * stream socket listening there, anything else is a file that Prometheus
+ * output replaces (through a rename, so a reader never sees half of it)
+ * and JSON lines are appended to.
+ * returns: false (errno set) if it could not be written.
+ */
+bool metrics_export(const char *target, enum metrics_format format);
+
+#endif
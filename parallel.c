@@ -0,0 +1,300 @@
+// Work pool for the 'parallel' builtin.
+//
+// Up to max_jobs children run at once. Each one is watched by the event
+// loop, whose callback collects the finished task's output and starts the
+// next task right there, so a free slot never waits for the shell to come
+// around. stdout and stderr of every task go to memfds that are copied out
+// with fd_copy() once the task is done.
+
+#include "parallel.h"
+
+#include "events.h"
+#include "fdcopy.h"
+#include "pathhash.h"
+#include "spawn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+struct task
+{
+  pid_t pid;
+  int out_fd; // memfds holding the task's output until it is printed
+  int err_fd;
+  bool done;
+};
+
+// State of the run in progress (there is only ever one)
+static char **template;
+static char **task_args;
+static size_t num_tasks;
+static struct task *tasks;
+static size_t next_task;  // next argument to start a task for
+static size_t next_print; // next task to print with keep_order
+static int running;
+static bool interrupted;
+static int stdin_fd;
+static const struct parallel_options *opts;
+static struct parallel_summary *result;
+
+// Copy all of memfd 'src' to 'dst', then close it.
+static void flush_output(int src, int dst)
+{
+  lseek(src, 0, SEEK_SET);
+  fd_copy(src, dst);
+  close(src);
+}
+
+static void print_task(struct task *task)
+{
+  flush_output(task->out_fd, STDOUT_FILENO);
+  flush_output(task->err_fd, STDERR_FILENO);
+  task->out_fd = task->err_fd = -1;
+}
+
+/*
+ * Build the argument vector of task 'index': the template with "{}"
+ * replaced by the task's argument, which is appended when the template has
+ * no "{}". Replaced words are heap copies, listed in 'owned'.
+ * returns: the vector, or NULL if out of memory.
+ */
+static char **task_argv(size_t index, char **owned[])
+{
+  const char *arg = task_args[index];
+  size_t arg_len = strlen(arg);
+  size_t num_words = 0;
+  while (template[num_words] != NULL)
+  {
+    num_words++;
+  }
+  char **argv = malloc((num_words + 2) * sizeof(char *));
+  *owned = calloc(num_words + 1, sizeof(char *));
+  if (argv == NULL || *owned == NULL)
+  {
+    free(argv);
+    free(*owned);
+    return NULL;
+  }
+
+  bool substituted = false;
+  size_t num_owned = 0;
+  for (size_t i = 0; i < num_words; i++)
+  {
+    const char *word = template[i];
+    const char *hole = strstr(word, "{}");
+    argv[i] = (char *)word;
+    if (hole == NULL)
+    {
+      continue;
+    }
+    substituted = true;
+
+    size_t holes = 0;
+    for (const char *p = hole; p != NULL; p = strstr(p + 2, "{}"))
+    {
+      holes++;
+    }
+    char *copy = malloc(strlen(word) + holes * arg_len + 1);
+    if (copy == NULL)
+    {
+      continue;
+    }
+    char *out = copy;
+    for (const char *p = word; *p != '\0';)
+    {
+      if (p[0] == '{' && p[1] == '}')
+      {
+        memcpy(out, arg, arg_len);
+        out += arg_len;
+        p += 2;
+      }
+      else
+      {
+        *out++ = *p++;
+      }
+    }
+    *out = '\0';
+    argv[i] = copy;
+    (*owned)[num_owned++] = copy;
+  }
+  argv[num_words] = substituted ? NULL : (char *)arg;
+  argv[num_words + 1] = NULL;
+  return argv;
+}
+
+static void task_done(const struct child_exit *child, void *ctx);
+
+// Start task 'index'. returns: false if it could not be started.
+static bool start_task(size_t index)
+{
+  struct task *task = &tasks[index];
+  char **owned;
+  char **argv = task_argv(index, &owned);
+  if (argv == NULL)
+  {
+    return false;
+  }
+
+  task->out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+  task->err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+  bool started = false;
+  if (task->out_fd >= 0 && task->err_fd >= 0)
+  {
+    struct spawn_io io = {{stdin_fd, task->out_fd, task->err_fd}, -1};
+    const char *path = path_hash_lookup(argv[0]);
+    if (path == NULL && errno != 0)
+    {
+      spawn_report_error(STDERR_FILENO, argv[0], errno);
+    }
+    else if ((task->pid = spawn_command(path, argv, &io)) < 0)
+    {
+      spawn_report_error(STDERR_FILENO, argv[0], errno);
+    }
+    else
+    {
+      started = true;
+      running++;
+      events_watch(task->pid, task_done, task);
+    }
+  }
+
+  for (size_t i = 0; owned[i] != NULL; i++)
+  {
+    free(owned[i]);
+  }
+  free(owned);
+  free(argv);
+  return started;
+}
+
+// Print whatever can be printed: every finished task, or with keep_order
+// only the finished ones that all earlier tasks are waiting behind.
+static void print_finished(struct task *task)
+{
+  if (!opts->keep_order)
+  {
+    print_task(task);
+    return;
+  }
+  while (next_print < next_task && tasks[next_print].done)
+  {
+    if (tasks[next_print].out_fd >= 0)
+    {
+      print_task(&tasks[next_print]);
+    }
+    next_print++;
+  }
+}
+
+// Keep the pool full.
+static void start_tasks(void)
+{
+  while (running < opts->max_jobs && next_task < num_tasks && !interrupted)
+  {
+    size_t index = next_task++;
+    if (!start_task(index))
+    {
+      struct task *task = &tasks[index];
+      if (task->out_fd >= 0)
+      {
+        close(task->out_fd);
+      }
+      if (task->err_fd >= 0)
+      {
+        close(task->err_fd);
+      }
+      task->out_fd = task->err_fd = -1;
+      task->done = true;
+      result->failed++;
+      print_finished(task);
+    }
+  }
+}
+
+// Event loop callback: a task exited. Hand out its output, start the next.
+static void task_done(const struct child_exit *child, void *ctx)
+{
+  struct task *task = ctx;
+  if (WIFSTOPPED(child->status) || WIFCONTINUED(child->status))
+  {
+    return;
+  }
+  task->done = true;
+  running--;
+  rusage_add(&result->usage, &child->usage);
+  if (!WIFEXITED(child->status) || WEXITSTATUS(child->status) != 0)
+  {
+    result->failed++;
+  }
+  print_finished(task);
+  start_tasks();
+}
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool parallel_run(char *cmd[], char *args[], size_t num_args,
+                  const struct parallel_options *options, struct parallel_summary *summary)
+{
+  memset(summary, 0, sizeof(*summary));
+  summary->tasks = num_args;
+  tasks = calloc(num_args > 0 ? num_args : 1, sizeof(*tasks));
+  if (tasks == NULL)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < num_args; i++)
+  {
+    tasks[i].out_fd = tasks[i].err_fd = -1;
+  }
+  template = cmd;
+  task_args = args;
+  num_tasks = num_args;
+  next_task = next_print = 0;
+  running = 0;
+  interrupted = false;
+  opts = options;
+  result = summary;
+  stdin_fd = options->null_stdin ? open("/dev/null", O_RDONLY | O_CLOEXEC) : -1;
+
+  double start = now_seconds();
+  start_tasks();
+  while (running > 0)
+  {
+    // ctrl-c reaches the tasks too (they share our process group): stop
+    // starting new ones and let the running ones wind down
+    if (!events_wait())
+    {
+      interrupted = true;
+    }
+  }
+  summary->seconds = now_seconds() - start;
+  summary->not_started = num_tasks - next_task;
+
+  // with keep_order, tasks that finished after a gap left by ctrl-c
+  for (size_t i = next_print; i < next_task; i++)
+  {
+    if (tasks[i].out_fd >= 0)
+    {
+      print_task(&tasks[i]);
+    }
+  }
+
+  if (stdin_fd >= 0)
+  {
+    close(stdin_fd);
+  }
+  free(tasks);
+  tasks = NULL;
+  return !interrupted;
+}
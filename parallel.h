@@ -0,0 +1,39 @@
+// Work pool for the 'parallel' builtin: runs one command per argument with
+// at most N of them at a time.
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/resource.h>
+
+struct parallel_options
+{
+  int max_jobs;    // children running at once
+  bool keep_order; // print output in argument order, not completion order
+  bool null_stdin; // give tasks /dev/null as stdin (arguments came from it)
+};
+
+struct parallel_summary
+{
+  size_t tasks;
+  size_t failed;       // tasks that did not exit with status 0
+  size_t not_started;  // tasks skipped after ctrl-c
+  double seconds;      // wall clock time of the whole run
+  struct rusage usage; // summed over all tasks
+};
+
+/*
+ * Run 'cmd' once per argument, with every "{}" in its words replaced by the
+ * argument (or the argument appended if there is no "{}"). Each child
+ * starts from the event loop the moment a running one is reaped. A task's
+ * stdout and stderr are collected in memory files and written out in one
+ * piece when it finishes, so the output of tasks never interleaves.
+ * ctrl-c stops starting new tasks and waits for the running ones.
+ * returns: false if the run was interrupted.
+ */
+bool parallel_run(char *cmd[], char *args[], size_t num_args,
+                  const struct parallel_options *options, struct parallel_summary *summary);
+
+#endif
@@ -0,0 +1,729 @@
+// Pathname expansion.
+//
+// A pattern is matched one path component at a time. Literal components
+// are just appended; a component with wildcards is matched against the
+// listing of the directory so far. Listings are read with getdents64()
+// into a large buffer (a few system calls even for 100k entries) and kept
+// in a small cache keyed by device and inode; only the matches are
+// sorted. Before a cached listing is used the directory is stat()ed: any
+// entry created, removed or renamed changes its mtime, and then it is read
+// again. A listing taken within a second of the directory's last change is
+// not trusted, as a change in that same clock tick would leave the mtime
+// as is.
+
+#include "pathglob.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DENTS_BUFFER_SIZE (1024 * 1024)
+#define CACHE_SLOTS 32
+#define CACHE_MAX_BYTES (64 * 1024 * 1024)
+#define CACHE_TTL_SECONDS 60 // listings not used for this long are dropped
+
+struct entry
+{
+  uint32_t name; // offset in the listing's names
+  uint32_t len;
+  unsigned char type; // DT_*, DT_UNKNOWN if the filesystem does not say
+};
+
+struct listing
+{
+  char *names; // NULL for an empty slot
+  struct entry *entries;
+  size_t num_entries;
+  size_t bytes;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  bool trusted; // taken long enough after the last change to be reused
+  time_t last_used;
+};
+
+static struct listing cache[CACHE_SLOTS];
+static size_t cache_bytes;
+
+// A piece of the pattern between two '/'
+struct component
+{
+  char *text; // without escapes when it has no magic
+  bool magic;
+  bool any_depth; // "**"
+};
+
+// One expansion in progress
+struct glob
+{
+  struct component *components;
+  int num_components;
+  bool dirs_only; // the pattern ended in '/'
+  char *path;     // the directory walked so far (not null terminated)
+  size_t path_size;
+  struct arena *arena; // where the matched paths go
+  char **matches;
+  size_t num_matches;
+  size_t max_matches;
+  bool failed; // out of memory
+};
+
+static void drop(struct listing *listing)
+{
+  cache_bytes -= listing->bytes;
+  free(listing->names);
+  free(listing->entries);
+  memset(listing, 0, sizeof(*listing));
+}
+
+void glob_cache_clear(void)
+{
+  for (int i = 0; i < CACHE_SLOTS; i++)
+  {
+    if (cache[i].names != NULL)
+    {
+      drop(&cache[i]);
+    }
+  }
+}
+
+// Read the directory open as 'fd' into 'listing'. returns: false on error.
+static bool read_listing(int fd, struct listing *listing)
+{
+  static char *buffer;
+  if (buffer == NULL && (buffer = malloc(DENTS_BUFFER_SIZE)) == NULL)
+  {
+    return false;
+  }
+  size_t names_size = 4096, names_used = 0;
+  size_t max_entries = 256;
+  listing->names = malloc(names_size);
+  listing->entries = malloc(max_entries * sizeof(struct entry));
+  listing->num_entries = 0;
+
+  ssize_t n = 0;
+  while (listing->names != NULL && listing->entries != NULL &&
+         (n = getdents64(fd, buffer, DENTS_BUFFER_SIZE)) > 0)
+  {
+    for (ssize_t off = 0; off < n;)
+    {
+      struct dirent64 *dent = (struct dirent64 *)(buffer + off);
+      off += dent->d_reclen;
+      const char *name = dent->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      {
+        continue;
+      }
+      size_t len = strlen(name);
+      if (names_used + len + 1 > names_size)
+      {
+        while (names_used + len + 1 > names_size)
+        {
+          names_size *= 2;
+        }
+        char *grown = realloc(listing->names, names_size);
+        if (grown == NULL)
+        {
+          n = -1;
+          break;
+        }
+        listing->names = grown;
+      }
+      if (listing->num_entries == max_entries)
+      {
+        max_entries *= 2;
+        struct entry *grown = realloc(listing->entries, max_entries * sizeof(struct entry));
+        if (grown == NULL)
+        {
+          n = -1;
+          break;
+        }
+        listing->entries = grown;
+      }
+      memcpy(listing->names + names_used, name, len + 1);
+      listing->entries[listing->num_entries++] = (struct entry){names_used, len, dent->d_type};
+      names_used += len + 1;
+    }
+    if (n < 0)
+    {
+      break;
+    }
+  }
+  if (listing->names == NULL || listing->entries == NULL || n < 0)
+  {
+    free(listing->names);
+    free(listing->entries);
+    listing->names = NULL;
+    return false;
+  }
+  listing->bytes = names_size + max_entries * sizeof(struct entry);
+  return true;
+}
+
+/*
+ * The entries of directory 'path' ("" for the current one), from
+ * the cache when the directory has not changed since it was read.
+ * returns: the listing, or NULL if it cannot be read.
+ */
+static struct listing *get_listing(const char *path)
+{
+  const char *dir = path[0] != '\0' ? path : ".";
+  struct stat st;
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+  {
+    return NULL;
+  }
+
+  // the slot for this directory, or else an empty or the least recently
+  // used one
+  struct listing *slot = NULL;
+  for (int i = 0; i < CACHE_SLOTS; i++)
+  {
+    struct listing *listing = &cache[i];
+    if (listing->names != NULL && now.tv_sec - listing->last_used > CACHE_TTL_SECONDS)
+    {
+      drop(listing);
+    }
+    if (listing->names != NULL && listing->dev == st.st_dev && listing->ino == st.st_ino)
+    {
+      slot = listing;
+      break;
+    }
+    if (slot == NULL || (slot->names != NULL &&
+                         (listing->names == NULL || listing->last_used < slot->last_used)))
+    {
+      slot = listing;
+    }
+  }
+  if (slot->names != NULL && slot->dev == st.st_dev && slot->ino == st.st_ino &&
+      slot->trusted && slot->mtime.tv_sec == st.st_mtim.tv_sec &&
+      slot->mtime.tv_nsec == st.st_mtim.tv_nsec)
+  {
+    slot->last_used = now.tv_sec;
+    return slot;
+  }
+
+  if (slot->names != NULL)
+  {
+    drop(slot);
+  }
+  // what was read is described by the open directory, not the stat() above
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  bool read = fd >= 0 && fstat(fd, &st) == 0 && read_listing(fd, slot);
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  if (!read)
+  {
+    return NULL;
+  }
+  slot->dev = st.st_dev;
+  slot->ino = st.st_ino;
+  slot->mtime = st.st_mtim;
+  slot->trusted = now.tv_sec - st.st_mtim.tv_sec > 1;
+  slot->last_used = now.tv_sec;
+  cache_bytes += slot->bytes;
+
+  // keep the cache within its budget, the oldest listings going first
+  while (cache_bytes > CACHE_MAX_BYTES)
+  {
+    struct listing *oldest = NULL;
+    for (int i = 0; i < CACHE_SLOTS; i++)
+    {
+      if (cache[i].names != NULL && &cache[i] != slot &&
+          (oldest == NULL || cache[i].last_used < oldest->last_used))
+      {
+        oldest = &cache[i];
+      }
+    }
+    if (oldest == NULL)
+    {
+      break;
+    }
+    drop(oldest);
+  }
+  return slot;
+}
+
+/*
+ * Match one character against the bracket expression at p[0] == '['.
+ * next: set to just past its closing ']'.
+ * returns: 1 if c is in the set, 0 if not, -1 if there is no closing ']'
+ *          (then the '[' is an ordinary character).
+ */
+static int match_bracket(const char *p, unsigned char c, const char **next)
+{
+  p++;
+  bool negate = *p == '!' || *p == '^';
+  if (negate)
+  {
+    p++;
+  }
+  bool found = false;
+  bool first = true;
+  while (*p != ']' || first)
+  {
+    first = false;
+    if (*p == '\0')
+    {
+      return -1;
+    }
+    if (p[0] == '[' && p[1] == ':')
+    {
+      const char *end = strstr(p + 2, ":]");
+      if (end != NULL)
+      {
+        size_t len = end - (p + 2);
+        static const struct
+        {
+          const char *name;
+          int (*test)(int);
+        } classes[] = {{"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+                       {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+                       {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+                       {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit}};
+        for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+        {
+          if (strlen(classes[i].name) == len && strncmp(classes[i].name, p + 2, len) == 0)
+          {
+            found |= classes[i].test(c) != 0;
+          }
+        }
+        p = end + 2;
+        continue;
+      }
+    }
+    if (*p == '\\' && p[1] != '\0')
+    {
+      p++;
+    }
+    unsigned char low = *p++;
+    unsigned char high = low;
+    if (p[0] == '-' && p[1] != ']' && p[1] != '\0')
+    {
+      p++;
+      if (*p == '\\' && p[1] != '\0')
+      {
+        p++;
+      }
+      high = *p++;
+    }
+    found |= c >= low && c <= high;
+  }
+  *next = p + 1;
+  return found != negate;
+}
+
+// Match a whole name against a component pattern
+static bool match(const char *p, const char *s)
+{
+  // where to resume after the last '*': it swallows one more character
+  const char *star_p = NULL;
+  const char *star_s = NULL;
+  while (*s != '\0')
+  {
+    const char *next;
+    int in_set;
+    if (*p == '*')
+    {
+      star_p = ++p;
+      star_s = s;
+      continue;
+    }
+    if (*p == '?')
+    {
+      p++;
+      s++;
+      continue;
+    }
+    if (*p == '[' && (in_set = match_bracket(p, *s, &next)) >= 0)
+    {
+      if (in_set)
+      {
+        p = next;
+        s++;
+        continue;
+      }
+    }
+    else
+    {
+      const char *literal = *p == '\\' && p[1] != '\0' ? p + 1 : p;
+      if (*literal == *s)
+      {
+        p = literal + 1;
+        s++;
+        continue;
+      }
+    }
+    if (star_p == NULL)
+    {
+      return false;
+    }
+    p = star_p;
+    s = ++star_s;
+  }
+  while (*p == '*')
+  {
+    p++;
+  }
+  return *p == '\0';
+}
+
+bool glob_has_magic(const char *pattern)
+{
+  for (const char *p = pattern; *p != '\0'; p++)
+  {
+    const char *next;
+    if (*p == '\\' && p[1] != '\0')
+    {
+      p++;
+    }
+    else if (*p == '*' || *p == '?' || (*p == '[' && match_bracket(p, 'a', &next) >= 0))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Remove the escapes from a component without magic, in place
+static void unescape(char *s)
+{
+  char *out = s;
+  for (; *s != '\0'; s++)
+  {
+    if (*s == '\\' && s[1] != '\0')
+    {
+      s++;
+    }
+    *out++ = *s;
+  }
+  *out = '\0';
+}
+
+// Append 'name' to the path walked so far. returns: the new length.
+static size_t path_append(struct glob *g, size_t len, const char *name, size_t name_len)
+{
+  bool slash = len > 0 && g->path[len - 1] != '/';
+  if (len + slash + name_len + 2 > g->path_size)
+  {
+    size_t size = (len + slash + name_len + 2) * 2;
+    char *grown = realloc(g->path, size);
+    if (grown == NULL)
+    {
+      g->failed = true;
+      return len;
+    }
+    g->path = grown;
+    g->path_size = size;
+  }
+  if (slash)
+  {
+    g->path[len++] = '/';
+  }
+  memcpy(g->path + len, name, name_len);
+  len += name_len;
+  g->path[len] = '\0';
+  return len;
+}
+
+static void add_match(struct glob *g, size_t len)
+{
+  if (g->num_matches == g->max_matches)
+  {
+    size_t max = g->max_matches ? g->max_matches * 2 : 64;
+    char **grown = realloc(g->matches, max * sizeof(char *));
+    if (grown == NULL)
+    {
+      g->failed = true;
+      return;
+    }
+    g->matches = grown;
+    g->max_matches = max;
+  }
+  if (g->dirs_only)
+  {
+    g->path[len++] = '/';
+  }
+  char *match = arena_strndup(g->arena, g->path, len);
+  if (match == NULL)
+  {
+    g->failed = true;
+    return;
+  }
+  g->matches[g->num_matches++] = match;
+}
+
+// Whether the path walked so far, 'len' bytes, names a directory.
+// follow: follow a symbolic link at the end.
+static bool is_dir(struct glob *g, size_t len, unsigned char type, bool follow)
+{
+  if (type == DT_DIR || (type != DT_UNKNOWN && type != DT_LNK) || (type == DT_LNK && !follow))
+  {
+    return type == DT_DIR;
+  }
+  struct stat st;
+  g->path[len] = '\0';
+  return (follow ? stat(g->path, &st) : lstat(g->path, &st)) == 0 && S_ISDIR(st.st_mode);
+}
+
+// A directory entry picked for walking below it
+struct picked
+{
+  char *name;
+  uint32_t len;
+  unsigned char type;
+};
+
+/*
+ * The entries of the directory walked so far that 'component' matches
+ * (NULL for every entry not starting with '.'), copied: walking below
+ * them may evict the listing.
+ * returns: the entries (free with free_picked()), NULL if there are none.
+ */
+static struct picked *pick(struct glob *g, size_t len, const char *component, size_t *count)
+{
+  *count = 0;
+  g->path[len] = '\0';
+  struct listing *listing = get_listing(g->path);
+  if (listing == NULL || listing->num_entries == 0)
+  {
+    return NULL;
+  }
+  struct picked *picked = malloc(listing->num_entries * sizeof(struct picked));
+  if (picked == NULL)
+  {
+    g->failed = true;
+    return NULL;
+  }
+  bool dot = component != NULL && component[0] == '.';
+  for (size_t i = 0; i < listing->num_entries; i++)
+  {
+    const struct entry *entry = &listing->entries[i];
+    const char *name = listing->names + entry->name;
+    if ((name[0] == '.' && !dot) || (component != NULL && !match(component, name)))
+    {
+      continue;
+    }
+    char *copy = strndup(name, entry->len);
+    if (copy == NULL)
+    {
+      g->failed = true;
+      break;
+    }
+    picked[(*count)++] = (struct picked){copy, entry->len, entry->type};
+  }
+  return picked;
+}
+
+static void free_picked(struct picked *picked, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    free(picked[i].name);
+  }
+  free(picked);
+}
+
+static void walk(struct glob *g, size_t len, int c);
+
+// A '**' component at 'c': zero or more directories below the path so far
+static void walk_any_depth(struct glob *g, size_t len, int c)
+{
+  bool last = c == g->num_components - 1;
+  if (!last)
+  {
+    walk(g, len, c + 1);
+  }
+  size_t count;
+  struct picked *picked = pick(g, len, NULL, &count);
+  for (size_t i = 0; i < count && !g->failed; i++)
+  {
+    size_t sub = path_append(g, len, picked[i].name, picked[i].len);
+    bool dir = is_dir(g, sub, picked[i].type, false);
+    if (last && (!g->dirs_only || dir))
+    {
+      add_match(g, sub);
+    }
+    if (dir)
+    {
+      walk_any_depth(g, sub, c);
+    }
+  }
+  free_picked(picked, count);
+}
+
+/*
+ * The last component, with wildcards: add the matching entries straight
+ * from the listing. "*suffix" (eg. "*.log") is checked with one memcmp()
+ * per entry instead of the matcher.
+ */
+static void match_last(struct glob *g, size_t len, const char *component)
+{
+  g->path[len] = '\0';
+  struct listing *listing = get_listing(g->path);
+  if (listing == NULL)
+  {
+    return;
+  }
+  bool dot = component[0] == '.';
+  const char *suffix = component[0] == '*' && strpbrk(component + 1, "*?[\\") == NULL
+                           ? component + 1
+                           : NULL;
+  size_t suffix_len = suffix != NULL ? strlen(suffix) : 0;
+  for (size_t i = 0; i < listing->num_entries && !g->failed; i++)
+  {
+    const struct entry *entry = &listing->entries[i];
+    const char *name = listing->names + entry->name;
+    if (name[0] == '.' && !dot)
+    {
+      continue;
+    }
+    if (suffix != NULL ? entry->len >= suffix_len &&
+                             memcmp(name + entry->len - suffix_len, suffix, suffix_len) == 0
+                       : match(component, name))
+    {
+      size_t sub = path_append(g, len, name, entry->len);
+      if (!g->dirs_only || is_dir(g, sub, entry->type, true))
+      {
+        add_match(g, sub);
+      }
+    }
+  }
+}
+
+// Match components c.. below the path walked so far ('len' bytes)
+static void walk(struct glob *g, size_t len, int c)
+{
+  const struct component *component = &g->components[c];
+  bool last = c == g->num_components - 1;
+  if (g->failed)
+  {
+    return;
+  }
+  if (component->any_depth)
+  {
+    walk_any_depth(g, len, c);
+  }
+  else if (!component->magic)
+  {
+    size_t sub = path_append(g, len, component->text, strlen(component->text));
+    struct stat st;
+    if (!last)
+    {
+      walk(g, sub, c + 1);
+    }
+    else if (lstat(g->path, &st) == 0 && (!g->dirs_only || is_dir(g, sub, DT_UNKNOWN, true)))
+    {
+      add_match(g, sub);
+    }
+  }
+  else if (last)
+  {
+    match_last(g, len, component->text);
+  }
+  else
+  {
+    size_t count;
+    struct picked *picked = pick(g, len, component->text, &count);
+    for (size_t i = 0; i < count && !g->failed; i++)
+    {
+      size_t sub = path_append(g, len, picked[i].name, picked[i].len);
+      if (is_dir(g, sub, picked[i].type, true))
+      {
+        walk(g, sub, c + 1);
+      }
+    }
+    free_picked(picked, count);
+  }
+}
+
+static int compare_matches(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+char **glob_expand(const char *pattern, struct arena *arena, size_t *count)
+{
+  *count = 0;
+  size_t len = strlen(pattern);
+  char *copy = strdup(pattern);
+  struct component *components = malloc((len / 2 + 2) * sizeof(struct component));
+  struct glob g = {components, 0, false, malloc(256), 256, arena, NULL, 0, 0, false};
+  if (copy == NULL || components == NULL || g.path == NULL)
+  {
+    free(copy);
+    free(components);
+    free(g.path);
+    return NULL;
+  }
+
+  // "/abs/path" starts at the root; "dir/" only matches directories
+  size_t path_len = 0;
+  char *p = copy;
+  if (*p == '/')
+  {
+    g.path[path_len++] = '/';
+    while (*p == '/')
+    {
+      p++;
+    }
+  }
+  while (len > 0 && copy[len - 1] == '/' && &copy[len - 1] >= p)
+  {
+    copy[--len] = '\0';
+    g.dirs_only = true;
+  }
+  for (char *start = p; start != NULL && *p != '\0';)
+  {
+    char *slash = strchr(start, '/');
+    if (slash != NULL)
+    {
+      *slash = '\0';
+    }
+    if (*start != '\0') // "a//b" is "a/b"
+    {
+      struct component *component = &components[g.num_components++];
+      component->text = start;
+      component->any_depth = strcmp(start, "**") == 0;
+      component->magic = glob_has_magic(start);
+      if (!component->magic)
+      {
+        unescape(start);
+      }
+    }
+    start = slash != NULL ? slash + 1 : NULL;
+  }
+
+  if (g.num_components > 0)
+  {
+    walk(&g, path_len, 0);
+  }
+
+  char **result = NULL;
+  if (!g.failed && g.num_matches > 0)
+  {
+    qsort(g.matches, g.num_matches, sizeof(char *), compare_matches);
+    result = arena_alloc(arena, (g.num_matches + 1) * sizeof(char *));
+  }
+  if (result != NULL)
+  {
+    memcpy(result, g.matches, g.num_matches * sizeof(char *));
+    result[g.num_matches] = NULL;
+    *count = g.num_matches;
+  }
+  free(g.matches);
+  free(g.path);
+  free(components);
+  free(copy);
+  return result;
+}
@@ -0,0 +1,41 @@
+// Pathname expansion: words like *.log or src/**/*.c become the sorted
+// list of paths they match.
+
+#ifndef PATHGLOB_H
+#define PATHGLOB_H
+
+#include "arena.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Whether 'pattern' has anything to expand: an unescaped '*' or '?', or a
+ * '[' with its closing ']'. A '\' makes the character after it literal.
+ */
+bool glob_has_magic(const char *pattern);
+
+/*
+ * Expand 'pattern' into the paths it matches, as sh does:
+ * - '*' matches any string and '?' any one character, '[...]' one
+ *   character of a set ("[a-z]", "[!0-9]", "[[:digit:]]");
+ * - a '**' component matches any number of directories (not following
+ *   symbolic links): src, '**' and '*.c' joined by slashes finds the .c
+ *   files at every depth below src;
+ * - names starting with '.' only match a pattern starting with '.', and
+ *   '.' and '..' never match;
+ * - a trailing '/' only matches directories.
+ * Directory listings are cached for a while and checked against the
+ * directory's mtime on every use, so globbing the same large directory
+ * again does not read it again unless it changed.
+ * arena: where the matches and the array are allocated.
+ * count: set to the number of matches.
+ * returns: the matches sorted by name, or NULL if there are none (or
+ *          out of memory).
+ */
+char **glob_expand(const char *pattern, struct arena *arena, size_t *count);
+
+// Drop every cached directory listing.
+void glob_cache_clear(void);
+
+#endif
@@ -0,0 +1,235 @@
+// Command name -> absolute path cache (the `hash` table).
+//
+// execvp() walks every $PATH directory and makes a failing execve() for
+// each miss, every time a command runs. Scripts run the same few programs
+// over and over, so resolve each name once and exec the cached path.
+
+#include "pathhash.h"
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INITIAL_SLOTS 64
+
+struct path_entry
+{
+  char *name; // NULL for an empty slot
+  char *path; // NULL once invalidated, re-resolved on next lookup
+  unsigned hits;
+};
+
+static struct path_entry *slots;
+static size_t num_slots;
+static size_t num_used;
+
+#define DEFAULT_PATH "/usr/local/bin:/bin:/usr/bin"
+
+// Copy of $PATH the table is built against, NULL until it is first needed
+static char *table_path;
+
+static uint32_t hash_name(const char *name)
+{
+  uint32_t h = 2166136261u;
+  for (; *name; name++)
+  {
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  }
+  return h;
+}
+
+static struct path_entry *find_slot(struct path_entry *table, size_t size,
+                                    const char *name)
+{
+  size_t i = hash_name(name) & (size - 1);
+  while (table[i].name != NULL && strcmp(table[i].name, name) != 0)
+  {
+    i = (i + 1) & (size - 1);
+  }
+  return &table[i];
+}
+
+static bool grow(void)
+{
+  size_t new_size = num_slots ? num_slots * 2 : INITIAL_SLOTS;
+  struct path_entry *table = calloc(new_size, sizeof(*table));
+  if (table == NULL)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < num_slots; i++)
+  {
+    if (slots[i].name != NULL)
+    {
+      *find_slot(table, new_size, slots[i].name) = slots[i];
+    }
+  }
+  free(slots);
+  slots = table;
+  num_slots = new_size;
+  return true;
+}
+
+void path_hash_clear(void)
+{
+  for (size_t i = 0; i < num_slots; i++)
+  {
+    free(slots[i].name);
+    free(slots[i].path);
+    slots[i].name = NULL;
+    slots[i].path = NULL;
+  }
+  num_used = 0;
+}
+
+void path_hash_set_path(const char *path_var)
+{
+  path_hash_clear();
+  free(table_path);
+  table_path = strdup(path_var != NULL ? path_var : DEFAULT_PATH);
+}
+
+static bool is_executable(const char *path)
+{
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+// Walk $PATH like execvp() does; returns a malloc'd path or NULL.
+static char *search_path(const char *name, const char *path_var)
+{
+  size_t name_len = strlen(name);
+  const char *dir = path_var;
+  while (true)
+  {
+    const char *end = strchr(dir, ':');
+    size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+    // an empty element means the current directory
+    char *candidate = malloc(dir_len + name_len + 3);
+    if (candidate == NULL)
+    {
+      return NULL;
+    }
+    if (dir_len == 0)
+    {
+      candidate[0] = '.';
+      dir_len = 1;
+    }
+    else
+    {
+      memcpy(candidate, dir, dir_len);
+    }
+    candidate[dir_len] = '/';
+    memcpy(candidate + dir_len + 1, name, name_len + 1);
+
+    if (is_executable(candidate))
+    {
+      return candidate;
+    }
+    free(candidate);
+
+    if (end == NULL)
+    {
+      return NULL;
+    }
+    dir = end + 1;
+  }
+}
+
+static const char *lookup(const char *name)
+{
+  if (strchr(name, '/') != NULL)
+  {
+    errno = 0;
+    return NULL;
+  }
+
+  if (table_path == NULL)
+  {
+    path_hash_set_path(getenv("PATH"));
+    if (table_path == NULL)
+    {
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+
+  if ((num_used + 1) * 4 > num_slots * 3 && !grow())
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  struct path_entry *entry = find_slot(slots, num_slots, name);
+  if (entry->name != NULL && entry->path != NULL)
+  {
+    if (access(entry->path, X_OK) == 0)
+    {
+      entry->hits++;
+      METRIC_COUNT(PATH_HITS);
+      return entry->path;
+    }
+    // the binary was moved or deleted: resolve it again
+    free(entry->path);
+    entry->path = NULL;
+  }
+
+  METRIC_COUNT(PATH_MISSES);
+  char *path = search_path(name, table_path);
+  if (path == NULL)
+  {
+    errno = ENOENT;
+    return NULL;
+  }
+  if (entry->name == NULL)
+  {
+    entry->name = strdup(name);
+    num_used++;
+  }
+  entry->path = path;
+  entry->hits = 1;
+  return path;
+}
+
+const char *path_hash_lookup(const char *name)
+{
+  METRIC_START(start);
+  const char *path = lookup(name);
+  METRIC_STOP(PATH_LOOKUP, start);
+  return path;
+}
+
+void path_hash_print(int fd)
+{
+  char line[4096];
+  bool empty = true;
+  for (size_t i = 0; i < num_slots; i++)
+  {
+    if (slots[i].name == NULL || slots[i].path == NULL)
+    {
+      continue;
+    }
+    if (empty)
+    {
+      write(fd, "hits\tcommand\n", strlen("hits\tcommand\n"));
+      empty = false;
+    }
+    int len = snprintf(line, sizeof(line), "%4u\t%s\n", slots[i].hits, slots[i].path);
+    if (len > (int)sizeof(line) - 1)
+    {
+      len = sizeof(line) - 1;
+    }
+    write(fd, line, len);
+  }
+  if (empty)
+  {
+    write(fd, "hash: hash table empty\n", strlen("hash: hash table empty\n"));
+  }
+}
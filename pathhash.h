@@ -0,0 +1,32 @@
+// Command name -> absolute path cache (the `hash` table).
+
+#ifndef PATHHASH_H
+#define PATHHASH_H
+
+#include <stdbool.h>
+
+/*
+ * Resolve 'name' against $PATH, remembering the result so later lookups
+ * skip the directory walk. The table is flushed whenever $PATH changes
+ * (path_hash_set_path()) and an entry is re-resolved if its file no longer
+ * exists.
+ * returns: absolute path (owned by the table, valid until the next call),
+ *          or NULL with errno set if the command cannot be found.
+ *          Names containing a '/' are never looked up: NULL, errno = 0.
+ */
+const char *path_hash_lookup(const char *name);
+
+/*
+ * Search 'path_var' ($PATH, NULL for the default) from now on, forgetting
+ * every remembered location. Until this is called, $PATH is read with
+ * getenv() on the first lookup.
+ */
+void path_hash_set_path(const char *path_var);
+
+// Forget every remembered location (`hash -r`).
+void path_hash_clear(void);
+
+// Print the table in `hash` format ("hits<TAB>path") to fd.
+void path_hash_print(int fd);
+
+#endif
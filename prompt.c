@@ -0,0 +1,199 @@
+// Interactive prompt, drawn from a PS1 style format.
+//
+// The format is parsed once into a list of pieces: literal text (with the
+// escapes that never change, like \u and \h, already filled in) and the
+// few dynamic values. Drawing a prompt is then a handful of memcpy()s into
+// one buffer, written out with a single write().
+
+#include "prompt.h"
+
+#include "cwd.h"
+
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_FORMAT "\\w$ "
+
+enum piece_type
+{
+  PIECE_TEXT,
+  PIECE_CWD,
+  PIECE_CWD_BASE,
+  PIECE_STATUS,
+};
+
+struct piece
+{
+  enum piece_type type;
+  size_t offset; // PIECE_TEXT: the text is text[offset, offset + len)
+  size_t len;
+};
+
+// The parsed format
+static struct piece *pieces;
+static size_t num_pieces;
+static char *text;
+static size_t text_len;
+static bool parsed;
+
+// The last rendered prompt
+static char *rendered;
+static size_t rendered_size;
+
+static void add_piece(enum piece_type type)
+{
+  pieces[num_pieces++] = (struct piece){type, text_len, 0};
+}
+
+// Append literal text, extending the previous text piece when there is one
+static void add_text(const char *s, size_t len)
+{
+  if (num_pieces == 0 || pieces[num_pieces - 1].type != PIECE_TEXT)
+  {
+    add_piece(PIECE_TEXT);
+  }
+  memcpy(text + text_len, s, len);
+  text_len += len;
+  pieces[num_pieces - 1].len += len;
+}
+
+void prompt_set_format(const char *format)
+{
+  if (format == NULL)
+  {
+    format = DEFAULT_FORMAT;
+  }
+
+  char user[256] = "";
+  char host[256] = "";
+  struct passwd *pw = getpwuid(geteuid());
+  if (pw != NULL)
+  {
+    snprintf(user, sizeof(user), "%s", pw->pw_name);
+  }
+  gethostname(host, sizeof(host) - 1);
+
+  // every escape expands to at most one of the strings above or two chars
+  size_t format_len = strlen(format);
+  size_t longest = strlen(user) > strlen(host) ? strlen(user) : strlen(host);
+  free(pieces);
+  free(text);
+  pieces = malloc((format_len + 1) * sizeof(struct piece));
+  text = malloc(format_len * (longest + 2) + 1);
+  num_pieces = text_len = 0;
+  parsed = pieces != NULL && text != NULL;
+  if (!parsed)
+  {
+    return;
+  }
+
+  for (const char *p = format; *p != '\0'; p++)
+  {
+    if (p[0] != '\\' || p[1] == '\0')
+    {
+      add_text(p, 1);
+      continue;
+    }
+    switch (*++p)
+    {
+    case 'w':
+      add_piece(PIECE_CWD);
+      break;
+    case 'W':
+      add_piece(PIECE_CWD_BASE);
+      break;
+    case '?':
+      add_piece(PIECE_STATUS);
+      break;
+    case 'u':
+      add_text(user, strlen(user));
+      break;
+    case 'H':
+      add_text(host, strlen(host));
+      break;
+    case 'h':
+      add_text(host, strcspn(host, "."));
+      break;
+    case '$':
+      add_text(geteuid() == 0 ? "#" : "$", 1);
+      break;
+    case 'n':
+      add_text("\n", 1);
+      break;
+    case 'e':
+      add_text("\033", 1);
+      break;
+    case '\\':
+      add_text("\\", 1);
+      break;
+    case '[':
+    case ']':
+      break;
+    default:
+      add_text(p - 1, 2);
+    }
+  }
+}
+
+const char *prompt_render(int last_status, size_t *len)
+{
+  if (!parsed)
+  {
+    prompt_set_format(getenv("PS1"));
+  }
+
+  const char *cwd = cwd_get();
+  size_t cwd_len = cwd_length();
+  const char *base = strrchr(cwd, '/');
+  base = base == NULL || base[1] == '\0' ? cwd : base + 1;
+  char status[16];
+  size_t status_len = snprintf(status, sizeof(status), "%d", last_status);
+
+  size_t need = text_len + 1;
+  for (size_t i = 0; i < num_pieces; i++)
+  {
+    need += pieces[i].type == PIECE_TEXT ? 0 : pieces[i].type == PIECE_STATUS ? status_len : cwd_len;
+  }
+  if (need > rendered_size)
+  {
+    char *grown = realloc(rendered, need);
+    if (grown == NULL)
+    {
+      *len = 0;
+      return "";
+    }
+    rendered = grown;
+    rendered_size = need;
+  }
+
+  char *out = rendered;
+  for (size_t i = 0; i < num_pieces; i++)
+  {
+    switch (pieces[i].type)
+    {
+    case PIECE_TEXT:
+      memcpy(out, text + pieces[i].offset, pieces[i].len);
+      out += pieces[i].len;
+      break;
+    case PIECE_CWD:
+      memcpy(out, cwd, cwd_len);
+      out += cwd_len;
+      break;
+    case PIECE_CWD_BASE:
+      memcpy(out, base, cwd + cwd_len - base);
+      out += cwd + cwd_len - base;
+      break;
+    case PIECE_STATUS:
+      memcpy(out, status, status_len);
+      out += status_len;
+      break;
+    }
+  }
+  *out = '\0';
+  *len = out - rendered;
+  return rendered;
+}
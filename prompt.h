@@ -0,0 +1,30 @@
+// Interactive prompt, drawn from a PS1 style format.
+
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <stddef.h>
+
+/*
+ * Parse the prompt format once; later renders only copy the pieces out.
+ * Escapes:
+ *   \w  working directory     \W  its last component
+ *   \u  user name             \h  host name up to the first '.'
+ *   \H  host name             \$  '#' for root, else '$'
+ *   \?  exit status of the last command
+ *   \n  newline   \e  escape (for colors)   \\  backslash
+ *   \[ \]  ignored (bash's non-printing markers)
+ * Any other character, or unknown escape, is shown as is.
+ * format: the format, or NULL for the default "\w$ ".
+ */
+void prompt_set_format(const char *format);
+
+/*
+ * Render the prompt for the current directory (see cwd.h).
+ * last_status: value shown by \? (exit code, 128+n for signal n).
+ * returns: the prompt text, valid until the next call, and its length in
+ *          *len, ready for a single write().
+ */
+const char *prompt_render(int last_status, size_t *len);
+
+#endif
@@ -0,0 +1,172 @@
+// I/O redirections of a command.
+//
+// Redirections are resolved in the shell, not in the child: every target
+// ends up as a descriptor of ours in a struct stage_fds, which spawn_io
+// dup2()s onto 0-2 in the child (this works the same for every spawn
+// method), and which builtins running inside the shell borrow for the
+// duration of the builtin.
+
+#include "redirect.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Descriptors are moved at least this high so they never collide with 0-2
+#define FIRST_PRIVATE_FD 10
+
+// Point slot 'fd' of 'io' at 'new_fd' (owned), closing what it owned before
+static void set_fd(struct stage_fds *io, int fd, int new_fd)
+{
+  if (io->owned[fd])
+  {
+    close(io->fds[fd]);
+  }
+  io->fds[fd] = new_fd;
+  io->owned[fd] = true;
+}
+
+static void open_error(const char *path)
+{
+  char msg[512];
+  int len = snprintf(msg, sizeof(msg), "ERROR: %s: %s.\n", path, strerror(errno));
+  if (len > (int)sizeof(msg) - 1)
+  {
+    len = sizeof(msg) - 1;
+  }
+  write(STDERR_FILENO, msg, len);
+}
+
+// returns: false with errno set if not all of 'text' could be written
+static bool write_all(int fd, const char *text, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, text, len);
+    if (n < 0 && errno != EINTR)
+    {
+      return false;
+    }
+    if (n > 0)
+    {
+      text += n;
+      len -= n;
+    }
+  }
+  return true;
+}
+
+/*
+ * An anonymous memory file holding 'text' (and a newline after it with
+ * 'newline'), read from its start.
+ * returns: the descriptor (O_CLOEXEC), or -1 with errno set.
+ */
+static int document_fd(const char *text, bool newline)
+{
+  int fd = memfd_create("here-document", MFD_CLOEXEC);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  if (!write_all(fd, text, strlen(text)) || (newline && !write_all(fd, "\n", 1)) ||
+      lseek(fd, 0, SEEK_SET) < 0)
+  {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+bool redirect_open(struct stage_fds *io, const struct redirect redirects[], int num_redirects)
+{
+  for (int i = 0; i < num_redirects; i++)
+  {
+    const struct redirect *r = &redirects[i];
+    int new_fd;
+    if (r->type == REDIRECT_DUP)
+    {
+      // copy what 'dup_fd' is right now: a redirected target or ours
+      int source = io->fds[r->dup_fd] >= 0 ? io->fds[r->dup_fd] : r->dup_fd;
+      new_fd = fcntl(source, F_DUPFD_CLOEXEC, FIRST_PRIVATE_FD);
+      if (new_fd < 0)
+      {
+        char name[16];
+        snprintf(name, sizeof(name), "%d", r->dup_fd);
+        open_error(name);
+        return false;
+      }
+    }
+    else
+    {
+      int flags = r->type == REDIRECT_IN       ? O_RDONLY
+                  : r->type == REDIRECT_APPEND ? O_WRONLY | O_CREAT | O_APPEND
+                                               : O_WRONLY | O_CREAT | O_TRUNC;
+      bool document = r->type == REDIRECT_HEREDOC || r->type == REDIRECT_HERESTRING;
+      int opened = document ? document_fd(r->path, r->type == REDIRECT_HERESTRING)
+                            : open(r->path, flags | O_CLOEXEC, 0666);
+      const char *name = document ? "here-document" : r->path;
+      if (opened < 0)
+      {
+        open_error(name);
+        return false;
+      }
+      new_fd = opened;
+      if (opened < FIRST_PRIVATE_FD)
+      {
+        new_fd = fcntl(opened, F_DUPFD_CLOEXEC, FIRST_PRIVATE_FD);
+        close(opened);
+        if (new_fd < 0)
+        {
+          open_error(name);
+          return false;
+        }
+      }
+    }
+    set_fd(io, r->fd, new_fd);
+  }
+  return true;
+}
+
+void redirect_release(struct stage_fds *io)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    if (io->owned[i])
+    {
+      close(io->fds[i]);
+      io->owned[i] = false;
+      io->fds[i] = -1;
+    }
+  }
+}
+
+void redirect_enter(const struct stage_fds *io, int saved[3])
+{
+  for (int i = 0; i < 3; i++)
+  {
+    saved[i] = -1;
+    if (io->fds[i] >= 0 && io->fds[i] != i)
+    {
+      saved[i] = fcntl(i, F_DUPFD_CLOEXEC, FIRST_PRIVATE_FD);
+      dup2(io->fds[i], i);
+    }
+  }
+}
+
+void redirect_leave(int saved[3])
+{
+  for (int i = 0; i < 3; i++)
+  {
+    if (saved[i] >= 0)
+    {
+      dup2(saved[i], i);
+      close(saved[i]);
+      saved[i] = -1;
+    }
+  }
+}
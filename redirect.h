@@ -0,0 +1,57 @@
+// I/O redirections of a command: < > >> n>&m n<&m, here-documents and
+// here-strings.
+
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#include <stdbool.h>
+
+enum redirect_type
+{
+  REDIRECT_IN,     // n<file  (n defaults to 0)
+  REDIRECT_OUT,    // n>file  (n defaults to 1)
+  REDIRECT_APPEND, // n>>file (n defaults to 1)
+  REDIRECT_DUP,    // n>&m or n<&m: n becomes a copy of m
+  REDIRECT_HEREDOC,    // n<<word: n reads the document in 'path'
+  REDIRECT_HERESTRING, // n<<<word: n reads 'path' and a newline
+};
+
+struct redirect
+{
+  enum redirect_type type;
+  int fd;           // descriptor redirected, 0-2
+  const char *path; // file for REDIRECT_IN/OUT/APPEND, text for the others
+  int dup_fd;       // REDIRECT_DUP: descriptor copied, 0-2
+};
+
+// Where descriptors 0-2 of a command end up
+struct stage_fds
+{
+  int fds[3];    // fds[i] becomes descriptor i, -1 to keep the shell's
+  bool owned[3]; // fds[i] was opened for a redirection: close it after
+};
+
+/*
+ * Apply 'redirects' in order on top of 'io' (set up by the caller for
+ * pipes): files are opened and n>&m copied, all O_CLOEXEC and owned by
+ * 'io'. Here-documents are written to a memfd, so no temporary file
+ * touches the disk and a document of any size is there before the command
+ * starts reading. So ">out 2>&1" sends both to out, "2>&1 >out" only stdout.
+ * returns: false (with an error printed) if a file cannot be opened; what
+ *          was opened so far is still in 'io' for redirect_release().
+ */
+bool redirect_open(struct stage_fds *io, const struct redirect redirects[], int num_redirects);
+
+// Close the descriptors redirect_open() opened.
+void redirect_release(struct stage_fds *io);
+
+/*
+ * Make the shell's own descriptors 0-2 those of 'io' while a builtin runs
+ * inside the shell, saving the originals in 'saved'.
+ */
+void redirect_enter(const struct stage_fds *io, int saved[3]);
+
+// Put back the descriptors redirect_enter() saved.
+void redirect_leave(int saved[3]);
+
+#endif
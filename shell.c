@@ -1,919 +1,2728 @@
 // Shell starter file
 // You may make any changes to any part of this file.
 
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <libgen.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include<pwd.h>
 
-#define COMMAND_LENGTH 1024
-#define NUM_TOKENS (COMMAND_LENGTH / 2 + 1)
-
-#define EXIT_HELP "'exit' is a builtin command for exiting the shell program.\n"
-#define PWD_HELP "'pwd' is a builtin command for displaying the current working directory.\n"
-#define CD_HELP "'cd' is a builtin command for changing the current working directory.\n"
-#define HIST_HELP "'history' is a builtin command for printing the 10 most recent commands.\n"
-#define HELP_HELP "'help' is a builtin command for printing information on builtin commands.\n"
+#include "arena.h"
+#include "benchmark.h"
+#include "builtins.h"
+#include "cwd.h"
+#include "events.h"
+#include "histindex.h"
+#include "histlog.h"
+#include "history.h"
+#include "input.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "metrics.h"
+#include "parallel.h"
+#include "pathglob.h"
+#include "pathhash.h"
+#include "prompt.h"
+#include "redirect.h"
+#include "spawn.h"
+#include "utilities.h"
+#include "vars.h"
+
+
+#define SEARCH_ERROR "ERROR: No command in history matches the given pattern.\n"
 #define ARG_ERROR "ERROR: More arguements were provided than expected.\n"
-#define IND_ERROR "ERROR: The given command index is either not recognized or does not match one of the 10 most recent commands.\n"
+#define IND_ERROR "ERROR: The given command index is either not recognized or does not match one of the HISTSIZE most recent commands.\n"
+
+#define JOB_ERROR "ERROR: No such job.\n"
+#define SIGNAL_ERROR "ERROR: Unknown signal.\n"
+#define PARALLEL_ERROR "usage: parallel [-j N] [-k] command [args] [{}] [::: arguments]\n"
+#define BENCH_ERROR "usage: bench [-n runs] [-w warmup] [-b] [-f text|csv|json] command [args]\n"
+#define STATS_ERROR "usage: stats [-r] [-t on|off] [-f text|prometheus|json] [-e file|unix:path|off [-i seconds]]\n"
+#define STOPPED_WARNING "There are stopped jobs.\n"
+#define SPAWN_ERROR "ERROR: Unknown or unusable SHELL_SPAWN method, using posix_spawn.\n"
+#define PIPE_ERROR "ERROR: Invalid null command in pipeline.\n"
+#define REDIRECT_ERROR "ERROR: Only descriptors 0, 1 and 2 can be redirected.\n"
+#define EXIT_ERROR "ERROR: exit takes a numeric status.\n"
+#define NAME_ERROR "ERROR: Not a valid variable name.\n"
+#define USAGE_ERROR "usage: shell [-c command | script]\n"
+#define HEREDOC_WARNING "Here-document ended before its delimiter.\n"
 
-#define AR_ERROR "Error: invalid argument .\n"
+// Kernel buffer requested for pipes a builtin writes into, so its whole
+// output can be handed over in one write() (capped by fs.pipe-max-size)
+#define PIPE_BUFFER_SIZE (1024 * 1024)
 
-#define HISTORY_DEPTH 10
-int NUM_COMMANDS = 0;
-char history[HISTORY_DEPTH][COMMAND_LENGTH];
+// true when the shell reads commands from a terminal it can hand to jobs
+_Bool shell_owns_terminal = false;
+
+#define HISTORY_SHOWN 10
 
-#define BUFFER_SIZE 1024
-static char buffer[BUFFER_SIZE];
-char buffCheck[BUFFER_SIZE];
 
 /**
  * Command Input and Processing
  */
 
-void handle_SIGINT(int sig)
+// Memory of the command being run (its line, words and stages), all
+// freed at once before the next command is read
+struct arena command_arena = ARENA_INIT;
+
+// One command of a pipeline: its words and redirections
+struct stage
+{
+  struct token **words;        // NULL terminated, as lexed
+  char **argv;                 // the words expanded (see expand_stage()); argv[0]
+                               // is NULL for a bare "> file" or "NAME=value"
+  struct redirect *redirects;  // in the order given
+  struct token **targets;      // file name of each redirection (NULL for n>&m)
+  int num_redirects;
+  char **assignments;          // the NAME=value words before argv[0], expanded
+};
+
+// A pipeline in a command list, and how it is joined to the one before
+struct pipeline
+{
+  struct stage *stages;
+  int num_stages;
+  enum token_type connector; // TOKEN_AND_IF or TOKEN_OR_IF: run only if the
+                             // status so far is zero or nonzero; else TOKEN_SEMI
+  _Bool in_background;       // the pipeline ended in '&'
+  _Bool timed;               // "time [-p]" in front: report its times
+  _Bool time_posix;          // -p: in the POSIX format
+};
+
+// A here-document whose body is still to be read, from the lines after
+// the command
+struct heredoc
+{
+  struct token **body;   // the redirection's target: the delimiter until
+                         // the body has been read
+  const char *delimiter; // the line that ends the body
+  _Bool strip_tabs;      // <<-: leading tabs are removed from every line
+  _Bool expand;          // the delimiter was not quoted: $ references and
+                         // $(...) in the body are expanded
+};
+
+// A command line split into pipelines (in the command arena)
+struct command
+{
+  struct pipeline *pipelines;
+  int num_pipelines; // 0 for a blank command or one that cannot be run
+  struct heredoc *heredocs; // in the order their bodies follow the line
+  int num_heredocs;
+  int hist_num; // its history entry, -1 if it was not added
+  long max_rss_kb; // largest max RSS of its processes, -1 if none ran (execute_command())
+};
+
+// How the last foreground command ended: wait status plus resource usage
+struct child_exit last_exit;
+
+// Wait status of the pipeline before the one running, which starts by
+// resetting last_exit: what 'exit' with no argument exits with
+int previous_status;
+
+// Wait status of the last $(command) run while expanding a pipeline, -1
+// if there was none: a command that is only assignments exits with it
+int substitution_status = -1;
+
+// true in a forked copy of the shell running the command of a $(command):
+// what it runs is not added to history
+_Bool in_subshell = false;
+
+// The exit code of a wait status, as $? shows it: 128 + the signal for a
+// command that was killed or stopped by one
+int exit_code(int status)
+{
+  return WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+         : WIFSTOPPED(status) ? 128 + WSTOPSIG(status)
+                              : WEXITSTATUS(status);
+}
+
+// HISTTIMING (any non-empty value) records in each history entry when the
+// command started, how long it took, its status and max RSS
+_Bool hist_timing = false;
+
+void set_hist_timing(const char *value)
+{
+  hist_timing = value != NULL && value[0] != '\0';
+}
+
+// HISTSIZE sets how many commands history keeps (and '!n' can reach)
+void set_hist_size(const char *value)
+{
+  if (value != NULL && value[0] != '\0' && strspn(value, "0123456789") == strlen(value))
+  {
+    hist_set_depth(strtoul(value, NULL, 10));
+  }
+}
+
+// Print the help text of every builtin, in builtins.def order
+void print_all_help(void)
+{
+  for (int i = 0; i < num_builtins; i++)
+  {
+    write(STDOUT_FILENO, builtins[i].help, strlen(builtins[i].help));
+  }
+}
+
+void handle_SIGINT(void)
 {
-  // handle SIGINT (ctrl-c) case, print out all help messages
-  signal(sig, handle_SIGINT);
+  // handle SIGINT (ctrl-c) case, print out all help messages. Called from
+  // the event loop, which reads SIGINT from a signalfd (see events.h).
   write(STDOUT_FILENO, "\n", strlen("\n"));
-  write(STDOUT_FILENO, PWD_HELP, strlen(PWD_HELP));
-  write(STDOUT_FILENO, CD_HELP, strlen(CD_HELP));
-  write(STDOUT_FILENO, EXIT_HELP, strlen(EXIT_HELP));
-  write(STDOUT_FILENO, HELP_HELP, strlen(HELP_HELP));
-  write(STDOUT_FILENO, HIST_HELP, strlen(HIST_HELP));
+  print_all_help();
+}
+
+/*
+ * Add a command to history (and the history file).
+ * returns: the number of its entry, or -1 if it cannot be found again.
+ */
+int add_to_hist(char *buff)
+{
+  size_t len = strlen(buff);
+  if (!histlog_enabled() || !histlog_append(buff, len))
+  {
+    return hist_add(buff, len);
+  }
+  // appending pulls in what other sessions wrote, maybe after ours
+  for (int num = hist_count() - 1; num >= hist_oldest(); num--)
+  {
+    if (strcmp(hist_get(num), buff) == 0)
+    {
+      return num;
+    }
+  }
+  return -1;
+}
+
+// Look up a command by number: in memory first, then in the history file
+const char *find_cmd(int cmd_num)
+{
+  return histlog_find(cmd_num);
+}
+
+// Number of the newest command matching pattern, or -1 if there is none
+int search_hist(const char *pattern, enum hist_match mode)
+{
+  int num;
+  if (histindex_search(pattern, mode, &num, 1) == 0)
+  {
+    return -1;
+  }
+  return num;
+}
+
+// print every command containing pattern, newest first
+void print_hist_matches(const char *pattern)
+{
+  int max = hist_count();
+  int *nums = malloc((max > 0 ? max : 1) * sizeof(int));
+  if (nums == NULL)
+  {
+    return;
+  }
+  int found = histindex_search(pattern, MATCH_SUBSTRING, nums, max);
+  for (int i = 0; i < found; i++)
+  {
+    char num_str[16];
+    const char *cmd = find_cmd(nums[i]);
+    int len = snprintf(num_str, sizeof(num_str), "%d\t", nums[i]);
+    write(STDOUT_FILENO, num_str, len);
+    write(STDOUT_FILENO, cmd, strlen(cmd));
+    write(STDOUT_FILENO, "\n", strlen("\n"));
+  }
+  free(nums);
+}
+
+// helper func that retrieves a command from history
+const char *get_cmd(int cmd_num)
+{
+  const char *cmd = find_cmd(cmd_num);
+  if (cmd == NULL)
+  {
+    // this error should not happen if function is called correctly
+    return "ERROR: index not in history";
+  }
+  return cmd;
+}
+
+// print the 'count' most recent commands
+void print_hist(int count)
+{
+  hist_print(STDOUT_FILENO, count);
+}
+
+// 'hash' builtin: list the remembered command locations, forget them all
+// with -r, or look up and remember the given command names
+void run_hash(char *tokens[])
+{
+  if (tokens[1] == NULL)
+  {
+    path_hash_print(STDOUT_FILENO);
+    return;
+  }
+  for (int i = 1; tokens[i] != NULL; i++)
+  {
+    if (strcmp(tokens[i], "-r") == 0)
+    {
+      path_hash_clear();
+    }
+    else if (path_hash_lookup(tokens[i]) == NULL && errno != 0)
+    {
+      write(STDERR_FILENO, "hash: ", strlen("hash: "));
+      write(STDERR_FILENO, tokens[i], strlen(tokens[i]));
+      write(STDERR_FILENO, ": not found\n", strlen(": not found\n"));
+      last_exit.status = 1 << 8;
+    }
+  }
+}
+
+// Find the job named by 'spec': %n, %%, %+, %-, %string, or a bare job number
+struct job *find_job(const char *spec)
+{
+  char buf[32];
+  if (spec != NULL && spec[0] != '%' && strspn(spec, "0123456789") == strlen(spec) &&
+      strlen(spec) < sizeof(buf) - 1)
+  {
+    snprintf(buf, sizeof(buf), "%%%s", spec);
+    spec = buf;
+  }
+  return jobs_find(spec);
+}
+
+// jobs [-l]: list every job, finished ones included, then forget the finished ones
+void run_jobs(char *tokens[])
+{
+  _Bool long_format = tokens[1] != NULL && strcmp(tokens[1], "-l") == 0;
+  if (tokens[1] != NULL && !long_format)
+  {
+    write(STDERR_FILENO, ARG_ERROR, strlen(ARG_ERROR));
+    last_exit.status = 2 << 8;
+    return;
+  }
+  jobs_print(STDOUT_FILENO, long_format);
+  jobs_report(-1);
+}
+
+// fg [job] / bg [job]: resume a job in the foreground or background
+void run_fg_bg(char *tokens[])
+{
+  struct job *job = find_job(tokens[1]);
+  if (job == NULL)
+  {
+    write(STDERR_FILENO, JOB_ERROR, strlen(JOB_ERROR));
+    last_exit.status = 1 << 8;
+    return;
+  }
+  if (strcmp(tokens[0], "fg") == 0)
+  {
+    write(STDOUT_FILENO, job_command(job), strlen(job_command(job)));
+    write(STDOUT_FILENO, "\n", strlen("\n"));
+    last_exit.status = job_foreground(job, &last_exit.usage);
+  }
+  else
+  {
+    job_background(job);
+    job_print(STDOUT_FILENO, job, false);
+  }
+}
+
+// wait [job | pid ...]: wait for the given jobs, or all of them, to finish
+void run_wait(char *tokens[])
+{
+  if (tokens[1] == NULL)
+  {
+    jobs_wait(NULL);
+    return;
+  }
+  for (int i = 1; tokens[i] != NULL; i++)
+  {
+    struct job *job = tokens[i][0] == '%' ? jobs_find(tokens[i])
+                      : strspn(tokens[i], "0123456789") == strlen(tokens[i])
+                          ? jobs_find_pid(atoi(tokens[i]))
+                          : NULL;
+    if (job == NULL)
+    {
+      // as in sh, waiting for something that is not a child is status 127
+      write(STDERR_FILENO, JOB_ERROR, strlen(JOB_ERROR));
+      last_exit.status = 127 << 8;
+      continue;
+    }
+    if (!jobs_wait(job))
+    {
+      return;
+    }
+    last_exit.status = job_status(job);
+    job_forget(job);
+  }
+}
+
+// Signal number for a name like "TERM", "SIGTERM" or "15", or -1
+int parse_signal(const char *name)
+{
+  if (name[0] != '\0' && strspn(name, "0123456789") == strlen(name))
+  {
+    int sig = atoi(name);
+    return sig < NSIG ? sig : -1;
+  }
+  if (strncasecmp(name, "SIG", 3) == 0)
+  {
+    name += 3;
+  }
+  for (int sig = 1; sig < NSIG; sig++)
+  {
+    const char *abbrev = sigabbrev_np(sig);
+    if (abbrev != NULL && strcasecmp(name, abbrev) == 0)
+    {
+      return sig;
+    }
+  }
+  return -1;
+}
+
+// kill [-s sig | -sig] job|pid ... / kill -l: send a signal, or list them
+void run_kill(char *tokens[])
+{
+  int sig = SIGTERM;
+  int i = 1;
+  if (tokens[1] != NULL && strcmp(tokens[1], "-l") == 0)
+  {
+    char list[NSIG * 16];
+    int len = 0;
+    for (int s = 1; s < NSIG; s++)
+    {
+      if (sigabbrev_np(s) != NULL)
+      {
+        len += snprintf(list + len, sizeof(list) - len, "%2d) SIG%s\n", s, sigabbrev_np(s));
+      }
+    }
+    write(STDOUT_FILENO, list, len);
+    return;
+  }
+  if (tokens[1] != NULL && strcmp(tokens[1], "-s") == 0 && tokens[2] != NULL)
+  {
+    sig = parse_signal(tokens[2]);
+    i = 3;
+  }
+  else if (tokens[1] != NULL && tokens[1][0] == '-')
+  {
+    sig = parse_signal(tokens[1] + 1);
+    i = 2;
+  }
+  if (sig < 0)
+  {
+    write(STDERR_FILENO, SIGNAL_ERROR, strlen(SIGNAL_ERROR));
+    last_exit.status = 1 << 8;
+    return;
+  }
+  if (tokens[i] == NULL)
+  {
+    const char *help = builtin_lookup("kill")->help;
+    write(STDERR_FILENO, help, strlen(help));
+    last_exit.status = 2 << 8;
+    return;
+  }
+  for (; tokens[i] != NULL; i++)
+  {
+    if (tokens[i][0] == '%')
+    {
+      struct job *job = jobs_find(tokens[i]);
+      if (job == NULL)
+      {
+        write(STDERR_FILENO, JOB_ERROR, strlen(JOB_ERROR));
+        last_exit.status = 1 << 8;
+      }
+      else if (!job_kill(job, sig))
+      {
+        perror("kill");
+        last_exit.status = 1 << 8;
+      }
+    }
+    else if (strspn(tokens[i], "-0123456789") != strlen(tokens[i]))
+    {
+      write(STDERR_FILENO, JOB_ERROR, strlen(JOB_ERROR));
+      last_exit.status = 1 << 8;
+    }
+    else if (kill(atoi(tokens[i]), sig) < 0)
+    {
+      perror(tokens[i]);
+      last_exit.status = 1 << 8;
+    }
+  }
+}
+
+/*
+ * Read 'parallel' arguments from stdin, one per line (empty lines skipped).
+ * returns: NULL terminated array of heap strings, count in *num_args.
+ */
+char **read_parallel_args(size_t *num_args)
+{
+  struct line_reader reader;
+  size_t cap = 64;
+  char **args = malloc(cap * sizeof(char *));
+  const char *line;
+  size_t len;
+
+  *num_args = 0;
+  reader_init_fd(&reader, STDIN_FILENO);
+  while (args != NULL && (line = reader_next_line(&reader, &len)) != NULL)
+  {
+    if (len == 0)
+    {
+      continue;
+    }
+    if (*num_args + 1 == cap)
+    {
+      cap *= 2;
+      char **grown = realloc(args, cap * sizeof(char *));
+      if (grown == NULL)
+      {
+        break;
+      }
+      args = grown;
+    }
+    args[*num_args] = strndup(line, len);
+    if (args[*num_args] != NULL)
+    {
+      (*num_args)++;
+    }
+  }
+  if (args != NULL)
+  {
+    args[*num_args] = NULL;
+  }
+  // leave stdin's offset past the lines taken, like a command would
+  reader_sync(&reader);
+  reader_free(&reader);
+  return args;
+}
+
+// parallel [-j N] [-k] command... [::: args...]: fan a command out over its
+// arguments with at most N running at once, then print a throughput summary
+void run_parallel(char *tokens[])
+{
+  struct parallel_options options = {0, false, false};
+  int i = 1;
+  for (; tokens[i] != NULL && tokens[i][0] == '-'; i++)
+  {
+    if (strcmp(tokens[i], "-k") == 0)
+    {
+      options.keep_order = true;
+    }
+    else if (strcmp(tokens[i], "-j") == 0 && tokens[i + 1] != NULL && atoi(tokens[i + 1]) > 0)
+    {
+      options.max_jobs = atoi(tokens[++i]);
+    }
+    else if (strncmp(tokens[i], "-j", 2) == 0 && atoi(tokens[i] + 2) > 0)
+    {
+      options.max_jobs = atoi(tokens[i] + 2);
+    }
+    else
+    {
+      break;
+    }
+  }
+  char **cmd = &tokens[i];
+  int separator = i;
+  while (tokens[separator] != NULL && strcmp(tokens[separator], ":::") != 0)
+  {
+    separator++;
+  }
+  if (cmd[0] == NULL || separator == i)
+  {
+    write(STDERR_FILENO, PARALLEL_ERROR, strlen(PARALLEL_ERROR));
+    last_exit.status = 2 << 8;
+    return;
+  }
+  if (options.max_jobs == 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    options.max_jobs = cpus > 0 ? cpus : 1;
+  }
+
+  char **args;
+  size_t num_args = 0;
+  char **stdin_args = NULL;
+  if (tokens[separator] != NULL)
+  {
+    tokens[separator] = NULL;
+    args = &tokens[separator + 1];
+    while (args[num_args] != NULL)
+    {
+      num_args++;
+    }
+  }
+  else
+  {
+    args = stdin_args = read_parallel_args(&num_args);
+    options.null_stdin = true;
+    if (args == NULL)
+    {
+      perror("parallel");
+      last_exit.status = 1 << 8;
+      return;
+    }
+  }
+
+  struct parallel_summary summary;
+  if (!parallel_run(cmd, args, num_args, &options, &summary))
+  {
+    write(STDERR_FILENO, "\n", strlen("\n"));
+  }
+
+  char msg[256];
+  int len = snprintf(msg, sizeof(msg),
+                     "parallel: %zu tasks (%zu failed, %zu not started) in %.3fs with -j %d: "
+                     "%.1f tasks/s, %.3fs user, %.3fs sys\n",
+                     summary.tasks, summary.failed, summary.not_started, summary.seconds,
+                     options.max_jobs,
+                     summary.seconds > 0 ? (summary.tasks - summary.not_started) / summary.seconds : 0.0,
+                     summary.usage.ru_utime.tv_sec + summary.usage.ru_utime.tv_usec / 1e6,
+                     summary.usage.ru_stime.tv_sec + summary.usage.ru_stime.tv_usec / 1e6);
+  write(STDERR_FILENO, msg, len);
+
+  // like GNU parallel, the exit status is the number of failed tasks
+  size_t failed = summary.failed + summary.not_started;
+  last_exit.status = (failed > 101 ? 101 : failed) << 8;
+  last_exit.usage = summary.usage;
+
+  for (size_t a = 0; stdin_args != NULL && a < num_args; a++)
+  {
+    free(stdin_args[a]);
+  }
+  free(stdin_args);
+}
+
+// Print "ERROR: <what>." for a command line that cannot be run
+void syntax_error(const char *what, const char *token)
+{
+  char msg[128];
+  int len = snprintf(msg, sizeof(msg), token != NULL ? "ERROR: %s '%s'.\n" : "ERROR: %s.\n",
+                     what, token);
+  write(STDERR_FILENO, msg, len);
+}
+
+/*
+ * Parse the redirection starting at lexed[*i] (an optional TOKEN_IO_NUMBER,
+ * a redirection operator and its target word) into 'redirect', advancing
+ * *i to the target.
+ * returns: false (with an error printed) if it is malformed.
+ */
+_Bool parse_redirect(struct token lexed[], int num_lexed, int *i, struct redirect *redirect)
+{
+  int fd = -1;
+  if (lexed[*i].type == TOKEN_IO_NUMBER)
+  {
+    fd = strlen(lexed[*i].text) == 1 ? lexed[*i].text[0] - '0' : INT_MAX;
+    (*i)++;
+  }
+  enum token_type op = lexed[*i].type;
+  if (*i + 1 >= num_lexed || lexed[*i + 1].type != TOKEN_WORD)
+  {
+    syntax_error(op == TOKEN_DLESS || op == TOKEN_DLESSDASH ? "Missing delimiter after"
+                 : op == TOKEN_TLESS                        ? "Missing word after"
+                                                            : "Missing file name after",
+                 lexed[*i].text);
+    return false;
+  }
+  const char *target = lexed[++*i].text;
+
+  switch (op)
+  {
+  case TOKEN_LESS:
+    redirect->type = REDIRECT_IN;
+    break;
+  case TOKEN_GREAT:
+    redirect->type = REDIRECT_OUT;
+    break;
+  case TOKEN_DGREAT:
+    redirect->type = REDIRECT_APPEND;
+    break;
+  case TOKEN_DLESS:
+  case TOKEN_DLESSDASH:
+    redirect->type = REDIRECT_HEREDOC;
+    break;
+  case TOKEN_TLESS:
+    redirect->type = REDIRECT_HERESTRING;
+    break;
+  default: // TOKEN_LESSAND, TOKEN_GREATAND: the target is a descriptor
+    redirect->type = REDIRECT_DUP;
+    if (target[0] < '0' || target[0] > '2' || target[1] != '\0')
+    {
+      write(STDERR_FILENO, REDIRECT_ERROR, strlen(REDIRECT_ERROR));
+      return false;
+    }
+    redirect->dup_fd = target[0] - '0';
+    break;
+  }
+  if (fd < 0)
+  {
+    fd = op == TOKEN_GREAT || op == TOKEN_DGREAT || op == TOKEN_GREATAND ? STDOUT_FILENO
+                                                                        : STDIN_FILENO;
+  }
+  if (fd > STDERR_FILENO)
+  {
+    write(STDERR_FILENO, REDIRECT_ERROR, strlen(REDIRECT_ERROR));
+    return false;
+  }
+  redirect->fd = fd;
+  redirect->path = target;
+  return true;
+}
+
+// Whether a stage has nothing in it yet
+_Bool stage_empty(const struct stage *stage, struct token **next_word)
+{
+  return stage->words == next_word && stage->num_redirects == 0;
+}
+
+/*
+ * Split the command in 'buff' into a list of pipelines joined by ';', '&',
+ * '&&' and '||', each split into stages with their words and redirections
+ * (see lexer.h for quoting). Words are expanded only when their pipeline
+ * runs, so "false; echo $?" sees the status of 'false'.
+ * buff: the command, 'length' bytes and a null byte. Modified: words are
+ *       unquoted in place and null terminated.
+ * cmd: set to the pipelines, allocated in the command arena. NOTE: the
+ *       words all point into buff! No pipelines for a blank command. Its
+ *       here-documents are listed for their bodies to be read.
+ * returns: number of words, or -1 (with an error printed) if the command
+ *       cannot be run.
+ */
+int tokenize_command(char *buff, size_t length, struct command *cmd)
+{
+  struct token *lexed;
+  const char *error;
+  int num_lexed = lex_line(buff, length, &command_arena, &lexed, &error);
+  cmd->pipelines = NULL;
+  cmd->num_pipelines = 0;
+  cmd->heredocs = NULL;
+  cmd->num_heredocs = 0;
+  if (num_lexed < 0)
+  {
+    syntax_error(error, NULL);
+    return -1;
+  }
+  if (num_lexed == 0)
+  {
+    return 0;
+  }
+
+  // Each operator ends a stage (and all but '|' a pipeline), and every
+  // stage's words are NULL terminated
+  int num_separators = 0;
+  int num_pipes = 0;
+  int num_heredocs = 0;
+  for (int i = 0; i < num_lexed; i++)
+  {
+    enum token_type type = lexed[i].type;
+    num_pipes += type == TOKEN_PIPE;
+    num_separators += type == TOKEN_SEMI || type == TOKEN_AMP || type == TOKEN_AND_IF ||
+                      type == TOKEN_OR_IF;
+    num_heredocs += type == TOKEN_DLESS || type == TOKEN_DLESSDASH;
+  }
+  int max_stages = num_pipes + num_separators + 1;
+  struct token **words = arena_alloc(&command_arena, (num_lexed + max_stages) * sizeof(struct token *));
+  struct token **targets = arena_alloc(&command_arena, num_lexed * sizeof(struct token *));
+  struct redirect *redirects = arena_alloc(&command_arena, num_lexed * sizeof(struct redirect));
+  struct stage *stages = arena_alloc(&command_arena, max_stages * sizeof(struct stage));
+  struct pipeline *pipelines =
+      arena_alloc(&command_arena, (num_separators + 1) * sizeof(struct pipeline));
+  struct heredoc *heredocs = arena_alloc(&command_arena, num_heredocs * sizeof(struct heredoc));
+  if (words == NULL || targets == NULL || redirects == NULL || stages == NULL ||
+      pipelines == NULL || (heredocs == NULL && num_heredocs > 0))
+  {
+    syntax_error("Out of memory", NULL);
+    return -1;
+  }
+
+  int num_words = 0;
+  int n = 0;
+  int num_redirects = 0;
+  struct stage *stage = &stages[0];
+  struct pipeline *pipeline = &pipelines[0];
+  *stage = (struct stage){words, NULL, redirects, targets, 0};
+  *pipeline = (struct pipeline){stage, 1, TOKEN_SEMI, false, false, false};
+  for (int i = 0; i < num_lexed; i++)
+  {
+    enum token_type type = lexed[i].type;
+    switch (type)
+    {
+    case TOKEN_WORD:
+      // "time [-p]" in front of a pipeline is a keyword, not a command
+      if (pipeline->stages == stage && stage_empty(stage, &words[n]) && !pipeline->timed &&
+          !lexed[i].quoted && strcmp(lexed[i].text, "time") == 0)
+      {
+        pipeline->timed = true;
+        if (i + 1 < num_lexed && lexed[i + 1].type == TOKEN_WORD && !lexed[i + 1].quoted &&
+            strcmp(lexed[i + 1].text, "-p") == 0)
+        {
+          pipeline->time_posix = true;
+          i++;
+        }
+        break;
+      }
+      words[n++] = &lexed[i];
+      num_words++;
+      break;
+    case TOKEN_IO_NUMBER:
+    case TOKEN_LESS:
+    case TOKEN_GREAT:
+    case TOKEN_DGREAT:
+    case TOKEN_LESSAND:
+    case TOKEN_GREATAND:
+    case TOKEN_DLESS:
+    case TOKEN_DLESSDASH:
+    case TOKEN_TLESS:
+      if (!parse_redirect(lexed, num_lexed, &i, &redirects[num_redirects]))
+      {
+        return -1;
+      }
+      targets[num_redirects] = redirects[num_redirects].type == REDIRECT_DUP ? NULL : &lexed[i];
+      if (redirects[num_redirects].type == REDIRECT_HEREDOC)
+      {
+        cmd->heredocs = heredocs;
+        heredocs[cmd->num_heredocs++] =
+            (struct heredoc){&targets[num_redirects], lexed[i].text,
+                             lexed[i - 1].type == TOKEN_DLESSDASH, !lexed[i].quoted};
+      }
+      num_redirects++;
+      stage->num_redirects++;
+      break;
+    case TOKEN_PIPE:
+      if (stage_empty(stage, &words[n]) || i == num_lexed - 1)
+      {
+        write(STDERR_FILENO, PIPE_ERROR, strlen(PIPE_ERROR));
+        return -1;
+      }
+      words[n++] = NULL;
+      stage++;
+      *stage = (struct stage){&words[n], NULL, &redirects[num_redirects], &targets[num_redirects], 0};
+      pipeline->num_stages++;
+      break;
+    default: // ; & && ||
+      if (stage_empty(stage, &words[n]) ||
+          ((type == TOKEN_AND_IF || type == TOKEN_OR_IF) && i == num_lexed - 1))
+      {
+        syntax_error("Unexpected", lexed[i].text);
+        return -1;
+      }
+      pipeline->in_background = type == TOKEN_AMP;
+      words[n++] = NULL;
+      if (i == num_lexed - 1)
+      {
+        break;
+      }
+      stage++;
+      *stage = (struct stage){&words[n], NULL, &redirects[num_redirects], &targets[num_redirects], 0};
+      pipeline++;
+      *pipeline = (struct pipeline){stage, 1, type == TOKEN_AMP ? TOKEN_SEMI : type, false,
+                                    false, false};
+      break;
+    }
+  }
+  words[n] = NULL;
+  cmd->pipelines = pipelines;
+  cmd->num_pipelines = pipeline - pipelines + 1;
+  return num_words;
+}
+
+/*
+ * The value of a parameter reference (see lexer.h).
+ * ref: the reference, 'len' bytes: "$NAME", "${NAME}", "$?" or "$$".
+ * buf: room for a number.
+ * returns: the value, "" for a variable that is not set.
+ */
+const char *parameter_value(const char *ref, size_t len, char buf[static 24])
+{
+  const char *name = ref + 1;
+  size_t name_len = len - 1;
+  if (name[0] == '{')
+  {
+    name++;
+    name_len -= 2;
+  }
+  switch (name[0])
+  {
+  case '?':
+    snprintf(buf, 24, "%d", exit_code(last_exit.status));
+    return buf;
+  case '$':
+    snprintf(buf, 24, "%d", (int)getpid());
+    return buf;
+  default:
+  {
+    const char *value = vars_getn(name, name_len);
+    return value != NULL ? value : "";
+  }
+  }
+}
+
+void run_substitution(char *tokens[]);
+
+// What a command substitution starts reading into
+#define FIRST_OUTPUT_SIZE 4096
+
+/*
+ * Run the command of a $(command) in a forked copy of the shell and read
+ * what it writes to stdout through a pipe, straight into a buffer in the
+ * command arena that doubles as it fills. Trailing newlines are dropped.
+ * Its wait status is kept in substitution_status.
+ * returns: the output ("" if it could not be run), or NULL if out of
+ *          memory.
+ */
+char *command_output(const char *command, size_t len)
+{
+  char *text = arena_strndup(&command_arena, command, len);
+  if (text == NULL)
+  {
+    return NULL;
+  }
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) < 0)
+  {
+    perror("Unable to run command substitution");
+    return "";
+  }
+  struct spawn_io io = {{-1, fds[1], -1}, -1, NULL};
+  char *argv[] = {text, NULL};
+  pid_t pid = spawn_function(run_substitution, argv, &io);
+  close(fds[1]);
+  if (pid < 0)
+  {
+    perror("Unable to run command substitution");
+    close(fds[0]);
+    return "";
+  }
+
+  size_t size = FIRST_OUTPUT_SIZE;
+  size_t used = 0;
+  char *output = arena_alloc(&command_arena, size);
+  while (output != NULL)
+  {
+    ssize_t n = read(fds[0], output + used, size - used);
+    if (n <= 0)
+    {
+      if (n < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+    used += n;
+    // keep room for the null byte
+    if (used == size)
+    {
+      output = arena_grow(&command_arena, output, size, 2 * size);
+      size *= 2;
+    }
+  }
+  // closed first, so a child that still writes is not left blocking
+  close(fds[0]);
+  struct child_exit child;
+  if (events_wait_pid(pid, 0, &child))
+  {
+    substitution_status = child.status;
+  }
+  if (output == NULL)
+  {
+    return NULL;
+  }
+  while (used > 0 && output[used - 1] == '\n')
+  {
+    used--;
+  }
+  output[used] = '\0';
+  return output;
+}
+
+/*
+ * The value of every reference in a word, worked out once: parameters
+ * are looked up and command substitutions run.
+ * returns: the values, in the command arena, or NULL if out of memory.
+ */
+const char **reference_values(struct token *word)
+{
+  const char **values = arena_alloc(&command_arena, (word->num_expansions + 1) * sizeof(char *));
+  if (values == NULL)
+  {
+    return NULL;
+  }
+  char buf[24];
+  for (uint32_t i = 0; i < word->num_expansions; i++)
+  {
+    const char *ref = word->text + word->expansions[i].start;
+    size_t len = word->expansions[i].length;
+    const char *value = ref[1] == '(' ? command_output(ref + 2, len - 3)
+                                      : parameter_value(ref, len, buf);
+    if (value == buf)
+    {
+      value = arena_strndup(&command_arena, buf, strlen(buf));
+    }
+    if (value == NULL)
+    {
+      return NULL;
+    }
+    values[i] = value;
+  }
+  return values;
+}
+
+/*
+ * Append 'len' bytes of 's' at 'end'. With 'escape', put a '\' before
+ * each character a glob pattern would take as special.
+ * returns: the new end.
+ */
+char *append_text(char *end, const char *s, size_t len, _Bool escape)
+{
+  if (!escape)
+  {
+    memmove(end, s, len);
+    return end + len;
+  }
+  for (size_t i = 0; i < len; i++)
+  {
+    if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\')
+    {
+      *end++ = '\\';
+    }
+    *end++ = s[i];
+  }
+  return end;
+}
+
+/*
+ * Expand a word into fields: each reference the lexer noted is replaced
+ * by its value, and with 'split' the values of those outside double
+ * quotes are split where they have characters of $IFS (default space, tab
+ * and newline), as sh does. Runs of IFS blanks separate fields and are
+ * dropped at the ends of a value; any other IFS character ends a field,
+ * even an empty one. An unquoted reference to nothing leaves no field.
+ * values: the values of the references (see reference_values()).
+ * pattern: build the fields as glob patterns, where only the unquoted
+ *          wildcards are special (everything else that would be is
+ *          escaped with '\').
+ * fields: set to the fields, in the command arena. A word that is only
+ *          an unquoted $(command) is split in place in its output.
+ * returns: the number of fields (always 1 without 'split'), or -1 if out
+ *          of memory.
+ */
+int expand_fields(struct token *word, const char **values, _Bool split, _Bool pattern,
+                  char ***fields)
+{
+  const char *text = word->text;
+  size_t text_len = strlen(text);
+  if (word->num_expansions == 0 && !pattern)
+  {
+    *fields = arena_alloc(&command_arena, 2 * sizeof(char *));
+    if (*fields == NULL)
+    {
+      return -1;
+    }
+    (*fields)[0] = word->text;
+    return 1;
+  }
+
+  _Bool ifs[256] = {false};
+  const char *ifs_chars = vars_get("IFS");
+  for (const char *c = ifs_chars != NULL ? ifs_chars : " \t\n"; split && *c != '\0'; c++)
+  {
+    ifs[(unsigned char)*c] = true;
+  }
+  size_t size = text_len + 1;
+  size_t max_fields = 1;
+  for (uint32_t i = 0; i < word->num_expansions; i++)
+  {
+    for (const char *c = values[i]; *c != '\0'; c++)
+    {
+      max_fields += ifs[(unsigned char)*c] && !word->expansions[i].quoted;
+    }
+    size += strlen(values[i]);
+  }
+  // every field ends in a null byte, and a pattern may need an escape per
+  // character; a lone $(command) becomes its output with nulls for
+  // separators, never longer
+  _Bool in_place = split && !pattern && word->num_expansions == 1 &&
+                   !word->expansions[0].quoted && word->expansions[0].start == 0 &&
+                   word->expansions[0].length == text_len && text[1] == '(';
+  char *buf = in_place ? (char *)values[0] : arena_alloc(&command_arena, 2 * size + max_fields);
+  char **result = arena_alloc(&command_arena, (max_fields + 1) * sizeof(char *));
+  if (buf == NULL || result == NULL)
+  {
+    return -1;
+  }
+
+  char *end = buf;
+  char *field = buf;
+  int num_fields = 0;
+  _Bool has_text = false;    // the field has text, or a quoted part
+  _Bool ended_blank = false; // the last field was ended by IFS blanks
+  size_t copied = 0;
+  uint32_t glob = 0;
+  for (uint32_t i = 0; i <= word->num_expansions; i++)
+  {
+    // the text up to the next reference, with its wildcards left as they are
+    size_t start = i < word->num_expansions ? word->expansions[i].start : text_len;
+    for (; pattern && glob < word->num_globs && word->globs[glob] < start; glob++)
+    {
+      end = append_text(end, text + copied, word->globs[glob] - copied, true);
+      *end++ = text[word->globs[glob]];
+      copied = word->globs[glob] + 1;
+      has_text = true;
+      ended_blank = false;
+    }
+    if (start > copied)
+    {
+      end = append_text(end, text + copied, start - copied, pattern);
+      has_text = true;
+      ended_blank = false;
+    }
+    if (i == word->num_expansions)
+    {
+      break;
+    }
+    copied = start + word->expansions[i].length;
+    const char *value = values[i];
+    if (!split || word->expansions[i].quoted)
+    {
+      end = append_text(end, value, strlen(value), pattern);
+      has_text = true;
+      ended_blank = false;
+      continue;
+    }
+    for (; *value != '\0'; value++)
+    {
+      unsigned char c = *value;
+      if (!ifs[c])
+      {
+        end = append_text(end, value, 1, pattern);
+        has_text = true;
+        ended_blank = false;
+        continue;
+      }
+      // blanks only end a field that has something in it; "a : b" is two
+      // fields, as the ':' belongs with the blanks before it
+      _Bool blank = c == ' ' || c == '\t' || c == '\n';
+      if (blank ? has_text : !ended_blank)
+      {
+        *end++ = '\0';
+        result[num_fields++] = field;
+        field = end;
+      }
+      ended_blank = blank && (has_text || ended_blank);
+      has_text = false;
+    }
+  }
+  if (has_text || (num_fields == 0 && (word->quoted || !split)))
+  {
+    *end = '\0';
+    result[num_fields++] = field;
+  }
+  result[num_fields] = NULL;
+  *fields = result;
+  return num_fields;
+}
+
+/*
+ * Expand the references in a word into one string, with no field
+ * splitting or pathname expansion (assignments, redirection targets).
+ * returns: the expanded word, in the command arena (the word itself if it
+ *          has nothing to expand), or NULL if out of memory.
+ */
+char *expand_word(struct token *word)
+{
+  if (word->num_expansions == 0)
+  {
+    return word->text;
+  }
+  const char **values = reference_values(word);
+  char **fields;
+  if (values == NULL || expand_fields(word, values, false, false, &fields) < 0)
+  {
+    return NULL;
+  }
+  return fields[0];
+}
+
+/*
+ * Expand an argument word into the arguments it becomes: its fields, with
+ * each one that has unquoted wildcards replaced by the paths it matches
+ * (a pattern that matches nothing stays as it is).
+ * args: set to the arguments, in the command arena.
+ * returns: the number of arguments, or -1 if out of memory.
+ */
+int expand_argument(struct token *word, char ***args)
+{
+  _Bool pattern = word->num_globs > 0;
+  const char **values = reference_values(word);
+  if (values == NULL)
+  {
+    return -1;
+  }
+  int num_fields = expand_fields(word, values, true, pattern, args);
+  if (num_fields <= 0 || !pattern)
+  {
+    return num_fields;
+  }
+
+  // the paths each field matched; the fields without escapes for those
+  // that matched nothing (split the same way)
+  char ***matches = arena_alloc(&command_arena, num_fields * sizeof(char **));
+  size_t *num_matches = arena_alloc(&command_arena, num_fields * sizeof(size_t));
+  char **plain = NULL;
+  if (matches == NULL || num_matches == NULL)
+  {
+    return -1;
+  }
+  size_t total = 0;
+  for (int f = 0; f < num_fields; f++)
+  {
+    num_matches[f] = 0;
+    matches[f] = glob_has_magic((*args)[f])
+                     ? glob_expand((*args)[f], &command_arena, &num_matches[f])
+                     : NULL;
+    if (matches[f] == NULL)
+    {
+      if (plain == NULL && expand_fields(word, values, true, false, &plain) < 0)
+      {
+        return -1;
+      }
+      matches[f] = &plain[f];
+      num_matches[f] = 1;
+    }
+    total += num_matches[f];
+  }
+  char **result = arena_alloc(&command_arena, (total + 1) * sizeof(char *));
+  if (result == NULL)
+  {
+    return -1;
+  }
+  size_t n = 0;
+  for (int f = 0; f < num_fields; f++)
+  {
+    memcpy(&result[n], matches[f], num_matches[f] * sizeof(char *));
+    n += num_matches[f];
+  }
+  result[n] = NULL;
+  *args = result;
+  return n;
+}
+
+/*
+ * Expand the words and redirection targets of a stage, right before it
+ * runs. The NAME=value words in front become its assignments; the others
+ * are split into fields and globbed (see expand_argument()).
+ * returns: false (with an error printed) if out of memory.
+ */
+_Bool expand_stage(struct stage *stage)
+{
+  int num_words = 0;
+  int num_assignments = 0;
+  while (stage->words[num_words] != NULL)
+  {
+    if (num_assignments == num_words && stage->words[num_words]->assignment)
+    {
+      num_assignments++;
+    }
+    num_words++;
+  }
+  stage->assignments = arena_alloc(&command_arena, (num_assignments + 1) * sizeof(char *));
+  // the arguments each word became
+  char ***args = arena_alloc(&command_arena, (num_words + 1) * sizeof(char **));
+  int *num_args = arena_alloc(&command_arena, (num_words + 1) * sizeof(int));
+  if (stage->assignments == NULL || args == NULL || num_args == NULL)
+  {
+    syntax_error("Out of memory", NULL);
+    return false;
+  }
+  size_t total = 0;
+  for (int i = 0; i < num_words; i++)
+  {
+    if (i < num_assignments)
+    {
+      stage->assignments[i] = expand_word(stage->words[i]);
+      num_args[i] = stage->assignments[i] != NULL ? 0 : -1;
+    }
+    else
+    {
+      num_args[i] = expand_argument(stage->words[i], &args[i]);
+      total += num_args[i];
+    }
+    if (num_args[i] < 0)
+    {
+      syntax_error("Out of memory", NULL);
+      return false;
+    }
+  }
+  stage->assignments[num_assignments] = NULL;
+
+  stage->argv = arena_alloc(&command_arena, (total + 1) * sizeof(char *));
+  if (stage->argv == NULL)
+  {
+    syntax_error("Out of memory", NULL);
+    return false;
+  }
+  size_t n = 0;
+  for (int i = num_assignments; i < num_words; i++)
+  {
+    memcpy(&stage->argv[n], args[i], num_args[i] * sizeof(char *));
+    n += num_args[i];
+  }
+  stage->argv[n] = NULL;
+
+  for (int r = 0; r < stage->num_redirects; r++)
+  {
+    if (stage->targets[r] != NULL)
+    {
+      stage->redirects[r].path = expand_word(stage->targets[r]);
+      if (stage->redirects[r].path == NULL)
+      {
+        syntax_error("Out of memory", NULL);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Set the shell variables of NAME=value words (for a command that is only
+// assignments, or that runs inside the shell)
+void assign_variables(char **assignments)
+{
+  for (int i = 0; assignments[i] != NULL; i++)
+  {
+    const char *eq = strchr(assignments[i], '=');
+    char name[eq - assignments[i] + 1];
+    memcpy(name, assignments[i], eq - assignments[i]);
+    name[eq - assignments[i]] = '\0';
+    if (!vars_set(name, eq + 1, false))
+    {
+      perror(name);
+    }
+  }
+}
+
+// true if "NAME=..." strings 'a' and 'b' set the same name
+_Bool same_name(const char *a, const char *b)
+{
+  size_t len = strchr(a, '=') - a;
+  return strncmp(a, b, len + 1) == 0;
+}
+
+/*
+ * The environment of a command run with NAME=value words in front: the
+ * exported variables with those added or replaced.
+ * returns: the envp array, in the command arena (NULL if out of memory).
+ */
+char **command_environment(char **assignments)
+{
+  char **exported = vars_environ();
+  size_t num_exported = 0;
+  size_t num_assignments = 0;
+  while (exported[num_exported] != NULL)
+  {
+    num_exported++;
+  }
+  while (assignments[num_assignments] != NULL)
+  {
+    num_assignments++;
+  }
+  char **envp = arena_alloc(&command_arena, (num_exported + num_assignments + 1) * sizeof(char *));
+  if (envp == NULL)
+  {
+    return NULL;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < num_exported; i++)
+  {
+    size_t a = 0;
+    while (a < num_assignments && !same_name(assignments[a], exported[i]))
+    {
+      a++;
+    }
+    if (a == num_assignments)
+    {
+      envp[n++] = exported[i];
+    }
+  }
+  // the last of several assignments to one name wins
+  for (size_t a = 0; a < num_assignments; a++)
+  {
+    size_t later = a + 1;
+    while (later < num_assignments && !same_name(assignments[a], assignments[later]))
+    {
+      later++;
+    }
+    if (later == num_assignments)
+    {
+      envp[n++] = assignments[a];
+    }
+  }
+  envp[n] = NULL;
+  return envp;
+}
+
+/*
+ * Read the bodies of the here-documents of 'cmd' from the lines after it,
+ * each up to the line that is its delimiter, into the command arena.
+ * From a terminal each line is asked for with a "> " prompt.
+ * returns: false if the command cannot be run (a bad reference in a body,
+ *          ctrl-c, out of memory).
+ */
+_Bool read_heredocs(struct line_reader *input, struct command *cmd)
+{
+  _Bool prompt = input->fd >= 0 && isatty(input->fd);
+  for (int h = 0; h < cmd->num_heredocs; h++)
+  {
+    struct heredoc *doc = &cmd->heredocs[h];
+    size_t delimiter_len = strlen(doc->delimiter);
+    size_t size = FIRST_OUTPUT_SIZE;
+    size_t used = 0;
+    char *body = arena_alloc(&command_arena, size);
+    while (body != NULL)
+    {
+      if (prompt)
+      {
+        write(STDOUT_FILENO, "> ", strlen("> "));
+        if (!reader_has_line(input) && !events_wait_input(input->fd))
+        {
+          write(STDOUT_FILENO, "\n", strlen("\n"));
+          return false;
+        }
+      }
+      size_t length;
+      const char *line = reader_next_line(input, &length);
+      if (line == NULL)
+      {
+        write(STDERR_FILENO, HEREDOC_WARNING, strlen(HEREDOC_WARNING));
+        break;
+      }
+      while (doc->strip_tabs && length > 0 && line[0] == '\t')
+      {
+        line++;
+        length--;
+      }
+      if (length == delimiter_len && memcmp(line, doc->delimiter, length) == 0)
+      {
+        break;
+      }
+      // the line, its newline and the null byte
+      if (used + length + 2 > size)
+      {
+        size_t new_size = 2 * size > used + length + 2 ? 2 * size : used + length + 2;
+        body = arena_grow(&command_arena, body, size, new_size);
+        size = new_size;
+        if (body == NULL)
+        {
+          break;
+        }
+      }
+      memcpy(body + used, line, length);
+      used += length;
+      body[used++] = '\n';
+    }
+    struct token *token = arena_alloc(&command_arena, sizeof(struct token));
+    const char *error = "Out of memory";
+    if (body == NULL || token == NULL)
+    {
+      syntax_error(error, NULL);
+      return false;
+    }
+    body[used] = '\0';
+    if (!lex_document(body, used, doc->expand, &command_arena, token, &error))
+    {
+      syntax_error(error, NULL);
+      return false;
+    }
+    *doc->body = token;
+  }
+  return true;
+}
+
+/**
+ * Read the next command line from 'input' into the command arena, add it
+ * to history and tokenize it into pipeline stages (see tokenize_command()).
+ * Lines of any length are read whole, and so are the bodies of its
+ * here-documents, which follow it.
+ * input: where commands come from (terminal, pipe, script file or -c).
+ * cmd: set to the stages; none for a blank command or one that cannot be
+ *       run.
+ * returns: false once the input is exhausted. A line interrupted by a
+ *       signal comes back as an empty command.
+ */
+_Bool read_command(struct line_reader *input, struct command *cmd)
+{
+  cmd->num_pipelines = 0;
+  cmd->hist_num = -1;
+
+  // Read the next line
+  size_t length;
+  const char *line = reader_next_line(input, &length);
+  if (line == NULL)
+  {
+    if (errno == EINTR)
+    {
+      return true;
+    }
+    if (errno != 0)
+    {
+      perror("Unable to read command. Terminating.\n");
+      exit(-1); /* terminate with error */
+    }
+    return false;
+  }
+  METRIC_COUNT(COMMANDS);
+
+  // Pick up commands other sessions added to the shared history file
+  if (!in_subshell)
+  {
+    histlog_sync();
+  }
+
+  // Copy out of the reader's buffer (the lexer works in place) and null
+  // terminate.
+  char *buff = arena_strndup(&command_arena, line, length);
+  if (buff == NULL)
+  {
+    perror("Unable to read command");
+    return true;
+  }
+
+  // add to history unless buff is blank or a '!' history command
+  if (buff[0] != '!' && strspn(buff, " \t") != length && !in_subshell)
+  {
+    cmd->hist_num = add_to_hist(buff);
+  }
+
+  METRIC_START(tokenize_start);
+  int tokenized = tokenize_command(buff, length, cmd);
+  METRIC_STOP(TOKENIZE, tokenize_start);
+  if (tokenized < 0)
+  {
+    last_exit.status = 2 << 8;
+  }
+  else if (!read_heredocs(input, cmd))
+  {
+    cmd->num_pipelines = 0;
+    last_exit.status = 2 << 8;
+  }
+  return true;
+}
+
+/*
+ * alternate read command for commands replayed from history (eg. during
+ * '!!'); the bodies of here-documents in them are read from 'input'
+ */
+void rea(const char *line, struct line_reader *input, struct command *cmd)
+{
+  cmd->num_pipelines = 0;
+  cmd->hist_num = -1;
+  size_t length = strlen(line);
+  char *buff = arena_strndup(&command_arena, line, length);
+  if (buff == NULL)
+  {
+    perror("Unable to read command");
+    return;
+  }
+
+  // add to history
+  if (buff[0] != '!')
+  {
+    cmd->hist_num = add_to_hist(buff);
+  }
+
+  METRIC_START(tokenize_start);
+  int tokenized = tokenize_command(buff, length, cmd);
+  METRIC_STOP(TOKENIZE, tokenize_start);
+  if (tokenized < 0)
+  {
+    last_exit.status = 2 << 8;
+  }
+  else if (!read_heredocs(input, cmd))
+  {
+    cmd->num_pipelines = 0;
+    last_exit.status = 2 << 8;
+  }
+}
+
+bool is_builtin(const char *name)
+{
+  return builtin_lookup(name) != NULL;
+}
+
+// true if argv runs as a builtin: 'cat' with options runs the program on
+// $PATH, since the builtin does not take them
+bool runs_builtin(char *argv[])
+{
+  return is_builtin(argv[0]) && utility_supported(argv);
+}
+
+// true if builtin argv can run inside the shell: under job control a
+// utility that can block (sleep, cat of a terminal) runs in a child, so
+// ctrl-z can stop it and 'bg' move it on
+bool runs_in_shell(char *argv[])
+{
+  return !jobs_control_enabled() || !utility_may_block(argv);
+}
+
+// export [-p] [NAME[=value] ...]: put variables into the environment of
+// commands, or list the ones that are
+void run_export(char *tokens[])
+{
+  int first = tokens[1] != NULL && strcmp(tokens[1], "-p") == 0 ? 2 : 1;
+  if (tokens[first] == NULL)
+  {
+    vars_print(STDOUT_FILENO, true);
+    return;
+  }
+  for (int i = first; tokens[i] != NULL; i++)
+  {
+    char *eq = strchr(tokens[i], '=');
+    size_t name_len = eq != NULL ? (size_t)(eq - tokens[i]) : strlen(tokens[i]);
+    if (!vars_valid_name(tokens[i], name_len))
+    {
+      write(STDERR_FILENO, NAME_ERROR, strlen(NAME_ERROR));
+      last_exit.status = 1 << 8;
+      continue;
+    }
+    char name[name_len + 1];
+    memcpy(name, tokens[i], name_len);
+    name[name_len] = '\0';
+    if (!(eq != NULL ? vars_set(name, eq + 1, true) : vars_export(name)))
+    {
+      perror(name);
+      last_exit.status = 1 << 8;
+    }
+  }
+}
+
+// unset NAME...: forget variables
+void run_unset(char *tokens[])
+{
+  for (int i = 1; tokens[i] != NULL; i++)
+  {
+    if (!vars_valid_name(tokens[i], strlen(tokens[i])))
+    {
+      write(STDERR_FILENO, NAME_ERROR, strlen(NAME_ERROR));
+      last_exit.status = 1 << 8;
+      continue;
+    }
+    vars_unset(tokens[i]);
+  }
+}
+
+// set: list every shell variable
+void run_set(char *tokens[])
+{
+  vars_print(STDOUT_FILENO, false);
+}
+
+// exit [n]: leave the shell with status n, by default that of the last
+// command (the first time with stopped jobs around, only warn)
+void run_exit(char *tokens[])
+{
+  int status = exit_code(previous_status);
+  if (tokens[1] != NULL)
+  {
+    char *end;
+    long n = strtol(tokens[1], &end, 10);
+    if (tokens[1][0] == '\0' || *end != '\0')
+    {
+      write(STDERR_FILENO, EXIT_ERROR, strlen(EXIT_ERROR));
+      last_exit.status = 2 << 8;
+      return;
+    }
+    status = n & 0xff;
+  }
+  static _Bool warned = false;
+  if (jobs_num_stopped() > 0 && !warned)
+  {
+    write(STDERR_FILENO, STOPPED_WARNING, strlen(STOPPED_WARNING));
+    warned = true;
+    last_exit.status = 1 << 8;
+    return;
+  }
+  exit(status);
+}
+
+// pwd: print the current working directory
+void run_pwd(char *tokens[])
+{
+  char line[cwd_length() + 1];
+  memcpy(line, cwd_get(), cwd_length());
+  line[cwd_length()] = '\n';
+  write(STDOUT_FILENO, line, sizeof(line));
+}
+
+// cd [dir | ~ | -]: change the current working directory
+void run_cd(char *tokens[])
+{
+  const char *dir = tokens[1];
+  if (dir == NULL || strcmp(dir, "~") == 0)
+  {
+    dir = vars_get("HOME");
+    if (dir == NULL)
+    {
+      struct passwd *pwd = getpwuid(getuid());
+      dir = pwd != NULL ? pwd->pw_dir : "/";
+    }
+  }
+  else if (strcmp(dir, "-") == 0)
+  {
+    dir = cwd_previous();
+    if (dir == NULL)
+    {
+      write(STDERR_FILENO, "cd OLDPWD not set.\n", strlen("cd OLDPWD not set.\n"));
+      last_exit.status = 1 << 8;
+      return;
+    }
+  }
+  if (!cwd_change(dir))
+  {
+    write(STDERR_FILENO, "Please enter a valid filepath \n",
+          strlen("Please enter a valid filepath \n"));
+    last_exit.status = 1 << 8;
+  }
+  else if (tokens[1] != NULL && strcmp(tokens[1], "-") == 0)
+  {
+    run_pwd(tokens);
+  }
+}
+
+// help [name]: print the help of every builtin, or of the given one
+void run_help(char *tokens[])
+{
+  if (tokens[1] == NULL)
+  {
+    print_all_help();
+    return;
+  }
+  const struct builtin *builtin = builtin_lookup(tokens[1]);
+  if (builtin != NULL)
+  {
+    write(STDOUT_FILENO, builtin->help, strlen(builtin->help));
+  }
+  else
+  {
+    write(STDERR_FILENO, "'", strlen("'"));
+    write(STDERR_FILENO, tokens[1], strlen(tokens[1]));
+    write(STDERR_FILENO, "' is an external command or application.\n", strlen("' is an external command or application.\n"));
+    last_exit.status = 1 << 8;
+  }
+}
+
+// history [N | -s pattern]: print the 10 (or N) most recent commands, or
+// every command containing pattern
+void run_history(char *tokens[])
+{
+  if (tokens[1] == 0)
+  {
+    print_hist(HISTORY_SHOWN);
+  }
+  else if (tokens[2] == 0 && strspn(tokens[1], "0123456789") == strlen(tokens[1]))
+  {
+    print_hist(atoi(tokens[1]));
+  }
+  else if (strcmp(tokens[1], "-s") == 0 && tokens[2] != 0)
+  {
+    print_hist_matches(tokens[2]);
+  }
+  else if (strcmp(tokens[1], "-v") == 0 &&
+           (tokens[2] == 0 || strspn(tokens[2], "0123456789") == strlen(tokens[2])))
+  {
+    hist_print_verbose(STDOUT_FILENO, tokens[2] == 0 ? HISTORY_SHOWN : atoi(tokens[2]));
+  }
+  else if (strcmp(tokens[1], "--slowest") == 0 &&
+           (tokens[2] == 0 || strspn(tokens[2], "0123456789") == strlen(tokens[2])))
+  {
+    hist_print_slowest(STDOUT_FILENO, tokens[2] == 0 ? HISTORY_SHOWN : atoi(tokens[2]));
+  }
+  else
+  {
+    write(STDERR_FILENO, ARG_ERROR, strlen(ARG_ERROR));
+    last_exit.status = 2 << 8;
+  }
+}
+
+// echo, printf, test, [, true, false, sleep, cat: the utilities built in
+// to save a fork and exec (see utilities.h)
+void run_utility(char *tokens[])
+{
+  last_exit.status = (utility_run(tokens) & 0xff) << 8;
+}
+
+// enable [-n] [name...]: turn builtins back on, or off with -n so the
+// command of that name on $PATH runs instead; without names, list them
+void run_enable(char *tokens[])
+{
+  _Bool enable = tokens[1] == NULL || strcmp(tokens[1], "-n") != 0;
+  char **names = enable ? tokens + 1 : tokens + 2;
+  if (names[0] == NULL)
+  {
+    for (int i = 0; i < num_builtins; i++)
+    {
+      if (builtin_enabled(&builtins[i]) == enable)
+      {
+        const char *prefix = enable ? "enable " : "enable -n ";
+        write(STDOUT_FILENO, prefix, strlen(prefix));
+        write(STDOUT_FILENO, builtins[i].name, strlen(builtins[i].name));
+        write(STDOUT_FILENO, "\n", strlen("\n"));
+      }
+    }
+    return;
+  }
+  for (int i = 0; names[i] != NULL; i++)
+  {
+    const struct builtin *builtin = builtin_find(names[i]);
+    if (builtin == NULL)
+    {
+      write(STDERR_FILENO, "enable: ", strlen("enable: "));
+      write(STDERR_FILENO, names[i], strlen(names[i]));
+      write(STDERR_FILENO, ": not a shell builtin\n", strlen(": not a shell builtin\n"));
+      last_exit.status = 1 << 8;
+      continue;
+    }
+    builtin_set_enabled(builtin, enable);
+  }
+}
+
+/*
+ * Run the builtin command in 'tokens' in the shell process: look it up in
+ * the builtin table, check its argument count, call its handler.
+ */
+void run_builtin(char *tokens[])
+{
+  METRIC_START(dispatch_start);
+  METRIC_COUNT(BUILTINS);
+  const struct builtin *builtin = builtin_lookup(tokens[0]);
+  int num_args = 0;
+  while (tokens[num_args + 1] != NULL)
+  {
+    num_args++;
+  }
+  // handlers only set a status when they fail (or report a job's)
+  memset(&last_exit, 0, sizeof(last_exit));
+  if (builtin->max_args >= 0 && num_args > builtin->max_args)
+  {
+    write(STDERR_FILENO, ARG_ERROR, strlen(ARG_ERROR));
+    last_exit.status = 2 << 8;
+  }
+  else if (num_args < builtin->min_args)
+  {
+    // too few arguments: show what the builtin expects
+    write(STDERR_FILENO, builtin->help, strlen(builtin->help));
+    last_exit.status = 2 << 8;
+  }
+  else
+  {
+    METRIC_STOP(DISPATCH, dispatch_start);
+    builtin->run(tokens);
+  }
+}
+
+// Run a builtin in a forked pipeline stage, away from the shell's children,
+// and exit with its status
+void run_builtin_in_child(char *tokens[])
+{
+  events_reset();
+  run_builtin(tokens);
+  _exit(exit_code(last_exit.status));
+}
+
+// Start a run of a program on $PATH for 'bench', as run_pipeline() would
+pid_t bench_spawn_program(char *argv[], const struct spawn_io *io)
+{
+  const char *path = path_hash_lookup(argv[0]);
+  if (path == NULL && errno != 0)
+  {
+    return -1;
+  }
+  return spawn_command(path, argv, io);
+}
+
+// Start a run for 'bench': a builtin in a forked copy of the shell (as in
+// a pipeline), anything else as a program
+pid_t bench_spawn(char *argv[], const struct spawn_io *io)
+{
+  return runs_builtin(argv) ? spawn_function(run_builtin_in_child, argv, io)
+                             : bench_spawn_program(argv, io);
+}
+
+/*
+ * bench [-n runs] [-w warmup] [-b] [-f text|csv|json] command [args]:
+ * run a command 'runs' times (default 20, after 2 untimed warm-up runs)
+ * and print its wall time percentiles and resource usage. -b also times
+ * 'true' started the same way and subtracts its median, leaving the time
+ * of the command itself rather than that of starting a process.
+ */
+void run_bench(char *tokens[])
+{
+  int runs = 20;
+  int warmup = 2;
+  _Bool subtract_baseline = false;
+  enum bench_format format = BENCH_TEXT;
+  int i = 1;
+  for (; tokens[i] != NULL && tokens[i][0] == '-'; i++)
+  {
+    if (strcmp(tokens[i], "-n") == 0 || strcmp(tokens[i], "-w") == 0)
+    {
+      // a count of runs (at least 1) or of warm-up runs (may be 0)
+      const char *count = tokens[++i];
+      if (count == NULL || count[0] == '\0' || strspn(count, "0123456789") != strlen(count) ||
+          (tokens[i - 1][1] == 'n' && atoi(count) == 0))
+      {
+        write(STDERR_FILENO, BENCH_ERROR, strlen(BENCH_ERROR));
+        last_exit.status = 2 << 8;
+        return;
+      }
+      *(tokens[i - 1][1] == 'n' ? &runs : &warmup) = atoi(count);
+    }
+    else if (strcmp(tokens[i], "-b") == 0)
+    {
+      subtract_baseline = true;
+    }
+    else if (strcmp(tokens[i], "-f") == 0)
+    {
+      const char *name = tokens[++i] != NULL ? tokens[i] : "";
+      format = strcmp(name, "csv") == 0    ? BENCH_CSV
+               : strcmp(name, "json") == 0 ? BENCH_JSON
+                                           : BENCH_TEXT;
+      if (format == BENCH_TEXT && strcmp(name, "text") != 0)
+      {
+        write(STDERR_FILENO, BENCH_ERROR, strlen(BENCH_ERROR));
+        last_exit.status = 2 << 8;
+        return;
+      }
+    }
+    else
+    {
+      break;
+    }
+  }
+  char **cmd = &tokens[i];
+  if (cmd[0] == NULL)
+  {
+    write(STDERR_FILENO, BENCH_ERROR, strlen(BENCH_ERROR));
+    last_exit.status = 2 << 8;
+    return;
+  }
+
+  struct bench_result baseline = {NULL, 0, 0};
+  _Bool completed = true;
+  if (subtract_baseline)
+  {
+    char *true_argv[] = {"true", NULL};
+    completed = bench_run(true_argv, runs_builtin(cmd) ? bench_spawn : bench_spawn_program,
+                          runs, warmup, &baseline);
+  }
+  struct bench_result result = {NULL, 0, 0};
+  if (completed)
+  {
+    completed = bench_run(cmd, bench_spawn, runs, warmup, &result);
+  }
+
+  // the command as typed, for the report
+  size_t size = 1;
+  for (int t = 0; cmd[t] != NULL; t++)
+  {
+    size += strlen(cmd[t]) + 1;
+  }
+  char *name = arena_alloc(&command_arena, size);
+  if (name != NULL)
+  {
+    char *end = name;
+    for (int t = 0; cmd[t] != NULL; t++)
+    {
+      end = stpcpy(stpcpy(end, t > 0 ? " " : ""), cmd[t]);
+    }
+    bench_report(STDOUT_FILENO, format, name, &result, subtract_baseline ? &baseline : NULL);
+  }
+
+  last_exit.status = completed && result.failed == 0 ? 0 : 1 << 8;
+  bench_total_usage(&result, &last_exit.usage);
+  bench_free(&result);
+  bench_free(&baseline);
+}
+
+// Where 'stats -e ... -i N' sends the metrics on its timer (malloc'd)
+static char *metrics_target;
+static enum metrics_format metrics_target_format;
+
+static void export_metrics(void)
+{
+  if (!metrics_export(metrics_target, metrics_target_format))
+  {
+    perror("stats");
+  }
+}
+
+/*
+ * stats [-r] [-t on|off] [-f text|prometheus|json] [-e file|unix:path|off
+ * [-i seconds]]: print where the shell spends its time (see metrics.def).
+ * -t turns timing of the phases on or off (off at startup). -e writes the
+ * metrics to a file or a Unix socket instead (default format prometheus),
+ * and with -i again every 'seconds' from the event loop; -e off stops
+ * that. -r then starts the counts over.
+ */
+void run_stats(char *tokens[])
+{
+  enum metrics_format format = METRICS_TEXT;
+  _Bool format_given = false;
+  _Bool reset = false;
+  int timing = -1; // -t: 1 on, 0 off
+  const char *target = NULL;
+  double interval = 0;
+  for (int i = 1; tokens[i] != NULL; i++)
+  {
+    if (strcmp(tokens[i], "-r") == 0)
+    {
+      reset = true;
+    }
+    else if (strcmp(tokens[i], "-f") == 0 && tokens[i + 1] != NULL)
+    {
+      const char *name = tokens[++i];
+      format = strcmp(name, "prometheus") == 0 ? METRICS_PROMETHEUS
+               : strcmp(name, "json") == 0     ? METRICS_JSON
+                                               : METRICS_TEXT;
+      if (format == METRICS_TEXT && strcmp(name, "text") != 0)
+      {
+        write(STDERR_FILENO, STATS_ERROR, strlen(STATS_ERROR));
+        last_exit.status = 2 << 8;
+        return;
+      }
+      format_given = true;
+    }
+    else if (strcmp(tokens[i], "-e") == 0 && tokens[i + 1] != NULL)
+    {
+      target = tokens[++i];
+    }
+    else if (strcmp(tokens[i], "-t") == 0 && tokens[i + 1] != NULL &&
+             (strcmp(tokens[i + 1], "on") == 0 || strcmp(tokens[i + 1], "off") == 0))
+    {
+      timing = strcmp(tokens[++i], "on") == 0;
+    }
+    else if (strcmp(tokens[i], "-i") == 0 && tokens[i + 1] != NULL && atof(tokens[i + 1]) > 0)
+    {
+      interval = atof(tokens[++i]);
+    }
+    else
+    {
+      write(STDERR_FILENO, STATS_ERROR, strlen(STATS_ERROR));
+      last_exit.status = 2 << 8;
+      return;
+    }
+  }
+  // text is for people; files and sockets get Prometheus or JSON
+  if ((interval > 0 && target == NULL) || (format_given && format == METRICS_TEXT && target))
+  {
+    write(STDERR_FILENO, STATS_ERROR, strlen(STATS_ERROR));
+    last_exit.status = 2 << 8;
+    return;
+  }
+  if (!metrics_compiled_in())
+  {
+    write(STDERR_FILENO, "stats: built without metrics (METRICS=0).\n",
+          strlen("stats: built without metrics (METRICS=0).\n"));
+  }
+
+  if (timing >= 0)
+  {
+    metrics_timing = timing;
+  }
+  if (target != NULL && strcmp(target, "off") == 0)
+  {
+    events_set_timer(0, NULL);
+    free(metrics_target);
+    metrics_target = NULL;
+  }
+  else if (target != NULL)
+  {
+    format = format_given ? format : METRICS_PROMETHEUS;
+    if (!metrics_export(target, format))
+    {
+      perror("stats");
+      last_exit.status = 1 << 8;
+      return;
+    }
+    if (interval > 0)
+    {
+      char *copy = strdup(target);
+      if (copy == NULL || !events_set_timer(interval, export_metrics))
+      {
+        perror("stats");
+        free(copy);
+        last_exit.status = 1 << 8;
+        return;
+      }
+      free(metrics_target);
+      metrics_target = copy;
+      metrics_target_format = format;
+    }
+  }
+  else if ((!reset && timing < 0) || format_given)
+  {
+    if (!metrics_print(STDOUT_FILENO, format))
+    {
+      perror("stats");
+      last_exit.status = 1 << 8;
+    }
+  }
+  if (reset)
+  {
+    metrics_reset();
+  }
 }
 
-// Add buff to history array
-void add_to_hist(char *buff)
-{
-  // create buff2, which is the command num followed by a tab and then the user input
-  char tmp[1024];
-  char buff2[1024];
-  strcpy(tmp, buff);
-  sprintf(buff2, "%d\t", NUM_COMMANDS);
-  strcat(buff2, tmp);
+// Longest text of a redirection besides its file name: "2<<<" or " 2<< ..."
+#define REDIRECT_TEXT_MAX 9
 
-  // shift down all previous elements in history
-  for (int i = 9; i > 0; i--)
+// Append the text of 'redirect' (eg. " 2>&1") at 'end'. returns: the new end.
+char *redirect_text(char *end, const struct redirect *redirect)
+{
+  static const char *ops[] = {[REDIRECT_IN] = "<",       [REDIRECT_OUT] = ">",
+                              [REDIRECT_APPEND] = ">>",  [REDIRECT_DUP] = ">&",
+                              [REDIRECT_HEREDOC] = "<<", [REDIRECT_HERESTRING] = "<<<"};
+  int default_fd = redirect->type == REDIRECT_OUT || redirect->type == REDIRECT_APPEND ||
+                           redirect->type == REDIRECT_DUP
+                       ? STDOUT_FILENO
+                       : STDIN_FILENO;
+  *end++ = ' ';
+  if (redirect->fd != default_fd)
   {
-    strcpy(history[i], history[i - 1]);
+    *end++ = '0' + redirect->fd;
   }
-
-  // add buff2 to top of history
-  strcpy(history[0], buff2);
-  NUM_COMMANDS++;
+  end = stpcpy(end, ops[redirect->type]);
+  if (redirect->type == REDIRECT_DUP)
+  {
+    *end++ = '0' + redirect->dup_fd;
+    return end;
+  }
+  // a here-document is shown without its body
+  return redirect->type == REDIRECT_HEREDOC ? stpcpy(end, " ...") : stpcpy(end, redirect->path);
 }
 
-// helper func that retrieves a command from history
-char *get_cmd(int cmd_num)
+/*
+ * Join the stages of a pipeline back into one command line, for 'jobs'.
+ * returns: the text, in the command arena (NULL if out of memory).
+ */
+char *pipeline_text(struct stage stages[], int num_stages)
 {
-  char *cur_cmd;
-  char *num_str;
-  char *cmd;
-  int num;
-  // iterate through history, check if each element matches the cmd_num arg
-  for (int i = 0; i < 10; i++)
+  size_t size = 1;
+  for (int i = 0; i < num_stages; i++)
+  {
+    for (int t = 0; stages[i].argv[t] != NULL; t++)
+    {
+      size += strlen(stages[i].argv[t]) + strlen(" | ");
+    }
+    for (int r = 0; r < stages[i].num_redirects; r++)
+    {
+      const char *path = stages[i].redirects[r].path;
+      size += strlen(path) + REDIRECT_TEXT_MAX;
+    }
+  }
+  char *cmd = arena_alloc(&command_arena, size);
+  if (cmd == NULL)
+  {
+    return NULL;
+  }
+  char *end = cmd;
+  for (int i = 0; i < num_stages; i++)
   {
-    cur_cmd = strdup(history[i]);
-    num_str = strtok(cur_cmd, "\t");
-    num = atoi(num_str);
-    if (num == cmd_num)
+    for (int t = 0; stages[i].argv[t] != NULL; t++)
+    {
+      const char *sep = t > 0 ? " " : i > 0 ? " | " : "";
+      end = stpcpy(stpcpy(end, sep), stages[i].argv[t]);
+    }
+    for (int r = 0; r < stages[i].num_redirects; r++)
     {
-      cmd = strtok(NULL, "\t");
-      return cmd;
+      end = redirect_text(end, &stages[i].redirects[r]);
     }
   }
-  // this error should not happen if function is called correctly
-  return "ERROR: index not in history";
+  *end = '\0';
+  return cmd;
 }
 
-// print 10 most recent commands
-void print_hist()
+/*
+ * Run a builtin (or, for a bare "> file", nothing) inside the shell with
+ * the stage's redirections in place of our descriptors 0-2.
+ * io: descriptors set up by the caller (eg. a pipe), or NULL for none.
+ */
+void run_builtin_redirected(struct stage *stage, struct stage_fds *io)
 {
-  int num_printed = 10;
-  if (NUM_COMMANDS < 10)
+  struct stage_fds none = {{-1, -1, -1}, {false, false, false}};
+  memset(&last_exit, 0, sizeof(last_exit));
+  if (io == NULL)
   {
-    num_printed = NUM_COMMANDS;
+    io = &none;
+    if (!redirect_open(io, stage->redirects, stage->num_redirects))
+    {
+      redirect_release(io);
+      last_exit.status = 1 << 8;
+      return;
+    }
   }
-  for (int i = 0; i < num_printed; i++)
+  if (stage->argv[0] != NULL)
   {
-    write(STDOUT_FILENO, history[i], strlen(history[i]));
-    write(STDOUT_FILENO, "\n", strlen("\n"));
+    int saved[3];
+    redirect_enter(io, saved);
+    run_builtin(stage->argv);
+    redirect_leave(saved);
   }
+  redirect_release(io);
 }
 
 /*
- * Tokenize the string in 'buff' into 'tokens'.
- * buff: Character array containing string to tokenize.
- *       Will be modified: all whitespace replaced with '\0'
- * tokens: array of pointers of size at least COMMAND_LENGTH/2 + 1.
- *       Will be modified so tokens[i] points to the i'th token
- *       in the string buff. All returned tokens will be non-empty.
- *       NOTE: pointers in tokens[] will all point into buff!
- *       Ends with a null pointer.
- * returns: number of tokens.
+ * Run all stages of a pipeline concurrently, each stage's stdout feeding the
+ * next stage's stdin, as one job (see jobs.h). Every stage is started
+ * before anything is waited on. With job control they all share a new
+ * process group, which gets the terminal while it runs in the foreground.
+ * A single command is a pipeline of one stage. Redirections of a stage are
+ * opened here and take the place of its pipe ends.
+ * A builtin in the first stage runs inside the shell and writes straight
+ * into an enlarged pipe; builtins anywhere else, and the state changing
+ * 'cd' and 'exit', run in a forked child like bash's subshells.
  */
-int tokenize_command(char *buff, char *tokens[])
+void run_pipeline(struct stage stages[], int num_stages, _Bool in_background)
 {
-  int token_count = 0;
-  _Bool in_token = false;
-  int num_chars = strnlen(buff, COMMAND_LENGTH);
-  for (int i = 0; i < num_chars; i++)
+  pid_t pids[num_stages];
+  int num_pids = 0;
+  // 0: the first child starts the job's group; -1: stay in ours
+  pid_t pgid = jobs_control_enabled() ? 0 : -1;
+  int in_fd = -1;
+  _Bool builtin_first = false;
+  struct stage_fds builtin_io;
+  // status of the last stage when it does not run as a process
+  int last_stage_status = 0;
+
+  for (int i = 0; i < num_stages; i++)
   {
-    switch (buff[i])
+    int fds[2] = {-1, -1};
+    if (i < num_stages - 1 && pipe2(fds, O_CLOEXEC) < 0)
     {
-    // Handle token delimiters (ends):
-    case ' ':
-    case '\t':
-    case '\n':
-      buff[i] = '\0';
-      in_token = false;
+      perror("pipe");
+      num_stages = i;
       break;
+    }
 
-    // Handle other characters (may be start)
-    default:
-      if (!in_token)
+    struct stage_fds redir = {{in_fd, fds[1], -1}, {false, false, false}};
+    char **argv = stages[i].argv;
+    pid_t pid = -1;
+    int status = 0;
+    if (!redirect_open(&redir, stages[i].redirects, stages[i].num_redirects))
+    {
+      status = 1 << 8; // not started, like a command that is not found
+    }
+    else if (argv[0] == NULL)
+    {
+      // only redirections: the files have been created, nothing to run
+    }
+    else if (runs_builtin(argv))
+    {
+      struct spawn_io io = {{redir.fds[0], redir.fds[1], redir.fds[2]}, pgid, NULL};
+      if (i == 0 && !in_background && strcmp(argv[0], "cd") != 0 &&
+          strcmp(argv[0], "exit") != 0 && runs_in_shell(argv))
+      {
+        // keep the descriptors (and the pipe, enlarged) until it has run
+        builtin_first = true;
+        builtin_io = redir;
+        if (fds[1] >= 0 && redir.fds[1] == fds[1])
+        {
+          fcntl(fds[1], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+          builtin_io.owned[1] = true;
+          fds[1] = -1;
+        }
+        redir.owned[0] = redir.owned[1] = redir.owned[2] = false;
+      }
+      else if ((pid = spawn_function(run_builtin_in_child, argv, &io)) < 0)
       {
-        tokens[token_count] = &buff[i];
-        token_count++;
-        in_token = true;
+        perror("fork");
+        status = 1 << 8;
+      }
+    }
+    else
+    {
+      struct spawn_io io = {{redir.fds[0], redir.fds[1], redir.fds[2]}, pgid, NULL};
+      if (stages[i].assignments[0] != NULL)
+      {
+        io.envp = command_environment(stages[i].assignments);
+      }
+      const char *path = path_hash_lookup(argv[0]);
+      if ((path == NULL && errno != 0) || (pid = spawn_command(path, argv, &io)) < 0)
+      {
+        // 127: no such command, 126: found but cannot be run, as in sh
+        status = (errno == ENOENT ? 127 : 126) << 8;
+        spawn_report_error(redir.fds[2] >= 0 ? redir.fds[2] : STDERR_FILENO, argv[0], errno);
+      }
+    }
+    redirect_release(&redir);
+    if (i == num_stages - 1)
+    {
+      last_stage_status = pid > 0 ? -1 : status;
+    }
+    if (pid > 0)
+    {
+      pids[num_pids++] = pid;
+      if (pgid == 0)
+      {
+        pgid = pid;
       }
     }
-  }
-  tokens[token_count] = NULL;
-  return token_count;
-}
 
-/**
- * Read a command from the keyboard into the buffer 'buff' and tokenize it
- * such that 'tokens[i]' points into 'buff' to the i'th token in the command.
- * buff: Buffer allocated by the calling code. Must be at least
- *       COMMAND_LENGTH bytes long.
- * tokens[]: Array of character pointers which point into 'buff'. Must be at
- *       least NUM_TOKENS long. Will strip out up to one final '&' token.
- *       tokens will be NULL terminated (a NULL pointer indicates end of
- * tokens). in_background: pointer to a boolean variable. Set to true if user
- * entered an & as their last token; otherwise set to false.
- */
- char pre_dir[COMMAND_LENGTH];
- void  save_dir(){
-  char* result = getcwd(buffer, BUFFER_SIZE);
-  if(result == NULL){
-    write(STDOUT_FILENO, "Unable to get current directory\n", strlen("Unable to get current directory\n"));
-    return;
+    if (in_fd >= 0)
+    {
+      close(in_fd);
+    }
+    if (fds[1] >= 0)
+    {
+      close(fds[1]);
+    }
+    in_fd = fds[0];
+  }
+  if (in_fd >= 0)
+  {
+    close(in_fd);
   }
-  strcpy(pre_dir, buffer);
- }
-void read_command(char *buff, char *tokens[], _Bool *in_background)
-{
-  *in_background = false;
-
-  // Read input
-  int length = read(STDIN_FILENO, buff, COMMAND_LENGTH - 1);
 
-  if ((length < 0) && (errno != EINTR))
+  struct job *job = NULL;
+  if (num_pids > 0)
   {
-    perror("Unable to read command. Terminating.\n");
-    exit(-1); /* terminate with error */
+    const char *cmd = pipeline_text(stages, num_stages);
+    job = jobs_add(pgid > 0 ? pgid : 0, pids, num_pids, cmd != NULL ? cmd : stages[0].argv[0],
+                   in_background);
   }
 
-  // Null terminate and strip \n.
-  buff[length] = '\0';
-  if (buff[strlen(buff) - 1] == '\n')
+  if (!in_background && pgid > 0 && shell_owns_terminal)
   {
-    buff[strlen(buff) - 1] = '\0';
+    tcsetpgrp(STDIN_FILENO, pgid);
   }
 
-  // add to history unless buff is a '!' history command
-  strcpy(buffCheck, buff);
-  if (buffCheck[0] != '!')
+  // first stage builtin: point our descriptors at its pipe and files while
+  // it runs
+  if (builtin_first)
   {
-    add_to_hist(buff);
+    run_builtin_redirected(&stages[0], &builtin_io);
   }
 
-  // Tokenize (saving original command string)
-  int token_count = tokenize_command(buff, tokens);
-  if (token_count == 0)
+  if (job == NULL)
   {
-    return;
+    if (pgid > 0 && shell_owns_terminal)
+    {
+      tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+  }
+  else if (in_background)
+  {
+    if (jobs_control_enabled())
+    {
+      job_print(STDOUT_FILENO, job, true);
+    }
+  }
+  else
+  {
+    last_exit.pid = pids[num_pids - 1];
+    METRIC_START(wait_start);
+    last_exit.status = job_foreground(job, &last_exit.usage);
+    METRIC_STOP(WAIT, wait_start);
   }
 
-  // Extract if running in background:
-  if (token_count > 0 && strcmp(tokens[token_count - 1], "&") == 0)
+  // the status of a pipeline is that of its last stage
+  if (in_background)
+  {
+    memset(&last_exit, 0, sizeof(last_exit));
+  }
+  else if (last_stage_status >= 0)
   {
-    *in_background = true;
-    tokens[token_count - 1] = 0;
+    last_exit.status = last_stage_status;
   }
 }
 
-// alternate read command to be used on non-user inputted commands (eg. during '!!')
-void rea(char *buff, char *tokens[], _Bool *in_background)
+/*
+ * Find the history command a '!' token refers to: !! (the previous
+ * command), !n (command number n), !?string[?] (the newest command
+ * containing string) or !prefix (the newest command starting with prefix).
+ * Prints an error when there is no such command.
+ * ref: the token, starting with '!'. Modified by !?string?.
+ * returns: the command, or NULL.
+ */
+const char *resolve_hist_ref(char *ref)
 {
-  *in_background = false;
-
-  // Read input
-  int length = strlen(buff);
-
-  if ((length < 0) && (errno != EINTR))
+  if (ref[1] == '!' && ref[2] == '\0')
   {
-    perror("Unable to read command. Terminating.\n");
-    exit(-1); /* terminate with error */
+    if (hist_count() == 0)
+    {
+      write(STDERR_FILENO, IND_ERROR, strlen(IND_ERROR));
+      return NULL;
+    }
+    return get_cmd(hist_count() - 1);
   }
 
-  // Null terminate and strip \n.
-  buff[length] = '\0';
-  if (buff[strlen(buff) - 1] == '\n')
+  if (isdigit((unsigned char)ref[1]))
   {
-    buff[strlen(buff) - 1] = '\0';
+    const char *cmd = NULL;
+    if (strspn(ref + 1, "0123456789") == strlen(ref + 1))
+    {
+      cmd = find_cmd(atoi(ref + 1));
+    }
+    if (cmd == NULL)
+    {
+      write(STDERR_FILENO, IND_ERROR, strlen(IND_ERROR));
+    }
+    return cmd;
   }
 
-  // add to history
-  strcpy(buffCheck, buff);
-  if (buffCheck[0] != '!')
+  enum hist_match mode = MATCH_PREFIX;
+  char *pattern = ref + 1;
+  if (pattern[0] == '?')
   {
-    add_to_hist(buff);
+    // !?string[?] as in bash: the closing '?' is optional
+    mode = MATCH_SUBSTRING;
+    pattern++;
+    size_t len = strlen(pattern);
+    if (len > 0 && pattern[len - 1] == '?')
+    {
+      pattern[len - 1] = '\0';
+    }
   }
-
-  // Tokenize (saving original command string)
-  int token_count = tokenize_command(buff, tokens);
-  if (token_count == 0)
+  int n = pattern[0] == '\0' ? -1 : search_hist(pattern, mode);
+  if (n < 0)
   {
-    return;
+    write(STDERR_FILENO, SEARCH_ERROR, strlen(SEARCH_ERROR));
+    return NULL;
   }
+  return get_cmd(n);
+}
 
-  // Extract if running in background:
-  if (token_count > 0 && strcmp(tokens[token_count - 1], "&") == 0)
+// returns: seconds from 'start' (CLOCK_MONOTONIC) until now
+double seconds_since(const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Report the times of a "time" pipeline to stderr, as bash does: real,
+ * user and sys as "0m0.003s", or with 'posix' (time -p) in seconds. The
+ * CPU times are those wait4() reported for its processes plus what the
+ * shell itself used while it ran, which is where builtins run.
+ * self_before: the shell's usage when the pipeline started.
+ */
+void print_times(_Bool posix, double real, const struct rusage *self_before)
+{
+  struct rusage self;
+  getrusage(RUSAGE_SELF, &self);
+  struct timeval user, sys;
+  timersub(&self.ru_utime, &self_before->ru_utime, &user);
+  timersub(&self.ru_stime, &self_before->ru_stime, &sys);
+  timeradd(&user, &last_exit.usage.ru_utime, &user);
+  timeradd(&sys, &last_exit.usage.ru_stime, &sys);
+  double times[] = {real, user.tv_sec + user.tv_usec / 1e6, sys.tv_sec + sys.tv_usec / 1e6};
+  const char *names[] = {"real", "user", "sys"};
+
+  char msg[256];
+  int len = posix ? 0 : snprintf(msg, sizeof(msg), "\n");
+  for (int i = 0; i < 3; i++)
   {
-    *in_background = true;
-    tokens[token_count - 1] = 0;
+    len += posix ? snprintf(msg + len, sizeof(msg) - len, "%s %.2f\n", names[i], times[i])
+                 : snprintf(msg + len, sizeof(msg) - len, "%s\t%dm%.3fs\n", names[i],
+                            (int)(times[i] / 60), times[i] - 60 * (int)(times[i] / 60));
   }
+  write(STDERR_FILENO, msg, len);
 }
 
-/**
- * Main and Execute Commands
+/*
+ * Run one command line, typed or replayed from history: its pipelines one
+ * after the other, skipping those whose && or || condition does not hold
+ * (the status stays that of the last one run). A builtin on its own runs
+ * inside the shell, and so do NAME=value words on their own or in front of
+ * it: they set shell variables. Anything else runs as a job of its own,
+ * where NAME=value words only go into the command's environment. ctrl-c ends the
+ * whole line, not just the command it interrupted.
  */
-int main(int argc, char *argv[])
+void execute_command(struct command *cmd)
 {
-  char input_buffer[COMMAND_LENGTH];
-  char *tokens[NUM_TOKENS];
-  char cwd[COMMAND_LENGTH];
-  char *get_cmd_output;
-  char command[COMMAND_LENGTH];
-
-  //signal(SIGINT, handle_SIGINT);
-  // handler for SIGINT (ctrl-c)
-  
-  
-
-  
-  while (true)
+  cmd->max_rss_kb = -1;
+  for (int i = 0; i < cmd->num_pipelines; i++)
   {
-    
-    struct sigaction handler;
-    handler.sa_handler = handle_SIGINT;
-    handler.sa_flags = 0;
-    sigemptyset(&handler.sa_mask);
-    sigaction(SIGINT, &handler, NULL);
-
-    // Get command
-    // Use write because we need to use read() to work with
-    // signals, and read() is incompatible with printf().
-    getcwd(cwd, COMMAND_LENGTH);
-    write(STDOUT_FILENO, getcwd(cwd, COMMAND_LENGTH),
-          strlen(cwd));
-    write(STDOUT_FILENO, "$ ", strlen("$ "));
-    _Bool in_background = false;
-    read_command(input_buffer, tokens, &in_background);
-
-    /**
-     * Steps For Basic Shell:
-     * 1. Fork a child process
-     * 2. Child process invokes execvp() using results in token array.
-     * 3. If in_background is false, parent waits for
-     *    child to finish. Otherwise, parent loops back to
-     *    read_command() again immediately.
-     */
-    // Fork a child process
-
-    // Check to see if exit is called, exit if so
-    if (strcmp(tokens[0], "exit") == 0)
+    struct pipeline *pipeline = &cmd->pipelines[i];
+    _Bool succeeded = last_exit.status == 0;
+    previous_status = last_exit.status;
+    if ((pipeline->connector == TOKEN_AND_IF && !succeeded) ||
+        (pipeline->connector == TOKEN_OR_IF && succeeded))
     {
-      if (tokens[1] != 0)
-      {
-        write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-      }
-      else
-      {
-        exit(0);
-      }
+      continue;
     }
-
-    // Check to see if pwd is called, print current wd if so
-    else if (strcmp(tokens[0], "pwd") == 0)
+    struct timespec started;
+    struct rusage self_before;
+    if (pipeline->timed)
     {
-      if (tokens[1] != 0)
-      {
-        write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-      }
-      else
-      {
-        getcwd(input_buffer, COMMAND_LENGTH);
-        write(STDOUT_FILENO, getcwd(input_buffer, COMMAND_LENGTH),
-              strlen(getcwd(input_buffer, COMMAND_LENGTH)));
-        write(STDOUT_FILENO, "\n", strlen("\n"));
-      }
+      clock_gettime(CLOCK_MONOTONIC, &started);
+      getrusage(RUSAGE_SELF, &self_before);
     }
-
-    // Check to see if cd is called, change dir if applicable
-    else if (strcmp(tokens[0], "cd") == 0)
+    substitution_status = -1;
+    for (int s = 0; s < pipeline->num_stages; s++)
     {
-      char *dir = NULL;
-      if (tokens[2] != 0)
+      if (!expand_stage(&pipeline->stages[s]))
       {
-        write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-        continue;
-      }
-      if(tokens[1] == NULL || strcmp(tokens[1], "~") == 0){
-        struct passwd *pwd = getpwuid(getuid());
-        dir = pwd->pw_dir;
-        save_dir();
-        chdir(dir);
-        continue;
-      }
-      if(strcmp(tokens[1], "-") == 0){
-        dir = getcwd(buffer, BUFFER_SIZE);
-        if(strcmp(dir, pre_dir) == 0){
-          write(STDOUT_FILENO, "cd OLDPWD not set.\n", strlen("cd OLDPWD not set.\n"));
-        }
-        else{
-          strcpy(dir, pre_dir);
-          write(STDOUT_FILENO, dir, strlen(dir));
-          write(STDOUT_FILENO, "\n", strlen("\n"));
-          chdir(dir);
-        }
-        continue;
+        last_exit.status = 1 << 8;
+        return;
       }
-      save_dir();
-
-      
-      
-      {
-        if (chdir(tokens[1]) != 0)
-        {
-          write(STDOUT_FILENO, "Please enter a valid filepath \n",
-                strlen("Please enter a valid filepath \n"));
-        }
-      } 
     }
 
-    // Check to see if help is called, print help messages according to second token (if any)
-    else if (strcmp(tokens[0], "help") == 0)
+    struct stage *first = &pipeline->stages[0];
+    if (pipeline->num_stages == 1 && !pipeline->in_background &&
+        (first->argv[0] == NULL || (runs_builtin(first->argv) && runs_in_shell(first->argv))))
     {
-      if (tokens[2] != 0)
-      {
-        write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-      }
-      else
+      assign_variables(first->assignments);
+      run_builtin_redirected(first, NULL);
+      // "x=$(false)" fails as its command substitution did
+      if (first->argv[0] == NULL && last_exit.status == 0 && substitution_status > 0)
       {
-        if (tokens[1] == 0)
-        {
-          // print out all messages if no second token provided
-          write(STDOUT_FILENO, PWD_HELP, strlen(PWD_HELP));
-          write(STDOUT_FILENO, CD_HELP, strlen(CD_HELP));
-          write(STDOUT_FILENO, EXIT_HELP, strlen(EXIT_HELP));
-          write(STDOUT_FILENO, HELP_HELP, strlen(HELP_HELP));
-          write(STDOUT_FILENO, HIST_HELP, strlen(HIST_HELP));
-        }
-        else
-        {
-          // print out messages corresponding to the second token
-          if (strcmp(tokens[1], "exit") == 0)
-          {
-            write(STDOUT_FILENO, EXIT_HELP, strlen(EXIT_HELP));
-          }
-          else if (strcmp(tokens[1], "pwd") == 0)
-          {
-            write(STDOUT_FILENO, PWD_HELP, strlen(PWD_HELP));
-          }
-          else if (strcmp(tokens[1], "cd") == 0)
-          {
-            write(STDOUT_FILENO, CD_HELP, strlen(CD_HELP));
-          }
-          else if (strcmp(tokens[1], "history") == 0)
-          {
-            write(STDOUT_FILENO, HIST_HELP, strlen(HIST_HELP));
-          }
-          else if (strcmp(tokens[1], "help") == 0)
-          {
-            write(STDOUT_FILENO, HELP_HELP, strlen(HELP_HELP));
-          }
-          else
-          {
-            // error for invalid entry
-            write(STDOUT_FILENO, "'", strlen("'"));
-            write(STDOUT_FILENO, tokens[1], strlen(tokens[1]));
-            write(STDOUT_FILENO, "' is an external command or application.\n", strlen("' is an external command or application.\n"));
-          }
-        }
+        last_exit.status = substitution_status;
       }
     }
-
-    // Check to see if history is called, print previous 10 commands if so
-    else if (strcmp(tokens[0], "history") == 0)
+    else
     {
-      if (tokens[1] != 0)
-      {
-        write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-      }
-      else
-      {
-        print_hist();
-      }
+      run_pipeline(pipeline->stages, pipeline->num_stages, pipeline->in_background);
     }
-
-    // Check to see if a different history command is called, print an error or run the corresponding command
-    else if (tokens[0][0] == '!')
+    // builtins leave no usage: only processes (of fg, parallel...) have an RSS
+    if (last_exit.usage.ru_maxrss > 0 && last_exit.usage.ru_maxrss > cmd->max_rss_kb)
     {
-      if (tokens[1] != 0)
-      {
-        write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-      }
-      if (tokens[0][1] == '!')
-      {
-        // !! case - re-run previous command
-        if (strcmp(history[0], "") == 0)
-        {
-          // print an error if history is empty
-          write(STDOUT_FILENO, IND_ERROR, strlen(IND_ERROR));
-        }
-        else
-        {
-          int index = NUM_COMMANDS - 1;
+      cmd->max_rss_kb = last_exit.usage.ru_maxrss;
+    }
+    if (pipeline->timed)
+    {
+      print_times(pipeline->time_posix, seconds_since(&started), &self_before);
+    }
+    if (WIFSIGNALED(last_exit.status) && WTERMSIG(last_exit.status) == SIGINT)
+    {
+      return;
+    }
+  }
+}
 
-          // command is the previous command
-          get_cmd_output = get_cmd(index);
-          strcpy(command, get_cmd_output);
-          rea(command, tokens, &in_background);
+/*
+ * Run the command of a $(command) in the forked copy of the shell that
+ * command_output() started, as a script of its own (so ';', '&&', pipes and
+ * nested substitutions all work), and exit with its status. Job control
+ * stays with the shell proper.
+ */
+void run_substitution(char *tokens[])
+{
+  events_reset();
+  jobs_init(-1);
+  shell_owns_terminal = false;
+  in_subshell = true;
+  struct line_reader input;
+  reader_init_string(&input, tokens[0]);
+  struct command cmd;
+  while (read_command(&input, &cmd))
+  {
+    execute_command(&cmd);
+  }
+  _exit(exit_code(last_exit.status));
+}
 
-          // write(STDOUT_FILENO, tokens[0], strlen(tokens[0]));
-          write(STDOUT_FILENO, get_cmd_output, strlen(get_cmd_output));
-          write(STDOUT_FILENO, "\n", strlen("\n"));
-          
-          // run the command (similar format to above command checks)
-          // exit check
-          if (strcmp(tokens[0], "exit") == 0)
-          {
-            if (tokens[1] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              exit(0);
-            }
-          }
-
-          // pwd check
-          if (strcmp(tokens[0], "pwd") == 0)
-          {
-            if (tokens[1] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              getcwd(input_buffer, COMMAND_LENGTH);
-              write(STDOUT_FILENO, getcwd(input_buffer, COMMAND_LENGTH),
-                    strlen(getcwd(input_buffer, COMMAND_LENGTH)));
-              write(STDOUT_FILENO, "\n", strlen("\n"));
-            }
-          }
-
-          // cd check
-          else if (strcmp(tokens[0], "cd") == 0)
-          {
-            if (tokens[2] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              if (chdir(tokens[1]) != 0)
-              {
-                write(STDOUT_FILENO, "Please enter a valid filepath \n",
-                      strlen("Please enter a valid filepath \n"));
-              }
-            }
-          }
-
-          // help check
-          else if (strcmp(tokens[0], "help") == 0)
-          {
-            if (tokens[2] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              if (tokens[1] == 0)
-              {
-                write(STDOUT_FILENO, PWD_HELP, strlen(PWD_HELP));
-                write(STDOUT_FILENO, CD_HELP, strlen(CD_HELP));
-                write(STDOUT_FILENO, EXIT_HELP, strlen(EXIT_HELP));
-                write(STDOUT_FILENO, HELP_HELP, strlen(HELP_HELP));
-                write(STDOUT_FILENO, HIST_HELP, strlen(HIST_HELP));
-              }
-              else
-              {
-                if (strcmp(tokens[1], "exit") == 0)
-                {
-                  write(STDOUT_FILENO, EXIT_HELP, strlen(EXIT_HELP));
-                }
-                else if (strcmp(tokens[1], "pwd") == 0)
-                {
-                  write(STDOUT_FILENO, PWD_HELP, strlen(PWD_HELP));
-                }
-                else if (strcmp(tokens[1], "cd") == 0)
-                {
-                  write(STDOUT_FILENO, CD_HELP, strlen(CD_HELP));
-                }
-                else if (strcmp(tokens[1], "history") == 0)
-                {
-                  write(STDOUT_FILENO, HIST_HELP, strlen(HIST_HELP));
-                }
-                else if (strcmp(tokens[1], "help") == 0)
-                {
-                  write(STDOUT_FILENO, HELP_HELP, strlen(HELP_HELP));
-                }
-                else
-                {
-                  write(STDOUT_FILENO, "'", strlen("'"));
-                  write(STDOUT_FILENO, tokens[1], strlen(tokens[1]));
-                  write(STDOUT_FILENO, "' is an external command or application.\n",
-                        strlen("' is an external command or application.\n"));
-                }
-              }
-            }
-          }
-
-          // history check
-          else if (strcmp(tokens[0], "history") == 0)
-          {
-            if (tokens[1] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              print_hist();
-            }
-          }
-
-          else if (strcmp(tokens[0], "ls") == 0 || strcmp(tokens[0], "echo") == 0 || strcmp(tokens[0], cwd) == 0) 
-          {
-            // avoid throwing error for external functions
-          }
-
-          else
-          {
-            // error if no matches
-            write(STDERR_FILENO, AR_ERROR, strlen(AR_ERROR));
-          }
-        }
-      }
+/**
+ * Main and Execute Commands
+ */
+int main(int argc, char *argv[])
+{
+  struct command cmd;
 
-      // !0 case - re-run command 0 if still in history
-      else if (tokens[0][1] == '0')
-      {
-        // !0 case
-        if (NUM_COMMANDS < 11 && NUM_COMMANDS > 0)
-        {
-          get_cmd_output = get_cmd(0);
-          strcpy(command, get_cmd_output);
-          rea(command, tokens, &in_background);
-          write(STDOUT_FILENO, get_cmd_output, strlen(get_cmd_output));
-          write(STDOUT_FILENO, "\n", strlen("\n"));
+  // Shell variables start out as the environment, all exported
+  if (!vars_init(environ))
+  {
+    perror("Unable to import the environment");
+  }
 
-          // run the command (similar format to above command checks)
-          // exit check
-          if (strcmp(tokens[0], "exit") == 0)
-          {
-            if (tokens[1] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              exit(0);
-            }
-          }
-
-          // pwd check
-          if (strcmp(tokens[0], "pwd") == 0)
-          {
-            if (tokens[1] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              getcwd(input_buffer, COMMAND_LENGTH);
-              write(STDOUT_FILENO, getcwd(input_buffer, COMMAND_LENGTH),
-                    strlen(getcwd(input_buffer, COMMAND_LENGTH)));
-              write(STDOUT_FILENO, "\n", strlen("\n"));
-            }
-          }
-
-          // cd check
-          else if (strcmp(tokens[0], "cd") == 0)
-          {
-            if (tokens[2] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              if (chdir(tokens[1]) != 0)
-              {
-                write(STDOUT_FILENO, "Please enter a valid filepath \n",
-                      strlen("Please enter a valid filepath \n"));
-              }
-            }
-          }
-
-          // help check
-          else if (strcmp(tokens[0], "help") == 0)
-          {
-            if (tokens[2] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              if (tokens[1] == 0)
-              {
-                write(STDOUT_FILENO, PWD_HELP, strlen(PWD_HELP));
-                write(STDOUT_FILENO, CD_HELP, strlen(CD_HELP));
-                write(STDOUT_FILENO, EXIT_HELP, strlen(EXIT_HELP));
-                write(STDOUT_FILENO, HELP_HELP, strlen(HELP_HELP));
-                write(STDOUT_FILENO, HIST_HELP, strlen(HIST_HELP));
-              }
-              else
-              {
-                if (strcmp(tokens[1], "exit") == 0)
-                {
-                  write(STDOUT_FILENO, EXIT_HELP, strlen(EXIT_HELP));
-                }
-                else if (strcmp(tokens[1], "pwd") == 0)
-                {
-                  write(STDOUT_FILENO, PWD_HELP, strlen(PWD_HELP));
-                }
-                else if (strcmp(tokens[1], "cd") == 0)
-                {
-                  write(STDOUT_FILENO, CD_HELP, strlen(CD_HELP));
-                }
-                else if (strcmp(tokens[1], "history") == 0)
-                {
-                  write(STDOUT_FILENO, HIST_HELP, strlen(HIST_HELP));
-                }
-                else if (strcmp(tokens[1], "help") == 0)
-                {
-                  write(STDOUT_FILENO, HELP_HELP, strlen(HELP_HELP));
-                }
-                else
-                {
-                  write(STDOUT_FILENO, "'", strlen("'"));
-                  write(STDOUT_FILENO, tokens[1], strlen(tokens[1]));
-                  write(STDOUT_FILENO, "' is an external command or application.\n",
-                        strlen("' is an external command or application.\n"));
-                }
-              }
-            }
-          }
-
-          // history check
-          else if (strcmp(tokens[0], "history") == 0)
-          {
-            if (tokens[1] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              print_hist();
-            }
-          }
-          else
-          {
-            // error if no matches
-            write(STDERR_FILENO, AR_ERROR, strlen(AR_ERROR));
-          }
+  // SHELL_SPAWN selects how external commands are started (see spawn.h);
+  // this comes first so a spawn helper starts out with a small heap
+  const char *method = vars_get("SHELL_SPAWN");
+  if (method != NULL && !spawn_set_method(method))
+  {
+    write(STDERR_FILENO, SPAWN_ERROR, strlen(SPAWN_ERROR));
+  }
 
-        }
+  // PATH and HISTSIZE take effect as soon as they are set
+  vars_watch("PATH", path_hash_set_path);
+  vars_watch("HISTSIZE", set_hist_size);
+  set_hist_size(vars_get("HISTSIZE"));
+  vars_watch("HISTTIMING", set_hist_timing);
+  set_hist_timing(vars_get("HISTTIMING"));
+
+  // Commands come from -c, a script file, or stdin. Only a terminal on
+  // stdin makes the shell interactive (prompt, ctrl-c help).
+  struct line_reader input;
+  _Bool interactive = false;
+  if (argc > 1 && strcmp(argv[1], "-c") == 0)
+  {
+    if (argc != 3)
+    {
+      write(STDERR_FILENO, USAGE_ERROR, strlen(USAGE_ERROR));
+      exit(2);
+    }
+    reader_init_string(&input, argv[2]);
+  }
+  else if (argc > 1)
+  {
+    int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      perror(argv[1]);
+      exit(127);
+    }
+    reader_init_fd(&input, fd);
+  }
+  else
+  {
+    reader_init_fd(&input, STDIN_FILENO);
+    interactive = isatty(STDIN_FILENO);
+  }
 
-        else if (strcmp(tokens[0], "ls") == 0 || strcmp(tokens[0], "echo") == 0 || strcmp(tokens[0], cwd) == 0) 
-        {
-          // avoid throwing error for external functions
-        }
+  // The working directory is looked up once and then tracked by 'cd'; the
+  // prompt format ($PS1) is parsed once
+  if (!cwd_init())
+  {
+    perror("Unable to get current directory");
+  }
+  if (interactive)
+  {
+    prompt_set_format(vars_get("PS1"));
+    vars_watch("PS1", prompt_set_format);
+  }
 
-        else
-        {
-          // error if command 0 is no longer in history
-          write(STDOUT_FILENO, IND_ERROR, strlen(IND_ERROR));
-        }
-      }
+  // History is kept in $HISTFILE (default ~/.shell_history) and shared
+  // with other sessions; scripts only use it when HISTFILE is set.
+  const char *histfile = vars_get("HISTFILE");
+  char histfile_buf[PATH_MAX];
+  if (histfile == NULL && interactive && vars_get("HOME") != NULL)
+  {
+    snprintf(histfile_buf, sizeof(histfile_buf), "%s/.shell_history", vars_get("HOME"));
+    histfile = histfile_buf;
+  }
+  if (histfile != NULL && histfile[0] != '\0')
+  {
+    histlog_open(histfile);
+  }
 
-      // !n case, run command number n if still in history
-      else
-      {
-        char *n_STR = strtok(tokens[0], "!");
-        int n = atoi(n_STR);
-        // if atoi == 0, then the string was not a valid int - print error
-        if (n == 0)
-        {
-          write(STDOUT_FILENO, IND_ERROR, strlen(IND_ERROR));
-        }
-        // check if n is in history
-        else if (n > NUM_COMMANDS - 11 && n < NUM_COMMANDS && n > 0)
-        {
-          get_cmd_output = get_cmd(n);
-          strcpy(command, get_cmd_output);
-          rea(command, tokens, &in_background);
-          write(STDOUT_FILENO, get_cmd_output, strlen(get_cmd_output));
-          write(STDOUT_FILENO, "\n", strlen("\n"));
+  // Builtins write into pipes from inside the shell: a reader that went
+  // away must give them EPIPE, not kill the shell (spawn.c restores
+  // SIGPIPE for children)
+  signal(SIGPIPE, SIG_IGN);
 
-          // run the n'th command, similar checks to above for command
-          // exit check
-          if (strcmp(tokens[0], "exit") == 0)
-          {
-            if (tokens[1] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              exit(0);
-            }
-          }
-
-          // pwd check
-          if (strcmp(tokens[0], "pwd") == 0)
-          {
-            if (tokens[1] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              getcwd(input_buffer, COMMAND_LENGTH);
-              write(STDOUT_FILENO, getcwd(input_buffer, COMMAND_LENGTH),
-                    strlen(getcwd(input_buffer, COMMAND_LENGTH)));
-              write(STDOUT_FILENO, "\n", strlen("\n"));
-            }
-          }
-
-          // cd check
-          else if (strcmp(tokens[0], "cd") == 0)
-          {
-            if (tokens[2] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              if (chdir(tokens[1]) != 0)
-              {
-                write(STDOUT_FILENO, "Please enter a valid filepath \n",
-                      strlen("Please enter a valid filepath \n"));
-              }
-            }
-          }
-
-          // help check
-          else if (strcmp(tokens[0], "help") == 0)
-          {
-            if (tokens[2] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              if (tokens[1] == 0)
-              {
-                write(STDOUT_FILENO, PWD_HELP, strlen(PWD_HELP));
-                write(STDOUT_FILENO, CD_HELP, strlen(CD_HELP));
-                write(STDOUT_FILENO, EXIT_HELP, strlen(EXIT_HELP));
-                write(STDOUT_FILENO, HELP_HELP, strlen(HELP_HELP));
-                write(STDOUT_FILENO, HIST_HELP, strlen(HIST_HELP));
-              }
-              else
-              {
-                if (strcmp(tokens[1], "exit") == 0)
-                {
-                  write(STDOUT_FILENO, EXIT_HELP, strlen(EXIT_HELP));
-                }
-                else if (strcmp(tokens[1], "pwd") == 0)
-                {
-                  write(STDOUT_FILENO, PWD_HELP, strlen(PWD_HELP));
-                }
-                else if (strcmp(tokens[1], "cd") == 0)
-                {
-                  write(STDOUT_FILENO, CD_HELP, strlen(CD_HELP));
-                }
-                else if (strcmp(tokens[1], "history") == 0)
-                {
-                  write(STDOUT_FILENO, HIST_HELP, strlen(HIST_HELP));
-                }
-                else if (strcmp(tokens[1], "help") == 0)
-                {
-                  write(STDOUT_FILENO, HELP_HELP, strlen(HELP_HELP));
-                }
-                else
-                {
-                  write(STDOUT_FILENO, "'", strlen("'"));
-                  write(STDOUT_FILENO, tokens[1], strlen(tokens[1]));
-                  write(STDOUT_FILENO, "' is an external command or application.\n",
-                        strlen("' is an external command or application.\n"));
-                }
-              }
-            }
-          }
-
-          // history check
-          else if (strcmp(tokens[0], "history") == 0)
-          {
-            if (tokens[1] != 0)
-            {
-              write(STDOUT_FILENO, ARG_ERROR, strlen(ARG_ERROR));
-            }
-            else
-            {
-              print_hist();
-            }
-          }
-          else
-          {
-            write(STDERR_FILENO, AR_ERROR, strlen(AR_ERROR));
-          }
-        }
+  // When reading from our controlling terminal, jobs get the terminal
+  // while they run in the foreground (job control); ignore SIGTTOU so we
+  // can take it back afterwards, and ctrl-z so only the job stops.
+  if (interactive && tcgetpgrp(STDIN_FILENO) == getpgrp())
+  {
+    shell_owns_terminal = true;
+    signal(SIGTTOU, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    jobs_init(STDIN_FILENO);
+  }
 
-        else if (strcmp(tokens[0], "ls") == 0 || strcmp(tokens[0], "echo") == 0 || strcmp(tokens[0], cwd) == 0) 
-        {
-          // avoid throwing error for external functions
-        }
+  // Children are reaped, and ctrl-c at the prompt is answered, by the
+  // event loop; it runs while we wait for input.
+  if (!events_init(interactive ? handle_SIGINT : NULL))
+  {
+    perror("Unable to set up the event loop");
+  }
 
-        else
-        {
-          // error if n is not in history
-          write(STDOUT_FILENO, IND_ERROR, strlen(IND_ERROR));
-        }
+  while (true)
+  {
+    // Report jobs that finished or stopped meanwhile (scripts only forget
+    // the finished ones)
+    jobs_report(interactive ? STDOUT_FILENO : -1);
+
+    if (interactive)
+    {
+      // Draw the prompt in one write(); read() is used for input so
+      // stdio buffering never gets in the way.
+      size_t prompt_len;
+      METRIC_START(prompt_start);
+      const char *prompt = prompt_render(exit_code(last_exit.status), &prompt_len);
+      METRIC_STOP(PROMPT, prompt_start);
+      write(STDOUT_FILENO, prompt, prompt_len);
+    }
+    // Wait for a line, reaping children meanwhile; ctrl-c redraws the prompt
+    if (!reader_has_line(&input))
+    {
+      if (!events_wait_input(input.fd))
+      {
+        continue;
       }
     }
-
-    else if (strcmp(tokens[0], "ls") == 0 || strcmp(tokens[0], "echo") == 0 || strcmp(tokens[0], cwd) == 0) 
+    else if (events_num_watched() > 0)
     {
-      // avoid throwing error for external functions
+      events_poll();
     }
 
-    // error if invalid input
-    else
+    // The previous command is done with: drop its memory in one go
+    arena_reset(&command_arena);
+    if (!read_command(&input, &cmd))
+    {
+      // end of input (ctrl-d on a terminal)
+      if (interactive)
+      {
+        write(STDOUT_FILENO, "\n", strlen("\n"));
+      }
+      // like sh, exit with the status of the last command
+      exit(exit_code(last_exit.status));
+    }
+    if (cmd.num_pipelines == 0)
     {
-      write(STDERR_FILENO, AR_ERROR, strlen(AR_ERROR));
+      continue;
     }
-
-    if(strcmp(tokens[0], "exit") != 0 && strcmp(tokens[0], "cd") != 0 && strcmp(tokens[0], "pwd") != 0 && strcmp(tokens[0], "help") != 0 && strcmp(tokens[0], "history") != 0 && strcmp(tokens[0], "!!") != 0 && strcmp(tokens[0], "![:number:]") != 0) 
+    // A '!' history reference replays the command it names, which is
+    // echoed and added to history as if it had been typed
+    struct stage *first = &cmd.pipelines[0].stages[0];
+    if (first->words[0] != NULL && first->words[0]->text[0] == '!')
     {
-      // fork a child
-      pid_t pid = fork();
-      if (pid < 0)
+      if (first->words[1] != NULL || cmd.num_pipelines > 1 ||
+          cmd.pipelines[0].num_stages > 1 || first->num_redirects > 0)
       {
-        perror("fork");
-        exit(1);
+        write(STDERR_FILENO, ARG_ERROR, strlen(ARG_ERROR));
+        last_exit.status = 2 << 8;
+        continue;
       }
-
-      if (pid == 0)
+      const char *line = resolve_hist_ref(first->words[0]->text);
+      if (line == NULL)
       {
-        // execute child
-        execvp(tokens[0], tokens);
+        last_exit.status = 1 << 8;
+        continue;
       }
-      else
+      write(STDOUT_FILENO, line, strlen(line));
+      write(STDOUT_FILENO, "\n", strlen("\n"));
+      rea(line, &input, &cmd);
+      if (cmd.num_pipelines == 0)
       {
-        if (!in_background)
-        {
-          waitpid(pid, NULL, 0);
-        }
-        while (waitpid(-1, NULL, WNOHANG) > 0)
-        {
-          ;
-        }
+        continue;
       }
     }
+
+    // A command reading stdin starts just past this one's lines
+    reader_sync(&input);
+    struct timespec started, started_at;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    clock_gettime(CLOCK_REALTIME, &started_at);
+    execute_command(&cmd);
+    if (hist_timing && cmd.hist_num >= 0)
+    {
+      struct hist_stats stats = {started_at.tv_sec, seconds_since(&started),
+                                 exit_code(last_exit.status), cmd.max_rss_kb};
+      hist_annotate(cmd.hist_num, &stats);
+    }
   }
 
   return 0;
@@ -0,0 +1,420 @@
+// Process creation for external commands.
+//
+// fork() duplicates the shell's page tables on every command, which gets
+// more expensive as the shell's heap grows. posix_spawn, vfork and
+// clone(CLONE_VM | CLONE_VFORK) all borrow the parent's address space until
+// the child calls exec, so their cost does not depend on the shell's size.
+// The helper (zygote.c) goes further: the child is forked from a separate
+// process that never grows.
+
+#include "spawn.h"
+
+#include "metrics.h"
+#include "zygote.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CLONE_STACK_SIZE (256 * 1024)
+
+extern char **environ;
+
+enum spawn_method spawn_method = SPAWN_POSIX_SPAWN;
+
+static const char *method_names[] = {
+    [SPAWN_POSIX_SPAWN] = "posix_spawn",
+    [SPAWN_VFORK] = "vfork",
+    [SPAWN_CLONE] = "clone",
+    [SPAWN_FORK] = "fork",
+    [SPAWN_HELPER] = "helper",
+};
+
+// Signals the shell catches or ignores. A child sharing our memory must not
+// run our handlers, and an ignored disposition would survive exec, so these
+// are reset to SIG_DFL in the child.
+static const int shell_signals[] = {SIGINT, SIGTSTP, SIGTTIN, SIGTTOU, SIGPIPE};
+#define NUM_SHELL_SIGNALS (sizeof(shell_signals) / sizeof(shell_signals[0]))
+
+// The shell keeps SIGCHLD and SIGINT blocked and reads them from a signalfd
+// (see events.c); every child starts with an empty signal mask instead of
+// inheriting ours.
+static void unblock_all_signals(void)
+{
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+// RLIMIT_NOFILE the shell started with, which children get back
+static struct rlimit child_fd_limit;
+static bool fd_limit_raised = false;
+
+void spawn_set_fd_limit(const struct rlimit *limit)
+{
+  child_fd_limit = *limit;
+  fd_limit_raised = true;
+}
+
+void spawn_restore_fd_limit(void)
+{
+  if (fd_limit_raised)
+  {
+    setrlimit(RLIMIT_NOFILE, &child_fd_limit);
+  }
+}
+
+// errno of a failed exec, written by a child that shares our memory
+// (vfork/clone) and read by the parent once the child is gone.
+static volatile int child_errno;
+
+bool spawn_set_method(const char *name)
+{
+  for (size_t i = 0; i < sizeof(method_names) / sizeof(method_names[0]); i++)
+  {
+    if (strcmp(name, method_names[i]) == 0)
+    {
+      if (i == SPAWN_HELPER && !zygote_running() && !zygote_start())
+      {
+        return false;
+      }
+      spawn_method = (enum spawn_method)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *spawn_method_name(enum spawn_method method)
+{
+  return method_names[method];
+}
+
+void spawn_report_error(int fd, const char *cmd, int err)
+{
+  char msg[512];
+  int len = snprintf(msg, sizeof(msg), "ERROR: Unable to execute '%s': %s.\n",
+                     cmd, strerror(err));
+  if (len > (int)sizeof(msg) - 1)
+  {
+    len = sizeof(msg) - 1;
+  }
+  write(fd, msg, len);
+}
+
+// Apply the descriptor and process group setup of 'io' in the child.
+// Async-signal-safe, so it can run after vfork().
+static void setup_child_io(const struct spawn_io *io)
+{
+  if (io == NULL)
+  {
+    return;
+  }
+  if (io->pgid >= 0)
+  {
+    setpgid(0, io->pgid);
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    if (io->fds[i] >= 0 && io->fds[i] != i)
+    {
+      dup2(io->fds[i], i);
+    }
+  }
+}
+
+// For a child that goes on running shell code instead of calling exec:
+// close what exec would have (every O_CLOEXEC descriptor), so it does not
+// keep other stages' pipe ends open and the pipes still see EOF and EPIPE.
+static void close_cloexec_fds(void)
+{
+  DIR *dir = opendir("/proc/self/fd");
+  if (dir == NULL)
+  {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    int fd = atoi(entry->d_name);
+    int flags = fd > STDERR_FILENO && fd != dirfd(dir) ? fcntl(fd, F_GETFD) : -1;
+    if (flags >= 0 && (flags & FD_CLOEXEC))
+    {
+      close(fd);
+    }
+  }
+  closedir(dir);
+}
+
+// The environment the new program gets
+static char **child_environment(const struct spawn_io *io)
+{
+  return io != NULL && io->envp != NULL ? io->envp : environ;
+}
+
+// Runs in a child that may share the parent's memory: only async-signal-safe
+// calls, and nothing that touches the parent's heap.
+static void exec_in_child(const char *path, char *tokens[], const struct spawn_io *io)
+{
+  struct sigaction dfl;
+  memset(&dfl, 0, sizeof(dfl));
+  dfl.sa_handler = SIG_DFL;
+  sigemptyset(&dfl.sa_mask);
+  for (size_t i = 0; i < NUM_SHELL_SIGNALS; i++)
+  {
+    sigaction(shell_signals[i], &dfl, NULL);
+  }
+  setup_child_io(io);
+  spawn_restore_fd_limit();
+  unblock_all_signals();
+
+  char **envp = child_environment(io);
+  if (path != NULL)
+  {
+    execve(path, tokens, envp);
+  }
+  else
+  {
+    execvpe(tokens[0], tokens, envp);
+  }
+  child_errno = errno;
+  _exit(127);
+}
+
+static pid_t spawn_posix(const char *path, char *tokens[], const struct spawn_io *io)
+{
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t actions;
+  sigset_t defaults, none;
+  short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+  pid_t pid;
+
+  sigemptyset(&defaults);
+  for (size_t i = 0; i < NUM_SHELL_SIGNALS; i++)
+  {
+    sigaddset(&defaults, shell_signals[i]);
+  }
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  sigemptyset(&none);
+  posix_spawnattr_setsigmask(&attr, &none);
+  posix_spawn_file_actions_init(&actions);
+  if (io != NULL)
+  {
+    if (io->pgid >= 0)
+    {
+      flags |= POSIX_SPAWN_SETPGROUP;
+      posix_spawnattr_setpgroup(&attr, io->pgid);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+      if (io->fds[i] >= 0 && io->fds[i] != i)
+      {
+        posix_spawn_file_actions_adddup2(&actions, io->fds[i], i);
+      }
+    }
+  }
+  posix_spawnattr_setflags(&attr, flags);
+
+  // posix_spawn has no attribute for limits, and the child starts with
+  // ours: lower the soft limit just around the call (the shell is single
+  // threaded, and descriptors already open past it stay usable)
+  char **envp = child_environment(io);
+  spawn_restore_fd_limit();
+  int err = path != NULL ? posix_spawn(&pid, path, &actions, &attr, tokens, envp)
+                         : posix_spawnp(&pid, tokens[0], &actions, &attr, tokens, envp);
+  if (fd_limit_raised)
+  {
+    struct rlimit raised = {child_fd_limit.rlim_max, child_fd_limit.rlim_max};
+    setrlimit(RLIMIT_NOFILE, &raised);
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (err != 0)
+  {
+    // glibc has already reaped the child when exec fails
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+struct clone_args
+{
+  const char *path;
+  char **tokens;
+  const struct spawn_io *io;
+};
+
+static int clone_child(void *arg)
+{
+  struct clone_args *args = arg;
+  exec_in_child(args->path, args->tokens, args->io);
+  return 127;
+}
+
+static pid_t spawn_shared(const char *path, char *tokens[], const struct spawn_io *io)
+{
+  static char *clone_stack = NULL;
+  sigset_t all, old_mask;
+  pid_t pid;
+
+  if (spawn_method == SPAWN_CLONE && clone_stack == NULL)
+  {
+    void *stack = mmap(NULL, CLONE_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED)
+    {
+      return -1;
+    }
+    clone_stack = stack;
+  }
+
+  // Block everything so no handler runs in the child while it is still
+  // using our memory; the child clears the mask just before exec.
+  sigfillset(&all);
+  sigprocmask(SIG_SETMASK, &all, &old_mask);
+  child_errno = 0;
+
+  if (spawn_method == SPAWN_CLONE)
+  {
+    struct clone_args args = {path, tokens, io};
+    pid = clone(clone_child, clone_stack + CLONE_STACK_SIZE,
+                CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+  }
+  else
+  {
+    pid = vfork();
+    if (pid == 0)
+    {
+      exec_in_child(path, tokens, io);
+    }
+  }
+
+  int err = errno;
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  if (pid < 0)
+  {
+    errno = err;
+    return -1;
+  }
+
+  // The parent only resumes once the child has exec'd or exited.
+  if (child_errno != 0)
+  {
+    err = child_errno;
+    waitpid(pid, NULL, 0);
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+static pid_t spawn_fork(const char *path, char *tokens[], const struct spawn_io *io)
+{
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    for (size_t i = 0; i < NUM_SHELL_SIGNALS; i++)
+    {
+      signal(shell_signals[i], SIG_DFL);
+    }
+    setup_child_io(io);
+    spawn_restore_fd_limit();
+    unblock_all_signals();
+    char **envp = child_environment(io);
+    if (path != NULL)
+    {
+      execve(path, tokens, envp);
+    }
+    else
+    {
+      execvpe(tokens[0], tokens, envp);
+    }
+    int err = errno;
+    spawn_report_error(STDERR_FILENO, tokens[0], err);
+    // 127: no such command, 126: found but cannot be run, as in sh
+    _exit(err == ENOENT ? 127 : 126);
+  }
+  // also join the group from this side so there is no window where the
+  // child has not done it yet
+  if (pid > 0 && io != NULL && io->pgid >= 0)
+  {
+    setpgid(pid, io->pgid);
+  }
+  return pid;
+}
+
+// Count a spawn and time it from 'start'
+static pid_t counted(pid_t pid, uint64_t start)
+{
+  METRIC_STOP(SPAWN, start);
+  if (pid < 0)
+  {
+    METRIC_COUNT(SPAWN_ERRORS);
+  }
+  else
+  {
+    METRIC_COUNT(SPAWNS);
+  }
+  return pid;
+}
+
+pid_t spawn_function(void (*fn)(char *[]), char *tokens[], const struct spawn_io *io)
+{
+  METRIC_START(start);
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    for (size_t i = 0; i < NUM_SHELL_SIGNALS; i++)
+    {
+      signal(shell_signals[i], SIG_DFL);
+    }
+    setup_child_io(io);
+    close_cloexec_fds();
+    unblock_all_signals();
+    // children of the helper would be the parent shell's, not ours
+    zygote_detach();
+    fn(tokens);
+    _exit(0);
+  }
+  if (pid > 0 && io != NULL && io->pgid >= 0)
+  {
+    setpgid(pid, io->pgid);
+  }
+  return counted(pid, start);
+}
+
+pid_t spawn_command(const char *path, char *tokens[], const struct spawn_io *io)
+{
+  METRIC_START(start);
+  switch (spawn_method)
+  {
+  case SPAWN_POSIX_SPAWN:
+    return counted(spawn_posix(path, tokens, io), start);
+  case SPAWN_VFORK:
+  case SPAWN_CLONE:
+    return counted(spawn_shared(path, tokens, io), start);
+  case SPAWN_HELPER:
+  {
+    pid_t pid = zygote_spawn(path, tokens, io);
+    if (pid < 0 && (errno == ENOTCONN || errno == EMSGSIZE))
+    {
+      pid = spawn_posix(path, tokens, io);
+    }
+    return counted(pid, start);
+  }
+  case SPAWN_FORK:
+  default:
+    return counted(spawn_fork(path, tokens, io), start);
+  }
+}
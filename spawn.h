@@ -0,0 +1,84 @@
+// Process creation for external commands.
+
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+// Ways of creating the child process that runs an external command.
+// Everything except SPAWN_FORK avoids copying the shell's page tables.
+enum spawn_method
+{
+  SPAWN_POSIX_SPAWN, // posix_spawnp() (default)
+  SPAWN_VFORK,       // vfork() + execvp()
+  SPAWN_CLONE,       // clone(CLONE_VM | CLONE_VFORK) + execvp()
+  SPAWN_FORK,        // fork() + execvp(), kept as a fallback and baseline
+  SPAWN_HELPER,      // forked by a helper process started with the shell (zygote.h)
+};
+
+extern enum spawn_method spawn_method;
+
+// Standard descriptors and process group for a new child.
+struct spawn_io
+{
+  int fds[3]; // fds[i] is dup'd onto descriptor i in the child, -1 to inherit
+  pid_t pgid; // process group to join: 0 starts a new group, -1 keeps ours
+  char **envp; // environment for the program, NULL for the shell's own
+};
+
+/*
+ * Select the spawn method by name ("posix_spawn", "vfork", "clone", "fork"
+ * or "helper"). "helper" starts the helper process, so choose it early.
+ * returns: false if the name is not recognized or the helper could not be
+ *          started.
+ */
+bool spawn_set_method(const char *name);
+const char *spawn_method_name(enum spawn_method method);
+
+/*
+ * Run the command in 'tokens' (tokens[0] is the program, NULL terminated)
+ * in a new child process using the current spawn method.
+ * path: already resolved program to exec, or NULL to search $PATH for
+ *       tokens[0].
+ * io: descriptors and process group for the child, or NULL to inherit the
+ *     shell's. Descriptors not listed should be opened O_CLOEXEC.
+ * returns: pid of the child, or -1 with errno set when the child could not
+ *          be created or the program could not be executed. In the latter
+ *          case the failed child has already been reaped.
+ *          With SPAWN_FORK an exec failure is reported by the child itself,
+ *          which then exits with status 127 (126 if the program exists but
+ *          cannot be run). SPAWN_HELPER falls back to posix_spawn when the
+ *          helper is gone or cannot take the request.
+ */
+pid_t spawn_command(const char *path, char *tokens[], const struct spawn_io *io);
+
+/*
+ * Run fn(tokens) in a forked copy of the shell with the same child setup as
+ * spawn_command(), including closing the O_CLOEXEC descriptors as exec
+ * would; the child exits once fn returns. Used for builtins that have to
+ * run as a separate process, e.g. inside a pipeline.
+ * returns: pid of the child, or -1 with errno set.
+ */
+pid_t spawn_function(void (*fn)(char *[]), char *tokens[], const struct spawn_io *io);
+
+/*
+ * Remember 'limit', the RLIMIT_NOFILE the shell was started with, before
+ * the shell raises its own soft limit to the hard one (events_init()).
+ * Programs it runs get 'limit' back: some size tables by the soft limit
+ * or break with descriptors past 1024 (select()).
+ */
+void spawn_set_fd_limit(const struct rlimit *limit);
+
+/*
+ * In a new child, before exec: go back to the limit given to
+ * spawn_set_fd_limit(), if any. Async-signal-safe.
+ */
+void spawn_restore_fd_limit(void);
+
+// Print the standard error message for a command that failed to start to
+// fd (its stderr, which a redirection may have pointed elsewhere).
+void spawn_report_error(int fd, const char *cmd, int err);
+
+#endif
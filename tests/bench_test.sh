@@ -0,0 +1,35 @@
+#!/bin/sh
+# Regression tests for the benchmark suite behind 'make bench': a short run
+# of bench/run.sh, and bench/compare.sh on made-up results.
+#
+# usage: tests/bench_test.sh   (SHELL_BIN overrides ./shell; needs
+#                               bench/core_bench and bench/pty_bench)
+
+. "$(dirname "$0")/lib.sh"
+BENCH_DIR=$(cd "$(dirname "$0")/../bench" && pwd)
+in_scratch_dir
+
+# a run reports every benchmark of the baseline, each with a number
+(cd "$BENCH_DIR/.." && CORE_ITERATIONS=1000 PTY_COMMANDS=20 SHELL_BIN=$SHELL_BIN \
+  bench/run.sh) > results.tsv
+status=$?
+bad=$(awk -F '\t' 'NR > 1 && $2 !~ /^[0-9.]+$/' results.tsv)
+compare 'bench/run.sh' "$(cut -f 1 "$BENCH_DIR/baseline.tsv")" 0 "$(cut -f 1 results.tsv)$bad" $status
+
+# times got worse when they rise and rates when they fall; past the
+# threshold that is a regression and the status is 1
+printf 'benchmark\tvalue\tunit\nlat\t100\tus\nrate\t100\tcmds/s\ngone\t1\tus\n' > old.tsv
+printf 'benchmark\tvalue\tunit\nlat\t110\tus\nrate\t130\tcmds/s\nnew\t1\tus\n' > new.tsv
+"$BENCH_DIR/compare.sh" old.tsv new.tsv 25 > report
+status=$?
+compare 'compare.sh, nothing worse' 'benchmark unit
+lat us
+rate cmds/s
+gone missing
+new us' 0 "$(awk '{ print $1, $NF }' report)" $status
+printf 'benchmark\tvalue\tunit\nlat\t130\tus\nrate\t70\tcmds/s\ngone\t1\tus\n' > new.tsv
+"$BENCH_DIR/compare.sh" old.tsv new.tsv 25 > report
+status=$?
+compare 'compare.sh, both worse' 2 1 "$(grep -c REGRESSION report)" $status
+
+finish
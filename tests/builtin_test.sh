@@ -0,0 +1,166 @@
+#!/bin/sh
+# Regression tests for builtins: run each command with 'shell -c' and
+# compare its output and status.
+#
+# usage: tests/builtin_test.sh   (SHELL_BIN overrides ./shell)
+
+. "$(dirname "$0")/lib.sh"
+in_scratch_dir
+
+# exit with no argument exits with the status of the command before it
+check 'false; exit' '' 1
+check 'true; exit' ''
+check 'false; exit 3' '' 3
+check 'false && true; exit' '' 1
+
+# echo -e leaves \" alone, as GNU echo does; printf turns it into "
+check "echo -e 'a\\\"b'" 'a\"b'
+check "printf 'a\\\"b %b\\n' 'c\\\"d'" 'a"b c"d'
+
+# cat with options runs the cat on $PATH; a lone - is stdin
+check "printf 'a\\n\\nb\\n' > cat_in; cat -n cat_in" '     1	a
+     2	
+     3	b'
+check "echo x | cat - /dev/null" 'x'
+
+# HISTTIMING shows no RSS for a line that only ran builtins
+HISTTIMING=1 HISTFILE= check_script 'true
+ls >/dev/null
+history -v 3 | cut -f 2 | awk "{ print \$NF }"
+' '-
+KB
+-'
+
+# a builtin that fails says so on stderr and sets a nonzero status, so
+# && and || act on it
+check 'cd /nonexist >/dev/null && echo PROCEEDED; echo st=$?' 'Please enter a valid filepath 
+st=1'
+check 'history -z 2>/dev/null; echo st=$?' 'st=2'
+check 'help nope 2>/dev/null || echo failed' 'failed'
+check 'hash no_such_command_here 2>/dev/null; echo st=$?' 'st=1'
+check 'fg 2>/dev/null; echo st=$?' 'st=1'
+check 'wait %9 2>/dev/null; echo st=$?' 'st=127'
+check 'kill -BOGUS 1 2>/dev/null; echo st=$?' 'st=1'
+check 'pwd extra 2>/dev/null; echo st=$?' 'st=2'
+
+# hash lists the cached paths with their hit counts; hash -r and a new
+# $PATH empty the cache, and an entry whose file is gone is looked up again
+mkdir -p hash_a hash_b
+printf '#!/bin/sh\necho A\n' > hash_a/zz
+printf '#!/bin/sh\necho B\n' > hash_b/zz
+chmod +x hash_a/zz hash_b/zz
+check 'hash; tr a b </dev/null; hash' 'hash: hash table empty
+hits	command
+   1	'"$(command -v tr)"
+check 'hash tr; hash -r; hash' 'hash: hash table empty'
+check 'hash tr; PATH=/bin:/usr/bin; hash' 'hash: hash table empty'
+check "PATH=$PWD/hash_a:$PWD/hash_b:\$PATH; zz; zz; hash | grep zz; rm hash_a/zz; zz; hash | grep zz" "A
+A
+   2	$PWD/hash_a/zz
+B
+   1	$PWD/hash_b/zz"
+
+# help describes one builtin; enable -n turns a builtin off so the program
+# on $PATH runs, and lists the ones that are off
+check 'help cd' "'cd' is a builtin command for changing the current working directory."
+check 'enable -n cd; enable -n echo; enable -n; enable echo; enable -n' 'enable -n cd
+enable -n echo
+enable -n cd'
+check 'enable -n cd; cd / 2>/dev/null; echo st=$?' 'st=127'
+check 'enable -n nosuch 2>/dev/null; echo st=$?' 'st=1'
+
+# a builtin replayed from history runs just as it does when typed
+HISTFILE= check_script 'cd /usr
+cd /
+!0
+pwd
+cd -
+' 'cd /usr
+/usr
+/'
+
+# cd keeps $PWD and $OLDPWD, resolves .. textually and cd - swaps them
+ln -s /usr/bin bin_link
+check 'cd /usr/bin; cd ..; pwd; cd -; echo $PWD $OLDPWD' '/usr
+/usr/bin
+/usr/bin /usr'
+check "cd bin_link; pwd; cd ..; pwd" "$PWD/bin_link
+$PWD"
+check 'cd; pwd' "$HOME"
+
+# the prompt follows $PS1 (drawn only on a terminal, so run under script)
+if command -v script >/dev/null 2>&1; then
+  out=$(cd / && printf 'cd /usr\nfalse\nexit 0\n' |
+    SHELL=/bin/sh PS1='[\W \?] ' HISTFILE= script -qec "$SHELL_BIN" /dev/null |
+    tr -d '\r' | grep -o '\[[/a-z]* [0-9]\]' | tr '\n' ' ')
+  compare 'PS1 prompt' '[/ 0] [usr 0] [usr 1] ' 0 "$out" 0
+fi
+
+# the utility builtins print and exit just as the programs do: compare each
+# command with what it gives under 'enable -n', which runs the program
+check_same() {
+  expected=$("$SHELL_BIN" -c "enable -n ${1%% *}; $1" 2>&1)
+  check "$1" "$expected" $?
+}
+check_same "echo -n a; echo b"
+check_same "echo -e 'a\tb\x41\0101\c' zz"
+check_same "echo -E 'a\tb' -n"
+check_same "echo -- -n"
+check_same "printf '%5.2f|%-4s|%x|%o|%e\n' 3.14159 ab 255 8 12345"
+check_same "printf '%s-%d\n' a 1 b 2 c"
+check_same "printf '%d\n' abc"
+check_same "printf '%b\n' 'a\tb\0101'"
+check_same "printf '%c%c|%%|%5s|%.2s\n' hello w a abcdef"
+check_same "printf -- '%s\n' a"
+check_same "printf"
+check_same "test -f /etc/passwd"
+check_same "test -d /etc/passwd"
+check_same "test ! a = b"
+check_same "test 1 -lt 2 -a 3 -gt 4"
+check_same "test 1 -lt 2 -o 3 -gt 4"
+check_same "test abc -eq 1"
+check_same "test -n"
+check_same "[ 1 -eq 1"
+check_same "true extra"
+check_same "false extra"
+check_same "sleep 0.1"
+check_same "sleep"
+check_same "sleep -1"
+check_same "sleep x"
+check_same "cat /etc/hostname /nonexist"
+
+# bench reports how many runs there were and how many failed, as text,
+# csv or json; its status is 1 if any run failed
+check 'bench -n 3 -w 1 true | head -n 2 | sed "s/  */ /g"' 'true: 3 runs, 0 failed
+wall ms min median p95 p99 max'
+check 'bench -n 2 -w 0 sh -c "exit 1" > out; echo st=$?; head -n 1 out' 'st=1
+sh -c exit 1: 2 runs, 2 failed'
+check 'bench -n 2 -f csv /bin/true | cut -d , -f 1-3' 'command,runs,failed
+"/bin/true",2,0'
+check 'bench -n 2 -f json echo hi | grep -o "\"runs\":2,\"failed\":0"' '"runs":2,"failed":0'
+check 'bench -n 2 -b true | tail -n 1 | cut -c 1-8' 'baseline'
+check 'bench -n 0 true 2>/dev/null; echo st=$?; bench -f xml true 2>/dev/null; echo st=$?' 'st=2
+st=2'
+
+# stats counts command lines, builtins and spawns since stats -r; phases
+# are timed only after stats -t on. -f and -e pick the format and target
+# (a build with METRICS=0 has no counters to check)
+if ! "$SHELL_BIN" -c stats 2>&1 | grep -q METRICS=0; then
+  check_script 'stats -r
+true
+/bin/true
+stats -t on
+true
+stats | awk "\$1 ~ /^(tokenize|dispatch|commands|builtins|spawns)\$/ { print \$1, \$2 }"
+' 'tokenize 2
+dispatch 2
+commands 5
+builtins 4
+spawns 2'
+  check 'stats -f json | grep -o "\"counters\":{\"commands\":[0-9]*"' '"counters":{"commands":1'
+  check 'stats -f prometheus | grep -c "^shell_phase_seconds_count"' '7'
+  check 'stats -e m.prom; stats -e off; grep -c "^# TYPE" m.prom' '10'
+  check 'stats -z 2>/dev/null; echo st=$?' 'st=2'
+fi
+
+finish
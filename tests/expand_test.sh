@@ -0,0 +1,99 @@
+#!/bin/sh
+# Regression tests for word expansion: run each command with 'shell -c'
+# from an empty directory and compare its output and status.
+#
+# usage: tests/expand_test.sh   (SHELL_BIN overrides ./shell)
+
+. "$(dirname "$0")/lib.sh"
+in_scratch_dir
+
+# a word of only wildcards, or literal text and then wildcards, that
+# matches nothing is left as it is
+check '[ 1 -lt 2 ]' ''
+check '[ 2 -lt 1 ]' '' 1
+check 'echo [ x' '[ x'
+check 'echo *' '*'
+check 'echo ?' '?'
+check 'echo zzz*' 'zzz*'
+
+# quotes and backslashes keep words together and operators literal; empty
+# quotes are an empty word
+check "echo \"Hello World\" 'a  b' a\\ b \"x\\\"y\" 'it''s' a\"b\"c" 'Hello World a  b a b x"y its abc'
+check 'echo "a|b" a\|b "a;b" "a&b"' 'a|b a|b a;b a&b'
+check "printf '%s|' \"\" ''; echo" '||'
+check 'echo "\$x \\ \a" '"'\$HOME \\n'" '$x \ \a $HOME \n'
+check 'echo "abc' 'ERROR: Unterminated double quote.' 2
+check 'echo a >' "ERROR: Missing file name after '>'." 2
+
+# quotes and operators past the first 16 and 32 bytes, where the scan
+# works a block at a time
+long=xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx
+check "echo $long'a  b'$long\"c|d\"; echo ${long}e|tr x y" "${long}a  b${long}c|d
+$(echo "$long" | tr x y)e"
+
+# variables expand unquoted and in double quotes; only exported ones reach
+# programs, NAME=value in front of a program sets it for that program only
+check 'X=1; echo $X ${X}y "$X" '"'\$X'"'; sh -c "echo [\$X]"; export X; sh -c "echo [\$X]"' '1 1y 1 $X
+[]
+[1]'
+check 'export Y=2; env | grep ^Y=; unset Y; echo [$Y]; env | grep -c ^Y= || true' 'Y=2
+[]
+0'
+check 'Z=5 sh -c "echo [\$Z]"; echo [$Z]' '[5]
+[]'
+
+# unquoted expansions are split at $IFS and vanish when empty
+check 'V="a  b"; E=; printf "<%s>" $V "$V" $E "$E"; echo' '<a><b><a  b><>'
+check 'IFS=:; W=x:y; printf "<%s>" $W; echo' '<x><y>'
+
+# patterns expand to the sorted paths they match; dot files need a dot,
+# ** spans directories and a trailing / only matches directories
+mkdir -p g/d/e
+(cd g && touch a.log b.log c.txt .h.log ab d/x.log d/e/y.log)
+check 'cd g; echo *.log; echo ?b; echo [ab]*; echo [!a]*; echo .*.log' 'a.log b.log
+ab
+a.log ab b.log
+b.log c.txt d
+.h.log'
+check 'cd g; echo **/*.log; echo d/*; echo */' 'a.log b.log d/e/y.log d/x.log
+d/e d/x.log
+d/'
+check 'cd g; X="*.log"; echo "*.log" \*.log $X' '*.log *.log *.log'
+
+# a cached listing is not used once the directory has changed
+check 'cd g; echo *.log; touch z.log; echo *.log; rm z.log; echo *.log' 'a.log b.log
+a.log b.log z.log
+a.log b.log'
+
+# $(command) is its output without the trailing newlines, split unless
+# quoted; it nests, and x=$(command) has the command's status
+check 'echo "[$(echo a; echo b)]"; echo $(echo "x  y"); printf "<%s>" $(printf "1\n2\n"); echo' '[a
+b]
+x y
+<1><2>'
+check 'echo $(echo $(echo nest)); x=$(false); echo st=$?' 'nest
+st=1'
+
+# here-strings and here-documents; a quoted delimiter turns expansion off,
+# <<- strips tabs, and a document bigger than a pipe buffer gets through
+check 'N=5; cat <<<"w $N"' 'w 5'
+check_script 'N=5
+cat <<EOF
+n=$N $(echo sub) \$N
+EOF
+cat <<'"'EOF'"'
+n=$N
+EOF
+cat <<-EOF
+		tabbed
+	EOF
+echo end
+' 'n=5 sub $N
+n=$N
+tabbed
+end'
+check 'seq 1 100000 > s; wc -l <<EOF
+$(cat s)
+EOF' '100000'
+
+finish
@@ -0,0 +1,131 @@
+#!/bin/sh
+# Regression tests for history: feed each script to the shell on stdin
+# and compare its output and status.
+#
+# usage: tests/history_test.sh   (SHELL_BIN overrides ./shell)
+
+. "$(dirname "$0")/lib.sh"
+in_scratch_dir
+export HISTFILE=
+
+# commands are numbered from 0; history lists them newest first, history N
+# the N newest; !n and !! run a command again and echo it first
+check_script 'echo a
+echo b
+history
+history 2
+!1
+!!
+' 'a
+b
+2	history
+1	echo b
+0	echo a
+3	history 2
+2	history
+echo b
+b
+echo b
+b'
+
+# HISTSIZE is how many commands are kept and reachable with !n
+HISTSIZE=3 check_script 'echo a
+echo b
+echo c
+echo d
+!1
+!0
+echo st=$?
+history
+' 'a
+b
+c
+d
+echo b
+b
+ERROR: The given command index is either not recognized or does not match one of the HISTSIZE most recent commands.
+st=1
+6	history
+5	echo st=$?
+4	echo b'
+
+# !?string and !prefix run the newest match; history -s lists every
+# match, newest first
+check_script 'echo apple
+echo banana
+printf "x\n"
+echo pineapple
+!?nan
+!pri
+history -s apple
+!?zzzq
+echo st=$?
+' 'apple
+banana
+x
+pineapple
+echo banana
+banana
+printf "x\n"
+x
+6	history -s apple
+3	echo pineapple
+0	echo apple
+ERROR: No command in history matches the given pattern.
+st=1'
+
+# time prints the times of a pipeline to stderr and keeps its status
+out=$("$SHELL_BIN" -c 'time sh -c "exit 3" >/dev/null; echo st=$?' 2>&1 | tr 0-9 N)
+compare 'time' '
+real	NmN.NNNs
+user	NmN.NNNs
+sys	NmN.NNNs
+st=N' 0 "$out" 0
+out=$("$SHELL_BIN" -c 'time -p true 2>/dev/null' 2>&1 >/dev/null | tr 0-9 N)
+compare 'time -p' 'real N.NN
+user N.NN
+sys N.NN' 0 "$out" 0
+
+# with HISTTIMING, history -v shows newest first how long each command took
+# and its status; --slowest lists the longest first
+HISTTIMING=1 check_script 'sleep 0.3
+sleep 0.1
+false
+history --slowest 2 > slowest
+history -v 3 > verbose
+awk -F "\t" "{ n = split(\$2, f, \" +\"); printf \"%.1f %s %s\n\", f[n - 2], f[n - 1], \$3 }" slowest verbose
+' '0.3 0 sleep 0.3
+0.1 0 sleep 0.1
+0.0 - history -v 3 > verbose
+0.0 0 history --slowest 2 > slowest
+0.0 1 false'
+
+# with HISTFILE set, history and !n see the commands of every session
+# that shares the file, including ones another session ran meanwhile
+HISTFILE=$PWD/shared check_script 'echo one
+'"'$SHELL_BIN'"' -c "echo inner"
+history
+!2
+' 'one
+inner
+3	history
+2	echo inner
+1	'"'$SHELL_BIN'"' -c "echo inner"
+0	echo one
+echo inner
+inner'
+HISTFILE=$PWD/shared check_script 'history 2
+' '5	history 2
+4	echo inner'
+
+# sessions appending at the same time never split or merge records
+rm -f shared
+for i in 1 2 3 4; do
+  seq 1 500 | sed "s/^/true $i./" | HISTFILE=$PWD/shared "$SHELL_BIN" &
+done
+wait
+out=$(grep -c '^true [1-4]\.[0-9]*$' shared; wc -l < shared)
+compare '4 sessions appending 500 commands' '2000
+2000' 0 "$out" 0
+
+finish
@@ -0,0 +1,58 @@
+#!/bin/sh
+# Regression tests for reading commands from stdin and from script files:
+# feed each script to the shell and compare its output and status.
+#
+# usage: tests/input_test.sh   (SHELL_BIN overrides ./shell)
+
+. "$(dirname "$0")/lib.sh"
+in_scratch_dir
+
+# a command reading stdin gets the lines after its own, and the shell goes
+# on from wherever it stopped
+check_script 'cat
+hello
+echo after
+' 'hello
+echo after'
+check_script 'echo one
+head -n 1
+middle
+echo two
+' 'one
+middle
+two'
+check_script 'cat
+last' 'last'
+
+# a script runs line by line until an exit, whose status is the shell's;
+# so does a script file named on the command line
+check_script 'echo 1; echo 2
+exit 4
+echo no
+' '1
+2' 4
+printf 'echo a\necho b\nfalse\n' > script.sh
+out=$("$SHELL_BIN" script.sh 2>&1)
+compare 'shell script.sh' 'a
+b' 1 "$out" $?
+out=$("$SHELL_BIN" no_such_script.sh 2>/dev/null)
+compare 'shell no_such_script.sh' '' 127 "$out" $?
+
+# every line of a long script piped in is run, none split or merged
+out=$(seq 1 20000 | sed 's/^/echo /' | "$SHELL_BIN" 2>&1 | awk 'NR == $0 { n++ } END { print n }')
+compare '20000 piped echo lines' 20000 0 "$out" 0
+
+# command lines have no length limit: 20000 words, and a 100 KB word, get
+# through whole, and the next line is unaffected
+words=$(seq 1 20000 | tr '\n' ' ')
+check_script "echo $words | wc -w
+echo next
+" '20000
+next'
+big=$(head -c 100000 /dev/zero | tr '\0' x)
+check_script "echo $big | wc -c
+/bin/echo $big $big | wc -c
+" '100001
+200002'
+
+finish
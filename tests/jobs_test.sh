@@ -0,0 +1,40 @@
+#!/bin/sh
+# Regression tests for background jobs: run each command with 'shell -c'
+# and compare its output and status.
+#
+# usage: tests/jobs_test.sh   (SHELL_BIN overrides ./shell)
+
+. "$(dirname "$0")/lib.sh"
+in_scratch_dir
+
+# background children are reaped as they exit, not at the next command,
+# and their status is kept until it is asked for
+many=$(i=0; while [ $i -lt 300 ]; do printf 'true & '; i=$((i + 1)); done)
+check "$many sleep 0.5; sh -c 'ps -o stat= --ppid \$PPID | grep -c Z || true'" '0'
+check 'sh -c "exit 5" & sleep 0.2; wait %%; echo st=$?' 'st=5'
+
+# wait %n gives the job's status and forgets it, so its number is free again
+check 'sh -c "exit 3" & wait %1; echo st=$?; wait %1 2>/dev/null; echo st=$?' 'st=3
+st=127'
+check 'sh -c "exit 3" & wait %1; sleep 5 & jobs; kill %1; wait %1; echo st=$?' '[1]+  Running                 sleep 5 &
+st=143'
+
+# wait with no job waits for all of them
+check 'sleep 0.2 & sleep 0.3 & wait; jobs' '[1]-  Done                    sleep 0.2
+[2]+  Done                    sleep 0.3'
+
+# jobs lists a finished job once, then forgets it
+check 'sh -c "exit 3" & sleep 0.2; jobs; jobs' '[1]+  Exit 3                  sh -c exit 3'
+
+# wait returns when a job stops; kill %n also wakes a stopped job so it
+# can act on the signal
+check 'sleep 5 & kill -STOP %1; wait %1; echo st=$?; jobs; kill %1; wait %1; echo st=$?' 'st=147
+[1]+  Stopped                 sleep 5
+st=143'
+
+# fg waits for a background job; a child killed by a signal is 128 + it
+check 'sleep 0.1 & fg %1; echo st=$?' 'sleep 0.1
+st=0'
+check 'sh -c "kill -9 \$\$"; echo st=$?' 'st=137'
+
+finish
@@ -0,0 +1,53 @@
+# Shared by the tests/*_test.sh scripts, which source it:
+#
+#   check 'command' 'expected output' [expected status]
+#       run the command with 'shell -c' and compare its output (stdout and
+#       stderr) and status (default 0)
+#   check_script 'script' 'expected output' [expected status]
+#       the same for a script fed to the shell on stdin, from a file
+#   in_scratch_dir
+#       cd to a new empty directory, removed when the test exits
+#   finish
+#       report and exit with 1 if any check failed
+#
+# SHELL_BIN overrides ./shell; it is made absolute, so a test can cd to
+# where its commands should run. 'label', when set, is shown with a failure.
+
+SHELL_BIN=${SHELL_BIN:-./shell}
+SHELL_BIN=$(cd "$(dirname "$SHELL_BIN")" && pwd)/$(basename "$SHELL_BIN")
+TEST_NAME=$(basename "$0" .sh)
+failed=0
+
+# compare 'what' 'expected output' 'expected status' 'output' 'status'
+compare() {
+  if [ "$4" != "$2" ] || [ "$5" -ne "$3" ]; then
+    printf 'FAIL%s: %s\n  expected: %s (status %s)\n  got:      %s (status %s)\n' \
+      "${label:+ ($label)}" "$1" "$2" "$3" "$4" "$5"
+    failed=1
+  fi
+}
+
+check() {
+  out=$("$SHELL_BIN" -c "$1" 2>&1)
+  compare "$1" "$2" "${3:-0}" "$out" $?
+}
+
+check_script() {
+  script=$(mktemp)
+  printf '%s' "$1" > "$script"
+  out=$("$SHELL_BIN" < "$script" 2>&1)
+  status=$?
+  rm -f "$script"
+  compare "$1" "$2" "${3:-0}" "$out" $status
+}
+
+in_scratch_dir() {
+  SCRATCH=$(mktemp -d) || exit 1
+  trap 'rm -rf "$SCRATCH"' EXIT
+  cd "$SCRATCH" || exit 1
+}
+
+finish() {
+  [ $failed -eq 0 ] && echo "$TEST_NAME: all passed"
+  exit $failed
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Regression tests for the parallel builtin: run each command with
+# 'shell -c' and compare its output and status.
+#
+# usage: tests/parallel_test.sh   (SHELL_BIN overrides ./shell)
+
+. "$(dirname "$0")/lib.sh"
+in_scratch_dir
+
+# {} is replaced by each argument, or the argument is appended; -k keeps
+# argument order; the summary goes to stderr
+check 'parallel -k -j 2 echo x{}y ::: a b c 2>/dev/null' 'xay
+xby
+xcy'
+check 'parallel -k echo ::: a b 2>/dev/null' 'a
+b'
+check 'parallel -j 2 echo ::: a b 2>&1 >/dev/null | sed "s/ in .*//"' \
+  'parallel: 2 tasks (0 failed, 0 not started)'
+
+# without ::: the arguments are stdin's lines; the status is the number of
+# tasks that failed
+check 'printf "0\n1\n2\n3\n" | parallel -k sh -c "echo {}; exit {}" 2>/dev/null; echo st=$?' '0
+1
+2
+3
+st=3'
+
+# a task's output is printed in one piece, and no more than -j tasks run
+check 'parallel -j 3 sh -c "echo {}1; sleep 0.1; echo {}2" ::: a b c 2>/dev/null | paste -d " " - - | sort' 'a1 a2
+b1 b2
+c1 c2'
+mkdir running
+check 'parallel -j 2 sh -c "touch running/{}; sleep 0.1; ls running | wc -l; sleep 0.1; rm running/{}" ::: 1 2 3 4 5 2>/dev/null | sort -n | tail -n 1' '2'
+
+finish
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Regression tests for pipelines: run each command with 'shell -c' and
+# compare its output and status.
+#
+# usage: tests/pipeline_test.sh   (SHELL_BIN overrides ./shell)
+
+. "$(dirname "$0")/lib.sh"
+in_scratch_dir
+
+# every stage runs; the status of a pipeline is the status of its last stage
+check 'echo abc | tr a-z A-Z | rev | tr -d B' 'CA'
+check 'echo a | cat | cat | cat | cat | cat' 'a'
+check 'echo hi | false; echo st=$?' 'st=1'
+check 'false | true; echo st=$?' 'st=0'
+check 'yes | head -n 3' 'y
+y
+y'
+
+# a builtin at either end moves more than a pipe buffer's worth of data
+seq 1 300000 > big
+check 'cat big | wc -l' '300000'
+check 'cat big | cat | tail -n 1' '300000'
+check 'cat big | head -n 2; echo st=$?' '1
+2
+st=0'
+check 'seq 1 300000 | cat | wc -l' '300000'
+
+# redirections work for programs and builtins alike, and a builtin's
+# descriptors are back in place afterwards
+check 'echo a > f; echo b >> f; cat < f; cat f > g; cat < f > g2; cat g g2' 'a
+b
+a
+b
+a
+b'
+check 'ls no_such_file 2> e; wc -l < e; ls no_such_file > o 2>&1; wc -l < o' '1
+1'
+check 'pwd > p; pwd; cat p' "$PWD
+$PWD"
+check '> empty; wc -c < empty' '0'
+check 'echo x 2>/dev/null 1>&2' ''
+check 'echo x 1>&2 2>/dev/null' 'x'
+check 'echo x > /nonexist/f; echo st=$?' 'ERROR: /nonexist/f: No such file or directory.
+st=1'
+check 'cat < nosuch; echo st=$?' 'ERROR: nosuch: No such file or directory.
+st=1'
+
+# cat copies a large file to a file in the kernel; the copy is exact
+check 'cat big > big_copy; cmp big big_copy && echo same' 'same'
+
+# ; runs commands in turn, && and || only when the last status says so;
+# $? is the last status and the shell exits with it
+check 'false && echo no || echo yes; true || echo no && echo yes2' 'yes
+yes2'
+check 'false; echo $?; false || false; echo $?$?; echo a; echo b ;echo c;' '1
+11
+a
+b
+c'
+check 'echo $?' '0'
+check 'false' '' 1
+check 'sh -c "exit 42"' '' 42
+check 'echo a &&' "ERROR: Unexpected '&&'." 2
+check '; echo a' "ERROR: Unexpected ';'." 2
+
+finish
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Regression tests for starting programs: run each command with 'shell -c'
+# under every SHELL_SPAWN method and compare its output.
+#
+# usage: tests/spawn_test.sh   (SHELL_BIN overrides ./shell)
+
+. "$(dirname "$0")/lib.sh"
+in_scratch_dir
+
+# check_methods 'command' 'expected output' [expected status]
+check_methods() {
+  for label in posix_spawn vfork clone fork helper; do
+    SHELL_SPAWN=$label check "$@"
+  done
+  label=
+}
+
+# every method runs programs found on $PATH or by path, with the shell's
+# environment plus the command's own assignments, and fails as sh does
+check_methods 'echo a | tr a b; /bin/echo hi there' 'b
+hi there'
+check_methods 'ZZ=1 env | grep ^ZZ=; env | grep ^ZZ= || echo none' 'ZZ=1
+none'
+check_methods 'no_such_command_zz 2>/dev/null; echo st=$?' 'st=127'
+check_methods '/etc/passwd 2>/dev/null; echo st=$?' 'st=126'
+check_methods 'sh -c "exit 7"; echo st=$?' 'st=7'
+
+# programs get the descriptor limit the shell started with, not the one it
+# raised for itself
+if [ "$(ulimit -Hn)" != 256 ] && ulimit -Sn 256 2>/dev/null; then
+  check_methods "sh -c 'ulimit -Sn'" 256
+  check_methods "sh -c 'ulimit -Sn' | cat" 256
+fi
+
+# with too few descriptors for a pidfd per child, children are reaped one
+# by one: the foreground job still gets its own status (last, as this
+# lowers the hard limit for good)
+if ulimit -n 12 2>/dev/null; then
+  check 'sleep 0.1 & sleep 0.1 & sleep 0.1 & sleep 0.1 & sleep 0.1 & sleep 0.1 & sleep 0.1 &
+sleep 0.1 & sh -c "exit 3"; echo fg=$?; wait; echo waited; sh -c "exit 4"; echo fg=$?' 'fg=3
+waited
+fg=4'
+fi
+
+# every method passes the working directory, exported variables and
+# redirections, and the child is the shell's own (the helper forks it with
+# CLONE_PARENT)
+check_methods 'cd /usr; /bin/pwd; export HV=7; sh -c "echo \$HV"; /bin/echo out > f; /bin/cat < f' '/usr
+7
+out'
+check_methods 'sh -c "[ \$PPID = $$ ] && echo own"' 'own'
+
+# if the helper dies, programs are still started, by posix_spawn
+SHELL_SPAWN=helper check 'sh -c "pkill -9 -P \$PPID -x shell"; /bin/echo still; sh -c "exit 4"; echo st=$?' 'still
+st=4'
+
+finish
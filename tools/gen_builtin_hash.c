@@ -0,0 +1,76 @@
+// Build-time generator for builtin_hash.h: finds a seed for builtin_hash()
+// under which the builtin names of builtins.def all land in different slots
+// of a power of two sized table, and prints that table.
+//
+// usage: gen_builtin_hash > builtin_hash.h
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../builtins.h"
+
+#define MAX_SEEDS 10000000u
+
+static const char *names[] = {
+#define BUILTIN(name, handler, min_args, max_args, help) #name,
+#include "../builtins.def"
+#undef BUILTIN
+};
+
+#define NUM_NAMES (int)(sizeof(names) / sizeof(names[0]))
+
+// Try to place every name. returns: true if no two share a slot.
+static bool place(uint32_t seed, int size, signed char slots[])
+{
+  memset(slots, -1, size);
+  for (int i = 0; i < NUM_NAMES; i++)
+  {
+    uint32_t slot = builtin_hash(names[i], seed) & (size - 1);
+    if (slots[slot] >= 0)
+    {
+      return false;
+    }
+    slots[slot] = i;
+  }
+  return true;
+}
+
+int main(void)
+{
+  signed char slots[1024];
+  if (NUM_NAMES > 127)
+  {
+    fprintf(stderr, "gen_builtin_hash: too many builtins\n");
+    return 1;
+  }
+
+  // smallest table first; a bigger one makes a perfect seed easier to find
+  for (int size = 1; size <= (int)sizeof(slots); size *= 2)
+  {
+    if (size < NUM_NAMES)
+    {
+      continue;
+    }
+    for (uint32_t seed = 0; seed < MAX_SEEDS; seed++)
+    {
+      if (!place(seed, size, slots))
+      {
+        continue;
+      }
+      printf("// Generated by tools/gen_builtin_hash from builtins.def: do not edit.\n\n");
+      printf("#define BUILTIN_HASH_SEED %uu\n", seed);
+      printf("#define BUILTIN_HASH_SIZE %d\n\n", size);
+      printf("// builtin_hash() slot -> index into builtins[], or -1\n");
+      printf("static const signed char builtin_slots[BUILTIN_HASH_SIZE] = {");
+      for (int i = 0; i < size; i++)
+      {
+        printf("%s%d", i == 0 ? "" : ", ", slots[i]);
+      }
+      printf("};\n");
+      return 0;
+    }
+  }
+  fprintf(stderr, "gen_builtin_hash: no perfect hash found\n");
+  return 1;
+}
@@ -0,0 +1,1162 @@
+// Small utilities built into the shell: echo, printf, test, [, true, false,
+// sleep and cat.
+//
+// They run in the shell process (or in the forked child of a pipeline
+// stage), so they must not exit(), must not leave anything allocated
+// behind, and write through an explicit buffer instead of stdio: the shell
+// never flushes stdout.
+
+#include "utilities.h"
+
+#include "events.h"
+#include "fdcopy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OUT_BUFFER_SIZE 8192
+
+// Longest 'sleep', in seconds (about 30 years)
+#define MAX_SLEEP 1e9
+
+// Output of a utility, written to stdout when full and at the end
+struct out
+{
+  char buf[OUT_BUFFER_SIZE];
+  size_t len;
+  bool failed; // a write() failed (eg. EPIPE): the rest is dropped
+};
+
+static void out_flush(struct out *out)
+{
+  for (size_t done = 0; done < out->len && !out->failed;)
+  {
+    ssize_t n = write(STDOUT_FILENO, out->buf + done, out->len - done);
+    if (n < 0 && errno != EINTR)
+    {
+      out->failed = true;
+    }
+    done += n > 0 ? n : 0;
+  }
+  out->len = 0;
+}
+
+static void out_write(struct out *out, const char *data, size_t len)
+{
+  while (len > 0 && !out->failed)
+  {
+    if (out->len == OUT_BUFFER_SIZE)
+    {
+      out_flush(out);
+    }
+    size_t n = OUT_BUFFER_SIZE - out->len < len ? OUT_BUFFER_SIZE - out->len : len;
+    memcpy(out->buf + out->len, data, n);
+    out->len += n;
+    data += n;
+    len -= n;
+  }
+}
+
+static void out_char(struct out *out, char c)
+{
+  out_write(out, &c, 1);
+}
+
+// printf() into the buffer (used for single printf conversions)
+static void out_format(struct out *out, const char *format, ...)
+{
+  char small[256];
+  va_list ap;
+  va_start(ap, format);
+  int len = vsnprintf(small, sizeof(small), format, ap);
+  va_end(ap);
+  if (len < (int)sizeof(small))
+  {
+    out_write(out, small, len > 0 ? len : 0);
+    return;
+  }
+  char *big = malloc(len + 1);
+  if (big == NULL)
+  {
+    out->failed = true;
+    return;
+  }
+  va_start(ap, format);
+  vsnprintf(big, len + 1, format, ap);
+  va_end(ap);
+  out_write(out, big, len);
+  free(big);
+}
+
+// Print "<utility>: <message>" to stderr
+static void complain(const char *utility, const char *format, ...)
+{
+  char msg[512];
+  int len = snprintf(msg, sizeof(msg), "%s: ", utility);
+  va_list ap;
+  va_start(ap, format);
+  len += vsnprintf(msg + len, sizeof(msg) - len, format, ap);
+  va_end(ap);
+  if (len > (int)sizeof(msg) - 2)
+  {
+    len = sizeof(msg) - 2;
+  }
+  msg[len++] = '\n';
+  write(STDERR_FILENO, msg, len);
+}
+
+// Complain about how a utility was called, and point to its --help as
+// coreutils does
+static void complain_usage(const char *utility, const char *format, const char *arg)
+{
+  complain(utility, format, arg);
+  char hint[128];
+  int len = snprintf(hint, sizeof(hint), "Try '%s --help' for more information.\n", utility);
+  write(STDERR_FILENO, hint, len);
+}
+
+static int hex_value(char c)
+{
+  return c >= '0' && c <= '9'   ? c - '0'
+         : c >= 'a' && c <= 'f' ? c - 'a' + 10
+         : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                : -1;
+}
+
+// The backslash escapes of 'echo -e' and printf differ slightly
+enum escapes
+{
+  ESCAPES_ECHO,     // echo -e: octal is \0NNN
+  ESCAPES_PRINTF_B, // printf's %b: octal is \0NNN, and \" is "
+  ESCAPES_PRINTF,   // printf formats: octal is \NNN, and \" is "
+};
+
+/*
+ * Decode the backslash escape at 'p' (just after the backslash) into *c.
+ * Something that is not an escape stands for the backslash itself, and
+ * the characters after it are left alone (so 'echo -e' keeps \" as it is).
+ * stop: set (and *c left alone) for \c, which ends all output.
+ * returns: the first character after the escape.
+ */
+static const char *unescape(const char *p, char *c, enum escapes escapes, bool *stop)
+{
+  static const char simple[] = "\\\\a\ab\be\033f\fn\nr\rt\tv\v";
+  for (const char *s = simple; *s != '\0'; s += 2)
+  {
+    if (*p == s[0])
+    {
+      *c = s[1];
+      return p + 1;
+    }
+  }
+  if (*p == '"' && escapes != ESCAPES_ECHO)
+  {
+    *c = '"';
+    return p + 1;
+  }
+  if (*p == 'c')
+  {
+    *stop = true;
+    return p + 1;
+  }
+  if (*p == 'x' && hex_value(p[1]) >= 0)
+  {
+    int value = hex_value(*++p);
+    if (hex_value(*++p) >= 0)
+    {
+      value = value * 16 + hex_value(*p++);
+    }
+    *c = value;
+    return p;
+  }
+  bool zero_octal = escapes != ESCAPES_PRINTF;
+  if (*p >= '0' && *p <= '7' && (!zero_octal || *p == '0'))
+  {
+    int max_digits = zero_octal ? 4 : 3;
+    int value = 0;
+    for (int i = 0; i < max_digits && *p >= '0' && *p <= '7'; i++)
+    {
+      value = value * 8 + (*p++ - '0');
+    }
+    *c = value;
+    return p;
+  }
+  *c = '\\';
+  return p;
+}
+
+/*
+ * Copy 's' to 'dst' (at least as large) with its escapes interpreted.
+ * stop: set if 's' had a \c, where the copy ends.
+ * returns: the length of the copy, which may contain null bytes.
+ */
+static size_t decode_escapes(const char *s, char *dst, enum escapes escapes, bool *stop)
+{
+  char *end = dst;
+  while (*s != '\0' && !*stop)
+  {
+    if (*s != '\\' || s[1] == '\0')
+    {
+      *end++ = *s++;
+      continue;
+    }
+    s = unescape(s + 1, end, escapes, stop);
+    end += !*stop;
+  }
+  return end - dst;
+}
+
+// Write 's' with its escapes interpreted. returns: false if it had a \c.
+static bool write_escaped(struct out *out, const char *s, enum escapes escapes)
+{
+  bool stop = false;
+  while (*s != '\0' && !stop)
+  {
+    size_t plain = strcspn(s, "\\");
+    out_write(out, s, plain);
+    s += plain;
+    if (*s == '\0')
+    {
+      break;
+    }
+    char c = '\\';
+    if (s[1] != '\0')
+    {
+      s = unescape(s + 1, &c, escapes, &stop);
+    }
+    else
+    {
+      s++;
+    }
+    if (!stop)
+    {
+      out_char(out, c);
+    }
+  }
+  return !stop;
+}
+
+// Write 'len' bytes of 'data' padded with blanks to 'width' (on the right
+// if 'left')
+static void out_padded(struct out *out, const char *data, size_t len, int width, bool left)
+{
+  static const char blanks[] = "                                ";
+  size_t pad = width > 0 && (size_t)width > len ? width - len : 0;
+  for (; !left && pad > 0; pad -= pad < 32 ? pad : 32)
+  {
+    out_write(out, blanks, pad < 32 ? pad : 32);
+  }
+  out_write(out, data, len);
+  for (; left && pad > 0; pad -= pad < 32 ? pad : 32)
+  {
+    out_write(out, blanks, pad < 32 ? pad : 32);
+  }
+}
+
+// echo [-neE] [string...]
+static int run_echo(char *argv[])
+{
+  bool newline = true;
+  bool escapes = false;
+  int i = 1;
+  // an argument is options only if every letter of it is one
+  for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0' &&
+         strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1);
+       i++)
+  {
+    for (const char *c = argv[i] + 1; *c != '\0'; c++)
+    {
+      if (*c == 'n')
+      {
+        newline = false;
+      }
+      else
+      {
+        escapes = *c == 'e';
+      }
+    }
+  }
+
+  struct out out;
+  out.len = 0;
+  out.failed = false;
+  for (; argv[i] != NULL; i++)
+  {
+    if (escapes && !write_escaped(&out, argv[i], ESCAPES_ECHO))
+    {
+      newline = false;
+      break;
+    }
+    if (!escapes)
+    {
+      out_write(&out, argv[i], strlen(argv[i]));
+    }
+    if (argv[i + 1] != NULL)
+    {
+      out_char(&out, ' ');
+    }
+  }
+  if (newline)
+  {
+    out_char(&out, '\n');
+  }
+  out_flush(&out);
+  return out.failed ? 1 : 0;
+}
+
+// true / false [ignored...]
+static int run_true(char *argv[])
+{
+  return 0;
+}
+
+static int run_false(char *argv[])
+{
+  return 1;
+}
+
+/**
+ * printf
+ */
+
+// Reading the arguments of one printf run
+struct printf_args
+{
+  char **next; // the next argument to convert, NULL terminated
+  bool used;   // a conversion took an argument during this pass
+  int status;  // 1 once an argument was not a valid number
+};
+
+static const char *next_arg(struct printf_args *args)
+{
+  if (*args->next == NULL)
+  {
+    return NULL;
+  }
+  args->used = true;
+  return *args->next++;
+}
+
+/*
+ * Check the end of a number parsed from 'arg' (a 'c or "c argument is the
+ * character's code and never gets here).
+ */
+static void check_number(struct printf_args *args, const char *arg, const char *end)
+{
+  if (errno == ERANGE)
+  {
+    complain("printf", "%s: %s", arg, strerror(ERANGE));
+    args->status = 1;
+  }
+  else if (end == arg)
+  {
+    complain("printf", "'%s': expected a numeric value", arg);
+    args->status = 1;
+  }
+  else if (*end != '\0')
+  {
+    complain("printf", "'%s': value not completely converted", arg);
+    args->status = 1;
+  }
+}
+
+static long long signed_arg(struct printf_args *args)
+{
+  const char *arg = next_arg(args);
+  if (arg == NULL || arg[0] == '\0')
+  {
+    return 0;
+  }
+  if (arg[0] == '\'' || arg[0] == '"')
+  {
+    return (unsigned char)arg[1];
+  }
+  char *end;
+  errno = 0;
+  long long value = strtoll(arg, &end, 0);
+  check_number(args, arg, end);
+  return value;
+}
+
+static unsigned long long unsigned_arg(struct printf_args *args)
+{
+  const char *arg = next_arg(args);
+  if (arg == NULL || arg[0] == '\0')
+  {
+    return 0;
+  }
+  if (arg[0] == '\'' || arg[0] == '"')
+  {
+    return (unsigned char)arg[1];
+  }
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(arg, &end, 0);
+  check_number(args, arg, end);
+  return value;
+}
+
+static long double float_arg(struct printf_args *args)
+{
+  const char *arg = next_arg(args);
+  if (arg == NULL || arg[0] == '\0')
+  {
+    return 0;
+  }
+  if (arg[0] == '\'' || arg[0] == '"')
+  {
+    return (unsigned char)arg[1];
+  }
+  char *end;
+  errno = 0;
+  long double value = strtold(arg, &end);
+  check_number(args, arg, end);
+  return value;
+}
+
+/*
+ * Output one conversion, 'spec' pointing just after its '%'.
+ * returns: the character after the conversion, or NULL if the format is
+ *          invalid (with the error printed).
+ */
+static const char *convert(const char *spec, struct printf_args *args, struct out *out,
+                           bool *stop)
+{
+  // rebuild the conversion for the C library: flags, '*' for width and
+  // precision (taken from arguments or the format), then the type
+  const char *start = spec;
+  char format[32] = "%";
+  size_t len = 1;
+  size_t flags = strspn(spec, "-+ #0'");
+  if (flags > 8)
+  {
+    flags = 8;
+  }
+  memcpy(format + len, spec, flags);
+  len += flags;
+  bool left = memchr(spec, '-', flags) != NULL;
+  spec += flags;
+
+  int width = 0;
+  bool has_width = false;
+  if (*spec == '*')
+  {
+    width = signed_arg(args);
+    has_width = true;
+    spec++;
+  }
+  else if (*spec >= '0' && *spec <= '9')
+  {
+    width = strtol(spec, (char **)&spec, 10);
+    has_width = true;
+  }
+  int precision = -1;
+  if (*spec == '.')
+  {
+    spec++;
+    if (*spec == '*')
+    {
+      precision = signed_arg(args);
+      spec++;
+    }
+    else
+    {
+      precision = strtol(spec, (char **)&spec, 10);
+    }
+  }
+  // length modifiers are accepted and ignored: every number is converted
+  // at the widest type
+  spec += strspn(spec, "hlLqjzt");
+
+  char type = *spec;
+  if (type == '\0' || strchr("diouxXeEfFgGaAcsb", type) == NULL)
+  {
+    complain("printf", "%%%.*s: invalid conversion specification",
+             (int)(spec - start) + (type != '\0'), start);
+    return NULL;
+  }
+  if (!has_width)
+  {
+    width = 0;
+  }
+  len += snprintf(format + len, sizeof(format) - len, "*.*%s%c",
+                  strchr("di", type)        ? "ll"
+                  : strchr("ouxX", type)    ? "ll"
+                  : strchr("eEfFgGaA", type) ? "L"
+                                            : "",
+                  type == 'b' ? 's' : type);
+
+  switch (type)
+  {
+  case 'd':
+  case 'i':
+  {
+    long long value = signed_arg(args);
+    out_format(out, format, width, precision, value);
+    break;
+  }
+  case 'o':
+  case 'u':
+  case 'x':
+  case 'X':
+  {
+    unsigned long long value = unsigned_arg(args);
+    out_format(out, format, width, precision, value);
+    break;
+  }
+  case 'c':
+  {
+    const char *arg = next_arg(args);
+    out_padded(out, arg != NULL ? arg : "", arg != NULL && arg[0] != '\0', width,
+               left || width < 0);
+    break;
+  }
+  case 's':
+  {
+    const char *arg = next_arg(args);
+    out_format(out, format, width, precision, arg != NULL ? arg : "");
+    break;
+  }
+  case 'b':
+  {
+    // interpret the argument's escapes first, then pad it
+    const char *arg = next_arg(args);
+    arg = arg != NULL ? arg : "";
+    char *decoded = malloc(strlen(arg) + 1);
+    if (decoded == NULL)
+    {
+      out->failed = true;
+      break;
+    }
+    size_t len = decode_escapes(arg, decoded, ESCAPES_PRINTF_B, stop);
+    if (precision >= 0 && (size_t)precision < len)
+    {
+      len = precision;
+    }
+    out_padded(out, decoded, len, width < 0 ? -width : width, left || width < 0);
+    free(decoded);
+    break;
+  }
+  default:
+  {
+    long double value = float_arg(args);
+    out_format(out, format, width, precision, value);
+    break;
+  }
+  }
+  return spec + 1;
+}
+
+// printf format [argument...]: the format is reused until every argument
+// has been converted
+static int run_printf(char *argv[])
+{
+  if (argv[1] != NULL && strcmp(argv[1], "--") == 0)
+  {
+    argv++;
+  }
+  if (argv[1] == NULL)
+  {
+    complain_usage("printf", "missing operand", NULL);
+    return 1;
+  }
+  const char *format = argv[1];
+  struct printf_args args = {argv + 2, false, 0};
+  struct out out;
+  out.len = 0;
+  out.failed = false;
+  bool stop = false;
+  do
+  {
+    args.used = false;
+    for (const char *p = format; *p != '\0' && !stop && !out.failed;)
+    {
+      size_t plain = strcspn(p, "%\\");
+      out_write(&out, p, plain);
+      p += plain;
+      if (*p == '\\')
+      {
+        char c = '\\';
+        p = p[1] == '\0' ? p + 1 : unescape(p + 1, &c, ESCAPES_PRINTF, &stop);
+        if (!stop)
+        {
+          out_char(&out, c);
+        }
+      }
+      else if (p[0] == '%' && p[1] == '%')
+      {
+        out_char(&out, '%');
+        p += 2;
+      }
+      else if (*p == '%')
+      {
+        p = convert(p + 1, &args, &out, &stop);
+        if (p == NULL)
+        {
+          out_flush(&out);
+          return 1;
+        }
+      }
+    }
+  } while (args.used && *args.next != NULL && !stop && !out.failed);
+  out_flush(&out);
+  return out.failed ? 1 : args.status;
+}
+
+/**
+ * test / [
+ */
+
+// State of one test expression being evaluated
+struct test
+{
+  const char *name; // "test" or "[" for error messages
+  char **argv;      // the operands, without the name and the closing ]
+  int argc;
+  int pos;    // next operand
+  bool error; // a syntax error was reported
+};
+
+static bool test_error(struct test *t, const char *format, const char *arg)
+{
+  if (!t->error)
+  {
+    complain(t->name, format, arg);
+  }
+  t->error = true;
+  return false;
+}
+
+// Operand 'i' from the current position, or NULL past the end
+static const char *peek(struct test *t, int i)
+{
+  return t->pos + i < t->argc ? t->argv[t->pos + i] : NULL;
+}
+
+static bool is_unary(const char *op)
+{
+  return op != NULL && op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+         strchr("bcdefgGhkLnOprsStuwxz", op[1]) != NULL;
+}
+
+static bool is_binary(const char *op)
+{
+  static const char *ops[] = {"=",   "==",  "!=",  "-eq", "-ne", "-lt", "-le", "-gt",
+                              "-ge", "-nt", "-ot", "-ef", "-a",  "-o",  NULL};
+  for (int i = 0; op != NULL && ops[i] != NULL; i++)
+  {
+    if (strcmp(op, ops[i]) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool unary(struct test *t, const char *op, const char *arg)
+{
+  struct stat st;
+  switch (op[1])
+  {
+  case 'n':
+    return arg[0] != '\0';
+  case 'z':
+    return arg[0] == '\0';
+  case 't':
+  {
+    char *end;
+    long fd = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0')
+    {
+      return test_error(t, "invalid integer '%s'", arg);
+    }
+    return isatty(fd);
+  }
+  case 'r':
+    return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+  case 'w':
+    return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+  case 'x':
+    return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+  case 'h':
+  case 'L':
+    return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+  }
+  if (stat(arg, &st) != 0)
+  {
+    return false;
+  }
+  switch (op[1])
+  {
+  case 'b':
+    return S_ISBLK(st.st_mode);
+  case 'c':
+    return S_ISCHR(st.st_mode);
+  case 'd':
+    return S_ISDIR(st.st_mode);
+  case 'f':
+    return S_ISREG(st.st_mode);
+  case 'g':
+    return (st.st_mode & S_ISGID) != 0;
+  case 'G':
+    return st.st_gid == getegid();
+  case 'k':
+    return (st.st_mode & S_ISVTX) != 0;
+  case 'O':
+    return st.st_uid == geteuid();
+  case 'p':
+    return S_ISFIFO(st.st_mode);
+  case 's':
+    return st.st_size > 0;
+  case 'S':
+    return S_ISSOCK(st.st_mode);
+  case 'u':
+    return (st.st_mode & S_ISUID) != 0;
+  default: // -e
+    return true;
+  }
+}
+
+// An integer operand: surrounding blanks are allowed, nothing else
+static long long test_integer(struct test *t, const char *arg)
+{
+  char *end;
+  errno = 0;
+  long long value = strtoll(arg, &end, 10);
+  while (*end == ' ' || *end == '\t')
+  {
+    end++;
+  }
+  if (end == arg || *end != '\0' || errno == ERANGE)
+  {
+    test_error(t, "invalid integer '%s'", arg);
+  }
+  return value;
+}
+
+// returns: <0, 0 or >0 as 'a' was modified before, at or after 'b'; files
+//          that do not exist are older than all others
+static int compare_mtime(const char *a, const char *b)
+{
+  struct stat sa, sb;
+  bool has_a = stat(a, &sa) == 0;
+  bool has_b = stat(b, &sb) == 0;
+  if (!has_a || !has_b)
+  {
+    return has_a - has_b;
+  }
+  if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec)
+  {
+    return sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ? -1 : 1;
+  }
+  return (sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec) - (sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec);
+}
+
+static bool binary(struct test *t, const char *a, const char *op, const char *b)
+{
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+  {
+    return strcmp(a, b) == 0;
+  }
+  if (strcmp(op, "!=") == 0)
+  {
+    return strcmp(a, b) != 0;
+  }
+  if (strcmp(op, "-a") == 0)
+  {
+    return a[0] != '\0' && b[0] != '\0';
+  }
+  if (strcmp(op, "-o") == 0)
+  {
+    return a[0] != '\0' || b[0] != '\0';
+  }
+  if (strcmp(op, "-nt") == 0)
+  {
+    return compare_mtime(a, b) > 0;
+  }
+  if (strcmp(op, "-ot") == 0)
+  {
+    return compare_mtime(a, b) < 0;
+  }
+  if (strcmp(op, "-ef") == 0)
+  {
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev &&
+           sa.st_ino == sb.st_ino;
+  }
+  long long x = test_integer(t, a);
+  long long y = test_integer(t, b);
+  switch (op[1] * 256 + op[2])
+  {
+  case 'e' * 256 + 'q':
+    return x == y;
+  case 'n' * 256 + 'e':
+    return x != y;
+  case 'l' * 256 + 't':
+    return x < y;
+  case 'l' * 256 + 'e':
+    return x <= y;
+  case 'g' * 256 + 't':
+    return x > y;
+  default: // -ge
+    return x >= y;
+  }
+}
+
+static bool test_or(struct test *t);
+
+// primary: ( expr ) | -op arg | arg op arg | arg
+static bool test_primary(struct test *t)
+{
+  const char *arg = peek(t, 0);
+  if (arg == NULL)
+  {
+    return test_error(t, "argument expected", NULL);
+  }
+  if (strcmp(arg, "(") == 0 && peek(t, 1) != NULL)
+  {
+    t->pos++;
+    bool value = test_or(t);
+    if (peek(t, 0) == NULL || strcmp(peek(t, 0), ")") != 0)
+    {
+      return test_error(t, "expected ')'", NULL);
+    }
+    t->pos++;
+    return value;
+  }
+  if (is_binary(peek(t, 1)) && peek(t, 2) != NULL && strcmp(peek(t, 1), "-a") != 0 &&
+      strcmp(peek(t, 1), "-o") != 0)
+  {
+    t->pos += 3;
+    return binary(t, arg, t->argv[t->pos - 2], t->argv[t->pos - 1]);
+  }
+  if (is_unary(arg) && peek(t, 1) != NULL)
+  {
+    t->pos += 2;
+    return unary(t, arg, t->argv[t->pos - 1]);
+  }
+  t->pos++;
+  return arg[0] != '\0';
+}
+
+static bool test_not(struct test *t)
+{
+  if (peek(t, 0) != NULL && strcmp(peek(t, 0), "!") == 0 && peek(t, 1) != NULL)
+  {
+    t->pos++;
+    return !test_not(t);
+  }
+  return test_primary(t);
+}
+
+static bool test_and(struct test *t)
+{
+  bool value = test_not(t);
+  while (peek(t, 0) != NULL && strcmp(peek(t, 0), "-a") == 0)
+  {
+    t->pos++;
+    value = test_not(t) && value;
+  }
+  return value;
+}
+
+static bool test_or(struct test *t)
+{
+  bool value = test_and(t);
+  while (peek(t, 0) != NULL && strcmp(peek(t, 0), "-o") == 0)
+  {
+    t->pos++;
+    value = test_and(t) || value;
+  }
+  return value;
+}
+
+/*
+ * Evaluate the next 'count' operands. Up to four operands are read by
+ * their number as POSIX specifies (so "test -n" and "test ! =" mean what
+ * they say); longer expressions go through the grammar.
+ */
+static bool test_eval(struct test *t, int count)
+{
+  const char *first = peek(t, 0);
+  switch (count)
+  {
+  case 0:
+    return false;
+  case 1:
+    t->pos++;
+    return first[0] != '\0';
+  case 2:
+    if (strcmp(first, "!") == 0)
+    {
+      t->pos++;
+      return !test_eval(t, 1);
+    }
+    if (is_unary(first))
+    {
+      t->pos += 2;
+      return unary(t, first, t->argv[t->pos - 1]);
+    }
+    return test_error(t, "'%s': unary operator expected", first);
+  case 3:
+    if (is_binary(peek(t, 1)))
+    {
+      t->pos += 3;
+      return binary(t, first, t->argv[t->pos - 2], t->argv[t->pos - 1]);
+    }
+    if (strcmp(first, "!") == 0)
+    {
+      t->pos++;
+      return !test_eval(t, 2);
+    }
+    if (strcmp(first, "(") == 0 && strcmp(peek(t, 2), ")") == 0)
+    {
+      t->pos++;
+      bool value = test_eval(t, 1);
+      t->pos++;
+      return value;
+    }
+    return test_error(t, "'%s': binary operator expected", peek(t, 1));
+  case 4:
+    if (strcmp(first, "!") == 0)
+    {
+      t->pos++;
+      return !test_eval(t, 3);
+    }
+    if (strcmp(first, "(") == 0 && strcmp(peek(t, 3), ")") == 0)
+    {
+      t->pos++;
+      bool value = test_eval(t, 2);
+      t->pos++;
+      return value;
+    }
+    // fall through
+  default:
+    return test_or(t);
+  }
+}
+
+// test expression / [ expression ]
+static int run_test(char *argv[])
+{
+  struct test t = {argv[0], argv + 1, 0, 0, false};
+  while (t.argv[t.argc] != NULL)
+  {
+    t.argc++;
+  }
+  if (strcmp(argv[0], "[") == 0)
+  {
+    if (t.argc == 0 || strcmp(t.argv[t.argc - 1], "]") != 0)
+    {
+      complain("[", "missing ']'");
+      return 2;
+    }
+    t.argc--;
+  }
+
+  bool value = test_eval(&t, t.argc);
+  if (!t.error && t.pos < t.argc)
+  {
+    test_error(&t, "extra argument '%s'", t.argv[t.pos]);
+  }
+  return t.error ? 2 : !value;
+}
+
+/**
+ * sleep
+ */
+
+// sleep number[smhd]...: sleep for the sum of the intervals
+static int run_sleep(char *argv[])
+{
+  if (argv[1] != NULL && strcmp(argv[1], "--") == 0)
+  {
+    argv++;
+  }
+  else if (argv[1] != NULL && argv[1][0] == '-' && argv[1][1] != '\0')
+  {
+    char option[2] = {argv[1][1], '\0'};
+    complain_usage("sleep", "invalid option -- '%s'", option);
+    return 1;
+  }
+  if (argv[1] == NULL)
+  {
+    complain_usage("sleep", "missing operand", NULL);
+    return 1;
+  }
+  double seconds = 0;
+  for (int i = 1; argv[i] != NULL; i++)
+  {
+    char *end;
+    double value = strtod(argv[i], &end);
+    double unit = *end == 'm' ? 60 : *end == 'h' ? 3600 : *end == 'd' ? 86400 : 1;
+    if (*end != '\0' && strchr("smhd", *end) != NULL)
+    {
+      end++;
+    }
+    if (end == argv[i] || *end != '\0' || !(value >= 0) || isnan(value))
+    {
+      complain_usage("sleep", "invalid time interval '%s'", argv[i]);
+      return 1;
+    }
+    seconds += value * unit;
+  }
+
+  // 'sleep inf' is a long time, not forever
+  if (seconds > MAX_SLEEP)
+  {
+    seconds = MAX_SLEEP;
+  }
+  struct timespec duration;
+  duration.tv_sec = seconds;
+  duration.tv_nsec = (seconds - duration.tv_sec) * 1e9;
+  return events_sleep(&duration) ? 0 : 130;
+}
+
+/**
+ * cat
+ */
+
+/*
+ * Copy what is typed on terminal 'fd' to stdout, a line at a time, until
+ * ctrl-d. The shell keeps SIGINT blocked, so ctrl-c is noticed by waiting
+ * for input through the event loop.
+ */
+static void cat_terminal(int fd)
+{
+  char buf[4096];
+  while (events_wait_input(fd))
+  {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0 || write(STDOUT_FILENO, buf, n) != n)
+    {
+      break;
+    }
+  }
+}
+
+// cat [file...]: copy the files (or stdin, also for "-") to stdout inside
+// the kernel (see fdcopy.h). There are no options: the shell runs the
+// program on $PATH for those (utility_supported()).
+static int run_cat(char *argv[])
+{
+  // a file that is also our output would be copied onto itself forever
+  struct stat out;
+  bool out_is_file = fstat(STDOUT_FILENO, &out) == 0 && S_ISREG(out.st_mode);
+
+  int status = 0;
+  char *stdin_args[] = {"-", NULL};
+  char **files = argv[1] != NULL ? argv + 1 : stdin_args;
+  for (int i = 0; files[i] != NULL; i++)
+  {
+    const char *name = files[i];
+    bool is_stdin = strcmp(name, "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      complain("cat", "%s: %s", name, strerror(errno));
+      status = 1;
+      continue;
+    }
+    struct stat in;
+    if (out_is_file && fstat(fd, &in) == 0 && in.st_dev == out.st_dev &&
+        in.st_ino == out.st_ino)
+    {
+      complain("cat", "%s: input file is output file", name);
+      status = 1;
+    }
+    else if (isatty(fd))
+    {
+      cat_terminal(fd);
+    }
+    else if (!fd_copy(fd, STDOUT_FILENO))
+    {
+      if (errno != EPIPE && errno != EINTR)
+      {
+        complain("cat", "%s: %s", name, strerror(errno));
+      }
+      status = errno == EINTR ? 130 : 1;
+    }
+    if (!is_stdin)
+    {
+      close(fd);
+    }
+    if (status == 130)
+    {
+      break;
+    }
+  }
+  return status;
+}
+
+static const struct
+{
+  const char *name;
+  int (*run)(char *argv[]);
+} utilities[] = {
+  {"echo", run_echo}, {"printf", run_printf}, {"test", run_test},   {"[", run_test},
+  {"true", run_true}, {"false", run_false},   {"sleep", run_sleep}, {"cat", run_cat},
+};
+
+#define NUM_UTILITIES (int)(sizeof(utilities) / sizeof(utilities[0]))
+
+int utility_run(char *argv[])
+{
+  for (int i = 0; i < NUM_UTILITIES; i++)
+  {
+    if (strcmp(argv[0], utilities[i].name) == 0)
+    {
+      return utilities[i].run(argv);
+    }
+  }
+  return 127;
+}
+
+bool utility_supported(char *argv[])
+{
+  if (strcmp(argv[0], "cat") != 0)
+  {
+    return true;
+  }
+  for (int i = 1; argv[i] != NULL; i++)
+  {
+    if (argv[i][0] == '-' && argv[i][1] != '\0')
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool utility_may_block(char *argv[])
+{
+  if (strcmp(argv[0], "sleep") == 0)
+  {
+    return true;
+  }
+  if (strcmp(argv[0], "cat") != 0)
+  {
+    return false;
+  }
+  if (argv[1] == NULL)
+  {
+    return true;
+  }
+  for (int i = 1; argv[i] != NULL; i++)
+  {
+    struct stat st;
+    if (strcmp(argv[i], "-") == 0 || (stat(argv[i], &st) == 0 && !S_ISREG(st.st_mode)))
+    {
+      return true;
+    }
+  }
+  return false;
+}
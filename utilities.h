@@ -0,0 +1,35 @@
+// Small utilities that scripts run all the time (echo, printf, test, [,
+// true, false, sleep, cat), built into the shell so they cost a function
+// call instead of a fork() and exec().
+
+#ifndef UTILITIES_H
+#define UTILITIES_H
+
+#include <stdbool.h>
+
+/*
+ * Run the utility named by argv[0] with the arguments that follow, like
+ * its GNU coreutils counterpart: same options, output and diagnostics
+ * ('cat' takes none, see utility_supported()).
+ * Output goes to descriptor 1 in as few write()s as possible.
+ * returns: the exit status (0 success, 1 failure or false, 2 for a
+ *          'test' syntax error, 130 when 'sleep' is interrupted by ctrl-c).
+ */
+int utility_run(char *argv[]);
+
+/*
+ * returns: false if argv should run as the program of that name on $PATH
+ * instead: 'cat' with options, which the builtin does not take. True for
+ * anything that is not a utility.
+ */
+bool utility_supported(char *argv[]);
+
+/*
+ * returns: true if the utility can block for as long as its input or its
+ * arguments say: 'sleep', and 'cat' reading stdin or anything but regular
+ * files. The shell ignores ctrl-z, so under job control these run in a
+ * child, as a job that can be stopped.
+ */
+bool utility_may_block(char *argv[]);
+
+#endif
@@ -0,0 +1,347 @@
+// Shell variables and the environment handed to commands.
+//
+// Variables live in an open addressing hash table. The exported ones are
+// also listed in an envp array whose entries point straight at the
+// variables' "NAME=value" strings, so starting a command never formats or
+// copies the environment: setting an exported variable swaps one pointer,
+// exporting or unsetting one appends or removes one entry.
+
+#include "vars.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INITIAL_SLOTS 64
+#define NOT_IN_ENV SIZE_MAX
+
+extern char **environ;
+
+struct var
+{
+  char *name;     // NULL for an empty slot
+  size_t name_len;
+  char *pair;     // "NAME=value", NULL while unset
+  bool exported;
+  size_t env_index; // position in 'env', or NOT_IN_ENV
+  void (*watch)(const char *value);
+};
+
+static struct var *slots;
+static size_t num_slots;
+static size_t num_used;
+
+// The exported variables, NULL terminated
+static char **env;
+static size_t env_count;
+static size_t env_size;
+
+static uint32_t hash_name(const char *name, size_t len)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+  {
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  }
+  return h;
+}
+
+static struct var *find_slot(struct var *table, size_t size, const char *name, size_t len)
+{
+  size_t i = hash_name(name, len) & (size - 1);
+  while (table[i].name != NULL &&
+         (table[i].name_len != len || memcmp(table[i].name, name, len) != 0))
+  {
+    i = (i + 1) & (size - 1);
+  }
+  return &table[i];
+}
+
+static bool grow(void)
+{
+  size_t new_size = num_slots ? num_slots * 2 : INITIAL_SLOTS;
+  struct var *table = calloc(new_size, sizeof(*table));
+  if (table == NULL)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < num_slots; i++)
+  {
+    if (slots[i].name != NULL)
+    {
+      *find_slot(table, new_size, slots[i].name, slots[i].name_len) = slots[i];
+    }
+  }
+  free(slots);
+  slots = table;
+  num_slots = new_size;
+  return true;
+}
+
+static struct var *lookup(const char *name, size_t len)
+{
+  if (num_slots == 0)
+  {
+    return NULL;
+  }
+  struct var *var = find_slot(slots, num_slots, name, len);
+  return var->name != NULL ? var : NULL;
+}
+
+// The variable called name[0..len), created (unset) if needed.
+static struct var *get_var(const char *name, size_t len)
+{
+  if ((num_used + 1) * 4 > num_slots * 3 && !grow())
+  {
+    return NULL;
+  }
+  struct var *var = find_slot(slots, num_slots, name, len);
+  if (var->name == NULL)
+  {
+    var->name = strndup(name, len);
+    if (var->name == NULL)
+    {
+      return NULL;
+    }
+    var->name_len = len;
+    var->env_index = NOT_IN_ENV;
+    num_used++;
+  }
+  return var;
+}
+
+static bool env_add(struct var *var)
+{
+  if (env_count + 2 > env_size)
+  {
+    size_t new_size = env_size ? env_size * 2 : INITIAL_SLOTS;
+    char **grown = realloc(env, new_size * sizeof(char *));
+    if (grown == NULL)
+    {
+      return false;
+    }
+    env = grown;
+    env_size = new_size;
+  }
+  var->env_index = env_count;
+  env[env_count++] = var->pair;
+  env[env_count] = NULL;
+  environ = env;
+  return true;
+}
+
+// Take 'var' out of the environment, moving the last entry into its place.
+static void env_remove(struct var *var)
+{
+  size_t index = var->env_index;
+  char *last = env[--env_count];
+  env[index] = last;
+  env[env_count] = NULL;
+  var->env_index = NOT_IN_ENV;
+  if (index != env_count)
+  {
+    lookup(last, strchr(last, '=') - last)->env_index = index;
+  }
+}
+
+bool vars_init(char **envp)
+{
+  for (; envp != NULL && *envp != NULL; envp++)
+  {
+    const char *eq = strchr(*envp, '=');
+    if (eq == NULL)
+    {
+      continue;
+    }
+    char name[eq - *envp + 1];
+    memcpy(name, *envp, eq - *envp);
+    name[eq - *envp] = '\0';
+    if (!vars_set(name, eq + 1, true))
+    {
+      return false;
+    }
+  }
+  // an empty environment still needs its terminator
+  if (env == NULL)
+  {
+    env = calloc(INITIAL_SLOTS, sizeof(char *));
+    if (env == NULL)
+    {
+      return false;
+    }
+    env_size = INITIAL_SLOTS;
+  }
+  environ = env;
+  return true;
+}
+
+bool vars_valid_name(const char *name, size_t len)
+{
+  if (len == 0 || (name[0] >= '0' && name[0] <= '9'))
+  {
+    return false;
+  }
+  for (size_t i = 0; i < len; i++)
+  {
+    char c = name[i];
+    if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+const char *vars_getn(const char *name, size_t len)
+{
+  struct var *var = lookup(name, len);
+  return var != NULL && var->pair != NULL ? var->pair + var->name_len + 1 : NULL;
+}
+
+const char *vars_get(const char *name)
+{
+  return vars_getn(name, strlen(name));
+}
+
+bool vars_set(const char *name, const char *value, bool export)
+{
+  size_t name_len = strlen(name);
+  size_t value_len = strlen(value);
+  struct var *var = get_var(name, name_len);
+  char *pair = malloc(name_len + value_len + 2);
+  if (var == NULL || pair == NULL)
+  {
+    free(pair);
+    return false;
+  }
+  memcpy(pair, name, name_len);
+  pair[name_len] = '=';
+  memcpy(pair + name_len + 1, value, value_len + 1);
+
+  free(var->pair);
+  var->pair = pair;
+  var->exported |= export;
+  if (var->env_index != NOT_IN_ENV)
+  {
+    env[var->env_index] = pair;
+  }
+  else if (var->exported && !env_add(var))
+  {
+    return false;
+  }
+  if (var->watch != NULL)
+  {
+    var->watch(pair + name_len + 1);
+  }
+  return true;
+}
+
+bool vars_export(const char *name)
+{
+  struct var *var = get_var(name, strlen(name));
+  if (var == NULL)
+  {
+    return false;
+  }
+  var->exported = true;
+  return var->pair == NULL || var->env_index != NOT_IN_ENV || env_add(var);
+}
+
+void vars_unset(const char *name)
+{
+  struct var *var = lookup(name, strlen(name));
+  if (var == NULL || (var->pair == NULL && !var->exported))
+  {
+    return;
+  }
+  if (var->env_index != NOT_IN_ENV)
+  {
+    env_remove(var);
+  }
+  free(var->pair);
+  var->pair = NULL;
+  var->exported = false;
+  if (var->watch != NULL)
+  {
+    var->watch(NULL);
+  }
+}
+
+char **vars_environ(void)
+{
+  return env;
+}
+
+bool vars_watch(const char *name, void (*fn)(const char *value))
+{
+  struct var *var = get_var(name, strlen(name));
+  if (var == NULL)
+  {
+    return false;
+  }
+  var->watch = fn;
+  return true;
+}
+
+static int compare_vars(const void *a, const void *b)
+{
+  return strcmp((*(struct var *const *)a)->name, (*(struct var *const *)b)->name);
+}
+
+void vars_print(int fd, bool exported)
+{
+  struct var **list = malloc((num_used + 1) * sizeof(*list));
+  if (list == NULL)
+  {
+    return;
+  }
+  size_t count = 0;
+  size_t size = 0;
+  for (size_t i = 0; i < num_slots; i++)
+  {
+    struct var *var = &slots[i];
+    if (var->name != NULL && (exported ? var->exported : var->pair != NULL))
+    {
+      list[count++] = var;
+      // "export " NAME "='" value with every ' as '\'' "'\n"
+      size += strlen("export ") + (var->pair ? 4 * strlen(var->pair) : var->name_len) + 4;
+    }
+  }
+  qsort(list, count, sizeof(*list), compare_vars);
+
+  char *text = malloc(size + 1);
+  char *out = text;
+  for (size_t i = 0; text != NULL && i < count; i++)
+  {
+    if (exported)
+    {
+      out = stpcpy(out, "export ");
+    }
+    out = stpcpy(out, list[i]->name);
+    if (list[i]->pair != NULL)
+    {
+      out = stpcpy(out, "='");
+      for (const char *p = list[i]->pair + list[i]->name_len + 1; *p != '\0'; p++)
+      {
+        if (*p == '\'')
+        {
+          out = stpcpy(out, "'\\''");
+        }
+        else
+        {
+          *out++ = *p;
+        }
+      }
+      *out++ = '\'';
+    }
+    *out++ = '\n';
+  }
+  if (text != NULL)
+  {
+    write(fd, text, out - text);
+  }
+  free(text);
+  free(list);
+}
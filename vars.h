@@ -0,0 +1,56 @@
+// Shell variables and the environment handed to commands.
+
+#ifndef VARS_H
+#define VARS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Import the process environment: every variable in it starts out
+ * exported. returns: false if out of memory.
+ */
+bool vars_init(char **envp);
+
+// true if name[0..len) is a valid variable name (letters, digits and '_',
+// not starting with a digit)
+bool vars_valid_name(const char *name, size_t len);
+
+// returns: the value of variable name[0..len), or NULL if it is unset.
+const char *vars_getn(const char *name, size_t len);
+const char *vars_get(const char *name);
+
+/*
+ * Set variable 'name' to 'value', keeping whether it is exported.
+ * export: also export it.
+ * returns: false if out of memory.
+ */
+bool vars_set(const char *name, const char *value, bool export);
+
+// Export 'name' without changing its value (an unset one is exported once
+// it gets a value). returns: false if out of memory.
+bool vars_export(const char *name);
+
+// Forget variable 'name' and its export attribute.
+void vars_unset(const char *name);
+
+/*
+ * The exported variables as a NULL terminated "NAME=value" array for
+ * execve(). It is kept up to date as variables change instead of being
+ * built per command; the process 'environ' points to it too, so getenv()
+ * agrees. returns: the array, valid until the next change.
+ */
+char **vars_environ(void);
+
+/*
+ * Call fn(value) whenever variable 'name' is set or unset (value NULL),
+ * e.g. to reparse $PS1. One watcher per variable.
+ * returns: false if out of memory.
+ */
+bool vars_watch(const char *name, void (*fn)(const char *value));
+
+// Print the variables (only the exported ones with 'exported') as
+// "export NAME='value'" or "NAME='value'" lines to fd, sorted by name.
+void vars_print(int fd, bool exported);
+
+#endif
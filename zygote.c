@@ -0,0 +1,437 @@
+// Spawn helper ("zygote").
+//
+// Even posix_spawn and vfork make the kernel set up a child from the
+// shell's own process, and fork() copies all of its page tables. The
+// helper is forked once at startup, while the shell is still small, and
+// from then on the shell sends it each command over a SOCK_SEQPACKET
+// socketpair: argv, environment and program path in one message, the
+// working directory and standard descriptors as SCM_RIGHTS. The helper
+// forks from its own small address space and answers with the pid, once
+// the child has exec'd, or the errno of a failed exec.
+//
+// The child is created with clone(CLONE_PARENT), which makes it a child of
+// the helper's parent: the shell. So the shell reaps it, gets its exit
+// status and resource usage, and runs job control on it exactly as for a
+// child it started itself; only its creation happens elsewhere.
+
+#include "zygote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Largest request: argv and environment together
+#define MAX_REQUEST (128 * 1024)
+
+// Descriptors sent along: the working directory, then stdin/out/err
+#define NUM_FDS 4
+
+struct request
+{
+  int32_t pgid;     // process group to join (never -1: the shell's is sent)
+  uint32_t argc;    // strings that follow: the path if has_path, argv, envp
+  uint32_t envc;
+  uint32_t has_path;
+  uint32_t fd_mask; // bit i: descriptor i is among those sent
+};
+
+struct reply
+{
+  int32_t pid; // -1 if no child was created
+  int32_t err; // errno of the failed fork or exec, 0 once exec'd
+};
+
+// Signals the helper ignores, so ctrl-c and ctrl-z at the prompt (which go
+// to the shell's process group) leave it alone; its children reset them.
+static const int ignored_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGPIPE};
+#define NUM_IGNORED (sizeof(ignored_signals) / sizeof(ignored_signals[0]))
+
+static int sock = -1;
+
+/*
+ * In the new child: set up the process and exec. Only async-signal-safe
+ * calls. A failed exec sends its errno down err_fd.
+ */
+static void exec_child(const struct request *request, char *path, char **argv, char **envp,
+                       const int *fds, int err_fd)
+{
+  if (fds[0] >= 0)
+  {
+    fchdir(fds[0]);
+  }
+  setpgid(0, request->pgid);
+  for (int i = 0; i < 3; i++)
+  {
+    if (request->fd_mask & (1u << i))
+    {
+      dup2(fds[i + 1], i);
+    }
+  }
+  for (size_t i = 0; i < NUM_IGNORED; i++)
+  {
+    signal(ignored_signals[i], SIG_DFL);
+  }
+  sigset_t none;
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+  // the helper is forked before events_init() raises the shell's
+  // RLIMIT_NOFILE, so this only matters for a helper started after it
+  spawn_restore_fd_limit();
+
+  if (path != NULL)
+  {
+    execve(path, argv, envp);
+  }
+  else
+  {
+    // execvpe() searches the PATH of environ, not of envp
+    environ = envp;
+    execvpe(argv[0], argv, envp);
+  }
+  int err = errno;
+  write(err_fd, &err, sizeof(err));
+  _exit(127);
+}
+
+// Start the child 'request' (of n bytes) asks for
+static struct reply start(char *buf, size_t n, const int *fds)
+{
+  struct reply reply = {-1, EINVAL};
+  struct request request;
+  if (n < sizeof(request))
+  {
+    return reply;
+  }
+  memcpy(&request, buf, sizeof(request));
+  size_t num_strings = request.has_path + request.argc + request.envc;
+  if (request.argc == 0 || num_strings > n)
+  {
+    return reply;
+  }
+
+  // the strings, each null terminated, one after the other
+  char **strings = malloc((num_strings + 2) * sizeof(char *));
+  if (strings == NULL)
+  {
+    reply.err = ENOMEM;
+    return reply;
+  }
+  char *s = buf + sizeof(request);
+  char *end = buf + n;
+  for (size_t i = 0; i < num_strings; i++)
+  {
+    char *nul = memchr(s, '\0', end - s);
+    if (nul == NULL)
+    {
+      free(strings);
+      return reply;
+    }
+    strings[i] = s;
+    s = nul + 1;
+  }
+  char *path = request.has_path ? strings[0] : NULL;
+  char **argv = strings + request.has_path;
+  // argv's NULL goes where envp starts, so move envp up by one
+  char **envp = argv + request.argc + 1;
+  memmove(envp, argv + request.argc, request.envc * sizeof(char *));
+  argv[request.argc] = NULL;
+  envp[request.envc] = NULL;
+
+  int err_pipe[2];
+  if (pipe2(err_pipe, O_CLOEXEC) < 0)
+  {
+    reply.err = errno;
+    free(strings);
+    return reply;
+  }
+  // like fork(), but the child's parent is the shell
+  pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL);
+  if (pid == 0)
+  {
+    close(err_pipe[0]);
+    exec_child(&request, path, argv, envp, fds, err_pipe[1]);
+  }
+  reply.pid = pid;
+  reply.err = pid < 0 ? errno : 0;
+  close(err_pipe[1]);
+  // the write end closes on exec: nothing to read means it exec'd
+  if (pid > 0)
+  {
+    int err;
+    ssize_t got;
+    do
+    {
+      got = read(err_pipe[0], &err, sizeof(err));
+    } while (got < 0 && errno == EINTR);
+    reply.err = got == sizeof(err) ? err : 0;
+  }
+  close(err_pipe[0]);
+  free(strings);
+  return reply;
+}
+
+// The helper: serve requests until the shell closes its end
+static void serve(void)
+{
+  char *buf = malloc(MAX_REQUEST);
+  if (buf == NULL)
+  {
+    _exit(1);
+  }
+  while (true)
+  {
+    struct iovec iov = {buf, MAX_REQUEST};
+    union
+    {
+      char buf[CMSG_SPACE(NUM_FDS * sizeof(int))];
+      struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      _exit(0);
+    }
+
+    int fds[NUM_FDS] = {-1, -1, -1, -1};
+    int num_fds = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      {
+        num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+      }
+    }
+    // fds[] by role: the working directory, then the ones in fd_mask
+    struct request request;
+    int by_role[NUM_FDS] = {-1, -1, -1, -1};
+    struct reply reply = {-1, EMSGSIZE};
+    if (!(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) && (size_t)n >= sizeof(request))
+    {
+      memcpy(&request, buf, sizeof(request));
+      int next = 0;
+      by_role[0] = next < num_fds ? fds[next++] : -1;
+      for (int i = 0; i < 3; i++)
+      {
+        if (request.fd_mask & (1u << i))
+        {
+          by_role[i + 1] = next < num_fds ? fds[next++] : -1;
+        }
+      }
+      reply = start(buf, n, by_role);
+    }
+    for (int i = 0; i < num_fds; i++)
+    {
+      close(fds[i]);
+    }
+    while (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) < 0 && errno == EINTR)
+    {
+    }
+  }
+}
+
+bool zygote_start(void)
+{
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0)
+  {
+    return false;
+  }
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    int err = errno;
+    close(pair[0]);
+    close(pair[1]);
+    errno = err;
+    return false;
+  }
+  if (pid == 0)
+  {
+    close(pair[0]);
+    sock = pair[1];
+    for (size_t i = 0; i < NUM_IGNORED; i++)
+    {
+      signal(ignored_signals[i], SIG_IGN);
+    }
+    serve();
+  }
+  close(pair[1]);
+  sock = pair[0];
+  return true;
+}
+
+bool zygote_running(void)
+{
+  return sock >= 0;
+}
+
+void zygote_detach(void)
+{
+  if (sock >= 0)
+  {
+    close(sock);
+    sock = -1;
+  }
+}
+
+// The helper is gone: spawn without it from now on
+static pid_t lost(void)
+{
+  zygote_detach();
+  errno = ENOTCONN;
+  return -1;
+}
+
+pid_t zygote_spawn(const char *path, char *tokens[], const struct spawn_io *io)
+{
+  if (sock < 0)
+  {
+    errno = ENOTCONN;
+    return -1;
+  }
+  char **envp = io != NULL && io->envp != NULL ? io->envp : environ;
+  struct request request = {
+      .pgid = io != NULL && io->pgid >= 0 ? io->pgid : getpgrp(),
+      .has_path = path != NULL,
+  };
+  size_t size = sizeof(request) + (path != NULL ? strlen(path) + 1 : 0);
+  for (; tokens[request.argc] != NULL; request.argc++)
+  {
+    size += strlen(tokens[request.argc]) + 1;
+  }
+  for (; envp[request.envc] != NULL; request.envc++)
+  {
+    size += strlen(envp[request.envc]) + 1;
+  }
+  if (size > MAX_REQUEST)
+  {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  // the descriptors: the working directory, and every one of 0, 1 and 2
+  // the child gets (its own or the shell's) that is open
+  int fds[NUM_FDS];
+  int num_fds = 0;
+  int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (cwd < 0)
+  {
+    return -1;
+  }
+  fds[num_fds++] = cwd;
+  for (int i = 0; i < 3; i++)
+  {
+    int fd = io != NULL && io->fds[i] >= 0 ? io->fds[i] : i;
+    if (fcntl(fd, F_GETFD) >= 0)
+    {
+      request.fd_mask |= 1u << i;
+      fds[num_fds++] = fd;
+    }
+  }
+
+  char *buf = malloc(size);
+  if (buf == NULL)
+  {
+    close(cwd);
+    return -1;
+  }
+  memcpy(buf, &request, sizeof(request));
+  char *end = buf + sizeof(request);
+  if (path != NULL)
+  {
+    end = stpcpy(end, path) + 1;
+  }
+  for (uint32_t i = 0; i < request.argc; i++)
+  {
+    end = stpcpy(end, tokens[i]) + 1;
+  }
+  for (uint32_t i = 0; i < request.envc; i++)
+  {
+    end = stpcpy(end, envp[i]) + 1;
+  }
+
+  struct iovec iov = {buf, size};
+  union
+  {
+    char buf[CMSG_SPACE(NUM_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buf,
+      .msg_controllen = CMSG_SPACE(num_fds * sizeof(int)),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+
+  ssize_t sent;
+  do
+  {
+    sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  int err = errno;
+  free(buf);
+  close(cwd);
+  if (sent < 0 && err == EMSGSIZE)
+  {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  if (sent < 0)
+  {
+    return lost();
+  }
+
+  struct reply reply;
+  ssize_t got;
+  do
+  {
+    got = recv(sock, &reply, sizeof(reply), 0);
+  } while (got < 0 && errno == EINTR);
+  if (got != sizeof(reply))
+  {
+    return lost();
+  }
+  if (reply.err != 0)
+  {
+    // a child that could not exec has exited, and it is ours to reap
+    if (reply.pid > 0)
+    {
+      waitpid(reply.pid, NULL, 0);
+    }
+    errno = reply.err;
+    return -1;
+  }
+  // also join the group from this side, as spawn_fork() does
+  if (io != NULL && io->pgid >= 0)
+  {
+    setpgid(reply.pid, io->pgid);
+  }
+  return reply.pid;
+}
@@ -0,0 +1,43 @@
+// Spawn helper ("zygote"): a small process forked from the shell at
+// startup that creates children for it, from its own small address space
+// instead of the shell's (SHELL_SPAWN=helper, see spawn.h).
+
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include "spawn.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * Fork the helper. Call it early, before the shell's heap grows: the
+ * helper keeps the address space the shell had at this point.
+ * returns: false (errno set) if it could not be started.
+ */
+bool zygote_start(void);
+
+// true while there is a helper to send spawns to
+bool zygote_running(void);
+
+/*
+ * Have the helper start 'tokens' (as spawn_command() would) with the
+ * shell's current working directory, the descriptors of 'io' (or the
+ * shell's own 0, 1 and 2) and io->envp (or the shell's environment). The
+ * child is created with CLONE_PARENT, so it is the shell's child: the
+ * shell waits for it, and gets its status and resource usage, as usual.
+ * returns: pid of the child once it has exec'd, or -1 with errno set, as
+ *          spawn_command() does. If the helper is gone (or the request is
+ *          too large for it), errno is ENOTCONN (or EMSGSIZE) and nothing
+ *          was started.
+ */
+pid_t zygote_spawn(const char *path, char *tokens[], const struct spawn_io *io);
+
+/*
+ * In a forked copy of the shell: let go of the parent's helper without
+ * stopping it. A child it started would belong to the parent shell, not to
+ * this copy, so the copy must spawn on its own.
+ */
+void zygote_detach(void);
+
+#endif